@@ -280,4 +280,35 @@ static inline unsigned long cmpxchg_386(volatile void *ptr, unsigned long old,
 
 #endif
 
+/*
+ * Compare and exchange the two adjacent words at @ptr, which must be
+ * 8 byte aligned.  Returns true if both matched and were replaced.
+ */
+#define __cmpxchg_double(pfx, ptr, o1, o2, n1, n2)			\
+({									\
+	char __ret;							\
+	__typeof__(o2) __dummy;						\
+	__typeof__(*(ptr)) __old1 = (o1);				\
+	__typeof__(o2) __old2 = (o2);					\
+	__typeof__(*(ptr)) __new1 = (n1);				\
+	__typeof__(o2) __new2 = (n2);					\
+	BUILD_BUG_ON(sizeof(*(ptr)) != 4);				\
+	BUILD_BUG_ON(sizeof(o2) != 4);					\
+	VM_BUG_ON((unsigned long)(ptr) % 8);				\
+	asm volatile(pfx "cmpxchg8b %2; setz %1"			\
+		     : "=d" (__dummy), "=a" (__ret), "+m" (*(ptr))	\
+		     : "a" (__old1), "d" (__old2),			\
+		       "b" (__new1), "c" (__new2)			\
+		     : "memory");					\
+	__ret;								\
+})
+
+#define cmpxchg_double(ptr, o1, o2, n1, n2)				\
+	__cmpxchg_double(LOCK_PREFIX, ptr, o1, o2, n1, n2)
+
+#define cmpxchg_double_local(ptr, o1, o2, n1, n2)			\
+	__cmpxchg_double("", ptr, o1, o2, n1, n2)
+
+#define system_has_cmpxchg_double() cpu_has_cx8
+
 #endif /* _ASM_X86_CMPXCHG_32_H */
@@ -151,4 +151,35 @@ extern void __cmpxchg_wrong_size(void);
 	cmpxchg_local((ptr), (o), (n));					\
 })
 
+/*
+ * Compare and exchange the two adjacent words at @ptr, which must be
+ * 16 byte aligned.  Returns true if both matched and were replaced.
+ */
+#define __cmpxchg_double(pfx, ptr, o1, o2, n1, n2)			\
+({									\
+	char __ret;							\
+	__typeof__(o2) __junk;						\
+	__typeof__(*(ptr)) __old1 = (o1);				\
+	__typeof__(o2) __old2 = (o2);					\
+	__typeof__(*(ptr)) __new1 = (n1);				\
+	__typeof__(o2) __new2 = (n2);					\
+	BUILD_BUG_ON(sizeof(*(ptr)) != 8);				\
+	BUILD_BUG_ON(sizeof(o2) != 8);					\
+	VM_BUG_ON((unsigned long)(ptr) % 16);				\
+	asm volatile(pfx "cmpxchg16b %2; setz %1"			\
+		     : "=d" (__junk), "=a" (__ret), "+m" (*(ptr))	\
+		     : "b" (__new1), "c" (__new2),			\
+		       "a" (__old1), "d" (__old2)			\
+		     : "memory");					\
+	__ret;								\
+})
+
+#define cmpxchg_double(ptr, o1, o2, n1, n2)				\
+	__cmpxchg_double(LOCK_PREFIX, ptr, o1, o2, n1, n2)
+
+#define cmpxchg_double_local(ptr, o1, o2, n1, n2)			\
+	__cmpxchg_double("", ptr, o1, o2, n1, n2)
+
+#define system_has_cmpxchg_double() cpu_has_cx16
+
 #endif /* _ASM_X86_CMPXCHG_64_H */
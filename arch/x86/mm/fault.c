@@ -1070,6 +1070,21 @@ do_page_fault(struct pt_regs *regs, unsigned long error_code)
 		return;
 	}
 
+	/*
+	 * Most faults on not present pages can be handled without
+	 * mmap_sem, so they don't have to wait for another thread's
+	 * mmap or munmap.  Anything unusual is retried below.
+	 */
+	if (!(error_code & PF_PROT)) {
+		fault = handle_speculative_fault(mm, address, flags);
+		if (!(fault & VM_FAULT_RETRY)) {
+			tsk->min_flt++;
+			perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1, 0,
+				      regs, address);
+			return;
+		}
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -125,9 +125,21 @@ static noinline int gup_huge_pmd(pmd_t pmd, unsigned long addr,
 	VM_BUG_ON(pte_flags(pte) & _PAGE_SPECIAL);
 	VM_BUG_ON(!pfn_valid(pte_pfn(pte)));
 
-	refs = 0;
 	head = pte_page(pte);
 	page = head + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
+	if (!PageHead(head)) {
+		/* small file pages, each holds its own reference */
+		do {
+			VM_BUG_ON(PageCompound(page));
+			pages[*nr] = page;
+			get_page(page);
+			(*nr)++;
+			page++;
+		} while (addr += PAGE_SIZE, addr != end);
+		return 1;
+	}
+
+	refs = 0;
 	do {
 		VM_BUG_ON(compound_head(page) != head);
 		pages[*nr] = page;
@@ -166,6 +178,13 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 		 */
 		if (pmd_none(pmd) || pmd_trans_splitting(pmd))
 			return 0;
+		/*
+		 * A huge pmd of a file mapping is made not present
+		 * while it is being split into a page table, see
+		 * __split_huge_file_pmd().
+		 */
+		if (unlikely(!pmd_present(pmd)))
+			return 0;
 		if (unlikely(pmd_large(pmd))) {
 			if (!gup_huge_pmd(pmd, addr, next, write, pages, nr))
 				return 0;
@@ -861,6 +861,7 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 	struct ixgbe_adapter *adapter = q_vector->adapter;
 	union ixgbe_adv_tx_desc *tx_desc, *eop_desc;
 	struct ixgbe_tx_buffer *tx_buffer_info;
+	struct sk_buff *skb;
 	unsigned int total_bytes = 0, total_packets = 0;
 	u16 i, eop, count = 0;
 
@@ -888,8 +889,12 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 				total_packets += tx_buffer_info->gso_segs;
 			}
 
+			/* unmap first, free the skb in bulk from napi */
+			skb = tx_buffer_info->skb;
+			tx_buffer_info->skb = NULL;
 			ixgbe_unmap_and_free_tx_resource(tx_ring,
 							 tx_buffer_info);
+			napi_consume_skb(skb);
 		}
 
 		tx_ring->tx_stats.completed++;
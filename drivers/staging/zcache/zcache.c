@@ -25,6 +25,7 @@
 #include <linux/lzo.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <linux/types.h>
 #include <linux/atomic.h>
 #include "tmem.h"
@@ -676,6 +677,7 @@ static unsigned long zcache_flobj_total;
 static unsigned long zcache_flobj_found;
 static unsigned long zcache_failed_eph_puts;
 static unsigned long zcache_failed_pers_puts;
+static unsigned long zcache_frontswap_writebacks;
 
 #define MAX_POOLS_PER_CLIENT 16
 
@@ -898,8 +900,12 @@ static unsigned long zcache_curr_eph_pampd_count_max;
 static atomic_t zcache_curr_pers_pampd_count = ATOMIC_INIT(0);
 static unsigned long zcache_curr_pers_pampd_count_max;
 
-/* forward reference */
+/* forward references */
 static int zcache_compress(struct page *from, void **out_va, size_t *out_len);
+static void zcache_frontswap_kick_writeback(unsigned long nr);
+
+/* pages pushed out to the swap device each time the pool is full */
+#define ZCACHE_FRONTSWAP_WB_BATCH	32
 
 static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 				 uint32_t index, struct page *page)
@@ -933,8 +939,12 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 		 * compressed frontswap pages
 		 */
 		if (atomic_read(&zcache_curr_pers_pampd_count) >
-							3 * totalram_pages / 4)
+						3 * totalram_pages / 4) {
+			/* make room for the next puts */
+			zcache_frontswap_kick_writeback(
+						ZCACHE_FRONTSWAP_WB_BATCH);
 			goto out;
+		}
 		ret = zcache_compress(page, &cdata, &clen);
 		if (ret == 0)
 			goto out;
@@ -1108,6 +1118,7 @@ ZCACHE_SYSFS_RO(flobj_total);
 ZCACHE_SYSFS_RO(flobj_found);
 ZCACHE_SYSFS_RO(failed_eph_puts);
 ZCACHE_SYSFS_RO(failed_pers_puts);
+ZCACHE_SYSFS_RO(frontswap_writebacks);
 ZCACHE_SYSFS_RO(zbud_curr_zbytes);
 ZCACHE_SYSFS_RO(zbud_cumul_zpages);
 ZCACHE_SYSFS_RO(zbud_cumul_zbytes);
@@ -1142,6 +1153,7 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_flobj_found_attr.attr,
 	&zcache_failed_eph_puts_attr.attr,
 	&zcache_failed_pers_puts_attr.attr,
+	&zcache_frontswap_writebacks_attr.attr,
 	&zcache_compress_poor_attr.attr,
 	&zcache_zbud_curr_raw_pages_attr.attr,
 	&zcache_zbud_curr_zpages_attr.attr,
@@ -1553,6 +1565,57 @@ struct frontswap_ops zcache_frontswap_register_ops(void)
 
 	return old_ops;
 }
+
+/*
+ * Persistent pages cannot simply be dropped like zbud pages, so when the
+ * pool is full or memory is tight some are written out to the real swap
+ * device instead.  That needs to sleep and do I/O, which neither a put
+ * (irqs off) nor a shrinker call may do, so it is done from a work item.
+ */
+static atomic_long_t zcache_frontswap_wb_pending = ATOMIC_LONG_INIT(0);
+
+static void zcache_frontswap_writeback_work(struct work_struct *work)
+{
+	long nr = atomic_long_xchg(&zcache_frontswap_wb_pending, 0);
+
+	if (nr > 0)
+		zcache_frontswap_writebacks += frontswap_writeback(nr);
+}
+static DECLARE_WORK(zcache_frontswap_wb_work, zcache_frontswap_writeback_work);
+
+static void zcache_frontswap_kick_writeback(unsigned long nr)
+{
+	if (zcache_frontswap_poolid < 0)
+		return;
+	if (atomic_long_read(&zcache_frontswap_wb_pending) <
+					(long)(totalram_pages / 64))
+		atomic_long_add(nr, &zcache_frontswap_wb_pending);
+	schedule_work(&zcache_frontswap_wb_work);
+}
+
+/*
+ * frontswap shrinker interface: report the persistent pages and have
+ * some of them written back when reclaim is allowed to do I/O.
+ */
+static int shrink_zcache_frontswap(struct shrinker *shrink,
+				   struct shrink_control *sc)
+{
+	int count = atomic_read(&zcache_curr_pers_pampd_count);
+
+	if (sc->nr_to_scan > 0 && count > 0 && (sc->gfp_mask & __GFP_IO))
+		zcache_frontswap_kick_writeback(sc->nr_to_scan);
+	return count;
+}
+
+/* refaults then come from disk, so make these expensive to reclaim */
+static struct shrinker zcache_frontswap_shrinker = {
+	.shrink = shrink_zcache_frontswap,
+	.seeks = DEFAULT_SEEKS * 4,
+};
+#else
+static void zcache_frontswap_kick_writeback(unsigned long nr)
+{
+}
 #endif
 
 /*
@@ -1647,6 +1710,7 @@ static int __init zcache_init(void)
 			pr_err("zcache: can't create xvpool\n");
 			goto out;
 		}
+		register_shrinker(&zcache_frontswap_shrinker);
 		old_ops = zcache_frontswap_register_ops();
 		pr_info("zcache: frontswap enabled using kernel "
 			"transcendent memory and xvmalloc\n");
@@ -22,16 +22,20 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/bio.h>
+#include <linux/bitmap.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/completion.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -42,51 +46,49 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
-{
-	*v = *v + 1;
-}
-
-static void zram_stat_dec(u32 *v)
+/*
+ * Table entries are protected by a bit spinlock in their value, so
+ * that I/O to different pages of a device runs in parallel.  It also
+ * serializes against swap slot free notifications, which come in with
+ * swap_lock held and so cannot sleep.
+ */
+static void zram_slot_lock(struct zram *zram, u32 index)
 {
-	*v = *v - 1;
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].value);
 }
 
-static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
+static void zram_slot_unlock(struct zram *zram, u32 index)
 {
-	spin_lock(&zram->stat64_lock);
-	*v = *v + inc;
-	spin_unlock(&zram->stat64_lock);
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].value);
 }
 
-static void zram_stat64_sub(struct zram *zram, u64 *v, u64 dec)
+static int zram_test_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
 {
-	spin_lock(&zram->stat64_lock);
-	*v = *v - dec;
-	spin_unlock(&zram->stat64_lock);
+	return zram->table[index].value & BIT(flag);
 }
 
-static void zram_stat64_inc(struct zram *zram, u64 *v)
+static void zram_set_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
 {
-	zram_stat64_add(zram, v, 1);
+	zram->table[index].value |= BIT(flag);
 }
 
-static int zram_test_flag(struct zram *zram, u32 index,
+static void zram_clear_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
-	return zram->table[index].flags & BIT(flag);
+	zram->table[index].value &= ~BIT(flag);
 }
 
-static void zram_set_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+static size_t zram_get_obj_size(struct zram *zram, u32 index)
 {
-	zram->table[index].flags |= BIT(flag);
+	return zram->table[index].value & ZRAM_SIZE_MASK;
 }
 
-static void zram_clear_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+static void zram_set_obj_size(struct zram *zram, u32 index, size_t size)
 {
-	zram->table[index].flags &= ~BIT(flag);
+	zram->table[index].value &= ~ZRAM_SIZE_MASK;
+	zram->table[index].value |= size;
 }
 
 static int page_zero_filled(void *ptr)
@@ -104,6 +106,153 @@ static int page_zero_filled(void *ptr)
 	return 1;
 }
 
+/* Compress @src into this cpu's stream buffer */
+static int zram_compress(struct zram *zram, struct zram_comp_stream *zstrm,
+			void *src, unsigned int *clen)
+{
+	u64 start = local_clock();
+	int ret;
+
+	/* lzo may expand an incompressible page, the buffer has two */
+	*clen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE, zstrm->buffer,
+				   clen);
+
+	atomic64_add(local_clock() - start, &zram->stats.comp_time);
+	atomic64_add(PAGE_SIZE, &zram->stats.comp_in);
+	if (!ret)
+		atomic64_add(*clen, &zram->stats.comp_out);
+	return ret;
+}
+
+static int zram_decompress(struct zram *zram, void *src, unsigned int slen,
+			void *dst)
+{
+	struct zram_comp_stream *zstrm;
+	unsigned int dlen = PAGE_SIZE;
+	u64 start;
+	int ret;
+
+	zstrm = get_cpu_ptr(zram->comp);
+	start = local_clock();
+	ret = crypto_comp_decompress(zstrm->tfm, src, slen, dst, &dlen);
+	atomic64_add(local_clock() - start, &zram->stats.decomp_time);
+	put_cpu_ptr(zram->comp);
+
+	if (!ret && dlen != PAGE_SIZE)
+		ret = -EINVAL;
+	if (!ret)
+		atomic64_add(PAGE_SIZE, &zram->stats.decomp_out);
+	return ret;
+}
+
+/* Find @nr free contiguous blocks on the backing device, 0 if none */
+static unsigned long zram_alloc_bd_blocks(struct zram *zram, int nr)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bitmap_lock);
+	blk = bitmap_find_next_zero_area(zram->bitmap, zram->nr_bd_pages,
+					 1, nr, 0);
+	if (blk + nr > zram->nr_bd_pages)
+		blk = 0;
+	else
+		bitmap_set(zram->bitmap, blk, nr);
+	spin_unlock(&zram->bitmap_lock);
+
+	return blk;
+}
+
+static void zram_free_bd_block(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bitmap_lock);
+	bitmap_clear(zram->bitmap, blk, 1);
+	spin_unlock(&zram->bitmap_lock);
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* Read or write @nr pages at block @blk of the backing device and wait */
+static int zram_bdev_rw(struct zram *zram, int rw, struct page **pages,
+			int nr, unsigned long blk)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int i, ret = 0;
+
+	bio = bio_alloc(GFP_NOIO, nr);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->backing_dev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	for (i = 0; i < nr; i++) {
+		if (bio_add_page(bio, pages[i], PAGE_SIZE, 0) != PAGE_SIZE) {
+			bio_put(bio);
+			return -EIO;
+		}
+	}
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ret = -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+struct zram_bdev_read {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_read *rd = container_of(work, struct zram_bdev_read,
+						 work);
+
+	rd->ret = zram_bdev_rw(rd->zram, READ, &rd->page, 1, rd->blk);
+}
+
+/*
+ * Bios submitted from within zram's make_request function are only
+ * issued once it returns, so waiting for the read there would never
+ * finish.  Have a worker submit it instead.
+ */
+static int zram_read_from_bdev(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	struct zram_bdev_read rd = {
+		.zram = zram,
+		.page = page,
+		.blk = blk,
+	};
+
+	INIT_WORK_ONSTACK(&rd.work, zram_bdev_read_work);
+	queue_work(system_unbound_wq, &rd.work);
+	flush_work(&rd.work);
+	destroy_work_on_stack(&rd.work);
+
+	if (rd.ret) {
+		pr_err("Read from backing device failed, block=%lu\n", blk);
+		atomic64_inc(&zram->stats.failed_reads);
+		return rd.ret;
+	}
+
+	atomic64_inc(&zram->stats.bd_reads);
+	flush_dcache_page(page);
+	return 0;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,48 +282,55 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/* Called with the slot lock held */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	unsigned long handle = zram->table[index].handle;
+	size_t clen = zram_get_obj_size(zram, index);
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	/* tells writeback that the slot changed under it */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	/* and tells the same to readers of the backing device */
+	zram->table[index].gen++;
 
-	if (unlikely(!page)) {
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
 		 */
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
 			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
+			atomic_dec(&zram->stats.pages_zero);
 		}
 		return;
 	}
 
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_free_bd_block(zram, handle);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		atomic_dec(&zram->stats.bd_count);
+		zram->table[index].handle = 0;
+		return;
+	}
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page((struct page *)handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+		atomic_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	zs_free(zram->mem_pool, handle);
 	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+		atomic_dec(&zram->stats.good_compress);
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	atomic64_sub(clen, &zram->stats.compr_size);
+	atomic_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].handle = 0;
+	zram_set_obj_size(zram, index, 0);
 }
 
 static void handle_zero_page(struct page *page)
@@ -194,8 +350,7 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic((struct page *)zram->table[index].handle, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -204,70 +359,94 @@ static void handle_uncompressed_page(struct zram *zram,
 	flush_dcache_page(page);
 }
 
-static void zram_read(struct zram *zram, struct bio *bio)
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
 {
+	int ret;
+	unsigned long handle, gen;
+	unsigned char *user_mem, *cmem;
 
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
-
-	zram_stat64_inc(zram, &zram->stats.num_reads);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+again:
+	zram_slot_lock(zram, index);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		zram_slot_unlock(zram, index);
+		handle_zero_page(page);
+		return 0;
+	}
 
-		page = bvec->bv_page;
+	/* Requested page is not present in compressed area */
+	handle = zram->table[index].handle;
+	if (unlikely(!handle)) {
+		zram_slot_unlock(zram, index);
+		pr_debug("Read before write: page=%u\n", index);
+		handle_zero_page(page);
+		return 0;
+	}
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
+	/*
+	 * The read sleeps, so it cannot be done under the slot lock.  The
+	 * slot may be freed or rewritten meanwhile, and its block reused
+	 * for another page, possibly written back to this very slot again:
+	 * only trust the data if the slot was not freed since, which its
+	 * generation tells, and start over otherwise.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		gen = zram->table[index].gen;
+		zram_slot_unlock(zram, index);
+		ret = zram_read_from_bdev(zram, page, handle);
+
+		zram_slot_lock(zram, index);
+		if (zram->table[index].gen != gen) {
+			zram_slot_unlock(zram, index);
+			goto again;
 		}
+		zram_slot_unlock(zram, index);
+		return ret;
+	}
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		zram_slot_unlock(zram, index);
+		return 0;
+	}
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+	ret = zram_decompress(zram, cmem, zram_get_obj_size(zram, index),
+			      user_mem);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	zs_unmap_object(zram->mem_pool, handle);
+	kunmap_atomic(user_mem, KM_USER0);
+	zram_slot_unlock(zram, index);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		atomic64_inc(&zram->stats.failed_reads);
+		return -EIO;
+	}
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	flush_dcache_page(page);
+	return 0;
+}
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+static void zram_read(struct zram *zram, struct bio *bio)
+{
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
-			goto out;
-		}
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
 
-		flush_dcache_page(page);
+	atomic64_inc(&zram->stats.num_reads);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_read_page(zram, bvec->bv_page, index))
+			goto out;
 		index++;
 	}
 
@@ -279,121 +458,147 @@ out:
 	bio_io_error(bio);
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+/* Replace whatever the slot held with the new object */
+static void zram_install_page(struct zram *zram, u32 index,
+			unsigned long handle, size_t size, bool uncompressed)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	zram_slot_lock(zram, index);
+	zram_free_page(zram, index);
+	zram->table[index].handle = handle;
+	zram_set_obj_size(zram, index, size);
+	if (!handle)
+		zram_set_flag(zram, index, ZRAM_ZERO);
+	else if (uncompressed)
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+	zram_slot_unlock(zram, index);
+}
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	unsigned int clen, alloc_len = 0;
+	bool uncompressed = false;
+	unsigned long handle = 0;
+	struct zram_comp_stream *zstrm;
+	struct page *page_store;
+	unsigned char *user_mem, *cmem, *src;
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		atomic_inc(&zram->stats.pages_zero);
+		zram_install_page(zram, index, 0, 0, false);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+compress_again:
+	zstrm = get_cpu_ptr(zram->comp);
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = zram_compress(zram, zstrm, user_mem, &clen);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+	if (unlikely(ret)) {
+		put_cpu_ptr(zram->comp);
+		zs_free(zram->mem_pool, handle);
+		pr_err("Compression failed! err=%d\n", ret);
+		goto fail;
+	}
 
-		mutex_lock(&zram->lock);
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		put_cpu_ptr(zram->comp);
+		zs_free(zram->mem_pool, handle);
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
+		clen = PAGE_SIZE;
+		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!page_store)) {
+			pr_info("Error allocating memory for "
+				"incompressible page: %u\n", index);
+			goto fail;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		src = kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
 
-		kunmap_atomic(user_mem, KM_USER0);
+		handle = (unsigned long)page_store;
+		uncompressed = true;
+		atomic_inc(&zram->stats.pages_expand);
+		goto install;
+	}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	/*
+	 * The stream cannot be held across a sleeping allocation, so try
+	 * without sleeping first.  If that fails, allocate with the stream
+	 * dropped and compress again, since another writer on this cpu
+	 * may have reused the buffer meanwhile.
+	 */
+	if (handle && clen != alloc_len) {
+		/* the page changed between the two passes */
+		put_cpu_ptr(zram->comp);
+		zs_free(zram->mem_pool, handle);
+		handle = 0;
+		goto compress_again;
+	}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
+	if (!handle) {
+		handle = zs_malloc(zram->mem_pool, clen,
+				GFP_NOWAIT | __GFP_HIGHMEM | __GFP_NOWARN);
+		if (!handle) {
+			put_cpu_ptr(zram->comp);
+			handle = zs_malloc(zram->mem_pool, clen,
+					GFP_NOIO | __GFP_HIGHMEM);
+			if (!handle) {
 				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
+					"compressed page: %u, size=%u\n",
+					index, clen);
+				goto fail;
 			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+			alloc_len = clen;
+			goto compress_again;
 		}
+	}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	memcpy(cmem, zstrm->buffer, clen);
+	zs_unmap_object(zram->mem_pool, handle);
+	put_cpu_ptr(zram->comp);
 
-memstore:
-		zram->table[index].offset = offset;
+	if (clen <= PAGE_SIZE / 2)
+		atomic_inc(&zram->stats.good_compress);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+install:
+	/* Update stats */
+	atomic64_add(clen, &zram->stats.compr_size);
+	atomic_inc(&zram->stats.pages_stored);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+	zram_install_page(zram, index, handle, clen, uncompressed);
+	return 0;
 
-		memcpy(cmem, src, clen);
+fail:
+	atomic64_inc(&zram->stats.failed_writes);
+	return -ENOMEM;
+}
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+static void zram_write(struct zram *zram, struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	atomic64_inc(&zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-		mutex_unlock(&zram->lock);
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_write_page(zram, bvec->bv_page, index))
+			goto out;
 		index++;
 	}
 
@@ -430,7 +635,7 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	struct zram *zram = queue->queuedata;
 
 	if (!valid_io_request(zram, bio)) {
-		zram_stat64_inc(zram, &zram->stats.invalid_io);
+		atomic64_inc(&zram->stats.invalid_io);
 		bio_io_error(bio);
 		return 0;
 	}
@@ -453,6 +658,60 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
+static void zram_comp_destroy(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->comp)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_stream *zstrm = per_cpu_ptr(zram->comp, cpu);
+
+		if (!IS_ERR_OR_NULL(zstrm->tfm))
+			crypto_free_comp(zstrm->tfm);
+		free_pages((unsigned long)zstrm->buffer, 1);
+	}
+	free_percpu(zram->comp);
+	zram->comp = NULL;
+}
+
+static int zram_comp_create(struct zram *zram)
+{
+	int cpu;
+
+	zram->comp = alloc_percpu(struct zram_comp_stream);
+	if (!zram->comp)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_stream *zstrm = per_cpu_ptr(zram->comp, cpu);
+
+		zstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(zstrm->tfm))
+			return PTR_ERR(zstrm->tfm);
+		/* lzo may expand an incompressible page, so allocate two */
+		zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+		if (!zstrm->buffer)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static void zram_put_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->backing_dev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->backing_dev = NULL;
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	zram->nr_bd_pages = 0;
+	kfree(zram->backing_dev_path);
+	zram->backing_dev_path = NULL;
+}
+
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
@@ -461,35 +720,30 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_comp_destroy(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		unsigned long handle = zram->table[index].handle;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (!handle || zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page((struct page *)handle);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+	zram_put_backing_dev(zram);
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -511,17 +765,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_comp_create(zram);
+	if (ret) {
+		pr_err("Error allocating compressor %s!\n", zram->compressor);
 		goto fail;
 	}
 
@@ -540,7 +786,7 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool("zram");
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -561,13 +807,209 @@ fail:
 	return ret;
 }
 
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_pages, *bitmap = NULL;
+	char *name;
+	int ret = 0;
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing device for initialized device\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto out;
+	}
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (bdev->bd_disk == zram->disk || nr_pages < 2)
+		ret = -EINVAL;
+	else {
+		bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+		if (!bitmap)
+			ret = -ENOMEM;
+	}
+	if (ret) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		goto out;
+	}
+
+	zram_put_backing_dev(zram);
+	set_bit(0, bitmap);
+	zram->backing_dev = bdev;
+	zram->backing_dev_path = name;
+	zram->bitmap = bitmap;
+	zram->nr_bd_pages = nr_pages;
+	pr_info("%s: using %s as backing device, %lu pages\n",
+		zram->disk->disk_name, name, nr_pages);
+
+out:
+	mutex_unlock(&zram->init_lock);
+	if (ret)
+		kfree(name);
+	return ret;
+}
+
+/* Mark all stored pages idle, any access to a page clears the mark */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	mutex_lock(&zram->init_lock);
+	for (index = 0; zram->init_done &&
+			index < zram->disksize >> PAGE_SHIFT; index++) {
+		zram_slot_lock(zram, index);
+		if (zram->table[index].handle &&
+		    !zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		zram_slot_unlock(zram, index);
+		cond_resched();
+	}
+	mutex_unlock(&zram->init_lock);
+}
+
+/*
+ * Copy the slot out to @page if it is to be written back, and mark it
+ * as under writeback, so that zram_wb_submit() can tell whether it was
+ * freed or rewritten meanwhile.
+ */
+static bool zram_wb_prepare(struct zram *zram, u32 index, struct page *page,
+			bool huge)
+{
+	unsigned long handle;
+	void *src, *dst;
+	bool ret = false;
+
+	zram_slot_lock(zram, index);
+	handle = zram->table[index].handle;
+	if (!handle || zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		goto out;
+	if (!zram_test_flag(zram, index,
+			    huge ? ZRAM_UNCOMPRESSED : ZRAM_IDLE))
+		goto out;
+
+	dst = kmap_atomic(page, KM_USER0);
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		src = kmap_atomic((struct page *)handle, KM_USER1);
+		memcpy(dst, src, PAGE_SIZE);
+		kunmap_atomic(src, KM_USER1);
+		ret = true;
+	} else {
+		src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+		ret = !zram_decompress(zram, src,
+				       zram_get_obj_size(zram, index), dst);
+		zs_unmap_object(zram->mem_pool, handle);
+	}
+	kunmap_atomic(dst, KM_USER0);
+
+	if (ret)
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+out:
+	zram_slot_unlock(zram, index);
+	return ret;
+}
+
+/* Write a batch out with one bio and free the slots' memory */
+static int zram_wb_submit(struct zram *zram, struct page **pages,
+			u32 *indices, int nr)
+{
+	unsigned long blk;
+	int i, ret;
+
+	blk = zram_alloc_bd_blocks(zram, nr);
+	ret = blk ? zram_bdev_rw(zram, WRITE, pages, nr, blk) : -ENOSPC;
+
+	for (i = 0; i < nr; i++) {
+		u32 index = indices[i];
+
+		zram_slot_lock(zram, index);
+		if (ret || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			if (blk)
+				zram_free_bd_block(zram, blk + i);
+		} else {
+			zram_free_page(zram, index);
+			zram->table[index].handle = blk + i;
+			zram_set_flag(zram, index, ZRAM_WB);
+			atomic_inc(&zram->stats.bd_count);
+			atomic64_inc(&zram->stats.bd_writes);
+		}
+		zram_slot_unlock(zram, index);
+	}
+
+	return ret;
+}
+
+/*
+ * Write idle pages, or pages stored uncompressed if @huge is set, to the
+ * backing device in batches of up to ZRAM_WB_BATCH pages per bio.
+ */
+int zram_writeback(struct zram *zram, bool huge)
+{
+	struct page *pages[ZRAM_WB_BATCH];
+	u32 indices[ZRAM_WB_BATCH];
+	size_t index, nr_slots;
+	int i, nr = 0, batch, ret = 0;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done || !zram->backing_dev) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	batch = queue_max_sectors(bdev_get_queue(zram->backing_dev)) >>
+			SECTORS_PER_PAGE_SHIFT;
+	batch = clamp(batch, 1, ZRAM_WB_BATCH);
+	for (i = 0; i < batch; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i])
+			break;
+	}
+	batch = i;
+	if (!batch) {
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+
+	nr_slots = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_slots && !ret; index++) {
+		if (zram_wb_prepare(zram, index, pages[nr], huge))
+			indices[nr++] = index;
+		if (nr == batch || (nr && index == nr_slots - 1)) {
+			ret = zram_wb_submit(zram, pages, indices, nr);
+			nr = 0;
+		}
+		cond_resched();
+	}
+
+	for (i = 0; i < batch; i++)
+		__free_page(pages[i]);
+out_unlock:
+	mutex_unlock(&zram->init_lock);
+	return ret;
+}
+
 void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_slot_lock(zram, index);
 	zram_free_page(zram, index);
-	zram_stat64_inc(zram, &zram->stats.notify_free);
+	zram_slot_unlock(zram, index);
+	atomic64_inc(&zram->stats.notify_free);
 }
 
 static const struct block_device_operations zram_devops = {
@@ -579,9 +1021,9 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
-	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->bitmap_lock);
+	strlcpy(zram->compressor, default_compressor, sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -713,6 +1155,7 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_put_backing_dev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
@@ -17,8 +17,11 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/crypto.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,23 +29,17 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default crypto API compressor, can be changed through sysfs */
+static const char default_compressor[] = "lzo";
+
+/* Pages written back to the backing device with a single bio */
+#define ZRAM_WB_BATCH		32
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -51,8 +48,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -63,49 +60,89 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 #define ZRAM_LOGICAL_BLOCK_SIZE	4096
 
-/* Flags for zram pages (table[page_no].flags) */
+/*
+ * The lower ZRAM_FLAG_SHIFT bits of table.value hold the size of the
+ * stored object, the upper bits are for zram_pageflags.
+ */
+#define ZRAM_FLAG_SHIFT		24
+#define ZRAM_SIZE_MASK		((1UL << ZRAM_FLAG_SHIFT) - 1)
+
+/* Flags for zram pages (table[page_no].value) */
 enum zram_pageflags {
 	/* Page is stored uncompressed */
-	ZRAM_UNCOMPRESSED,
+	ZRAM_UNCOMPRESSED = ZRAM_FLAG_SHIFT,
 
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Bit spinlock protecting the table entry */
+	ZRAM_ACCESS,
+
+	/* Page lives on the backing device, handle is the block */
+	ZRAM_WB,
+
+	/* Page is being written back to the backing device */
+	ZRAM_UNDER_WB,
+
+	/* Page was not accessed since the device was last marked idle */
+	ZRAM_IDLE,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
+/*
+ * Allocated for each disk page.  The handle is a zsmalloc handle, the
+ * struct page of a page stored uncompressed, or the block on the
+ * backing device of a page written back.  The generation is bumped
+ * whenever the slot is freed, so that a reader who dropped the slot
+ * lock can tell that the slot was reused meanwhile.
+ */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
-} __attribute__((aligned(4)));
+	unsigned long handle;
+	unsigned long value;
+	unsigned long gen;
+};
 
 struct zram_stats {
-	u64 compr_size;		/* compressed size of pages stored */
-	u64 num_reads;		/* failed + successful */
-	u64 num_writes;		/* --do-- */
-	u64 failed_reads;	/* should NEVER! happen */
-	u64 failed_writes;	/* can happen when memory is too low */
-	u64 invalid_io;		/* non-page-aligned I/O requests */
-	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	atomic64_t compr_size;	/* compressed size of pages stored */
+	atomic64_t num_reads;	/* failed + successful */
+	atomic64_t num_writes;	/* --do-- */
+	atomic64_t failed_reads;	/* should NEVER! happen */
+	atomic64_t failed_writes;	/* can happen when memory is too low */
+	atomic64_t invalid_io;	/* non-page-aligned I/O requests */
+	atomic64_t notify_free;	/* no. of swap slot free notifications */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	/* compressor throughput, the time is in nanoseconds */
+	atomic64_t comp_in;	/* bytes handed to the compressor */
+	atomic64_t comp_out;	/* bytes it returned */
+	atomic64_t comp_time;
+	atomic64_t decomp_out;	/* bytes returned by the decompressor */
+	atomic64_t decomp_time;
+	/* backing device */
+	atomic_t bd_count;	/* no. of pages on the backing device */
+	atomic64_t bd_reads;	/* pages read from it */
+	atomic64_t bd_writes;	/* pages written back to it */
+};
+
+/*
+ * Compressor transform and buffer, one per cpu.  A reader or writer
+ * uses the one of the cpu it runs on with preemption disabled, so I/O
+ * to a device compresses on all cpus in parallel.
+ */
+struct zram_comp_stream {
+	struct crypto_comp *tfm;
+	void *buffer;
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zram_comp_stream __percpu *comp;
 	struct table *table;
-	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -116,6 +153,19 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* crypto API compressor, set before the device is initialized */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+
+	/*
+	 * Optional backing device for idle and incompressible pages.
+	 * The bitmap tracks its page sized blocks, block 0 is never
+	 * used so that a zero handle still means an empty slot.
+	 */
+	struct block_device *backing_dev;
+	char *backing_dev_path;
+	unsigned long *bitmap;
+	unsigned long nr_bd_pages;
+	spinlock_t bitmap_lock;
 
 	struct zram_stats stats;
 };
@@ -128,5 +178,8 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, bool huge);
 
 #endif
@@ -0,0 +1,1131 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * zsmalloc is a size class allocator for compressed pages.  Objects of
+ * similar size are packed into 'zspages' of up to 4 discontiguous
+ * 0-order pages, chosen per class to waste as little space as possible.
+ * Objects may span the boundary between two pages of a zspage, so they
+ * are only accessible between zs_map_object() and zs_unmap_object().
+ *
+ * Allocations return an opaque handle, which points to a word holding
+ * the object location.  Objects store their handle in front of the
+ * data, so that compaction can move them from sparsely used zspages
+ * into denser ones and update the handle, freeing whole zspages.
+ *
+ * Following is how we use various fields and flags of underlying
+ * struct page(s) to form a zspage.
+ *
+ * Usage of struct page fields:
+ *	page->first_page: points to the first component (0-order) page
+ *	page->lru: links together all component pages (except the first page)
+ *		of a zspage
+ *
+ *	For _first_ page only:
+ *
+ *	page->private (union with page->first_page): refers to the
+ *		component page after the first page
+ *	page->freelist: points to the first free object in zspage.
+ *		Free objects are linked together using in-place
+ *		metadata.
+ *	page->inuse: number of objects allocated in the zspage
+ *	page->lru: links together first pages of various zspages.
+ *		Basically forming list of zspages in a fullness group.
+ *	page->mapping: class index and fullness group of the zspage
+ *
+ * Usage of struct page flags:
+ *	PG_private: identifies the first component page
+ *	PG_private2: identifies the last component page
+ *
+ * Locking: each size class has its own lock, protecting its zspages,
+ * their free lists and the fullness lists.  The lowest bit of a handle
+ * pins the object: it is held while the object is mapped or being freed,
+ * and compaction skips objects it cannot pin.
+ */
+
+#ifdef CONFIG_ZSMALLOC_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/*
+ * Per-cpu state of zs_map_object(), kept until zs_unmap_object().
+ * Preemption stays disabled in between.
+ */
+struct mapping_area {
+	char *vm_buf;	/* copy buffer for objects that span pages */
+	char *vm_addr;	/* address of kmap_atomic()'ed pages */
+	enum zs_mapmode vm_mm;	/* mapping mode */
+};
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+/* handles of all pools */
+static struct kmem_cache *zs_handle_cachep;
+
+struct zs_compact_control {
+	/* source zspage and the next object in it to look at */
+	struct page *s_page;
+	int index;
+	/* destination zspage */
+	struct page *d_page;
+};
+
+static int is_first_page(struct page *page)
+{
+	return PagePrivate(page);
+}
+
+static int is_last_page(struct page *page)
+{
+	return PagePrivate2(page);
+}
+
+static void get_zspage_mapping(struct page *page, unsigned int *class_idx,
+				enum fullness_group *fullness)
+{
+	unsigned long m;
+	BUG_ON(!is_first_page(page));
+
+	m = (unsigned long)page->mapping;
+	*fullness = m & ((1 << FULLNESS_BITS) - 1);
+	*class_idx = m >> FULLNESS_BITS;
+}
+
+static void set_zspage_mapping(struct page *page, unsigned int class_idx,
+				enum fullness_group fullness)
+{
+	unsigned long m;
+	BUG_ON(!is_first_page(page));
+
+	m = (class_idx << FULLNESS_BITS) |
+		(fullness & ((1 << FULLNESS_BITS) - 1));
+	page->mapping = (struct address_space *)m;
+}
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return min_t(int, ZS_SIZE_CLASSES - 1, idx);
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+						struct page *page)
+{
+	int inuse, max_objects;
+	enum fullness_group fg;
+	BUG_ON(!is_first_page(page));
+
+	inuse = page->inuse;
+	max_objects = class->objs_per_zspage;
+
+	if (inuse == 0)
+		fg = ZS_EMPTY;
+	else if (inuse == max_objects)
+		fg = ZS_FULL;
+	else if (inuse <= 3 * max_objects / fullness_threshold_frac)
+		fg = ZS_ALMOST_EMPTY;
+	else
+		fg = ZS_ALMOST_FULL;
+
+	return fg;
+}
+
+/*
+ * Each size class maintains various freelists and zspages are assigned
+ * to one of these freelists based on the number of live objects they
+ * have.  Almost full zspages are put at the head, so that allocations
+ * fill them up first and leave the almost empty ones to drain.
+ */
+static void insert_zspage(struct size_class *class, struct page *page,
+				enum fullness_group fullness)
+{
+	BUG_ON(!is_first_page(page));
+
+	if (fullness == ZS_EMPTY)
+		return;
+
+	list_add(&page->lru, &class->fullness_list[fullness]);
+}
+
+static void remove_zspage(struct size_class *class, struct page *page,
+				enum fullness_group fullness)
+{
+	BUG_ON(!is_first_page(page));
+
+	if (fullness == ZS_EMPTY)
+		return;
+
+	BUG_ON(list_empty(&class->fullness_list[fullness]));
+	list_del_init(&page->lru);
+}
+
+/*
+ * Each size class maintains zspages in different fullness groups depending
+ * on the number of live objects they contain. When allocating or freeing
+ * objects, the fullness status of the page can change, say, from ALMOST_FULL
+ * to ALMOST_EMPTY when freeing an object. This function checks if such
+ * a status change has occurred for the given page and accordingly moves the
+ * page from the freelist of the old fullness group to that of the new
+ * fullness group.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+						struct page *page)
+{
+	unsigned int class_idx;
+	enum fullness_group currfg, newfg;
+
+	BUG_ON(!is_first_page(page));
+
+	get_zspage_mapping(page, &class_idx, &currfg);
+	newfg = get_fullness_group(class, page);
+	if (newfg == currfg)
+		goto out;
+
+	remove_zspage(class, page, currfg);
+	insert_zspage(class, page, newfg);
+	set_zspage_mapping(page, class_idx, newfg);
+
+out:
+	return newfg;
+}
+
+/*
+ * We have to decide on how many pages to link together
+ * to form a zspage for each size class. This is important
+ * to reduce wastage due to unusable space left at end of
+ * each zspage which is given as:
+ *	wastage = Zp - Zp % size_class
+ * where Zp = zspage size = k * PAGE_SIZE where k = 1, 2, ...
+ *
+ * For example, for size class of 3/8 * PAGE_SIZE, we should
+ * link together 3 PAGE_SIZE sized pages to form a zspage
+ * since then we can perfectly fit in 8 such objects.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	/* zspage order which gives maximum used size per KB */
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size;
+		int waste, usedpc;
+
+		zspage_size = i * PAGE_SIZE;
+		waste = zspage_size % class_size;
+		usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+/*
+ * A single 'zspage' is composed of many system pages which are
+ * linked together using fields in struct page. This function finds
+ * the first/head page, given any component page of a zspage.
+ */
+static struct page *get_first_page(struct page *page)
+{
+	if (is_first_page(page))
+		return page;
+	else
+		return page->first_page;
+}
+
+static struct page *get_next_page(struct page *page)
+{
+	struct page *next;
+
+	if (is_last_page(page))
+		next = NULL;
+	else if (is_first_page(page))
+		next = (struct page *)page_private(page);
+	else
+		next = list_entry(page->lru.next, struct page, lru);
+
+	return next;
+}
+
+/* Encode <page, obj_idx> as a single value, leaving the tag bits clear */
+static unsigned long location_to_obj(struct page *page, unsigned long obj_idx)
+{
+	unsigned long obj;
+
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= obj_idx & OBJ_INDEX_MASK;
+	obj <<= OBJ_TAG_BITS;
+
+	return obj;
+}
+
+/* Decode <page, obj_idx> pair from the given object location */
+static void obj_to_location(unsigned long obj, struct page **page,
+				unsigned long *obj_idx)
+{
+	obj >>= OBJ_TAG_BITS;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = obj & OBJ_INDEX_MASK;
+}
+
+/* Offset of the object within the page it starts in */
+static unsigned long obj_offset(struct size_class *class,
+				unsigned long obj_idx)
+{
+	return (obj_idx * class->size) & ~PAGE_MASK;
+}
+
+/* Page of the zspage that object @obj_idx starts in */
+static struct page *obj_idx_to_page(struct page *first_page,
+				struct size_class *class, unsigned long obj_idx)
+{
+	unsigned long nr = (obj_idx * class->size) >> PAGE_SHIFT;
+	struct page *page = first_page;
+
+	while (nr--)
+		page = get_next_page(page);
+
+	return page;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~BIT(HANDLE_PIN_BIT);
+}
+
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	*(unsigned long *)handle = obj;
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static struct size_class *obj_to_class(struct zs_pool *pool,
+				unsigned long obj, struct page **page,
+				unsigned long *obj_idx)
+{
+	unsigned int class_idx;
+	enum fullness_group fg;
+
+	obj_to_location(obj, page, obj_idx);
+	get_zspage_mapping(get_first_page(*page), &class_idx, &fg);
+	return pool->size_class[class_idx];
+}
+
+static void reset_page(struct page *page)
+{
+	clear_bit(PG_private, &page->flags);
+	clear_bit(PG_private_2, &page->flags);
+	set_page_private(page, 0);
+	page->mapping = NULL;
+	page->freelist = NULL;
+	reset_page_mapcount(page);
+}
+
+static void free_zspage(struct page *first_page)
+{
+	struct page *nextp, *tmp, *head_extra;
+
+	BUG_ON(!is_first_page(first_page));
+	BUG_ON(first_page->inuse);
+
+	head_extra = (struct page *)page_private(first_page);
+
+	reset_page(first_page);
+	__free_page(first_page);
+
+	/* zspage with only 1 system page */
+	if (!head_extra)
+		return;
+
+	list_for_each_entry_safe(nextp, tmp, &head_extra->lru, lru) {
+		list_del(&nextp->lru);
+		reset_page(nextp);
+		__free_page(nextp);
+	}
+	reset_page(head_extra);
+	__free_page(head_extra);
+}
+
+/* Initialize a newly allocated zspage */
+static void init_zspage(struct page *first_page, struct size_class *class)
+{
+	unsigned long obj_idx;
+
+	/* link all objects together in order of their index */
+	for (obj_idx = 0; obj_idx < class->objs_per_zspage; obj_idx++) {
+		struct page *page, *next_page;
+		struct link_free *link;
+		void *vaddr;
+
+		page = obj_idx_to_page(first_page, class, obj_idx);
+		vaddr = kmap_atomic(page, KM_USER0);
+		link = (struct link_free *)(vaddr + obj_offset(class, obj_idx));
+		if (obj_idx + 1 < class->objs_per_zspage) {
+			next_page = obj_idx_to_page(first_page, class,
+						    obj_idx + 1);
+			link->next = location_to_obj(next_page, obj_idx + 1);
+		} else {
+			link->next = 0;
+		}
+		kunmap_atomic(vaddr, KM_USER0);
+	}
+}
+
+/*
+ * Allocate a zspage for the given size class
+ */
+static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	int i;
+	struct page *first_page = NULL, *prev_page = NULL;
+
+	/*
+	 * Allocate individual pages and link them together as:
+	 * 1. first page->private = first sub-page
+	 * 2. all sub-pages are linked together using page->lru
+	 * 3. each sub-page is linked to the first page using page->first_page
+	 *
+	 * For each size class, First/Head pages are linked together using
+	 * page->lru. Also, we set PG_private to identify the first page
+	 * (i.e. no other sub-page has this flag set) and PG_private_2 to
+	 * identify the last page.
+	 */
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page;
+
+		page = alloc_page(flags);
+		if (!page)
+			goto cleanup;
+
+		INIT_LIST_HEAD(&page->lru);
+		if (i == 0) {	/* first page */
+			SetPagePrivate(page);
+			set_page_private(page, 0);
+			first_page = page;
+			first_page->inuse = 0;
+		}
+		if (i == 1)
+			set_page_private(first_page, (unsigned long)page);
+		if (i >= 1)
+			page->first_page = first_page;
+		if (i >= 2)
+			list_add(&page->lru, &prev_page->lru);
+		if (i == class->pages_per_zspage - 1)	/* last page */
+			SetPagePrivate2(page);
+		prev_page = page;
+	}
+
+	init_zspage(first_page, class);
+
+	first_page->freelist = (void *)location_to_obj(first_page, 0);
+	set_zspage_mapping(first_page, class->index, ZS_EMPTY);
+
+	return first_page;
+
+cleanup:
+	if (first_page)
+		free_zspage(first_page);
+	return NULL;
+}
+
+static struct page *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = ZS_ALMOST_FULL; i >= ZS_ALMOST_EMPTY; i--) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+						struct page, lru);
+	}
+
+	return NULL;
+}
+
+/* Take a free object off the zspage, called with the class lock held */
+static unsigned long obj_malloc(struct size_class *class,
+				struct page *first_page, unsigned long handle)
+{
+	unsigned long obj, obj_idx;
+	struct link_free *link;
+	struct page *page;
+	void *vaddr;
+
+	obj = (unsigned long)first_page->freelist;
+	obj_to_location(obj, &page, &obj_idx);
+
+	vaddr = kmap_atomic(page, KM_USER0);
+	link = (struct link_free *)(vaddr + obj_offset(class, obj_idx));
+	first_page->freelist = (void *)link->next;
+	link->handle = handle | OBJ_ALLOCATED_TAG;
+	kunmap_atomic(vaddr, KM_USER0);
+
+	first_page->inuse++;
+	class->objs_inuse++;
+
+	return obj;
+}
+
+/* Put an object back on its zspage's free list, with the class lock held */
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	unsigned long obj_idx;
+	struct link_free *link;
+	struct page *first_page, *page;
+	void *vaddr;
+
+	obj_to_location(obj, &page, &obj_idx);
+	first_page = get_first_page(page);
+
+	vaddr = kmap_atomic(page, KM_USER0);
+	link = (struct link_free *)(vaddr + obj_offset(class, obj_idx));
+	link->next = (unsigned long)first_page->freelist;
+	kunmap_atomic(vaddr, KM_USER0);
+
+	first_page->freelist = (void *)obj;
+	first_page->inuse--;
+	class->objs_inuse--;
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: allocation flags used when the pool needs to grow
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	unsigned long handle, obj;
+	struct size_class *class;
+	struct page *first_page;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = (unsigned long)kmem_cache_alloc(zs_handle_cachep,
+				flags & ~(__GFP_HIGHMEM | __GFP_MOVABLE));
+	if (!handle)
+		return 0;
+
+	size += ZS_HANDLE_SIZE;
+	class = pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	first_page = find_get_zspage(class);
+
+	if (!first_page) {
+		spin_unlock(&class->lock);
+		first_page = alloc_zspage(class, flags);
+		if (unlikely(!first_page)) {
+			kmem_cache_free(zs_handle_cachep, (void *)handle);
+			return 0;
+		}
+
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	obj = obj_malloc(class, first_page, handle);
+	/* the object is not mapped yet, so nobody can hold the pin */
+	record_obj(handle, obj);
+	fix_fullness_group(class, first_page);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct page *first_page, *page;
+	unsigned long obj, obj_idx;
+	struct size_class *class;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	/* compaction cannot move the object away from us while pinned */
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	class = obj_to_class(pool, obj, &page, &obj_idx);
+	first_page = get_first_page(page);
+
+	spin_lock(&class->lock);
+	obj_free(class, obj);
+	fullness = fix_fullness_group(class, first_page);
+	if (fullness == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+
+	unpin_tag(handle);
+	kmem_cache_free(zs_handle_cachep, (void *)handle);
+
+	if (fullness == ZS_EMPTY) {
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		free_zspage(first_page);
+	}
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/* Copy @size bytes from the object at <page, off> into @buf, or back */
+static void zs_copy_object(char *buf, struct page *page, unsigned long off,
+				int size, bool to_object)
+{
+	int sizes[2];
+	struct page *pages[2];
+	int i, done = 0;
+
+	pages[0] = page;
+	pages[1] = get_next_page(page);
+	BUG_ON(!pages[1]);
+
+	sizes[0] = PAGE_SIZE - off;
+	sizes[1] = size - sizes[0];
+
+	for (i = 0; i < 2; i++) {
+		char *addr = kmap_atomic(pages[i], KM_USER1);
+
+		if (to_object)
+			memcpy(addr + off, buf + done, sizes[i]);
+		else
+			memcpy(buf + done, addr + off, sizes[i]);
+		kunmap_atomic(addr, KM_USER1);
+		done += sizes[i];
+		off = 0;
+	}
+}
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: mapping mode
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped
+ * using this function. When done with the object, it must be unmapped
+ * using zs_unmap_object.
+ *
+ * Only one object can be mapped per cpu at a time.  Preemption stays
+ * disabled until the object is unmapped, so the caller must not sleep
+ * in between.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct page *page;
+	unsigned long obj, obj_idx, off;
+	struct size_class *class;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	class = obj_to_class(pool, obj, &page, &obj_idx);
+	off = obj_offset(class, obj_idx);
+
+	area = &get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+	if (off + class->size <= PAGE_SIZE) {
+		/* this object is contained entirely within a page */
+		area->vm_addr = kmap_atomic(page, KM_USER1);
+		return area->vm_addr + off + ZS_HANDLE_SIZE;
+	}
+
+	/* this object spans two pages */
+	area->vm_addr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy_object(area->vm_buf, page, off, class->size, false);
+	return area->vm_buf + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct page *page;
+	unsigned long obj, obj_idx, off;
+	struct size_class *class;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	obj = handle_to_obj(handle);
+	class = obj_to_class(pool, obj, &page, &obj_idx);
+	off = obj_offset(class, obj_idx);
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vm_addr)
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	else if (area->vm_mm != ZS_MM_RO)
+		zs_copy_object(area->vm_buf, page, off, class->size, true);
+	put_cpu_var(zs_map_area);
+
+	unpin_tag(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* Copy a whole object, both source and destination may span pages */
+static void zs_object_copy(struct size_class *class, unsigned long dst,
+				unsigned long src)
+{
+	struct page *s_page, *d_page;
+	unsigned long s_idx, d_idx, s_off, d_off;
+	int written = 0;
+
+	obj_to_location(src, &s_page, &s_idx);
+	obj_to_location(dst, &d_page, &d_idx);
+	s_off = obj_offset(class, s_idx);
+	d_off = obj_offset(class, d_idx);
+
+	while (written < class->size) {
+		char *s_addr, *d_addr;
+		int size;
+
+		size = min_t(int, PAGE_SIZE - s_off, PAGE_SIZE - d_off);
+		size = min_t(int, size, class->size - written);
+
+		s_addr = kmap_atomic(s_page, KM_USER0);
+		d_addr = kmap_atomic(d_page, KM_USER1);
+		memcpy(d_addr + d_off, s_addr + s_off, size);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		written += size;
+		s_off += size;
+		d_off += size;
+		if (s_off == PAGE_SIZE && written < class->size) {
+			s_page = get_next_page(s_page);
+			s_off = 0;
+		}
+		if (d_off == PAGE_SIZE && written < class->size) {
+			d_page = get_next_page(d_page);
+			d_off = 0;
+		}
+	}
+}
+
+/* Handle of the object at @obj_idx if it is allocated, otherwise 0 */
+static unsigned long obj_handle(struct size_class *class,
+				struct page *first_page, unsigned long obj_idx)
+{
+	struct page *page = obj_idx_to_page(first_page, class, obj_idx);
+	struct link_free *link;
+	unsigned long head;
+	void *vaddr;
+
+	vaddr = kmap_atomic(page, KM_USER0);
+	link = (struct link_free *)(vaddr + obj_offset(class, obj_idx));
+	head = link->handle;
+	kunmap_atomic(vaddr, KM_USER0);
+
+	if (!(head & OBJ_ALLOCATED_TAG))
+		return 0;
+	return head & ~OBJ_ALLOCATED_TAG;
+}
+
+/*
+ * Move the allocated objects of the source zspage into the destination
+ * zspage until either one runs out.  Returns -ENOMEM when the
+ * destination is full.  Called with the class lock held.
+ */
+static int migrate_zspage(struct size_class *class,
+				struct zs_compact_control *cc)
+{
+	struct page *s_page = cc->s_page;
+	struct page *d_page = cc->d_page;
+	unsigned long handle, used_obj, free_obj;
+	int ret = 0;
+
+	for (; cc->index < class->objs_per_zspage; cc->index++) {
+		handle = obj_handle(class, s_page, cc->index);
+		if (!handle)
+			continue;
+
+		/* mapped or being freed right now, leave it alone */
+		if (!trypin_tag(handle))
+			continue;
+
+		if (d_page->inuse == class->objs_per_zspage) {
+			unpin_tag(handle);
+			ret = -ENOMEM;
+			break;
+		}
+
+		used_obj = handle_to_obj(handle);
+		free_obj = obj_malloc(class, d_page, handle);
+		zs_object_copy(class, free_obj, used_obj);
+		/* the new location goes in with the pin still held */
+		record_obj(handle, free_obj | BIT(HANDLE_PIN_BIT));
+		unpin_tag(handle);
+		obj_free(class, used_obj);
+	}
+
+	return ret;
+}
+
+static struct page *isolate_target_page(struct size_class *class)
+{
+	struct page *page = find_get_zspage(class);
+	unsigned int class_idx;
+	enum fullness_group fg;
+
+	if (page) {
+		get_zspage_mapping(page, &class_idx, &fg);
+		remove_zspage(class, page, fg);
+	}
+
+	return page;
+}
+
+/* the emptiest zspages are at the tail of the almost empty list */
+static struct page *isolate_source_page(struct size_class *class)
+{
+	struct list_head *head = &class->fullness_list[ZS_ALMOST_EMPTY];
+	struct page *page;
+
+	if (list_empty(head))
+		return NULL;
+
+	page = list_entry(head->prev, struct page, lru);
+	remove_zspage(class, page, ZS_ALMOST_EMPTY);
+	return page;
+}
+
+static enum fullness_group putback_zspage(struct size_class *class,
+						struct page *first_page)
+{
+	enum fullness_group fullness;
+
+	fullness = get_fullness_group(class, first_page);
+	insert_zspage(class, first_page, fullness);
+	set_zspage_mapping(first_page, class->index, fullness);
+
+	return fullness;
+}
+
+/* Number of pages compaction could free in this class */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	obj_wasted = class->zspages * class->objs_per_zspage -
+			class->objs_inuse;
+	obj_wasted /= class->objs_per_zspage;
+
+	return obj_wasted * class->pages_per_zspage;
+}
+
+static unsigned long __zs_compact(struct zs_pool *pool,
+				struct size_class *class)
+{
+	struct zs_compact_control cc;
+	struct page *src_page, *dst_page = NULL;
+	unsigned long freed = 0;
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class) &&
+	       (src_page = isolate_source_page(class))) {
+		cc.index = 0;
+		cc.s_page = src_page;
+
+		while ((dst_page = isolate_target_page(class))) {
+			cc.d_page = dst_page;
+			/*
+			 * If there is no more space in dst_page, resched
+			 * and see if anyone had allocated another zspage.
+			 */
+			if (!migrate_zspage(class, &cc))
+				break;
+
+			putback_zspage(class, dst_page);
+		}
+
+		/* Stop if we couldn't find slot */
+		if (dst_page == NULL) {
+			putback_zspage(class, src_page);
+			break;
+		}
+
+		putback_zspage(class, dst_page);
+		if (putback_zspage(class, src_page) != ZS_EMPTY) {
+			/* some objects are pinned, try again another time */
+			break;
+		}
+		class->zspages--;
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		free_zspage(src_page);
+		freed += class->pages_per_zspage;
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+static unsigned long __zs_compact_pool(struct zs_pool *pool,
+				unsigned long nr_to_free)
+{
+	int i;
+	struct size_class *class;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		class = pool->size_class[i];
+		if (class->index != i)
+			continue;
+		freed += __zs_compact(pool, class);
+		if (freed >= nr_to_free)
+			break;
+	}
+
+	atomic_long_add(freed, &pool->pages_compacted);
+	return freed;
+}
+
+/**
+ * zs_compact - move objects out of sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	return __zs_compact_pool(pool, ULONG_MAX);
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/*
+ * Compact the pool when reclaim asks for it.  Compaction needs no memory
+ * and only takes the class locks, which are never held while allocating.
+ */
+static int zs_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					shrinker);
+	unsigned long pages = 0;
+	int i;
+
+	if (sc->nr_to_scan)
+		__zs_compact_pool(pool, sc->nr_to_scan);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = pool->size_class[i];
+
+		if (class->index == i)
+			pages += zs_can_compact(class);
+	}
+
+	return min_t(unsigned long, pages, INT_MAX);
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool to be created
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name)
+{
+	int i;
+	struct zs_pool *pool;
+	struct size_class *prev_class = NULL;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	pool->name = name;
+
+	/*
+	 * Iterate reversely, because, size of size_class that we want to
+	 * use for merging should be larger or equal to current size.
+	 */
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		int size, pages_per_zspage, objs_per_zspage;
+		struct size_class *class;
+		int fullness;
+
+		size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		if (size > ZS_MAX_ALLOC_SIZE)
+			size = ZS_MAX_ALLOC_SIZE;
+		pages_per_zspage = get_pages_per_zspage(size);
+		objs_per_zspage = pages_per_zspage * PAGE_SIZE / size;
+
+		/*
+		 * A class with the same number of pages and objects per
+		 * zspage as the next larger one would only spread objects
+		 * over more zspages, so share that one instead.
+		 */
+		if (prev_class &&
+		    prev_class->pages_per_zspage == pages_per_zspage &&
+		    prev_class->objs_per_zspage == objs_per_zspage) {
+			pool->size_class[i] = prev_class;
+			continue;
+		}
+
+		class = kzalloc(sizeof(struct size_class), GFP_KERNEL);
+		if (!class)
+			goto err;
+
+		class->size = size;
+		class->index = i;
+		class->pages_per_zspage = pages_per_zspage;
+		class->objs_per_zspage = objs_per_zspage;
+		spin_lock_init(&class->lock);
+		for (fullness = 0; fullness < _ZS_NR_FULLNESS_GROUPS;
+							fullness++)
+			INIT_LIST_HEAD(&class->fullness_list[fullness]);
+
+		pool->size_class[i] = class;
+		prev_class = class;
+	}
+
+	pool->shrinker.shrink = zs_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+
+err:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	if (pool->shrinker.shrink)
+		unregister_shrinker(&pool->shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = pool->size_class[i];
+
+		if (!class || class->index != i)
+			continue;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (!list_empty(&class->fullness_list[fg])) {
+				pr_info("Freeing non-empty class with size "
+					"%db, fullness group %d\n",
+					class->size, fg);
+			}
+		}
+		kfree(class);
+	}
+
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+static void zs_exit(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu(zs_map_area, cpu).vm_buf);
+	if (zs_handle_cachep)
+		kmem_cache_destroy(zs_handle_cachep);
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	zs_handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					     0, 0, NULL);
+	if (!zs_handle_cachep)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc_node(ZS_MAX_ALLOC_SIZE, GFP_KERNEL,
+					    cpu_to_node(cpu));
+		if (!area->vm_buf) {
+			zs_exit();
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void __exit zs_module_exit(void)
+{
+	zs_exit();
+}
+
+module_init(zs_init);
+module_exit(zs_module_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Size class allocator for compressed pages");
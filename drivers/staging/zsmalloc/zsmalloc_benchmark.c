@@ -0,0 +1,385 @@
+/*
+ * zsmalloc vs. xvmalloc benchmark
+ *
+ * Samples pages in use on the system, spread evenly over all of memory,
+ * and compresses them with LZO the way zram would.  Zero filled pages
+ * and pages that do not compress below zram's max_zpage_size are left
+ * out, as zram does not store those in its allocator.  The resulting
+ * object sizes are then replayed in random order against a zsmalloc
+ * and an xvmalloc pool:
+ *
+ *  alloc:  nr_objs objects are allocated and filled.
+ *  churn:  every other object is freed and allocated again with a
+ *          different size, like a swap device whose slots are reused.
+ *  free:   all objects are freed.
+ *
+ * The average number of cycles per allocation and free, and the memory
+ * used by the pool compared to the bytes stored after the alloc and
+ * churn steps are printed to the kernel log when the module is loaded.
+ * For zsmalloc the pool is also compacted after the churn step.  Once
+ * done, loading fails with -EAGAIN so that the module can be loaded
+ * again for the next run.
+ */
+#include <linux/highmem.h>
+#include <linux/lzo.h>
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/timex.h>
+#include <linux/vmalloc.h>
+
+#include "zsmalloc.h"
+#include "../zram/xvmalloc.h"
+
+static unsigned int nr_samples = 4096;
+module_param(nr_samples, uint, 0444);
+MODULE_PARM_DESC(nr_samples, "# of pages to sample for compressed sizes");
+
+static unsigned int nr_objs = 65536;
+module_param(nr_objs, uint, 0444);
+MODULE_PARM_DESC(nr_objs, "# of objects allocated from each pool");
+
+/* same as zram's max_zpage_size */
+#define BENCH_MAX_SIZE		(PAGE_SIZE / 4 * 3)
+
+struct bench_obj {
+	unsigned long handle;	/* zsmalloc */
+	struct page *page;	/* xvmalloc */
+	u32 offset;
+	u32 size;
+};
+
+struct bench_result {
+	unsigned long long alloc_cycles;
+	unsigned long long free_cycles;
+	unsigned long nr_allocs;
+	unsigned long failed;
+	u64 pool_alloc, pool_churn, pool_compact;
+};
+
+static u32 *bench_sizes;
+static unsigned int nr_sizes;
+static struct bench_obj *bench_objs;
+static struct rnd_state bench_rnd;
+
+static int page_zero_filled(void *ptr)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos])
+			return 0;
+	}
+
+	return 1;
+}
+
+static void sample_page(struct page *page, void *wrkmem, void *dst)
+{
+	size_t clen;
+	void *src;
+	int ret;
+
+	src = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(src)) {
+		kunmap_atomic(src, KM_USER0);
+		return;
+	}
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &clen, wrkmem);
+	kunmap_atomic(src, KM_USER0);
+
+	if (ret == LZO_E_OK && clen <= BENCH_MAX_SIZE)
+		bench_sizes[nr_sizes++] = clen;
+}
+
+/* Compress pages spread evenly over all nodes, skipping free ones */
+static int sample_sizes(void)
+{
+	unsigned long pfn, start, end, stride;
+	void *wrkmem, *dst;
+	int nid;
+
+	wrkmem = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	dst = kmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+	if (!wrkmem || !dst) {
+		kfree(wrkmem);
+		kfree(dst);
+		return -ENOMEM;
+	}
+
+	stride = max_t(unsigned long, num_physpages / nr_samples, 1);
+	for_each_online_node(nid) {
+		start = NODE_DATA(nid)->node_start_pfn;
+		end = start + NODE_DATA(nid)->node_spanned_pages;
+
+		for (pfn = start; pfn < end; pfn += stride) {
+			struct page *page;
+
+			if (nr_sizes == nr_samples)
+				break;
+			if (!pfn_valid(pfn))
+				continue;
+			page = pfn_to_page(pfn);
+			if (PageReserved(page) || !page_count(page))
+				continue;
+			sample_page(page, wrkmem, dst);
+			cond_resched();
+		}
+	}
+
+	kfree(dst);
+	kfree(wrkmem);
+	return 0;
+}
+
+static u32 random_size(void)
+{
+	return bench_sizes[prandom32(&bench_rnd) % nr_sizes];
+}
+
+static int zs_bench_alloc(struct zs_pool *pool, struct bench_obj *obj,
+			  struct bench_result *res)
+{
+	cycles_t start = get_cycles();
+	void *p;
+
+	obj->handle = zs_malloc(pool, obj->size, GFP_KERNEL | __GFP_HIGHMEM);
+	res->alloc_cycles += get_cycles() - start;
+	res->nr_allocs++;
+	if (!obj->handle) {
+		res->failed++;
+		return -ENOMEM;
+	}
+
+	p = zs_map_object(pool, obj->handle, ZS_MM_WO);
+	memset(p, obj->size, obj->size);
+	zs_unmap_object(pool, obj->handle);
+	return 0;
+}
+
+static void zs_bench_free(struct zs_pool *pool, struct bench_obj *obj,
+			  struct bench_result *res)
+{
+	cycles_t start;
+
+	if (!obj->handle)
+		return;
+	start = get_cycles();
+	zs_free(pool, obj->handle);
+	res->free_cycles += get_cycles() - start;
+	obj->handle = 0;
+}
+
+static int bench_zsmalloc(struct bench_result *res)
+{
+	struct zs_pool *pool;
+	unsigned int i;
+
+	pool = zs_create_pool("zsmalloc_benchmark");
+	if (!pool)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_objs; i++) {
+		zs_bench_alloc(pool, &bench_objs[i], res);
+		cond_resched();
+	}
+	res->pool_alloc = zs_get_total_size_bytes(pool);
+
+	for (i = 0; i < nr_objs; i += 2) {
+		zs_bench_free(pool, &bench_objs[i], res);
+		bench_objs[i].size = random_size();
+		zs_bench_alloc(pool, &bench_objs[i], res);
+		cond_resched();
+	}
+	res->pool_churn = zs_get_total_size_bytes(pool);
+	zs_compact(pool);
+	res->pool_compact = zs_get_total_size_bytes(pool);
+
+	for (i = 0; i < nr_objs; i++) {
+		zs_bench_free(pool, &bench_objs[i], res);
+		cond_resched();
+	}
+
+	zs_destroy_pool(pool);
+	return 0;
+}
+
+static int xv_bench_alloc(struct xv_pool *pool, struct bench_obj *obj,
+			  struct bench_result *res)
+{
+	cycles_t start = get_cycles();
+	void *p;
+	int ret;
+
+	ret = xv_malloc(pool, obj->size, &obj->page, &obj->offset,
+			GFP_KERNEL | __GFP_HIGHMEM);
+	res->alloc_cycles += get_cycles() - start;
+	res->nr_allocs++;
+	if (ret) {
+		obj->page = NULL;
+		res->failed++;
+		return ret;
+	}
+
+	p = kmap_atomic(obj->page, KM_USER0);
+	memset(p + obj->offset, obj->size, obj->size);
+	kunmap_atomic(p, KM_USER0);
+	return 0;
+}
+
+static void xv_bench_free(struct xv_pool *pool, struct bench_obj *obj,
+			  struct bench_result *res)
+{
+	cycles_t start;
+
+	if (!obj->page)
+		return;
+	start = get_cycles();
+	xv_free(pool, obj->page, obj->offset);
+	res->free_cycles += get_cycles() - start;
+	obj->page = NULL;
+}
+
+static int bench_xvmalloc(struct bench_result *res)
+{
+	struct xv_pool *pool;
+	unsigned int i;
+
+	pool = xv_create_pool();
+	if (!pool)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_objs; i++) {
+		xv_bench_alloc(pool, &bench_objs[i], res);
+		cond_resched();
+	}
+	res->pool_alloc = xv_get_total_size_bytes(pool);
+
+	for (i = 0; i < nr_objs; i += 2) {
+		xv_bench_free(pool, &bench_objs[i], res);
+		bench_objs[i].size = random_size();
+		xv_bench_alloc(pool, &bench_objs[i], res);
+		cond_resched();
+	}
+	res->pool_churn = xv_get_total_size_bytes(pool);
+	res->pool_compact = res->pool_churn;
+
+	for (i = 0; i < nr_objs; i++) {
+		xv_bench_free(pool, &bench_objs[i], res);
+		cond_resched();
+	}
+
+	xv_destroy_pool(pool);
+	return 0;
+}
+
+/* Same sizes in the same order for both allocators */
+static void bench_reset_objs(void)
+{
+	unsigned int i;
+
+	prandom32_seed(&bench_rnd, nr_objs);
+	for (i = 0; i < nr_objs; i++) {
+		bench_objs[i].handle = 0;
+		bench_objs[i].page = NULL;
+		bench_objs[i].size = random_size();
+	}
+}
+
+/* Bytes stored per 100 bytes of pool memory */
+static unsigned int bench_efficiency(u64 stored, u64 pool)
+{
+	return pool ? div64_u64(stored * 100, pool) : 0;
+}
+
+static void bench_report(const char *name, struct bench_result *res,
+			 u64 stored_alloc, u64 stored_churn)
+{
+	unsigned long nr = res->nr_allocs ? res->nr_allocs : 1;
+
+	printk(KERN_INFO "zsmalloc_benchmark: %-8s alloc %llu cycles/op, "
+	       "free %llu cycles/op, %lu failed\n", name,
+	       div64_u64(res->alloc_cycles, nr),
+	       div64_u64(res->free_cycles, nr), res->failed);
+	printk(KERN_INFO "zsmalloc_benchmark: %-8s %llu kB pool, %u%% used "
+	       "after alloc; %llu kB pool, %u%% used after churn; "
+	       "%llu kB pool after compaction\n", name,
+	       res->pool_alloc >> 10,
+	       bench_efficiency(stored_alloc, res->pool_alloc),
+	       res->pool_churn >> 10,
+	       bench_efficiency(stored_churn, res->pool_churn),
+	       res->pool_compact >> 10);
+}
+
+static u64 bench_stored(unsigned int step)
+{
+	u64 stored = 0;
+	unsigned int i;
+
+	for (i = 0; i < nr_objs; i += step)
+		stored += bench_objs[i].size;
+	return stored;
+}
+
+static int __init zsmalloc_benchmark_init(void)
+{
+	struct bench_result zs = { 0 }, xv = { 0 };
+	u64 stored_alloc, stored_churn;
+	int ret;
+
+	if (!nr_samples || !nr_objs)
+		return -EINVAL;
+
+	bench_sizes = vmalloc(nr_samples * sizeof(*bench_sizes));
+	bench_objs = vmalloc(nr_objs * sizeof(*bench_objs));
+	if (!bench_sizes || !bench_objs) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = sample_sizes();
+	if (ret)
+		goto out;
+	if (!nr_sizes) {
+		printk(KERN_INFO "zsmalloc_benchmark: no compressible pages found\n");
+		ret = -ENODATA;
+		goto out;
+	}
+
+	/*
+	 * Both runs replay the same sequence of sizes, the churn step
+	 * included, so the sizes left in the objects after the first run
+	 * are the bytes stored after churn for both.
+	 */
+	bench_reset_objs();
+	stored_alloc = bench_stored(1);
+	ret = bench_zsmalloc(&zs);
+	if (ret)
+		goto out;
+	stored_churn = bench_stored(1);
+
+	bench_reset_objs();
+	ret = bench_xvmalloc(&xv);
+	if (ret)
+		goto out;
+
+	printk(KERN_INFO "zsmalloc_benchmark: %u objects, sizes from %u "
+	       "sampled pages, avg %llu bytes\n", nr_objs, nr_sizes,
+	       div64_u64(stored_alloc, nr_objs));
+	bench_report("zsmalloc", &zs, stored_alloc, stored_churn);
+	bench_report("xvmalloc", &xv, stored_alloc, stored_churn);
+	ret = -EAGAIN;
+out:
+	vfree(bench_objs);
+	vfree(bench_sizes);
+	return ret;
+}
+
+module_init(zsmalloc_benchmark_init);
+
+MODULE_DESCRIPTION("zsmalloc vs. xvmalloc benchmark");
+MODULE_LICENSE("GPL");
@@ -920,6 +920,11 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	pgoff_t mmap_prev;		/* Last mmap cache miss */
+	long mmap_stride;		/* Distance between the last mmap misses */
+	unsigned int mmap_stride_hits;	/* # of misses seen at that distance */
+	pgoff_t mmap_stride_next;	/* Where the stride readahead goes on */
 };
 
 /*
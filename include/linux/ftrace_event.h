@@ -74,6 +74,8 @@ struct trace_iterator {
 	/* The below is zeroed out in pipe_read */
 	struct trace_seq	seq;
 	struct trace_entry	*ent;
+	/* compact records are expanded into this */
+	unsigned long		ent_buf[8];
 	unsigned long		lost_events;
 	int			leftover;
 	int			cpu;
@@ -3,6 +3,7 @@
 
 #include <linux/compiler.h>
 #include <linux/types.h>
+#include <linux/errno.h>
 
 /* Second argument to futex syscall */
 
@@ -177,6 +178,9 @@ union futex_key {
 extern void exit_robust_list(struct task_struct *curr);
 extern void exit_pi_state_list(struct task_struct *curr);
 extern int futex_cmpxchg_enabled;
+extern int futex_hash_set(unsigned long buckets);
+extern int futex_hash_get(void);
+extern void futex_mm_free(struct mm_struct *mm);
 #else
 static inline void exit_robust_list(struct task_struct *curr)
 {
@@ -184,6 +188,17 @@ static inline void exit_robust_list(struct task_struct *curr)
 static inline void exit_pi_state_list(struct task_struct *curr)
 {
 }
+static inline int futex_hash_set(unsigned long buckets)
+{
+	return -EINVAL;
+}
+static inline int futex_hash_get(void)
+{
+	return -EINVAL;
+}
+static inline void futex_mm_free(struct mm_struct *mm)
+{
+}
 #endif
 #endif /* __KERNEL__ */
 
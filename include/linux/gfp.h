@@ -310,6 +310,34 @@ static inline struct page *alloc_pages_node(int nid, gfp_t gfp_mask,
 	return __alloc_pages(gfp_mask, order, node_zonelist(nid, gfp_mask));
 }
 
+unsigned long __alloc_pages_bulk(gfp_t gfp_mask, int nid,
+				 unsigned long nr_pages,
+				 struct list_head *page_list,
+				 struct page **page_array);
+
+/* Bulk allocate order-0 pages onto a list */
+static inline unsigned long
+alloc_pages_bulk_list(gfp_t gfp_mask, unsigned long nr_pages,
+		      struct list_head *list)
+{
+	return __alloc_pages_bulk(gfp_mask, -1, nr_pages, list, NULL);
+}
+
+/* Bulk allocate order-0 pages into the NULL entries of an array */
+static inline unsigned long
+alloc_pages_bulk_array(gfp_t gfp_mask, unsigned long nr_pages,
+		       struct page **page_array)
+{
+	return __alloc_pages_bulk(gfp_mask, -1, nr_pages, NULL, page_array);
+}
+
+static inline unsigned long
+alloc_pages_bulk_array_node(gfp_t gfp_mask, int nid, unsigned long nr_pages,
+			    struct page **page_array)
+{
+	return __alloc_pages_bulk(gfp_mask, nid, nr_pages, NULL, page_array);
+}
+
 static inline struct page *alloc_pages_exact_node(int nid, gfp_t gfp_mask,
 						unsigned int order)
 {
@@ -115,6 +115,7 @@ enum zone_stat_item {
 	NUMA_OTHER,		/* allocation from other node */
 #endif
 	NR_ANON_TRANSPARENT_HUGEPAGES,
+	NR_PCP_HIGH_ORDER,	/* base pages of order > 0 on the pcp lists */
 	NR_VM_ZONE_STAT_ITEMS };
 
 /*
@@ -169,13 +170,20 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * The pcp-lists cache pages of every order up to PAGE_ALLOC_COSTLY_ORDER,
+ * so that task stacks, slabs and network buffers are not all served
+ * under zone->lock.  There is one list per order and migrate type.
+ */
+#define NR_PCP_LISTS (MIGRATE_PCPTYPES * (PAGE_ALLOC_COSTLY_ORDER + 1))
+
 struct per_cpu_pages {
-	int count;		/* number of pages in the list */
+	int count;		/* number of pages in the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per order and migrate type, see pcp_list() */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -184,7 +192,7 @@ struct per_cpu_pageset {
 	s8 expire;
 #endif
 #ifdef CONFIG_SMP
-	s8 stat_threshold;
+	s8 stat_threshold[NR_VM_ZONE_STAT_ITEMS];
 	s8 vm_stat_diff[NR_VM_ZONE_STAT_ITEMS];
 #endif
 };
@@ -262,6 +270,10 @@ enum zone_type {
 #error ZONES_SHIFT -- too many zones configured adjust calculation
 #endif
 
+struct lruvec {
+	struct list_head lists[NR_LRU_LISTS];
+};
+
 struct zone_reclaim_stat {
 	/*
 	 * The pageout code in vmscan.c keeps track of how many of the
@@ -338,11 +350,14 @@ struct zone {
 
 	ZONE_PADDING(_pad1_)
 
-	/* Fields commonly accessed by the page reclaim scanner */
-	spinlock_t		lru_lock;	
-	struct zone_lru {
-		struct list_head list;
-	} lru[NR_LRU_LISTS];
+	/*
+	 * Fields commonly accessed by the page reclaim scanner.  lru_lock
+	 * covers the lists of every lruvec in the zone, the memcg ones
+	 * included, and pc->mem_cgroup of the pages on them: the page's
+	 * lruvec is only known once the lock is held.
+	 */
+	spinlock_t		lru_lock;
+	struct lruvec		lruvec;
 
 	struct zone_reclaim_stat reclaim_stat;
 
@@ -636,6 +651,12 @@ typedef struct pglist_data {
 	struct task_struct *kswapd;
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+	int kcompactd_max_order;	/* highest order woken for */
+	unsigned int kcompactd_defer_shift;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
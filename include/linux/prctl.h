@@ -102,4 +102,12 @@
 
 #define PR_MCE_KILL_GET 34
 
+/*
+ * Hash PROCESS_PRIVATE futexes into a table of the process' own, arg2
+ * is the number of buckets (0 for a default based on the cpu count).
+ * Only allowed while the process is still single threaded.
+ */
+#define PR_SET_FUTEX_HASH 35
+#define PR_GET_FUTEX_HASH 36
+
 #endif /* _LINUX_PRCTL_H */
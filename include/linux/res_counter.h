@@ -14,6 +14,7 @@
  */
 
 #include <linux/cgroup.h>
+#include <linux/atomic.h>
 
 /*
  * The core object. the cgroup that wishes to account for some
@@ -23,27 +24,32 @@
 
 struct res_counter {
 	/*
-	 * the current resource consumption level
+	 * the current resource consumption level, charged and uncharged
+	 * without the lock so that a hierarchy of counters is walked
+	 * without taking a lock at every level
 	 */
-	unsigned long long usage;
+	atomic64_t usage;
 	/*
 	 * the maximal value of the usage from the counter creation
 	 */
-	unsigned long long max_usage;
+	atomic64_t max_usage;
 	/*
 	 * the limit that usage cannot exceed
 	 */
-	unsigned long long limit;
+	atomic64_t limit;
 	/*
 	 * the limit that usage can be exceed
 	 */
-	unsigned long long soft_limit;
+	atomic64_t soft_limit;
 	/*
 	 * the number of unsuccessful attempts to consume the resource
 	 */
-	unsigned long long failcnt;
+	atomic64_t failcnt;
 	/*
-	 * the lock to protect all of the above.
+	 * the lock to serialize the writers of all of the above but
+	 * usage.  Charging reads them and updates max_usage and failcnt
+	 * without it, which is why they are atomic64_t: that keeps them
+	 * from tearing on 32-bit.
 	 * the routines below consider this to be IRQ-safe
 	 */
 	spinlock_t lock;
@@ -108,11 +114,10 @@ void res_counter_init(struct res_counter *counter, struct res_counter *parent);
  *       units, e.g. numbers, bytes, Kbytes, etc
  *
  * returns 0 on success and <0 if the counter->usage will exceed the
- * counter->limit _locked call expects the counter->lock to be taken
+ * counter->limit.  Racing charges may briefly see usage over the limit
+ * and fail, even though one of them alone would have fit.
  */
 
-int __must_check res_counter_charge_locked(struct res_counter *counter,
-		unsigned long val);
 int __must_check res_counter_charge(struct res_counter *counter,
 		unsigned long val, struct res_counter **limit_fail_at);
 
@@ -123,12 +128,20 @@ int __must_check res_counter_charge(struct res_counter *counter,
  * @val: the amount of the resource
  *
  * these calls check for usage underflow and show a warning on the console
- * _locked call expects the counter->lock to be taken
  */
 
-void res_counter_uncharge_locked(struct res_counter *counter, unsigned long val);
 void res_counter_uncharge(struct res_counter *counter, unsigned long val);
 
+static inline unsigned long long res_counter_usage(struct res_counter *cnt)
+{
+	return atomic64_read(&cnt->usage);
+}
+
+static inline unsigned long long res_counter_limit(struct res_counter *cnt)
+{
+	return atomic64_read(&cnt->limit);
+}
+
 /**
  * res_counter_margin - calculate chargeable space of a counter
  * @cnt: the counter
@@ -138,13 +151,11 @@ void res_counter_uncharge(struct res_counter *counter, unsigned long val);
  */
 static inline unsigned long long res_counter_margin(struct res_counter *cnt)
 {
-	unsigned long long margin;
-	unsigned long flags;
+	unsigned long long usage, limit;
 
-	spin_lock_irqsave(&cnt->lock, flags);
-	margin = cnt->limit - cnt->usage;
-	spin_unlock_irqrestore(&cnt->lock, flags);
-	return margin;
+	usage = res_counter_usage(cnt);
+	limit = res_counter_limit(cnt);
+	return usage < limit ? limit - usage : 0;
 }
 
 /**
@@ -157,16 +168,11 @@ static inline unsigned long long res_counter_margin(struct res_counter *cnt)
 static inline unsigned long long
 res_counter_soft_limit_excess(struct res_counter *cnt)
 {
-	unsigned long long excess;
-	unsigned long flags;
+	unsigned long long usage, soft_limit;
 
-	spin_lock_irqsave(&cnt->lock, flags);
-	if (cnt->usage <= cnt->soft_limit)
-		excess = 0;
-	else
-		excess = cnt->usage - cnt->soft_limit;
-	spin_unlock_irqrestore(&cnt->lock, flags);
-	return excess;
+	usage = res_counter_usage(cnt);
+	soft_limit = atomic64_read(&cnt->soft_limit);
+	return usage <= soft_limit ? 0 : usage - soft_limit;
 }
 
 static inline void res_counter_reset_max(struct res_counter *cnt)
@@ -174,7 +180,7 @@ static inline void res_counter_reset_max(struct res_counter *cnt)
 	unsigned long flags;
 
 	spin_lock_irqsave(&cnt->lock, flags);
-	cnt->max_usage = cnt->usage;
+	atomic64_set(&cnt->max_usage, res_counter_usage(cnt));
 	spin_unlock_irqrestore(&cnt->lock, flags);
 }
 
@@ -183,20 +189,30 @@ static inline void res_counter_reset_failcnt(struct res_counter *cnt)
 	unsigned long flags;
 
 	spin_lock_irqsave(&cnt->lock, flags);
-	cnt->failcnt = 0;
+	atomic64_set(&cnt->failcnt, 0);
 	spin_unlock_irqrestore(&cnt->lock, flags);
 }
 
+/*
+ * A charge adds to usage before it checks the limit, and the limit is
+ * set before usage is checked against it here, with full barriers in
+ * between: either the charge sees the new limit, or the new limit is
+ * refused because of the charge.
+ */
 static inline int res_counter_set_limit(struct res_counter *cnt,
 		unsigned long long limit)
 {
+	unsigned long long old;
 	unsigned long flags;
-	int ret = -EBUSY;
+	int ret = 0;
 
 	spin_lock_irqsave(&cnt->lock, flags);
-	if (cnt->usage <= limit) {
-		cnt->limit = limit;
-		ret = 0;
+	old = res_counter_limit(cnt);
+	atomic64_set(&cnt->limit, limit);
+	smp_mb();
+	if (res_counter_usage(cnt) > limit) {
+		atomic64_set(&cnt->limit, old);
+		ret = -EBUSY;
 	}
 	spin_unlock_irqrestore(&cnt->lock, flags);
 	return ret;
@@ -209,7 +225,7 @@ res_counter_set_soft_limit(struct res_counter *cnt,
 	unsigned long flags;
 
 	spin_lock_irqsave(&cnt->lock, flags);
-	cnt->soft_limit = soft_limit;
+	atomic64_set(&cnt->soft_limit, soft_limit);
 	spin_unlock_irqrestore(&cnt->lock, flags);
 	return 0;
 }
@@ -27,6 +27,10 @@ struct rw_semaphore {
 	long			count;
 	spinlock_t		wait_lock;
 	struct list_head	wait_list;
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+	/* write owner, for contending writers to spin on */
+	struct task_struct	*owner;
+#endif
 #ifdef CONFIG_DEBUG_LOCK_ALLOC
 	struct lockdep_map	dep_map;
 #endif
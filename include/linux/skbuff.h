@@ -489,6 +489,10 @@ static inline struct rtable *skb_rtable(const struct sk_buff *skb)
 
 extern void kfree_skb(struct sk_buff *skb);
 extern void consume_skb(struct sk_buff *skb);
+extern void napi_consume_skb(struct sk_buff *skb);
+extern void __kfree_skb_defer(void);
+extern void __kfree_skb_flush(void);
+extern int sysctl_skb_bulk_free;
 extern void	       __kfree_skb(struct sk_buff *skb);
 extern struct sk_buff *__alloc_skb(unsigned int size,
 				   gfp_t priority, int fclone, int node);
@@ -106,6 +106,15 @@ int kmem_cache_shrink(struct kmem_cache *);
 void kmem_cache_free(struct kmem_cache *, void *);
 unsigned int kmem_cache_size(struct kmem_cache *);
 
+/*
+ * Bulk allocation and freeing of objects.  kmem_cache_alloc_bulk() fills
+ * the array with @nr objects and returns @nr, or returns 0 and allocates
+ * nothing if it runs out of memory.  The per cpu and node lock overhead is
+ * paid once per call where the allocator can do so.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *, gfp_t, size_t, void **);
+void kmem_cache_free_bulk(struct kmem_cache *, size_t, void **);
+
 /*
  * Please use this macro to create slab caches. Simply specify the
  * name of the structure and maybe some flags that are listed above.
@@ -0,0 +1,12 @@
+#ifndef _LINUX_SWAPFILE_H
+#define _LINUX_SWAPFILE_H
+
+/*
+ * these were static in swapfile.c but frontswap.c needs them and we don't
+ * want to expose them to the dozens of source files that include swap.h
+ */
+extern spinlock_t swap_lock;
+extern unsigned int nr_swapfiles;
+extern struct swap_info_struct *swap_info[];
+
+#endif /* _LINUX_SWAPFILE_H */
@@ -139,6 +139,30 @@ static inline unsigned long zone_page_state_snapshot(struct zone *zone,
 	return x;
 }
 
+/*
+ * Same as zone_page_state_snapshot() for the global counter.  This walks
+ * the pagesets of every populated zone on every cpu, so it is only meant
+ * for decisions that go wrong when they see the drift, not for
+ * statistics.
+ */
+static inline unsigned long global_page_state_snapshot(enum zone_stat_item item)
+{
+	long x = atomic_long_read(&vm_stat[item]);
+
+#ifdef CONFIG_SMP
+	struct zone *zone;
+	int cpu;
+
+	for_each_populated_zone(zone)
+		for_each_online_cpu(cpu)
+			x += per_cpu_ptr(zone->pageset, cpu)->vm_stat_diff[item];
+
+	if (x < 0)
+		x = 0;
+#endif
+	return x;
+}
+
 extern unsigned long global_reclaimable_pages(void);
 extern unsigned long zone_reclaimable_pages(struct zone *zone);
 
@@ -200,9 +224,14 @@ extern void __inc_zone_state(struct zone *, enum zone_stat_item);
 extern void dec_zone_state(struct zone *, enum zone_stat_item);
 extern void __dec_zone_state(struct zone *, enum zone_stat_item);
 
-void refresh_cpu_vm_stats(int);
+int refresh_cpu_vm_stats(int);
 void refresh_zone_stat_thresholds(void);
 
+extern int sysctl_stat_threshold_shift;
+struct ctl_table;
+int vmstat_threshold_shift_sysctl_handler(struct ctl_table *, int,
+					void __user *, size_t *, loff_t *);
+
 int calculate_pressure_threshold(struct zone *zone);
 int calculate_normal_threshold(struct zone *zone);
 void set_pgdat_percpu_threshold(pg_data_t *pgdat,
@@ -253,7 +282,7 @@ static inline void __dec_zone_page_state(struct page *page,
 
 #define set_pgdat_percpu_threshold(pgdat, callback) { }
 
-static inline void refresh_cpu_vm_stats(int cpu) { }
+static inline int refresh_cpu_vm_stats(int cpu) { return 0; }
 static inline void refresh_zone_stat_thresholds(void) { }
 
 #endif		/* CONFIG_SMP */
@@ -10,6 +10,7 @@
 #include <linux/bitops.h>
 #include <linux/lockdep.h>
 #include <linux/threads.h>
+#include <linux/numa.h>
 #include <asm/atomic.h>
 
 struct workqueue_struct;
@@ -54,9 +55,13 @@ enum {
 	WORK_NR_COLORS		= (1 << WORK_STRUCT_COLOR_BITS) - 1,
 	WORK_NO_COLOR		= WORK_NR_COLORS,
 
-	/* special cpu IDs */
+	/*
+	 * Special cpu IDs.  Unbound gcwqs are per NUMA node and are
+	 * identified by WORK_CPU_UNBOUND + node.  WORK_CPU_UNBOUND
+	 * passed in by users means the local node.
+	 */
 	WORK_CPU_UNBOUND	= NR_CPUS,
-	WORK_CPU_NONE		= NR_CPUS + 1,
+	WORK_CPU_NONE		= NR_CPUS + MAX_NUMNODES,
 	WORK_CPU_LAST		= WORK_CPU_NONE,
 
 	/*
@@ -257,6 +262,8 @@ enum {
 
 	WQ_DYING		= 1 << 6, /* internal: workqueue is dying */
 	WQ_RESCUER		= 1 << 7, /* internal: workqueue has rescuer */
+	WQ_ORDERED		= 1 << 8, /* unbound, max_active 1, in order */
+	WQ_ORDERED_EXPLICIT	= 1 << 9, /* internal: WQ_ORDERED requested */
 
 	WQ_MAX_ACTIVE		= 512,	  /* I like 512, better ideas? */
 	WQ_MAX_UNBOUND_PER_CPU	= 4,	  /* 4 * #cpus for unbound wq */
@@ -334,15 +341,16 @@ __alloc_workqueue_key(const char *name, unsigned int flags, int max_active,
 static inline struct workqueue_struct *
 alloc_ordered_workqueue(const char *name, unsigned int flags)
 {
-	return alloc_workqueue(name, WQ_UNBOUND | flags, 1);
+	return alloc_workqueue(name, WQ_UNBOUND | WQ_ORDERED | flags, 1);
 }
 
 #define create_workqueue(name)					\
 	alloc_workqueue((name), WQ_MEM_RECLAIM, 1)
 #define create_freezable_workqueue(name)			\
-	alloc_workqueue((name), WQ_FREEZABLE | WQ_UNBOUND | WQ_MEM_RECLAIM, 1)
+	alloc_workqueue((name), WQ_FREEZABLE | WQ_UNBOUND | WQ_ORDERED |	\
+			WQ_MEM_RECLAIM, 1)
 #define create_singlethread_workqueue(name)			\
-	alloc_workqueue((name), WQ_UNBOUND | WQ_MEM_RECLAIM, 1)
+	alloc_workqueue((name), WQ_UNBOUND | WQ_ORDERED | WQ_MEM_RECLAIM, 1)
 
 extern void destroy_workqueue(struct workqueue_struct *wq);
 
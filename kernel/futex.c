@@ -59,6 +59,9 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -66,7 +69,16 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
+/*
+ * The global hash gets this many buckets per possible cpu, so that
+ * heavily threaded workloads do not end up serializing on a handful
+ * of bucket locks on large machines.
+ */
+#define FUTEX_HASH_PER_CPU	256
+
+/* Bounds on the number of buckets of a per-mm private futex hash */
+#define FUTEX_PRIVATE_HASH_MIN	16
+#define FUTEX_PRIVATE_HASH_MAX	8192
 
 /*
  * Futex flags used to encode options to functions and preserve them across
@@ -145,19 +157,48 @@ static const struct futex_q futex_q_init = {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
-};
+} ____cacheline_aligned_in_smp;
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned int futex_hashmask __read_mostly;
+
+/*
+ * Keys of PROCESS_PRIVATE futexes carry neither an inode nor an mm
+ * reference and can only ever be looked up from within their own mm.
+ */
+static inline int key_is_private(union futex_key *key)
+{
+	return !(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED));
+}
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
+ * Private keys of an mm that asked for its own hash table (see
+ * futex_hash_set()) go there, everything else to the global table.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	if (key_is_private(key)) {
+		struct mm_struct *mm = key->private.mm;
+
+		if (mm->futex_hash)
+			return &mm->futex_hash[hash & mm->futex_hash_mask];
+	}
+	return &futex_queues[hash & futex_hashmask];
+}
+
+static void futex_hash_init(struct futex_hash_bucket *hb, unsigned long size)
+{
+	unsigned long i;
+
+	for (i = 0; i < size; i++) {
+		plist_head_init(&hb[i].chain, &hb[i].lock);
+		spin_lock_init(&hb[i].lock);
+	}
 }
 
 /*
@@ -2720,10 +2761,89 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 	return do_futex(uaddr, op, val, tp, uaddr2, val2, val3);
 }
 
+/**
+ * futex_hash_set() - give the current mm its own private futex hash
+ * @buckets:	number of hash buckets, 0 picks a size from the cpu count
+ *
+ * PROCESS_PRIVATE futexes of the current mm are hashed into a table
+ * of their own from now on, so that they no longer contend with every
+ * other process on the global bucket locks.  This has to be done
+ * before the process goes multithreaded: no other task may be using
+ * the mm and the caller must not own any PI futexes, since those are
+ * already queued on the global table.
+ *
+ * Return: 0 on success, -EBUSY if the mm is shared or already has a
+ * private hash, -ENOMEM if the table could not be allocated.
+ */
+int futex_hash_set(unsigned long buckets)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_hash_bucket *hb;
+	size_t size;
+
+	if (!mm)
+		return -EINVAL;
+	if (!buckets)
+		buckets = 4 * num_online_cpus();
+	buckets = clamp_t(unsigned long, buckets, FUTEX_PRIVATE_HASH_MIN,
+			  FUTEX_PRIVATE_HASH_MAX);
+	buckets = roundup_pow_of_two(buckets);
+
+	if (atomic_read(&mm->mm_users) != 1 || mm->futex_hash ||
+	    !list_empty(&current->pi_state_list))
+		return -EBUSY;
+
+	size = buckets * sizeof(*hb);
+	if (size <= PAGE_SIZE)
+		hb = kzalloc(size, GFP_KERNEL);
+	else
+		hb = vzalloc(size);
+	if (!hb)
+		return -ENOMEM;
+	futex_hash_init(hb, buckets);
+
+	mm->futex_hash_mask = buckets - 1;
+	mm->futex_hash = hb;
+	return 0;
+}
+
+/**
+ * futex_hash_get() - number of buckets of the current mm's private hash
+ *
+ * Return: the size of the private futex hash, or 0 if the current mm
+ * uses the global one.
+ */
+int futex_hash_get(void)
+{
+	struct mm_struct *mm = current->mm;
+
+	if (!mm || !mm->futex_hash)
+		return 0;
+	return mm->futex_hash_mask + 1;
+}
+
+/*
+ * Called from mmput() once the last user of the mm is gone, so nobody
+ * can be queued on the table anymore.  Not from __mmdrop(), which may
+ * run in atomic context where vfree() is not allowed.
+ */
+void futex_mm_free(struct mm_struct *mm)
+{
+	struct futex_hash_bucket *hb = mm->futex_hash;
+
+	if (!hb)
+		return;
+	if ((mm->futex_hash_mask + 1) * sizeof(*hb) <= PAGE_SIZE)
+		kfree(hb);
+	else
+		vfree(hb);
+	mm->futex_hash = NULL;
+}
+
 static int __init futex_init(void)
 {
+	unsigned long size;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2738,10 +2858,16 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	size = 16;
+#else
+	size = roundup_pow_of_two(FUTEX_HASH_PER_CPU * num_possible_cpus());
+#endif
+	futex_queues = alloc_large_system_hash("futex",
+					       sizeof(struct futex_hash_bucket),
+					       size, 0, 0, NULL, &futex_hashmask,
+					       size);
+	futex_hash_init(futex_queues, futex_hashmask + 1);
 
 	return 0;
 }
@@ -17,84 +17,81 @@
 void res_counter_init(struct res_counter *counter, struct res_counter *parent)
 {
 	spin_lock_init(&counter->lock);
-	counter->limit = RESOURCE_MAX;
-	counter->soft_limit = RESOURCE_MAX;
+	atomic64_set(&counter->limit, RESOURCE_MAX);
+	atomic64_set(&counter->soft_limit, RESOURCE_MAX);
 	counter->parent = parent;
 }
 
-int res_counter_charge_locked(struct res_counter *counter, unsigned long val)
+static void res_counter_cancel(struct res_counter *counter, unsigned long val)
 {
-	if (counter->usage + val > counter->limit) {
-		counter->failcnt++;
+	long long usage;
+
+	usage = atomic64_sub_return(val, &counter->usage);
+	/* more uncharged than charged: put it back where it was */
+	if (WARN_ON(usage < 0))
+		atomic64_add(val, &counter->usage);
+}
+
+/*
+ * usage is raised first and the limit checked after, so racing charges
+ * never overshoot the limit for long: the one that sees usage over the
+ * limit takes its charge back.
+ */
+static int res_counter_try_charge(struct res_counter *counter,
+				  unsigned long val)
+{
+	unsigned long long usage;
+	long long max, old;
+
+	usage = atomic64_add_return(val, &counter->usage);
+	if (usage > res_counter_limit(counter)) {
+		atomic64_sub(val, &counter->usage);
+		atomic64_inc(&counter->failcnt);
 		return -ENOMEM;
 	}
 
-	counter->usage += val;
-	if (counter->usage > counter->max_usage)
-		counter->max_usage = counter->usage;
+	max = atomic64_read(&counter->max_usage);
+	while (usage > max) {
+		old = atomic64_cmpxchg(&counter->max_usage, max, usage);
+		if (old == max)
+			break;
+		max = old;
+	}
 	return 0;
 }
 
 int res_counter_charge(struct res_counter *counter, unsigned long val,
 			struct res_counter **limit_fail_at)
 {
-	int ret;
-	unsigned long flags;
 	struct res_counter *c, *u;
 
 	*limit_fail_at = NULL;
-	local_irq_save(flags);
 	for (c = counter; c != NULL; c = c->parent) {
-		spin_lock(&c->lock);
-		ret = res_counter_charge_locked(c, val);
-		spin_unlock(&c->lock);
-		if (ret < 0) {
+		if (res_counter_try_charge(c, val) < 0) {
 			*limit_fail_at = c;
 			goto undo;
 		}
 	}
-	ret = 0;
-	goto done;
+	return 0;
 undo:
-	for (u = counter; u != c; u = u->parent) {
-		spin_lock(&u->lock);
-		res_counter_uncharge_locked(u, val);
-		spin_unlock(&u->lock);
-	}
-done:
-	local_irq_restore(flags);
-	return ret;
-}
-
-void res_counter_uncharge_locked(struct res_counter *counter, unsigned long val)
-{
-	if (WARN_ON(counter->usage < val))
-		val = counter->usage;
-
-	counter->usage -= val;
+	for (u = counter; u != c; u = u->parent)
+		res_counter_cancel(u, val);
+	return -ENOMEM;
 }
 
 void res_counter_uncharge(struct res_counter *counter, unsigned long val)
 {
-	unsigned long flags;
 	struct res_counter *c;
 
-	local_irq_save(flags);
-	for (c = counter; c != NULL; c = c->parent) {
-		spin_lock(&c->lock);
-		res_counter_uncharge_locked(c, val);
-		spin_unlock(&c->lock);
-	}
-	local_irq_restore(flags);
+	for (c = counter; c != NULL; c = c->parent)
+		res_counter_cancel(c, val);
 }
 
 
-static inline unsigned long long *
+static inline atomic64_t *
 res_counter_member(struct res_counter *counter, int member)
 {
 	switch (member) {
-	case RES_USAGE:
-		return &counter->usage;
 	case RES_MAX_USAGE:
 		return &counter->max_usage;
 	case RES_LIMIT:
@@ -113,37 +110,25 @@ ssize_t res_counter_read(struct res_counter *counter, int member,
 		const char __user *userbuf, size_t nbytes, loff_t *pos,
 		int (*read_strategy)(unsigned long long val, char *st_buf))
 {
-	unsigned long long *val;
+	unsigned long long val;
 	char buf[64], *s;
 
 	s = buf;
-	val = res_counter_member(counter, member);
+	val = res_counter_read_u64(counter, member);
 	if (read_strategy)
-		s += read_strategy(*val, s);
+		s += read_strategy(val, s);
 	else
-		s += sprintf(s, "%llu\n", *val);
+		s += sprintf(s, "%llu\n", val);
 	return simple_read_from_buffer((void __user *)userbuf, nbytes,
 			pos, buf, s - buf);
 }
 
-#if BITS_PER_LONG == 32
-u64 res_counter_read_u64(struct res_counter *counter, int member)
-{
-	unsigned long flags;
-	u64 ret;
-
-	spin_lock_irqsave(&counter->lock, flags);
-	ret = *res_counter_member(counter, member);
-	spin_unlock_irqrestore(&counter->lock, flags);
-
-	return ret;
-}
-#else
 u64 res_counter_read_u64(struct res_counter *counter, int member)
 {
-	return *res_counter_member(counter, member);
+	if (member == RES_USAGE)
+		return res_counter_usage(counter);
+	return atomic64_read(res_counter_member(counter, member));
 }
-#endif
 
 int res_counter_memparse_write_strategy(const char *buf,
 					unsigned long long *res)
@@ -173,7 +158,11 @@ int res_counter_write(struct res_counter *counter, int member,
 {
 	char *end;
 	unsigned long flags;
-	unsigned long long tmp, *val;
+	unsigned long long tmp;
+
+	/* usage only changes by charges */
+	if (member == RES_USAGE)
+		return -EINVAL;
 
 	if (write_strategy) {
 		if (write_strategy(buf, &tmp))
@@ -184,8 +173,7 @@ int res_counter_write(struct res_counter *counter, int member,
 			return -EINVAL;
 	}
 	spin_lock_irqsave(&counter->lock, flags);
-	val = res_counter_member(counter, member);
-	*val = tmp;
+	atomic64_set(res_counter_member(counter, member), tmp);
 	spin_unlock_irqrestore(&counter->lock, flags);
 	return 0;
 }
@@ -0,0 +1,171 @@
+/*
+ * rwsem benchmark
+ *
+ * Reader and writer threads hammer a single rwsem for a fixed time,
+ * each holding it for a short critical section and then doing some
+ * work outside of it.  The benchmark reports the read and write
+ * acquisitions per second and the number of context switches the
+ * threads went through, which is what spinning on the lock saves.
+ * The module runs once at load time and is not kept loaded.
+ */
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/jiffies.h>
+#include <linux/rwsem.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+
+static unsigned int nr_readers;
+module_param(nr_readers, uint, 0444);
+MODULE_PARM_DESC(nr_readers, "# of reader threads (default: # of online cpus)");
+
+static unsigned int nr_writers = 1;
+module_param(nr_writers, uint, 0444);
+MODULE_PARM_DESC(nr_writers, "# of writer threads");
+
+static unsigned int duration = 5;
+module_param(duration, uint, 0444);
+MODULE_PARM_DESC(duration, "# of seconds to run");
+
+static unsigned int read_loops = 100;
+module_param(read_loops, uint, 0444);
+MODULE_PARM_DESC(read_loops, "# of loops readers spend in the critical section");
+
+static unsigned int write_loops = 100;
+module_param(write_loops, uint, 0444);
+MODULE_PARM_DESC(write_loops, "# of loops writers spend in the critical section");
+
+static unsigned int idle_loops = 1000;
+module_param(idle_loops, uint, 0444);
+MODULE_PARM_DESC(idle_loops, "# of loops spent outside the critical section");
+
+struct bench_thread {
+	struct task_struct	*task;
+	bool			writer;
+	unsigned long		ops;
+	unsigned long		nvcsw;
+	unsigned long		nivcsw;
+};
+
+static DECLARE_RWSEM(bench_sem);
+static unsigned long bench_data[L1_CACHE_BYTES / sizeof(unsigned long)];
+static unsigned long bench_sink;
+
+static atomic_t nr_threads_running;
+static struct completion threads_done;
+static bool bench_stop;
+
+static void bench_spin(unsigned int loops)
+{
+	while (loops--)
+		cpu_relax();
+}
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_thread *t = data;
+	unsigned long nvcsw = current->nvcsw, nivcsw = current->nivcsw;
+	unsigned long sum = 0;
+	int i;
+
+	while (!ACCESS_ONCE(bench_stop)) {
+		if (t->writer) {
+			down_write(&bench_sem);
+			for (i = 0; i < ARRAY_SIZE(bench_data); i++)
+				bench_data[i]++;
+			bench_spin(write_loops);
+			up_write(&bench_sem);
+		} else {
+			down_read(&bench_sem);
+			for (i = 0; i < ARRAY_SIZE(bench_data); i++)
+				sum += bench_data[i];
+			bench_spin(read_loops);
+			up_read(&bench_sem);
+		}
+		t->ops++;
+
+		bench_spin(idle_loops);
+		cond_resched();
+	}
+
+	t->nvcsw = current->nvcsw - nvcsw;
+	t->nivcsw = current->nivcsw - nivcsw;
+
+	/* keep the reads */
+	ACCESS_ONCE(bench_sink) = sum;
+
+	if (atomic_dec_and_test(&nr_threads_running))
+		complete(&threads_done);
+	return 0;
+}
+
+static int __init rwsem_benchmark_init(void)
+{
+	struct bench_thread *threads;
+	unsigned long reads = 0, writes = 0, csw = 0;
+	unsigned int i, nr;
+	int ret = 0;
+
+	if (!nr_readers)
+		nr_readers = num_online_cpus();
+	nr = nr_readers + nr_writers;
+	if (!nr || !duration)
+		return -EINVAL;
+
+	threads = kcalloc(nr, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	bench_stop = false;
+	init_completion(&threads_done);
+	atomic_set(&nr_threads_running, nr);
+
+	for (i = 0; i < nr; i++) {
+		threads[i].writer = i >= nr_readers;
+		threads[i].task = kthread_create(bench_thread_fn, &threads[i],
+						 "rwsem_bench/%u", i);
+		if (IS_ERR(threads[i].task)) {
+			ret = PTR_ERR(threads[i].task);
+			break;
+		}
+	}
+
+	if (ret) {
+		/* the threads never ran, kthread_stop() reaps them */
+		while (i--)
+			kthread_stop(threads[i].task);
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++)
+		wake_up_process(threads[i].task);
+
+	schedule_timeout_interruptible(duration * HZ);
+	bench_stop = true;
+	wait_for_completion(&threads_done);
+
+	for (i = 0; i < nr; i++) {
+		if (threads[i].writer)
+			writes += threads[i].ops;
+		else
+			reads += threads[i].ops;
+		csw += threads[i].nvcsw + threads[i].nivcsw;
+	}
+
+	printk(KERN_INFO "rwsem_benchmark: %u readers, %u writers, %u s\n",
+	       nr_readers, nr_writers, duration);
+	printk(KERN_INFO "rwsem_benchmark: %lu reads/s, %lu writes/s, "
+	       "%lu context switches/s\n", reads / duration,
+	       writes / duration, csw / duration);
+	ret = -EAGAIN;
+out:
+	kfree(threads);
+	return ret;
+}
+
+module_init(rwsem_benchmark_init);
+
+MODULE_DESCRIPTION("rwsem benchmark");
+MODULE_LICENSE("GPL");
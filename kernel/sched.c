@@ -4372,6 +4372,51 @@ int mutex_spin_on_owner(struct mutex *lock, struct task_struct *owner)
 }
 #endif
 
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+
+static inline bool rwsem_owner_running(struct rw_semaphore *sem,
+				       struct task_struct *owner)
+{
+	bool ret = false;
+
+	rcu_read_lock();
+	if (sem->owner != owner)
+		goto fail;
+
+	/* see owner_running() */
+	barrier();
+
+	ret = owner->on_cpu;
+fail:
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/*
+ * Spin while the writer @owner holds @sem and is running. Returns 0 if
+ * the spinning should stop, like mutex_spin_on_owner(). "owner" is as
+ * speculative here as it is there.
+ */
+int rwsem_spin_on_owner(struct rw_semaphore *sem, struct task_struct *owner)
+{
+	if (!sched_feat(OWNER_SPIN))
+		return 0;
+
+	while (rwsem_owner_running(sem, owner)) {
+		if (need_resched())
+			return 0;
+
+		arch_mutex_cpu_relax();
+	}
+
+	if (ACCESS_ONCE(sem->owner))
+		return 0;
+
+	return 1;
+}
+#endif
+
 #ifdef CONFIG_PREEMPT
 /*
  * this is the entry point to schedule() from in-kernel preemption
@@ -47,6 +47,7 @@
 #include <linux/user_namespace.h>
 
 #include <linux/kmsg_dump.h>
+#include <linux/futex.h>
 /* Move somewhere else to avoid recompiling? */
 #include <generated/utsrelease.h>
 
@@ -1800,6 +1801,16 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			else
 				error = PR_MCE_KILL_DEFAULT;
 			break;
+		case PR_SET_FUTEX_HASH:
+			if (arg3 | arg4 | arg5)
+				return -EINVAL;
+			error = futex_hash_set(arg2);
+			break;
+		case PR_GET_FUTEX_HASH:
+			if (arg2 | arg3 | arg4 | arg5)
+				return -EINVAL;
+			error = futex_hash_get();
+			break;
 		default:
 			error = -EINVAL;
 			break;
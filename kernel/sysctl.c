@@ -1178,6 +1178,23 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &min_extfrag_threshold,
 		.extra2		= &max_extfrag_threshold,
 	},
+	{
+		.procname	= "kcompactd_cpu_percent",
+		.data		= &sysctl_kcompactd_cpu_percent,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
+	{
+		.procname	= "kcompactd_scan_millisecs",
+		.data		= &sysctl_kcompactd_scan_millisecs,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+	},
 
 #endif /* CONFIG_COMPACTION */
 	{
@@ -1284,6 +1301,15 @@ static struct ctl_table vm_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec_jiffies,
 	},
+	{
+		.procname	= "stat_threshold_shift",
+		.data		= &sysctl_stat_threshold_shift,
+		.maxlen		= sizeof(sysctl_stat_threshold_shift),
+		.mode		= 0644,
+		.proc_handler	= vmstat_threshold_shift_sysctl_handler,
+		.extra1		= &zero,
+		.extra2		= &three,
+	},
 #endif
 #ifdef CONFIG_MMU
 	{
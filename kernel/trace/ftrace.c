@@ -34,6 +34,7 @@
 
 #include <asm/ftrace.h>
 #include <asm/setup.h>
+#include <asm/local.h>
 
 #include "trace_output.h"
 #include "trace_stat.h"
@@ -328,6 +329,14 @@ static void ftrace_update_pid_func(void)
 }
 
 #ifdef CONFIG_FUNCTION_PROFILER
+/*
+ * Call times are counted in log2 buckets: bucket 0 holds calls under
+ * 2^FTRACE_PROFILE_HIST_SHIFT ns (about 1 us), each following bucket
+ * twice the range of the previous one, the last one everything above.
+ */
+#define FTRACE_PROFILE_HIST_SIZE	16
+#define FTRACE_PROFILE_HIST_SHIFT	10
+
 struct ftrace_profile {
 	struct hlist_node		node;
 	unsigned long			ip;
@@ -335,6 +344,7 @@ struct ftrace_profile {
 #ifdef CONFIG_FUNCTION_GRAPH_TRACER
 	unsigned long long		time;
 	unsigned long long		time_squared;
+	unsigned int			hist[FTRACE_PROFILE_HIST_SIZE];
 #endif
 };
 
@@ -344,12 +354,20 @@ struct ftrace_profile_page {
 	struct ftrace_profile		records[];
 };
 
+/*
+ * The records of a cpu are only written by that cpu. Instead of
+ * disabling interrupts, an update that interrupts another update on
+ * the same cpu is dropped, see ftrace_profile_get_cpu().
+ */
 struct ftrace_profile_stat {
-	atomic_t			disabled;
+	local_t				busy;
 	struct hlist_head		*hash;
 	struct ftrace_profile_page	*pages;
 	struct ftrace_profile_page	*start;
 	struct tracer_stat		stat;
+#ifdef CONFIG_FUNCTION_GRAPH_TRACER
+	struct tracer_stat		hist_stat;
+#endif
 };
 
 #define PROFILE_RECORDS_SIZE						\
@@ -403,6 +421,19 @@ static void *function_stat_start(struct tracer_stat *trace)
 	return function_stat_next(&stat->start->records[0], 0);
 }
 
+#ifdef CONFIG_FUNCTION_GRAPH_TRACER
+static void *function_hist_start(struct tracer_stat *trace)
+{
+	struct ftrace_profile_stat *stat =
+		container_of(trace, struct ftrace_profile_stat, hist_stat);
+
+	if (!stat->start)
+		return NULL;
+
+	return function_stat_next(&stat->start->records[0], 0);
+}
+#endif
+
 #ifdef CONFIG_FUNCTION_GRAPH_TRACER
 /* function graph compares on total time */
 static int function_stat_cmp(void *p1, void *p2)
@@ -500,6 +531,56 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_FUNCTION_GRAPH_TRACER
+static int function_hist_headers(struct seq_file *m)
+{
+	int i;
+
+	seq_printf(m, "  Function                       ");
+	seq_printf(m, "  %8s", "<1us");
+	for (i = 1; i < FTRACE_PROFILE_HIST_SIZE - 1; i++) {
+		unsigned long us = 1UL << (i - 1);
+
+		if (us < 1024)
+			seq_printf(m, "  %6luus", us);
+		else
+			seq_printf(m, "  %6lums", us >> 10);
+	}
+	seq_printf(m, "  %5lums+\n", 1UL << (FTRACE_PROFILE_HIST_SIZE - 12));
+	seq_printf(m, "  --------                       ");
+	for (i = 0; i < FTRACE_PROFILE_HIST_SIZE; i++)
+		seq_printf(m, "  %8s", "---");
+	seq_putc(m, '\n');
+	return 0;
+}
+
+static int function_hist_show(struct seq_file *m, void *v)
+{
+	struct ftrace_profile *rec = v;
+	char str[KSYM_SYMBOL_LEN];
+	int ret = 0;
+	int i;
+
+	mutex_lock(&ftrace_profile_lock);
+
+	/* we raced with function_profile_reset() */
+	if (unlikely(rec->counter == 0)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	kallsyms_lookup(rec->ip, NULL, NULL, NULL, str);
+	seq_printf(m, "  %-30.30s ", str);
+	for (i = 0; i < FTRACE_PROFILE_HIST_SIZE; i++)
+		seq_printf(m, "  %8u", rec->hist[i]);
+	seq_putc(m, '\n');
+out:
+	mutex_unlock(&ftrace_profile_lock);
+
+	return ret;
+}
+#endif
+
 static void ftrace_profile_reset(struct ftrace_profile_stat *stat)
 {
 	struct ftrace_profile_page *pg;
@@ -666,23 +747,11 @@ static void ftrace_add_profile(struct ftrace_profile_stat *stat,
 static struct ftrace_profile *
 ftrace_profile_alloc(struct ftrace_profile_stat *stat, unsigned long ip)
 {
-	struct ftrace_profile *rec = NULL;
-
-	/* prevent recursion (from NMIs) */
-	if (atomic_inc_return(&stat->disabled) != 1)
-		goto out;
-
-	/*
-	 * Try to find the function again since an NMI
-	 * could have added it
-	 */
-	rec = ftrace_find_profiled_func(stat, ip);
-	if (rec)
-		goto out;
+	struct ftrace_profile *rec;
 
 	if (stat->pages->index == PROFILES_PER_PAGE) {
 		if (!stat->pages->next)
-			goto out;
+			return NULL;
 		stat->pages = stat->pages->next;
 	}
 
@@ -690,38 +759,57 @@ ftrace_profile_alloc(struct ftrace_profile_stat *stat, unsigned long ip)
 	rec->ip = ip;
 	ftrace_add_profile(stat, rec);
 
- out:
-	atomic_dec(&stat->disabled);
-
 	return rec;
 }
 
+/*
+ * Returns this cpu's profile with preemption disabled, or NULL if
+ * profiling is off or an interrupt or NMI came in while this cpu was
+ * updating its profile. The records are then left alone, and the
+ * call is not counted. Release with ftrace_profile_put_cpu().
+ */
+static struct ftrace_profile_stat *ftrace_profile_get_cpu(void)
+{
+	struct ftrace_profile_stat *stat;
+
+	preempt_disable_notrace();
+	stat = &__get_cpu_var(ftrace_profile_stats);
+	if (local_inc_return(&stat->busy) != 1 ||
+	    !stat->hash || !ftrace_profile_enabled) {
+		local_dec(&stat->busy);
+		preempt_enable_notrace();
+		return NULL;
+	}
+
+	return stat;
+}
+
+static void ftrace_profile_put_cpu(struct ftrace_profile_stat *stat)
+{
+	local_dec(&stat->busy);
+	preempt_enable_notrace();
+}
+
 static void
 function_profile_call(unsigned long ip, unsigned long parent_ip)
 {
 	struct ftrace_profile_stat *stat;
 	struct ftrace_profile *rec;
-	unsigned long flags;
 
 	if (!ftrace_profile_enabled)
 		return;
 
-	local_irq_save(flags);
-
-	stat = &__get_cpu_var(ftrace_profile_stats);
-	if (!stat->hash || !ftrace_profile_enabled)
-		goto out;
+	stat = ftrace_profile_get_cpu();
+	if (!stat)
+		return;
 
 	rec = ftrace_find_profiled_func(stat, ip);
-	if (!rec) {
+	if (!rec)
 		rec = ftrace_profile_alloc(stat, ip);
-		if (!rec)
-			goto out;
-	}
+	if (rec)
+		rec->counter++;
 
-	rec->counter++;
- out:
-	local_irq_restore(flags);
+	ftrace_profile_put_cpu(stat);
 }
 
 #ifdef CONFIG_FUNCTION_GRAPH_TRACER
@@ -736,16 +824,15 @@ static void profile_graph_return(struct ftrace_graph_ret *trace)
 	struct ftrace_profile_stat *stat;
 	unsigned long long calltime;
 	struct ftrace_profile *rec;
-	unsigned long flags;
-
-	local_irq_save(flags);
-	stat = &__get_cpu_var(ftrace_profile_stats);
-	if (!stat->hash || !ftrace_profile_enabled)
-		goto out;
+	int bucket;
 
 	/* If the calltime was zero'd ignore it */
 	if (!trace->calltime)
-		goto out;
+		return;
+
+	stat = ftrace_profile_get_cpu();
+	if (!stat)
+		return;
 
 	calltime = trace->rettime - trace->calltime;
 
@@ -768,10 +855,14 @@ static void profile_graph_return(struct ftrace_graph_ret *trace)
 	if (rec) {
 		rec->time += calltime;
 		rec->time_squared += calltime * calltime;
+
+		bucket = fls64(calltime >> FTRACE_PROFILE_HIST_SHIFT);
+		if (bucket >= FTRACE_PROFILE_HIST_SIZE)
+			bucket = FTRACE_PROFILE_HIST_SIZE - 1;
+		rec->hist[bucket]++;
 	}
 
- out:
-	local_irq_restore(flags);
+	ftrace_profile_put_cpu(stat);
 }
 
 static int register_ftrace_profiler(void)
@@ -883,6 +974,42 @@ static struct tracer_stat function_stats __initdata = {
 	.stat_show	= function_stat_show
 };
 
+#ifdef CONFIG_FUNCTION_GRAPH_TRACER
+static struct tracer_stat function_hist_stats __initdata = {
+	.name		= "function_hist",
+	.stat_start	= function_hist_start,
+	.stat_next	= function_stat_next,
+	.stat_cmp	= function_stat_cmp,
+	.stat_headers	= function_hist_headers,
+	.stat_show	= function_hist_show
+};
+
+static __init int ftrace_profile_hist_debugfs(struct ftrace_profile_stat *stat,
+					      int cpu)
+{
+	char *name;
+	int ret;
+
+	name = kmalloc(32, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+
+	stat->hist_stat = function_hist_stats;
+	snprintf(name, 32, "function_hist%d", cpu);
+	stat->hist_stat.name = name;
+	ret = register_stat_tracer(&stat->hist_stat);
+	if (ret)
+		kfree(name);
+	return ret;
+}
+#else
+static inline int ftrace_profile_hist_debugfs(struct ftrace_profile_stat *stat,
+					      int cpu)
+{
+	return 0;
+}
+#endif
+
 static __init void ftrace_profile_debugfs(struct dentry *d_tracer)
 {
 	struct ftrace_profile_stat *stat;
@@ -917,6 +1044,12 @@ static __init void ftrace_profile_debugfs(struct dentry *d_tracer)
 			kfree(name);
 			return;
 		}
+		if (ftrace_profile_hist_debugfs(stat, cpu)) {
+			WARN(1,
+			     "Could not register function histogram for cpu %d\n",
+			     cpu);
+			return;
+		}
 	}
 
 	entry = debugfs_create_file("function_profile_enabled", 0644,
@@ -20,6 +20,7 @@
 #include <linux/cpu.h>
 #include <linux/fs.h>
 
+#include <asm/cacheflush.h>
 #include <asm/local.h>
 #include "trace.h"
 
@@ -380,6 +381,7 @@ struct buffer_page {
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
+	unsigned	 id;		/* sub-buffer id when mapped */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -496,6 +498,10 @@ struct ring_buffer_per_cpu {
 	unsigned long			read;
 	u64				write_stamp;
 	u64				read_stamp;
+	/* user space mappings, see ring_buffer_map() */
+	int				mapped;
+	struct trace_buffer_meta	*meta_page;
+	unsigned long			*subbuf_ids;
 };
 
 struct ring_buffer {
@@ -1100,6 +1106,9 @@ static void rb_free_cpu_buffer(struct ring_buffer_per_cpu *cpu_buffer)
 	struct list_head *head = cpu_buffer->pages;
 	struct buffer_page *bpage, *tmp;
 
+	free_page((unsigned long)cpu_buffer->meta_page);
+	kfree(cpu_buffer->subbuf_ids);
+
 	free_buffer_page(cpu_buffer->reader_page);
 
 	rb_head_page_deactivate(cpu_buffer);
@@ -1343,6 +1352,16 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size)
 	mutex_lock(&buffer->mutex);
 	get_online_cpus();
 
+	/* sub-buffers of mapped buffers can't come and go */
+	for_each_buffer_cpu(buffer, cpu) {
+		if (buffer->buffers[cpu]->mapped) {
+			put_online_cpus();
+			mutex_unlock(&buffer->mutex);
+			atomic_dec(&buffer->record_disabled);
+			return -EBUSY;
+		}
+	}
+
 	nr_pages = DIV_ROUND_UP(size, BUF_PAGE_SIZE);
 
 	if (size < buffer_size) {
@@ -3683,6 +3702,12 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (atomic_read(&cpu_buffer_b->record_disabled))
 		goto out;
 
+	ret = -EBUSY;
+
+	/* user space holds on to the pages of mapped buffers */
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped)
+		goto out;
+
 	/*
 	 * We can't do a synchronize_sched here because this
 	 * function can be called in atomic context.
@@ -3843,12 +3868,14 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 	/*
 	 * If this page has been partially read or
 	 * if len is not big enough to read the rest of the page or
-	 * a writer is still on the page, then
+	 * a writer is still on the page or
+	 * the buffer is mapped to user space, then
 	 * we must copy the data from the page to the buffer.
 	 * Otherwise, we can simply swap the page with the one passed in.
 	 */
 	if (read || (len < (commit - read)) ||
-	    cpu_buffer->reader_page == cpu_buffer->commit_page) {
+	    cpu_buffer->reader_page == cpu_buffer->commit_page ||
+	    cpu_buffer->mapped) {
 		struct buffer_data_page *rpage = cpu_buffer->reader_page->page;
 		unsigned int rpos = read;
 		unsigned int pos = 0;
@@ -3956,6 +3983,266 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/*
+ * Mapping per cpu buffers to user space.
+ *
+ * The first page of a mapping is a meta page (struct trace_buffer_meta),
+ * followed by all the sub-buffers (the data pages) of the cpu buffer in
+ * the order of their ids.  The sub-buffers stay the same for as long as
+ * the buffer is mapped: resizing, swapping and page swapping reads are
+ * refused or fall back to copying.
+ *
+ * The consumer calls ring_buffer_map_get_reader() to get the current
+ * reader sub-buffer.  The meta page then tells which sub-buffer that is
+ * and the range of committed data in it, which is consumed right away.
+ * The consumer reads the events in place and must be done with the
+ * sub-buffer before asking for the next one.
+ */
+
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+}
+
+static void rb_setup_ids_meta_page(struct ring_buffer_per_cpu *cpu_buffer,
+				   unsigned long *subbuf_ids)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+	struct list_head *head = cpu_buffer->pages;
+	struct list_head *p = head;
+	struct buffer_page *bpage;
+	unsigned id = 0;
+
+	/* the reader page is always id 0 */
+	bpage = cpu_buffer->reader_page;
+	bpage->id = id;
+	subbuf_ids[id++] = (unsigned long)bpage->page;
+
+	do {
+		bpage = list_entry(p, struct buffer_page, list);
+		bpage->id = id;
+		subbuf_ids[id++] = (unsigned long)bpage->page;
+		p = rb_list_head(p->next);
+	} while (p != head);
+
+	cpu_buffer->subbuf_ids = subbuf_ids;
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = id;
+	meta->reader.id = cpu_buffer->reader_page->id;
+	meta->reader.read = cpu_buffer->reader_page->read;
+	meta->reader.commit = cpu_buffer->reader_page->read;
+	rb_update_meta_page(cpu_buffer);
+}
+
+/**
+ * ring_buffer_map - prepare a cpu buffer to be mapped to user space
+ * @buffer: the buffer
+ * @cpu: the cpu buffer to map
+ *
+ * Nested calls only take a reference.  Every successful call must be
+ * paired with ring_buffer_unmap().
+ *
+ * Returns 0 on success, negative error otherwise.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	unsigned long *subbuf_ids;
+	unsigned long flags;
+	void *meta;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (cpu_buffer->mapped) {
+		cpu_buffer->mapped++;
+		goto out;
+	}
+
+	meta = (void *)get_zeroed_page(GFP_KERNEL);
+	/* the reader page is not part of buffer->pages */
+	subbuf_ids = kcalloc(buffer->pages + 1, sizeof(*subbuf_ids),
+			     GFP_KERNEL);
+	if (!meta || !subbuf_ids) {
+		free_page((unsigned long)meta);
+		kfree(subbuf_ids);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->meta_page = meta;
+	rb_setup_ids_meta_page(cpu_buffer, subbuf_ids);
+	cpu_buffer->mapped = 1;
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+ out:
+	mutex_unlock(&buffer->mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - drop a user space mapping of a cpu buffer
+ * @buffer: the buffer
+ * @cpu: the cpu buffer to unmap
+ *
+ * Returns 0 on success, -ENODEV if @cpu was not mapped.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	unsigned long flags;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (!cpu_buffer->mapped) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	if (--cpu_buffer->mapped)
+		goto out;
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	free_page((unsigned long)cpu_buffer->meta_page);
+	cpu_buffer->meta_page = NULL;
+	kfree(cpu_buffer->subbuf_ids);
+	cpu_buffer->subbuf_ids = NULL;
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+ out:
+	mutex_unlock(&buffer->mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_page - page at a page offset of a cpu buffer mapping
+ * @buffer: the buffer
+ * @cpu: the mapped cpu buffer
+ * @pgoff: page offset into the mapping
+ *
+ * Page offset 0 is the meta page, offset n is the sub-buffer of id n - 1.
+ * The caller must hold a mapping of @cpu.
+ *
+ * Returns the page or NULL if @pgoff is out of range.
+ */
+struct page *ring_buffer_map_page(struct ring_buffer *buffer, int cpu,
+				  unsigned long pgoff)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return NULL;
+
+	cpu_buffer = buffer->buffers[cpu];
+	if (WARN_ON_ONCE(!cpu_buffer->mapped))
+		return NULL;
+
+	if (!pgoff)
+		return virt_to_page(cpu_buffer->meta_page);
+	if (pgoff > cpu_buffer->meta_page->nr_subbufs)
+		return NULL;
+	return virt_to_page((void *)cpu_buffer->subbuf_ids[pgoff - 1]);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_page);
+
+/**
+ * ring_buffer_map_get_reader - hand the next events to a mapped consumer
+ * @buffer: the buffer
+ * @cpu: the mapped cpu buffer
+ *
+ * Consume the committed data of the current reader page, or of the
+ * next page if the reader page has been consumed already, and describe
+ * it in the meta page: reader.id is the sub-buffer and the data is
+ * between reader.read and reader.commit.  The previous sub-buffer handed
+ * out may be reused by the writer once this is called.
+ *
+ * Returns the number of events handed out, 0 if there are none and a
+ * negative error if @cpu is not mapped.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	struct buffer_page *reader;
+	unsigned long flags;
+	unsigned long read;
+	unsigned commit;
+	int ret = -ENODEV;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped)
+		goto out;
+
+	meta = cpu_buffer->meta_page;
+	ret = 0;
+
+	reader = rb_get_reader_page(cpu_buffer);
+	if (!reader) {
+		/* caught up with the writer, hand out an empty range */
+		reader = cpu_buffer->reader_page;
+		meta->reader.id = reader->id;
+		meta->reader.read = reader->read;
+		meta->reader.commit = reader->read;
+		goto out_update;
+	}
+
+	meta->reader.id = reader->id;
+	meta->reader.read = reader->read;
+	meta->reader.lost_events = cpu_buffer->lost_events;
+	cpu_buffer->lost_events = 0;
+
+	read = cpu_buffer->read;
+	commit = rb_page_size(reader);
+
+	if (!reader->read && reader != cpu_buffer->commit_page) {
+		/* the writer is done with the page, consume it as a whole */
+		cpu_buffer->read += rb_page_entries(reader);
+		reader->read = commit;
+	} else {
+		while (reader->read < commit)
+			rb_advance_reader(cpu_buffer);
+	}
+
+	meta->reader.commit = commit;
+	ret = cpu_buffer->read - read;
+
+	/* some archs need the page flushed before user space reads it */
+	flush_dcache_page(virt_to_page(reader->page));
+
+ out_update:
+	rb_update_meta_page(cpu_buffer);
+ out:
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
+
 #ifdef CONFIG_TRACING
 static ssize_t
 rb_simple_read(struct file *filp, char __user *ubuf,
@@ -8,8 +8,11 @@
 #include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/time.h>
+#include <asm/sections.h>
 #include <asm/local.h>
 
+#include "trace.h"
+
 struct rb_page {
 	u64		ts;
 	local_t		commit;
@@ -58,7 +61,38 @@ MODULE_PARM_DESC(producer_fifo, "fifo prio for producer");
 module_param(consumer_fifo, uint, 0644);
 MODULE_PARM_DESC(consumer_fifo, "fifo prio for consumer");
 
-static int read_events;
+enum read_mode {
+	READ_EVENTS,
+	READ_PAGES,
+	READ_MAPPED,
+	NR_READ_MODES,
+};
+
+static const char *read_mode_names[NR_READ_MODES] = {
+	[READ_EVENTS]	= "events",
+	[READ_PAGES]	= "pages",
+	[READ_MAPPED]	= "mapped pages",
+};
+
+static int read_mode = NR_READ_MODES - 1;
+
+enum event_format {
+	EVENT_RAW,
+	EVENT_FUNCTION,
+	EVENT_COMPACT,
+	NR_EVENT_FORMATS,
+};
+
+static const char *event_format_names[NR_EVENT_FORMATS] = {
+	[EVENT_RAW]		= "raw",
+	[EVENT_FUNCTION]	= "function",
+	[EVENT_COMPACT]		= "function_compact",
+};
+
+static unsigned int event_format;
+module_param(event_format, uint, 0444);
+MODULE_PARM_DESC(event_format, "0: 10 byte events, 1: function records, "
+		 "2: compact function records");
 
 static int kill_test;
 
@@ -95,76 +129,82 @@ static enum event_status read_event(int cpu)
 	return EVENT_FOUND;
 }
 
-static enum event_status read_page(int cpu)
+static void read_page_events(int cpu, struct rb_page *rpage,
+			     unsigned long start, unsigned long commit)
 {
 	struct ring_buffer_event *event;
-	struct rb_page *rpage;
-	unsigned long commit;
-	void *bpage;
 	int *entry;
-	int ret;
 	int inc;
 	int i;
 
-	bpage = ring_buffer_alloc_read_page(buffer);
-	if (!bpage)
-		return EVENT_DROPPED;
+	for (i = start; i < commit && !kill_test; i += inc) {
 
-	ret = ring_buffer_read_page(buffer, &bpage, PAGE_SIZE, cpu, 1);
-	if (ret >= 0) {
-		rpage = bpage;
-		/* The commit may have missed event flags set, clear them */
-		commit = local_read(&rpage->commit) & 0xfffff;
-		for (i = 0; i < commit && !kill_test; i += inc) {
+		if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
+			KILL_TEST();
+			break;
+		}
 
-			if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
+		inc = -1;
+		event = (void *)&rpage->data[i];
+		switch (event->type_len) {
+		case RINGBUF_TYPE_PADDING:
+			/* failed writes may be discarded events */
+			if (!event->time_delta)
+				KILL_TEST();
+			inc = event->array[0] + 4;
+			break;
+		case RINGBUF_TYPE_TIME_EXTEND:
+			inc = 8;
+			break;
+		case 0:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
 				KILL_TEST();
 				break;
 			}
-
-			inc = -1;
-			event = (void *)&rpage->data[i];
-			switch (event->type_len) {
-			case RINGBUF_TYPE_PADDING:
-				/* failed writes may be discarded events */
-				if (!event->time_delta)
-					KILL_TEST();
-				inc = event->array[0] + 4;
-				break;
-			case RINGBUF_TYPE_TIME_EXTEND:
-				inc = 8;
-				break;
-			case 0:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					KILL_TEST();
-					break;
-				}
-				read++;
-				if (!event->array[0]) {
-					KILL_TEST();
-					break;
-				}
-				inc = event->array[0] + 4;
+			read++;
+			if (!event->array[0]) {
+				KILL_TEST();
 				break;
-			default:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					KILL_TEST();
-					break;
-				}
-				read++;
-				inc = ((event->type_len + 1) * 4);
 			}
-			if (kill_test)
-				break;
-
-			if (inc <= 0) {
+			inc = event->array[0] + 4;
+			break;
+		default:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
 				KILL_TEST();
 				break;
 			}
+			read++;
+			inc = ((event->type_len + 1) * 4);
+		}
+		if (kill_test)
+			break;
+
+		if (inc <= 0) {
+			KILL_TEST();
+			break;
 		}
 	}
+}
+
+static enum event_status read_page(int cpu)
+{
+	unsigned long commit;
+	void *bpage;
+	int ret;
+
+	bpage = ring_buffer_alloc_read_page(buffer);
+	if (!bpage)
+		return EVENT_DROPPED;
+
+	ret = ring_buffer_read_page(buffer, &bpage, PAGE_SIZE, cpu, 1);
+	if (ret >= 0) {
+		/* The commit may have missed event flags set, clear them */
+		commit = local_read(&((struct rb_page *)bpage)->commit) &
+			0xfffff;
+		read_page_events(cpu, bpage, 0, commit);
+	}
 	ring_buffer_free_read_page(buffer, bpage);
 
 	if (ret < 0)
@@ -172,10 +212,55 @@ static enum event_status read_page(int cpu)
 	return EVENT_FOUND;
 }
 
+/*
+ * Read the events in place from the sub-buffer handed out to the
+ * mapped consumer, the same way user space reads a mapped buffer.
+ */
+static enum event_status read_mapped(int cpu)
+{
+	struct trace_buffer_meta *meta;
+	struct page *page;
+	int ret;
+
+	ret = ring_buffer_map_get_reader(buffer, cpu);
+	if (ret <= 0)
+		return EVENT_DROPPED;
+
+	meta = page_address(ring_buffer_map_page(buffer, cpu, 0));
+	page = ring_buffer_map_page(buffer, cpu, meta->reader.id + 1);
+	if (!page) {
+		KILL_TEST();
+		return EVENT_DROPPED;
+	}
+
+	read_page_events(cpu, page_address(page), meta->reader.read,
+			 meta->reader.commit);
+	return EVENT_FOUND;
+}
+
+static void map_buffers(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		if (ring_buffer_map(buffer, cpu))
+			KILL_TEST();
+}
+
+static void unmap_buffers(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		ring_buffer_unmap(buffer, cpu);
+}
+
 static void ring_buffer_consumer(void)
 {
-	/* toggle between reading pages and events */
-	read_events ^= 1;
+	/* cycle between reading events, pages and mapped pages */
+	read_mode = (read_mode + 1) % NR_READ_MODES;
+	if (read_mode == READ_MAPPED)
+		map_buffers();
 
 	read = 0;
 	while (!reader_finish && !kill_test) {
@@ -188,10 +273,16 @@ static void ring_buffer_consumer(void)
 			for_each_online_cpu(cpu) {
 				enum event_status stat;
 
-				if (read_events)
+				switch (read_mode) {
+				case READ_EVENTS:
 					stat = read_event(cpu);
-				else
+					break;
+				case READ_PAGES:
 					stat = read_page(cpu);
+					break;
+				default:
+					stat = read_mapped(cpu);
+				}
 
 				if (kill_test)
 					break;
@@ -207,10 +298,64 @@ static void ring_buffer_consumer(void)
 		schedule();
 		__set_current_state(TASK_RUNNING);
 	}
+	__set_current_state(TASK_RUNNING);
+	if (read_mode == READ_MAPPED)
+		unmap_buffers();
 	reader_finish = 0;
 	complete(&read_done);
 }
 
+/*
+ * Write one event shaped like the records of @event_format. The first
+ * int of the data is overwritten with the cpu, for the reader to check.
+ * Returns the bytes used in the buffer, or 0 if the write failed.
+ */
+static int ring_buffer_write_event(void)
+{
+	unsigned char buf[TRACE_COMPACT_MAX], *p = buf;
+	struct ring_buffer_event *event;
+	struct compact_entry *centry;
+	struct ftrace_entry *fentry;
+	unsigned long ip = _THIS_IP_;
+	unsigned long parent_ip = _RET_IP_;
+	int len;
+
+	switch (event_format) {
+	case EVENT_FUNCTION:
+		event = ring_buffer_lock_reserve(buffer, sizeof(*fentry));
+		if (!event)
+			return 0;
+		fentry = ring_buffer_event_data(event);
+		fentry->ent.pid = current->pid;
+		fentry->ip = ip;
+		fentry->parent_ip = parent_ip;
+		break;
+	case EVENT_COMPACT:
+		p = trace_compact_put(p, current->pid);
+		p = trace_compact_put_signed(p, ip - (unsigned long)_stext);
+		p = trace_compact_put_signed(p, parent_ip - ip);
+		event = ring_buffer_lock_reserve(buffer,
+						 sizeof(*centry) + (p - buf));
+		if (!event)
+			return 0;
+		centry = ring_buffer_event_data(event);
+		centry->len = p - buf;
+		memcpy(centry->buf, buf, p - buf);
+		break;
+	default:
+		event = ring_buffer_lock_reserve(buffer, 10);
+		if (!event)
+			return 0;
+	}
+
+	*(int *)ring_buffer_event_data(event) = smp_processor_id();
+	/* data plus the 4 byte event header */
+	len = ring_buffer_event_length(event) + 4;
+	ring_buffer_unlock_commit(buffer, event);
+
+	return len;
+}
+
 static void ring_buffer_producer(void)
 {
 	struct timeval start_tv;
@@ -218,6 +363,7 @@ static void ring_buffer_producer(void)
 	unsigned long long time;
 	unsigned long long entries;
 	unsigned long long overruns;
+	unsigned long long bytes = 0;
 	unsigned long missed = 0;
 	unsigned long hit = 0;
 	unsigned long avg;
@@ -230,19 +376,16 @@ static void ring_buffer_producer(void)
 	trace_printk("Starting ring buffer hammer\n");
 	do_gettimeofday(&start_tv);
 	do {
-		struct ring_buffer_event *event;
-		int *entry;
+		int len;
 		int i;
 
 		for (i = 0; i < write_iteration; i++) {
-			event = ring_buffer_lock_reserve(buffer, 10);
-			if (!event) {
+			len = ring_buffer_write_event();
+			if (!len) {
 				missed++;
 			} else {
 				hit++;
-				entry = ring_buffer_event_data(event);
-				*entry = smp_processor_id();
-				ring_buffer_unlock_commit(buffer, event);
+				bytes += len;
 			}
 		}
 		do_gettimeofday(&end_tv);
@@ -317,11 +460,17 @@ static void ring_buffer_producer(void)
 		trace_printk("Read:     (reader disabled)\n");
 	else
 		trace_printk("Read:     %ld  (by %s)\n", read,
-			read_events ? "events" : "pages");
+			read_mode_names[read_mode]);
 	trace_printk("Entries:  %lld\n", entries);
 	trace_printk("Total:    %lld\n", entries + overruns + read);
 	trace_printk("Missed:   %ld\n", missed);
 	trace_printk("Hit:      %ld\n", hit);
+	trace_printk("Format:   %s\n", event_format_names[event_format]);
+	if (bytes) {
+		trace_printk("Bytes per entry: %lld\n", div64_u64(bytes, hit));
+		trace_printk("Entries per MB:  %lld\n",
+			     div64_u64((u64)hit << 20, bytes));
+	}
 
 	/* Convert time from usecs to millisecs */
 	do_div(time, USEC_PER_MSEC);
@@ -420,6 +569,9 @@ static int __init ring_buffer_benchmark_init(void)
 {
 	int ret;
 
+	if (event_format >= NR_EVENT_FORMATS)
+		return -EINVAL;
+
 	/* make a one meg buffer in overwite mode */
 	buffer = ring_buffer_alloc(1000000, RB_FL_OVERWRITE);
 	if (!buffer)
@@ -38,6 +38,8 @@
 #include <linux/poll.h>
 #include <linux/fs.h>
 
+#include <asm/sections.h>
+
 #include "trace.h"
 #include "trace_output.h"
 
@@ -424,6 +426,7 @@ static const char *trace_options[] = {
 	"graph-time",
 	"record-cmd",
 	"overwrite",
+	"compact",
 	NULL
 };
 
@@ -602,6 +605,23 @@ static ssize_t trace_seq_to_buffer(struct trace_seq *s, void *buf, size_t cnt)
 static arch_spinlock_t ftrace_max_lock =
 	(arch_spinlock_t)__ARCH_SPIN_LOCK_UNLOCKED;
 
+/*
+ * Number of user space mappings of trace buffers, see
+ * tracing_buffers_mmap().  update_max_tr() does not swap the buffers
+ * while there are any, or a mapped buffer would become the max
+ * buffer under its consumer.  Protected by ftrace_max_lock.
+ */
+static int trace_buffers_mapped;
+
+static void trace_buffers_mapped_add(int nr)
+{
+	local_irq_disable();
+	arch_spin_lock(&ftrace_max_lock);
+	trace_buffers_mapped += nr;
+	arch_spin_unlock(&ftrace_max_lock);
+	local_irq_enable();
+}
+
 unsigned long __read_mostly	tracing_thresh;
 
 #ifdef CONFIG_TRACER_MAX_TRACE
@@ -661,8 +681,14 @@ update_max_tr(struct trace_array *tr, struct task_struct *tsk, int cpu)
 	}
 	arch_spin_lock(&ftrace_max_lock);
 
-	tr->buffer = max_tr.buffer;
-	max_tr.buffer = buf;
+	if (trace_buffers_mapped) {
+		/* record the latency, but keep the snapshot we have */
+		trace_array_printk(&max_tr, _THIS_IP_,
+			"Failed to swap buffers, the trace buffer is mapped\n");
+	} else {
+		tr->buffer = max_tr.buffer;
+		max_tr.buffer = buf;
+	}
 
 	__update_max_tr(tr, tsk, cpu);
 	arch_spin_unlock(&ftrace_max_lock);
@@ -1102,16 +1128,9 @@ void tracing_record_cmdline(struct task_struct *tsk)
 	trace_save_cmdline(tsk);
 }
 
-void
-tracing_generic_entry_update(struct trace_entry *entry, unsigned long flags,
-			     int pc)
+static inline unsigned char trace_entry_flags(unsigned long flags, int pc)
 {
-	struct task_struct *tsk = current;
-
-	entry->preempt_count		= pc & 0xff;
-	entry->pid			= (tsk) ? tsk->pid : 0;
-	entry->padding			= 0;
-	entry->flags =
+	return
 #ifdef CONFIG_TRACE_IRQFLAGS_SUPPORT
 		(irqs_disabled_flags(flags) ? TRACE_FLAG_IRQS_OFF : 0) |
 #else
@@ -1121,6 +1140,18 @@ tracing_generic_entry_update(struct trace_entry *entry, unsigned long flags,
 		((pc & SOFTIRQ_MASK) ? TRACE_FLAG_SOFTIRQ : 0) |
 		(need_resched() ? TRACE_FLAG_NEED_RESCHED : 0);
 }
+
+void
+tracing_generic_entry_update(struct trace_entry *entry, unsigned long flags,
+			     int pc)
+{
+	struct task_struct *tsk = current;
+
+	entry->preempt_count		= pc & 0xff;
+	entry->pid			= (tsk) ? tsk->pid : 0;
+	entry->padding			= 0;
+	entry->flags			= trace_entry_flags(flags, pc);
+}
 EXPORT_SYMBOL_GPL(tracing_generic_entry_update);
 
 struct ring_buffer_event *
@@ -1142,6 +1173,39 @@ trace_buffer_lock_reserve(struct ring_buffer *buffer,
 	return event;
 }
 
+/**
+ * trace_compact_lock_reserve - reserve and fill a compact record
+ * @buffer: the ring buffer to write to
+ * @type: one of the TRACE_*_COMPACT types
+ * @buf: the varint encoded payload, starting with the pid
+ * @len: length of @buf in bytes
+ * @flags: irq flags of the caller
+ * @pc: preempt count of the caller
+ *
+ * The record is committed by the caller, like one returned by
+ * trace_buffer_lock_reserve().
+ */
+struct ring_buffer_event *
+trace_compact_lock_reserve(struct ring_buffer *buffer, int type,
+			   const unsigned char *buf, int len,
+			   unsigned long flags, int pc)
+{
+	struct ring_buffer_event *event;
+	struct compact_entry *entry;
+
+	event = ring_buffer_lock_reserve(buffer, sizeof(*entry) + len);
+	if (event != NULL) {
+		entry = ring_buffer_event_data(event);
+		entry->ent.type			= type;
+		entry->ent.flags		= trace_entry_flags(flags, pc);
+		entry->ent.preempt_count	= pc & 0xff;
+		entry->len			= len;
+		memcpy(entry->buf, buf, len);
+	}
+
+	return event;
+}
+
 static inline void
 __trace_buffer_unlock_commit(struct ring_buffer *buffer,
 			     struct ring_buffer_event *event,
@@ -1198,6 +1262,42 @@ void trace_current_buffer_discard_commit(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(trace_current_buffer_discard_commit);
 
+/*
+ * The compact record has no fields of its own to filter on, so the
+ * filter of @call is run on the full record it stands for.  That
+ * record is only built when a filter is set.
+ */
+static void
+trace_function_compact(struct ftrace_event_call *call,
+		       struct ring_buffer *buffer,
+		       unsigned long ip, unsigned long parent_ip,
+		       unsigned long flags, int pc)
+{
+	unsigned char buf[TRACE_COMPACT_MAX], *p = buf;
+	struct ring_buffer_event *event;
+	struct ftrace_entry entry;
+
+	p = trace_compact_put(p, current->pid);
+	p = trace_compact_put_signed(p, ip - (unsigned long)_stext);
+	p = trace_compact_put_signed(p, parent_ip - ip);
+
+	event = trace_compact_lock_reserve(buffer, TRACE_FN_COMPACT,
+					   buf, p - buf, flags, pc);
+	if (!event)
+		return;
+
+	if (unlikely(call->flags & TRACE_EVENT_FL_FILTERED)) {
+		tracing_generic_entry_update(&entry.ent, flags, pc);
+		entry.ent.type		= TRACE_FN;
+		entry.ip		= ip;
+		entry.parent_ip		= parent_ip;
+
+		if (filter_check_discard(call, &entry, buffer, event))
+			return;
+	}
+	ring_buffer_unlock_commit(buffer, event);
+}
+
 void
 trace_function(struct trace_array *tr,
 	       unsigned long ip, unsigned long parent_ip, unsigned long flags,
@@ -1212,6 +1312,11 @@ trace_function(struct trace_array *tr,
 	if (unlikely(__this_cpu_read(ftrace_cpu_disabled)))
 		return;
 
+	if (trace_flags & TRACE_ITER_COMPACT) {
+		trace_function_compact(call, buffer, ip, parent_ip, flags, pc);
+		return;
+	}
+
 	event = trace_buffer_lock_reserve(buffer, TRACE_FN, sizeof(*entry),
 					  flags, pc);
 	if (!event)
@@ -1608,8 +1713,10 @@ void *trace_find_next_entry_inc(struct trace_iterator *iter)
 	iter->ent = __find_next_entry(iter, &iter->cpu,
 				      &iter->lost_events, &iter->ts);
 
-	if (iter->ent)
+	if (iter->ent) {
+		iter->ent = trace_expand_compact(iter, iter->ent);
 		trace_iterator_increment(iter);
+	}
 
 	return iter->ent ? iter : NULL;
 }
@@ -3659,6 +3766,7 @@ struct ftrace_buffer_info {
 	void			*spare;
 	int			cpu;
 	unsigned int		read;
+	struct ring_buffer	*mapped;	/* buffer mmap()ed via this file */
 };
 
 static int tracing_buffers_open(struct inode *inode, struct file *filp)
@@ -3907,11 +4015,114 @@ out:
 	return ret;
 }
 
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+
+	/* can't fail, the buffer is mapped already */
+	WARN_ON(ring_buffer_map(info->mapped, info->cpu));
+	trace_buffers_mapped_add(1);
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+
+	WARN_ON(ring_buffer_unmap(info->mapped, info->cpu));
+	trace_buffers_mapped_add(-1);
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+};
+
+/*
+ * Map the meta page and the sub-buffers of the cpu buffer read only.
+ * The consumer reads events in place and moves on to the next
+ * sub-buffer with TRACE_MMAP_IOCTL_GET_READER, no data is copied.
+ */
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct ring_buffer *buffer;
+	unsigned long addr, i;
+	int ret;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	/*
+	 * All mappings of this file must be of the same buffer.  Count
+	 * the mapping before the buffer is picked, so that it cannot be
+	 * swapped with the max buffer from here on.
+	 */
+	mutex_lock(&trace_types_lock);
+	trace_buffers_mapped_add(1);
+	if (!info->mapped)
+		info->mapped = info->tr->buffer;
+	buffer = info->mapped;
+	mutex_unlock(&trace_types_lock);
+
+	ret = ring_buffer_map(buffer, info->cpu);
+	if (ret) {
+		trace_buffers_mapped_add(-1);
+		return ret;
+	}
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND;
+
+	for (i = 0, addr = vma->vm_start; addr < vma->vm_end;
+	     i++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		page = ring_buffer_map_page(buffer, info->cpu,
+					    vma->vm_pgoff + i);
+		if (!page) {
+			ret = -EINVAL;
+			goto out_unmap;
+		}
+		ret = vm_insert_page(vma, addr, page);
+		if (ret)
+			goto out_unmap;
+	}
+
+	vma->vm_ops = &tracing_buffers_vmops;
+	return 0;
+
+ out_unmap:
+	ring_buffer_unmap(buffer, info->cpu);
+	trace_buffers_mapped_add(-1);
+	return ret;
+}
+
+static long tracing_buffers_ioctl(struct file *filp, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	long ret;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	if (!info->mapped)
+		return -ENODEV;
+
+	trace_access_lock(info->cpu);
+	ret = ring_buffer_map_get_reader(info->mapped, info->cpu);
+	trace_access_unlock(info->cpu);
+
+	return ret;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.mmap		= tracing_buffers_mmap,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
 	.llseek		= no_llseek,
 };
 
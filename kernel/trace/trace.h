@@ -29,6 +29,9 @@ enum trace_type {
 	TRACE_GRAPH_ENT,
 	TRACE_USER_STACK,
 	TRACE_BLK,
+	TRACE_FN_COMPACT,
+	TRACE_CTX_COMPACT,
+	TRACE_WAKE_COMPACT,
 
 	__TRACE_LAST_TYPE,
 };
@@ -62,6 +65,24 @@ enum trace_type {
 		tstruct						\
 	}
 
+/*
+ * Header of the records written when the "compact" trace option is
+ * set.  The pid and the padding of struct trace_entry are left out,
+ * the pid is the first varint of the record payload instead.
+ */
+struct compact_trace_entry {
+	unsigned short		type;
+	unsigned char		flags;
+	unsigned char		preempt_count;
+};
+
+#undef FTRACE_ENTRY_PACKED
+#define FTRACE_ENTRY_PACKED(name, struct_name, id, tstruct, print) \
+	struct struct_name {					\
+		struct compact_trace_entry	ent;		\
+		tstruct						\
+	} __packed
+
 #undef TP_ARGS
 #define TP_ARGS(args...)	args
 
@@ -308,6 +329,36 @@ void trace_buffer_unlock_commit(struct ring_buffer *buffer,
 				struct ring_buffer_event *event,
 				unsigned long flags, int pc);
 
+/*
+ * Compact records carry their fields as LEB128 varints, signed
+ * values zigzag encoded so that small deltas stay small.
+ */
+#define TRACE_COMPACT_MAX	48
+
+static inline unsigned char *
+trace_compact_put(unsigned char *p, unsigned long val)
+{
+	while (val >= 0x80) {
+		*p++ = val | 0x80;
+		val >>= 7;
+	}
+	*p++ = val;
+	return p;
+}
+
+static inline unsigned char *
+trace_compact_put_signed(unsigned char *p, long val)
+{
+	return trace_compact_put(p, (val << 1) ^ (val >> (BITS_PER_LONG - 1)));
+}
+
+struct ring_buffer_event *
+trace_compact_lock_reserve(struct ring_buffer *buffer, int type,
+			   const unsigned char *buf, int len,
+			   unsigned long flags, int pc);
+struct trace_entry *trace_expand_compact(struct trace_iterator *iter,
+					 struct trace_entry *entry);
+
 struct trace_entry *tracing_get_trace_entry(struct trace_array *tr,
 						struct trace_array_cpu *data);
 
@@ -609,6 +660,7 @@ enum trace_iterator_flags {
 	TRACE_ITER_GRAPH_TIME		= 0x80000,
 	TRACE_ITER_RECORD_CMD		= 0x100000,
 	TRACE_ITER_OVERWRITE		= 0x200000,
+	TRACE_ITER_COMPACT		= 0x400000,
 };
 
 /*
@@ -783,6 +835,9 @@ extern const char *__stop___trace_bprintk_fmt[];
 #undef FTRACE_ENTRY_DUP
 #define FTRACE_ENTRY_DUP(call, struct_name, id, tstruct, print)		\
 	FTRACE_ENTRY(call, struct_name, id, PARAMS(tstruct), PARAMS(print))
+#undef FTRACE_ENTRY_PACKED
+#define FTRACE_ENTRY_PACKED(call, struct_name, id, tstruct, print)	\
+	FTRACE_ENTRY(call, struct_name, id, PARAMS(tstruct), PARAMS(print))
 #include "trace_entries.h"
 
 /* Only current can touch trace_recursion */
@@ -50,6 +50,11 @@
  *
  *
  * @print: the print format shown to users in the format file.
+ *
+ * FTRACE_ENTRY_PACKED() takes the same arguments but creates a packed
+ * structure that starts with struct compact_trace_entry instead of
+ * struct trace_entry. The common_pid and common_padding fields of
+ * the format file do not apply to these records.
  */
 
 /*
@@ -150,6 +155,53 @@ FTRACE_ENTRY_DUP(wakeup, ctx_switch_entry,
 		)
 );
 
+/*
+ * Compact records, written instead of the above when the "compact"
+ * trace option is set. @buf holds @len bytes of varints:
+ *
+ *  function_compact:	pid, ip - _stext, parent_ip - ip
+ *  context_switch_compact, wakeup_compact:
+ *			pid, prev_pid - pid, next_pid - prev_pid, next_cpu,
+ *			prev_prio, prev_state, next_prio, next_state
+ *
+ * Differences are zigzag encoded, everything else is unsigned.
+ */
+FTRACE_ENTRY_PACKED(function_compact, compact_entry,
+
+	TRACE_FN_COMPACT,
+
+	F_STRUCT(
+		__field(	unsigned char,	len	)
+		__dynamic_array(	unsigned char,	buf	)
+	),
+
+	F_printk("len:%u buf:%p", __entry->len, __entry->buf)
+);
+
+FTRACE_ENTRY_DUP(context_switch_compact, compact_entry,
+
+	TRACE_CTX_COMPACT,
+
+	F_STRUCT(
+		__field(	unsigned char,	len	)
+		__dynamic_array(	unsigned char,	buf	)
+	),
+
+	F_printk("len:%u buf:%p", __entry->len, __entry->buf)
+);
+
+FTRACE_ENTRY_DUP(wakeup_compact, compact_entry,
+
+	TRACE_WAKE_COMPACT,
+
+	F_STRUCT(
+		__field(	unsigned char,	len	)
+		__dynamic_array(	unsigned char,	buf	)
+	),
+
+	F_printk("len:%u buf:%p", __entry->len, __entry->buf)
+);
+
 /*
  * Stack-trace entry:
  */
@@ -60,6 +60,10 @@ static void __always_unused ____ftrace_check_##name(void)	\
 #define FTRACE_ENTRY_DUP(name, struct_name, id, tstruct, print)	\
 	FTRACE_ENTRY(name, struct_name, id, PARAMS(tstruct), PARAMS(print))
 
+#undef FTRACE_ENTRY_PACKED
+#define FTRACE_ENTRY_PACKED(name, struct_name, id, tstruct, print)	\
+	FTRACE_ENTRY(name, struct_name, id, PARAMS(tstruct), PARAMS(print))
+
 #include "trace_entries.h"
 
 #undef __field
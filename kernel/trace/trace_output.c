@@ -9,6 +9,8 @@
 #include <linux/mutex.h>
 #include <linux/ftrace.h>
 
+#include <asm/sections.h>
+
 #include "trace_output.h"
 
 /* must be a power of 2 */
@@ -1100,6 +1102,128 @@ static struct trace_event trace_wake_event = {
 	.funcs		= &trace_wake_funcs,
 };
 
+/* TRACE_FN_COMPACT, TRACE_CTX_COMPACT and TRACE_WAKE_COMPACT */
+
+static const unsigned char *
+compact_get(const unsigned char *p, const unsigned char *end,
+	    unsigned long *val)
+{
+	unsigned long v = 0;
+	int shift;
+
+	for (shift = 0; p < end && shift < BITS_PER_LONG; shift += 7) {
+		v |= (unsigned long)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*val = v;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static const unsigned char *
+compact_get_signed(const unsigned char *p, const unsigned char *end,
+		   long *val)
+{
+	unsigned long v;
+
+	p = compact_get(p, end, &v);
+	if (p)
+		*val = (v >> 1) ^ -(v & 1);
+	return p;
+}
+
+static bool compact_expand_fn(struct ftrace_entry *field,
+			      const unsigned char *p, const unsigned char *end)
+{
+	long ip, parent;
+
+	if (!(p = compact_get_signed(p, end, &ip)) ||
+	    !(p = compact_get_signed(p, end, &parent)))
+		return false;
+
+	field->ip = (unsigned long)_stext + ip;
+	field->parent_ip = field->ip + parent;
+	return true;
+}
+
+static bool compact_expand_ctx(struct ctx_switch_entry *field,
+			       const unsigned char *p, const unsigned char *end)
+{
+	unsigned long val[5];
+	long prev, next;
+	int i;
+
+	if (!(p = compact_get_signed(p, end, &prev)) ||
+	    !(p = compact_get_signed(p, end, &next)))
+		return false;
+
+	for (i = 0; i < ARRAY_SIZE(val); i++)
+		if (!(p = compact_get(p, end, &val[i])))
+			return false;
+
+	field->prev_pid		= field->ent.pid + prev;
+	field->next_pid		= field->prev_pid + next;
+	field->next_cpu		= val[0];
+	field->prev_prio	= val[1];
+	field->prev_state	= val[2];
+	field->next_prio	= val[3];
+	field->next_state	= val[4];
+	return true;
+}
+
+/**
+ * trace_expand_compact - expand a compact record for printing
+ * @iter: the iterator the record was read by
+ * @entry: the record
+ *
+ * Returns @entry if it is not a compact record, or if it is malformed.
+ * Otherwise the record is expanded into the equivalent full record in
+ * @iter->ent_buf, which is returned, so that the output functions of the
+ * full record type can be used.
+ */
+struct trace_entry *trace_expand_compact(struct trace_iterator *iter,
+					 struct trace_entry *entry)
+{
+	struct compact_entry *field = (struct compact_entry *)entry;
+	struct trace_entry *ent = (struct trace_entry *)iter->ent_buf;
+	const unsigned char *p = field->buf, *end = p + field->len;
+	unsigned long pid;
+	bool ok;
+
+	BUILD_BUG_ON(sizeof(struct ftrace_entry) > sizeof(iter->ent_buf));
+	BUILD_BUG_ON(sizeof(struct ctx_switch_entry) > sizeof(iter->ent_buf));
+
+	if (entry->type < TRACE_FN_COMPACT || entry->type > TRACE_WAKE_COMPACT)
+		return entry;
+
+	p = compact_get(p, end, &pid);
+	if (!p)
+		return entry;
+
+	ent->flags		= field->ent.flags;
+	ent->preempt_count	= field->ent.preempt_count;
+	ent->pid		= pid;
+	ent->padding		= 0;
+
+	switch (entry->type) {
+	case TRACE_FN_COMPACT:
+		ent->type = TRACE_FN;
+		ok = compact_expand_fn((struct ftrace_entry *)ent, p, end);
+		break;
+	case TRACE_CTX_COMPACT:
+		ent->type = TRACE_CTX;
+		ok = compact_expand_ctx((struct ctx_switch_entry *)ent, p, end);
+		break;
+	default:
+		ent->type = TRACE_WAKE;
+		ok = compact_expand_ctx((struct ctx_switch_entry *)ent, p, end);
+		break;
+	}
+
+	return ok ? ent : entry;
+}
+
 /* TRACE_STACK */
 
 static enum print_line_t trace_stack_print(struct trace_iterator *iter,
@@ -20,6 +20,53 @@ static int			sched_ref;
 static DEFINE_MUTEX(sched_register_mutex);
 static int			sched_stopped;
 
+/*
+ * Reserve a compact context switch or wakeup record, the pids are
+ * stored as deltas to the pid of the record, see trace_entries.h.
+ * The filter of @call, if any, is run on the full record it stands for;
+ * returns NULL if nothing was reserved or the filter discarded the record.
+ */
+static struct ring_buffer_event *
+tracing_sched_compact_reserve(struct ftrace_event_call *call,
+			      struct ring_buffer *buffer, int type,
+			      struct task_struct *prev,
+			      struct task_struct *next,
+			      unsigned long flags, int pc)
+{
+	unsigned char buf[TRACE_COMPACT_MAX], *p = buf;
+	struct ring_buffer_event *event;
+	struct ctx_switch_entry entry;
+	pid_t pid = current->pid;
+
+	p = trace_compact_put(p, pid);
+	p = trace_compact_put_signed(p, (long)prev->pid - pid);
+	p = trace_compact_put_signed(p, (long)next->pid - prev->pid);
+	p = trace_compact_put(p, task_cpu(next));
+	p = trace_compact_put(p, (unsigned char)prev->prio);
+	p = trace_compact_put(p, (unsigned char)prev->state);
+	p = trace_compact_put(p, (unsigned char)next->prio);
+	p = trace_compact_put(p, (unsigned char)next->state);
+
+	event = trace_compact_lock_reserve(buffer, type, buf, p - buf,
+					   flags, pc);
+	if (!event || likely(!(call->flags & TRACE_EVENT_FL_FILTERED)))
+		return event;
+
+	tracing_generic_entry_update(&entry.ent, flags, pc);
+	entry.ent.type		= type == TRACE_CTX_COMPACT ?
+				  TRACE_CTX : TRACE_WAKE;
+	entry.prev_pid		= prev->pid;
+	entry.prev_prio		= prev->prio;
+	entry.prev_state	= prev->state;
+	entry.next_pid		= next->pid;
+	entry.next_prio		= next->prio;
+	entry.next_state	= next->state;
+	entry.next_cpu		= task_cpu(next);
+
+	if (filter_check_discard(call, &entry, buffer, event))
+		return NULL;
+	return event;
+}
 
 void
 tracing_sched_switch_trace(struct trace_array *tr,
@@ -32,6 +79,15 @@ tracing_sched_switch_trace(struct trace_array *tr,
 	struct ring_buffer_event *event;
 	struct ctx_switch_entry *entry;
 
+	if (trace_flags & TRACE_ITER_COMPACT) {
+		event = tracing_sched_compact_reserve(call, buffer,
+						      TRACE_CTX_COMPACT,
+						      prev, next, flags, pc);
+		if (event)
+			trace_buffer_unlock_commit(buffer, event, flags, pc);
+		return;
+	}
+
 	event = trace_buffer_lock_reserve(buffer, TRACE_CTX,
 					  sizeof(*entry), flags, pc);
 	if (!event)
@@ -88,6 +144,15 @@ tracing_sched_wakeup_trace(struct trace_array *tr,
 	struct ctx_switch_entry *entry;
 	struct ring_buffer *buffer = tr->buffer;
 
+	if (trace_flags & TRACE_ITER_COMPACT) {
+		event = tracing_sched_compact_reserve(call, buffer,
+						      TRACE_WAKE_COMPACT,
+						      curr, wakee, flags, pc);
+		if (event)
+			ring_buffer_unlock_commit(buffer, event);
+		goto out;
+	}
+
 	event = trace_buffer_lock_reserve(buffer, TRACE_WAKE,
 					  sizeof(*entry), flags, pc);
 	if (!event)
@@ -103,6 +168,7 @@ tracing_sched_wakeup_trace(struct trace_array *tr,
 
 	if (!filter_check_discard(call, entry, buffer, event))
 		ring_buffer_unlock_commit(buffer, event);
+ out:
 	ftrace_trace_stack(tr->buffer, flags, 6, pc);
 	ftrace_trace_userstack(tr->buffer, flags, pc);
 }
@@ -17,8 +17,8 @@
  * This is the generic async execution mechanism.  Work items as are
  * executed in process context.  The worker pool is shared and
  * automatically managed.  There is one worker pool for each CPU and
- * one extra for works which are better served by workers which are
- * not bound to any specific CPU.
+ * one extra for each NUMA node for works which are better served by
+ * workers which are not bound to any specific CPU.
  *
  * Please read Documentation/workqueue.txt for details.
  */
@@ -225,6 +225,7 @@ struct workqueue_struct {
 	union {
 		struct cpu_workqueue_struct __percpu	*pcpu;
 		struct cpu_workqueue_struct		*single;
+		struct cpu_workqueue_struct		**nodes;
 		unsigned long				v;
 	} cpu_wq;				/* I: cwq's */
 	struct list_head	list;		/* W: list of all workqueues */
@@ -265,18 +266,38 @@ EXPORT_SYMBOL_GPL(system_freezable_wq);
 	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)			\
 		hlist_for_each_entry(worker, pos, &gcwq->busy_hash[i], hentry)
 
+/* unbound gcwqs are identified by WORK_CPU_UNBOUND + node */
+static inline unsigned int unbound_gcwq_cpu(int node)
+{
+	return WORK_CPU_UNBOUND + node;
+}
+
+static inline bool is_unbound_gcwq_cpu(unsigned int cpu)
+{
+	return cpu >= WORK_CPU_UNBOUND && cpu < WORK_CPU_NONE;
+}
+
 static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				  unsigned int sw)
 {
+	int node;
+
 	if (cpu < nr_cpu_ids) {
 		if (sw & 1) {
 			cpu = cpumask_next(cpu, mask);
 			if (cpu < nr_cpu_ids)
 				return cpu;
 		}
-		if (sw & 2)
-			return WORK_CPU_UNBOUND;
-	}
+		if (!(sw & 2))
+			return WORK_CPU_NONE;
+		node = first_node(node_possible_map);
+	} else if (is_unbound_gcwq_cpu(cpu))
+		node = next_node(cpu - WORK_CPU_UNBOUND, node_possible_map);
+	else
+		node = MAX_NUMNODES;
+
+	if (node < MAX_NUMNODES)
+		return unbound_gcwq_cpu(node);
 	return WORK_CPU_NONE;
 }
 
@@ -289,15 +310,15 @@ static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
 /*
  * CPU iterators
  *
- * An extra gcwq is defined for an invalid cpu number
- * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
- * specific CPU.  The following iterators are similar to
- * for_each_*_cpu() iterators but also considers the unbound gcwq.
+ * An extra gcwq is defined for each possible NUMA node using invalid
+ * cpu numbers (WORK_CPU_UNBOUND + node) to host workqueues which are
+ * not bound to any specific CPU.  The following iterators are similar
+ * to for_each_*_cpu() iterators but also consider the unbound gcwqs.
  *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
+ * for_each_gcwq_cpu()		: possible CPUs + unbound gcwqs
+ * for_each_online_gcwq_cpu()	: online CPUs + unbound gcwqs
  * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ *				  unbound gcwqs for unbound workqueues
  */
 #define for_each_gcwq_cpu(cpu)						\
 	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
@@ -444,31 +465,68 @@ static DEFINE_PER_CPU(struct global_cwq, global_cwq);
 static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, gcwq_nr_running);
 
 /*
- * Global cpu workqueue and nr_running counter for unbound gcwq.  The
- * gcwq is always online, has GCWQ_DISASSOCIATED set, and all its
- * workers have WORKER_UNBOUND set.
+ * Global cpu workqueues for unbound gcwqs, one per possible NUMA node,
+ * and the nr_running counter shared by all of them.  The gcwqs are
+ * always online, have GCWQ_DISASSOCIATED set, and all their workers
+ * have WORKER_UNBOUND set.  Workers prefer the CPUs of their node.
  */
-static struct global_cwq unbound_global_cwq;
+static struct global_cwq *unbound_global_cwq[MAX_NUMNODES] __read_mostly;
 static atomic_t unbound_gcwq_nr_running = ATOMIC_INIT(0);	/* always 0 */
 
 static int worker_thread(void *__worker);
 
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (!is_unbound_gcwq_cpu(cpu))
 		return &per_cpu(global_cwq, cpu);
 	else
-		return &unbound_global_cwq;
+		return unbound_global_cwq[cpu - WORK_CPU_UNBOUND];
 }
 
 static atomic_t *get_gcwq_nr_running(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (!is_unbound_gcwq_cpu(cpu))
 		return &per_cpu(gcwq_nr_running, cpu);
 	else
 		return &unbound_gcwq_nr_running;
 }
 
+/*
+ * Node the memory of unbound gcwq @cpu should be allocated from.
+ * Possible nodes may be offline or memoryless; let the allocator
+ * pick in that case.
+ */
+static int gcwq_mem_node(unsigned int cpu)
+{
+	int node;
+
+	if (!is_unbound_gcwq_cpu(cpu))
+		return cpu_to_node(cpu);
+
+	node = cpu - WORK_CPU_UNBOUND;
+	return node_state(node, N_HIGH_MEMORY) ? node : NUMA_NO_NODE;
+}
+
+/*
+ * Whether all work items of unbound @wq go to the gcwq of the first
+ * node.  Ordered workqueues depend on a single gcwq to guarantee
+ * execution order, and a max_active smaller than the number of nodes
+ * can't be split over them.
+ */
+static bool wq_first_node_only(struct workqueue_struct *wq)
+{
+	return wq->flags & WQ_ORDERED ||
+		wq->saved_max_active < num_possible_nodes();
+}
+
+/* The unbound gcwq work items queued to @wq from the current cpu go to */
+static unsigned int wq_unbound_cpu(struct workqueue_struct *wq)
+{
+	if (wq_first_node_only(wq))
+		return unbound_gcwq_cpu(first_node(node_possible_map));
+	return unbound_gcwq_cpu(cpu_to_node(raw_smp_processor_id()));
+}
+
 static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 					    struct workqueue_struct *wq)
 {
@@ -480,8 +538,8 @@ static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 			return wq->cpu_wq.single;
 #endif
 		}
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+	} else if (likely(is_unbound_gcwq_cpu(cpu)))
+		return wq->cpu_wq.nodes[cpu - WORK_CPU_UNBOUND];
 	return NULL;
 }
 
@@ -563,7 +621,7 @@ static struct global_cwq *get_work_gcwq(struct work_struct *work)
 	if (cpu == WORK_CPU_NONE)
 		return NULL;
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
+	BUG_ON(cpu >= nr_cpu_ids && !is_unbound_gcwq_cpu(cpu));
 	return get_gcwq(cpu);
 }
 
@@ -981,7 +1039,7 @@ static bool is_chained_work(struct workqueue_struct *wq)
 static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
-	struct global_cwq *gcwq;
+	struct global_cwq *gcwq, *last_gcwq;
 	struct cpu_workqueue_struct *cwq;
 	struct list_head *worklist;
 	unsigned int work_flags;
@@ -996,39 +1054,36 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 
 	/* determine gcwq to use */
 	if (!(wq->flags & WQ_UNBOUND)) {
-		struct global_cwq *last_gcwq;
-
 		if (unlikely(cpu == WORK_CPU_UNBOUND))
 			cpu = raw_smp_processor_id();
-
-		/*
-		 * It's multi cpu.  If @wq is non-reentrant and @work
-		 * was previously on a different cpu, it might still
-		 * be running there, in which case the work needs to
-		 * be queued on that cpu to guarantee non-reentrance.
-		 */
 		gcwq = get_gcwq(cpu);
-		if (wq->flags & WQ_NON_REENTRANT &&
-		    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
-			struct worker *worker;
+	} else
+		gcwq = get_gcwq(wq_unbound_cpu(wq));
 
-			spin_lock_irqsave(&last_gcwq->lock, flags);
+	/*
+	 * It's multi cpu or multi node.  If @wq is non-reentrant and
+	 * @work was previously on a different gcwq, it might still be
+	 * running there, in which case the work needs to be queued on
+	 * that gcwq to guarantee non-reentrance.  Unbound workqueues
+	 * used to share a single gcwq and are always non-reentrant.
+	 */
+	if (wq->flags & (WQ_NON_REENTRANT | WQ_UNBOUND) &&
+	    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
+		struct worker *worker;
 
-			worker = find_worker_executing_work(last_gcwq, work);
+		spin_lock_irqsave(&last_gcwq->lock, flags);
 
-			if (worker && worker->current_cwq->wq == wq)
-				gcwq = last_gcwq;
-			else {
-				/* meh... not running there, queue here */
-				spin_unlock_irqrestore(&last_gcwq->lock, flags);
-				spin_lock_irqsave(&gcwq->lock, flags);
-			}
-		} else
+		worker = find_worker_executing_work(last_gcwq, work);
+
+		if (worker && worker->current_cwq->wq == wq)
+			gcwq = last_gcwq;
+		else {
+			/* meh... not running there, queue here */
+			spin_unlock_irqrestore(&last_gcwq->lock, flags);
 			spin_lock_irqsave(&gcwq->lock, flags);
-	} else {
-		gcwq = get_gcwq(WORK_CPU_UNBOUND);
+		}
+	} else
 		spin_lock_irqsave(&gcwq->lock, flags);
-	}
 
 	/* gcwq determined, get cwq and queue */
 	cwq = get_cwq(gcwq->cpu, wq);
@@ -1156,12 +1211,12 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 		if (!(wq->flags & WQ_UNBOUND)) {
 			struct global_cwq *gcwq = get_work_gcwq(work);
 
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
+			if (gcwq && !is_unbound_gcwq_cpu(gcwq->cpu))
 				lcpu = gcwq->cpu;
 			else
 				lcpu = raw_smp_processor_id();
 		} else
-			lcpu = WORK_CPU_UNBOUND;
+			lcpu = wq_unbound_cpu(wq);
 
 		set_work_cwq(work, get_cwq(lcpu, wq), 0);
 
@@ -1319,11 +1374,11 @@ static void worker_rebind_fn(struct work_struct *work)
 	spin_unlock_irq(&gcwq->lock);
 }
 
-static struct worker *alloc_worker(void)
+static struct worker *alloc_worker(int node)
 {
 	struct worker *worker;
 
-	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	worker = kzalloc_node(sizeof(*worker), GFP_KERNEL, node);
 	if (worker) {
 		INIT_LIST_HEAD(&worker->entry);
 		INIT_LIST_HEAD(&worker->scheduled);
@@ -1351,7 +1406,8 @@ static struct worker *alloc_worker(void)
  */
 static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 {
-	bool on_unbound_cpu = gcwq->cpu == WORK_CPU_UNBOUND;
+	bool on_unbound_cpu = is_unbound_gcwq_cpu(gcwq->cpu);
+	int node = gcwq_mem_node(gcwq->cpu);
 	struct worker *worker = NULL;
 	int id = -1;
 
@@ -1364,7 +1420,7 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 	}
 	spin_unlock_irq(&gcwq->lock);
 
-	worker = alloc_worker();
+	worker = alloc_worker(node);
 	if (!worker)
 		goto fail;
 
@@ -1373,15 +1429,30 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 
 	if (!on_unbound_cpu)
 		worker->task = kthread_create_on_node(worker_thread,
-						      worker,
-						      cpu_to_node(gcwq->cpu),
+						      worker, node,
 						      "kworker/%u:%d", gcwq->cpu, id);
 	else
-		worker->task = kthread_create(worker_thread, worker,
-					      "kworker/u:%d", id);
+		worker->task = kthread_create_on_node(worker_thread,
+						      worker, node,
+						      "kworker/u%u:%d",
+						      gcwq->cpu - WORK_CPU_UNBOUND,
+						      id);
 	if (IS_ERR(worker->task))
 		goto fail;
 
+	/*
+	 * Unbound workers prefer the CPUs of their node.  This must
+	 * be done before PF_THREAD_BOUND is set below.  If the node
+	 * has no online CPU, the worker may run anywhere.
+	 */
+	if (on_unbound_cpu) {
+		const struct cpumask *mask =
+			cpumask_of_node(gcwq->cpu - WORK_CPU_UNBOUND);
+
+		if (cpumask_intersects(mask, cpu_online_mask))
+			set_cpus_allowed_ptr(worker->task, mask);
+	}
+
 	/*
 	 * A rogue worker will become a regular one if CPU comes
 	 * online later on.  Make sure every worker has
@@ -1495,8 +1566,8 @@ static bool send_mayday(struct work_struct *work)
 
 	/* mayday mayday mayday */
 	cpu = cwq->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
-	if (cpu == WORK_CPU_UNBOUND)
+	/* unbound gcwqs can't be set in cpumask, use cpu 0 instead */
+	if (is_unbound_gcwq_cpu(cpu))
 		cpu = 0;
 	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
 		wake_up_process(wq->rescuer->task);
@@ -2004,6 +2075,47 @@ sleep:
 	goto woke_up;
 }
 
+/**
+ * rescue_cwq - process the works of @cwq on behalf of its gcwq
+ * @rescuer: the rescuer of @cwq's workqueue
+ * @cwq: cwq which asked for help
+ *
+ * Move all works issued via @cwq's workqueue on @cwq->gcwq to
+ * @rescuer and process them.
+ */
+static void rescue_cwq(struct worker *rescuer,
+		       struct cpu_workqueue_struct *cwq)
+{
+	struct list_head *scheduled = &rescuer->scheduled;
+	struct global_cwq *gcwq = cwq->gcwq;
+	struct work_struct *work, *n;
+
+	/* migrate to the target cpu if possible */
+	rescuer->gcwq = gcwq;
+	worker_maybe_bind_and_lock(rescuer);
+
+	/*
+	 * Slurp in all works issued via this workqueue and
+	 * process'em.
+	 */
+	BUG_ON(!list_empty(&rescuer->scheduled));
+	list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
+		if (get_work_cwq(work) == cwq)
+			move_linked_works(work, scheduled, &n);
+
+	process_scheduled_works(rescuer);
+
+	/*
+	 * Leave this gcwq.  If keep_working() is %true, notify a
+	 * regular worker; otherwise, we end up with 0 concurrency
+	 * and stalling the execution.
+	 */
+	if (keep_working(gcwq))
+		wake_up_worker(gcwq);
+
+	spin_unlock_irq(&gcwq->lock);
+}
+
 /**
  * rescuer_thread - the rescuer thread function
  * @__wq: the associated workqueue
@@ -2027,9 +2139,8 @@ static int rescuer_thread(void *__wq)
 {
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
-	struct list_head *scheduled = &rescuer->scheduled;
 	bool is_unbound = wq->flags & WQ_UNBOUND;
-	unsigned int cpu;
+	unsigned int cpu, tcpu;
 
 	set_user_nice(current, RESCUER_NICE_LEVEL);
 repeat:
@@ -2040,41 +2151,18 @@ repeat:
 
 	/*
 	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * workqueues use cpu 0 in mayday_mask for all nodes and
+	 * have all their unbound gcwqs checked.
 	 */
 	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
-		struct global_cwq *gcwq = cwq->gcwq;
-		struct work_struct *work, *n;
-
 		__set_current_state(TASK_RUNNING);
 		mayday_clear_cpu(cpu, wq->mayday_mask);
 
-		/* migrate to the target cpu if possible */
-		rescuer->gcwq = gcwq;
-		worker_maybe_bind_and_lock(rescuer);
-
-		/*
-		 * Slurp in all works issued via this workqueue and
-		 * process'em.
-		 */
-		BUG_ON(!list_empty(&rescuer->scheduled));
-		list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
-			if (get_work_cwq(work) == cwq)
-				move_linked_works(work, scheduled, &n);
-
-		process_scheduled_works(rescuer);
-
-		/*
-		 * Leave this gcwq.  If keep_working() is %true, notify a
-		 * regular worker; otherwise, we end up with 0 concurrency
-		 * and stalling the execution.
-		 */
-		if (keep_working(gcwq))
-			wake_up_worker(gcwq);
-
-		spin_unlock_irq(&gcwq->lock);
+		if (is_unbound) {
+			for_each_cwq_cpu(tcpu, wq)
+				rescue_cwq(rescuer, get_cwq(tcpu, wq));
+		} else
+			rescue_cwq(rescuer, get_cwq(cpu, wq));
 	}
 
 	schedule();
@@ -2833,58 +2921,96 @@ int keventd_up(void)
 	return system_wq != NULL;
 }
 
-static int alloc_cwqs(struct workqueue_struct *wq)
+/*
+ * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.  Make
+ * sure that the alignment isn't lower than that of unsigned long long.
+ */
+#define CWQ_ALIGN	max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,	\
+			      __alignof__(unsigned long long))
+
+static struct cpu_workqueue_struct *alloc_single_cwq(int node)
 {
+	const size_t size = sizeof(struct cpu_workqueue_struct);
+	struct cpu_workqueue_struct *cwq;
+	void *ptr;
+
 	/*
-	 * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.
-	 * Make sure that the alignment isn't lower than that of
-	 * unsigned long long.
+	 * Allocate enough room to align cwq and put an extra
+	 * pointer at the end pointing back to the originally
+	 * allocated pointer which will be used for free.
 	 */
-	const size_t size = sizeof(struct cpu_workqueue_struct);
-	const size_t align = max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,
-				   __alignof__(unsigned long long));
-#ifdef CONFIG_SMP
-	bool percpu = !(wq->flags & WQ_UNBOUND);
-#else
-	bool percpu = false;
-#endif
+	ptr = kzalloc_node(size + CWQ_ALIGN + sizeof(void *), GFP_KERNEL,
+			   node);
+	if (!ptr)
+		return NULL;
 
-	if (percpu)
-		wq->cpu_wq.pcpu = __alloc_percpu(size, align);
-	else {
-		void *ptr;
+	cwq = PTR_ALIGN(ptr, CWQ_ALIGN);
+	*(void **)(cwq + 1) = ptr;
+	return cwq;
+}
 
-		/*
-		 * Allocate enough room to align cwq and put an extra
-		 * pointer at the end pointing back to the originally
-		 * allocated pointer which will be used for free.
-		 */
-		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
-		if (ptr) {
-			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
+static void free_single_cwq(struct cpu_workqueue_struct *cwq)
+{
+	/* the pointer to free is stored right after the cwq */
+	if (cwq)
+		kfree(*(void **)(cwq + 1));
+}
+
+static int alloc_cwqs(struct workqueue_struct *wq)
+{
+	int node;
+
+	if (wq->flags & WQ_UNBOUND) {
+		/* one cwq on each node for the node's unbound gcwq */
+		wq->cpu_wq.nodes = kzalloc(nr_node_ids * sizeof(void *),
+					   GFP_KERNEL);
+		if (!wq->cpu_wq.nodes)
+			return -ENOMEM;
+
+		for_each_node(node) {
+			struct cpu_workqueue_struct *cwq;
+
+			cwq = alloc_single_cwq(gcwq_mem_node(
+						unbound_gcwq_cpu(node)));
+			if (!cwq)
+				return -ENOMEM;
+			/* just in case, make sure it's actually aligned */
+			BUG_ON(!IS_ALIGNED((unsigned long)cwq, CWQ_ALIGN));
+			wq->cpu_wq.nodes[node] = cwq;
 		}
+		return 0;
 	}
 
+#ifdef CONFIG_SMP
+	wq->cpu_wq.pcpu = __alloc_percpu(sizeof(struct cpu_workqueue_struct),
+					 CWQ_ALIGN);
+#else
+	wq->cpu_wq.single = alloc_single_cwq(NUMA_NO_NODE);
+#endif
+
 	/* just in case, make sure it's actually aligned */
-	BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, align));
+	BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, CWQ_ALIGN));
 	return wq->cpu_wq.v ? 0 : -ENOMEM;
 }
 
 static void free_cwqs(struct workqueue_struct *wq)
 {
+	int node;
+
+	if (wq->flags & WQ_UNBOUND) {
+		if (!wq->cpu_wq.nodes)
+			return;
+		for_each_node(node)
+			free_single_cwq(wq->cpu_wq.nodes[node]);
+		kfree(wq->cpu_wq.nodes);
+		return;
+	}
+
 #ifdef CONFIG_SMP
-	bool percpu = !(wq->flags & WQ_UNBOUND);
+	free_percpu(wq->cpu_wq.pcpu);
 #else
-	bool percpu = false;
+	free_single_cwq(wq->cpu_wq.single);
 #endif
-
-	if (percpu)
-		free_percpu(wq->cpu_wq.pcpu);
-	else if (wq->cpu_wq.single) {
-		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
-	}
 }
 
 static int wq_clamp_max_active(int max_active, unsigned int flags,
@@ -2900,6 +3026,35 @@ static int wq_clamp_max_active(int max_active, unsigned int flags,
 	return clamp_val(max_active, 1, lim);
 }
 
+/*
+ * max_active of an unbound workqueue limits it as a whole, so split it
+ * over the per-node cwqs such that the shares of the possible nodes add
+ * up to @max_active.  The cwq of @cpu gets its share.
+ */
+static int cwq_max_active(struct workqueue_struct *wq, unsigned int cpu,
+			  int max_active)
+{
+	int nr = num_possible_nodes(), node, n, rank = 0;
+
+	if (!(wq->flags & WQ_UNBOUND))
+		return max_active;
+
+	node = cpu - WORK_CPU_UNBOUND;
+	if (wq_first_node_only(wq)) {
+		/*
+		 * Nothing new is queued to the other nodes, but they may
+		 * still have to run what was queued before max_active was
+		 * lowered.
+		 */
+		return node == first_node(node_possible_map) ? max_active : 1;
+	}
+
+	for (n = 0; n < node; n++)
+		if (node_possible(n))
+			rank++;
+	return max_active / nr + (rank < max_active % nr);
+}
+
 struct workqueue_struct *__alloc_workqueue_key(const char *name,
 					       unsigned int flags,
 					       int max_active,
@@ -2926,6 +3081,20 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, name);
 
+	/*
+	 * Unbound workqueues with max_active of 1 are used to order
+	 * execution and must not be spread over the per-node gcwqs.
+	 * Older users don't ask for it through WQ_ORDERED, so treat them
+	 * the same, but let them change max_active later on.
+	 */
+	if (flags & WQ_ORDERED) {
+		if (WARN_ON(!(flags & WQ_UNBOUND) || max_active != 1))
+			flags &= ~WQ_ORDERED;
+		else
+			flags |= WQ_ORDERED_EXPLICIT;
+	} else if (flags & WQ_UNBOUND && max_active == 1)
+		flags |= WQ_ORDERED;
+
 	wq = kzalloc(sizeof(*wq), GFP_KERNEL);
 	if (!wq)
 		goto err;
@@ -2952,7 +3121,7 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 		cwq->gcwq = gcwq;
 		cwq->wq = wq;
 		cwq->flush_color = -1;
-		cwq->max_active = max_active;
+		cwq->max_active = cwq_max_active(wq, cpu, max_active);
 		INIT_LIST_HEAD(&cwq->delayed_works);
 	}
 
@@ -2962,7 +3131,7 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 		if (!alloc_mayday_mask(&wq->mayday_mask, GFP_KERNEL))
 			goto err;
 
-		wq->rescuer = rescuer = alloc_worker();
+		wq->rescuer = rescuer = alloc_worker(NUMA_NO_NODE);
 		if (!rescuer)
 			goto err;
 
@@ -3078,7 +3247,8 @@ EXPORT_SYMBOL_GPL(destroy_workqueue);
  * @wq: target workqueue
  * @max_active: new max_active value.
  *
- * Set max_active of @wq to @max_active.
+ * Set max_active of @wq to @max_active.  Workqueues allocated with
+ * WQ_ORDERED depend on a max_active of 1 and are left alone.
  *
  * CONTEXT:
  * Don't call from IRQ context.
@@ -3087,12 +3257,23 @@ void workqueue_set_max_active(struct workqueue_struct *wq, int max_active)
 {
 	unsigned int cpu;
 
+	if (WARN_ON(wq->flags & WQ_ORDERED_EXPLICIT))
+		return;
+
 	max_active = wq_clamp_max_active(max_active, wq->flags, wq->name);
 
 	spin_lock(&workqueue_lock);
 
 	wq->saved_max_active = max_active;
 
+	/* ordered, unless asked for otherwise, exactly as long as it's 1 */
+	if (wq->flags & WQ_UNBOUND) {
+		if (max_active == 1)
+			wq->flags |= WQ_ORDERED;
+		else
+			wq->flags &= ~WQ_ORDERED;
+	}
+
 	for_each_cwq_cpu(cpu, wq) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
 
@@ -3100,7 +3281,8 @@ void workqueue_set_max_active(struct workqueue_struct *wq, int max_active)
 
 		if (!(wq->flags & WQ_FREEZABLE) ||
 		    !(gcwq->flags & GCWQ_FREEZING))
-			get_cwq(gcwq->cpu, wq)->max_active = max_active;
+			get_cwq(gcwq->cpu, wq)->max_active =
+				cwq_max_active(wq, gcwq->cpu, max_active);
 
 		spin_unlock_irq(&gcwq->lock);
 	}
@@ -3117,13 +3299,18 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  * Test whether @wq's cpu workqueue for @cpu is congested.  There is
  * no synchronization around this function and the test result is
  * unreliable and only useful as advisory hints or for debugging.
+ * For unbound workqueues, WORK_CPU_UNBOUND tests the local node.
  *
  * RETURNS:
  * %true if congested, %false otherwise.
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+
+	if (wq->flags & WQ_UNBOUND && cpu == WORK_CPU_UNBOUND)
+		cpu = wq_unbound_cpu(wq);
+	cwq = get_cwq(cpu, wq);
 
 	return !list_empty(&cwq->delayed_works);
 }
@@ -3134,7 +3321,8 @@ EXPORT_SYMBOL_GPL(workqueue_congested);
  * @work: the work of interest
  *
  * RETURNS:
- * CPU number if @work was ever queued.  WORK_CPU_NONE otherwise.
+ * CPU number if @work was ever queued, WORK_CPU_UNBOUND + node if it
+ * was last on an unbound gcwq.  WORK_CPU_NONE otherwise.
  */
 unsigned int work_cpu(struct work_struct *work)
 {
@@ -3724,7 +3912,8 @@ void thaw_workqueues(void)
 				continue;
 
 			/* restore max_active and repopulate worklist */
-			cwq->max_active = wq->saved_max_active;
+			cwq->max_active = cwq_max_active(wq, cpu,
+							 wq->saved_max_active);
 
 			while (!list_empty(&cwq->delayed_works) &&
 			       cwq->nr_active < cwq->max_active)
@@ -3745,10 +3934,19 @@ out_unlock:
 static int __init init_workqueues(void)
 {
 	unsigned int cpu;
-	int i;
+	int i, node;
 
 	cpu_notifier(workqueue_cpu_callback, CPU_PRI_WORKQUEUE);
 
+	/* allocate unbound gcwqs on their own nodes */
+	for_each_node(node) {
+		cpu = unbound_gcwq_cpu(node);
+		unbound_global_cwq[node] =
+			kzalloc_node(sizeof(struct global_cwq), GFP_KERNEL,
+				     gcwq_mem_node(cpu));
+		BUG_ON(!unbound_global_cwq[node]);
+	}
+
 	/* initialize gcwqs */
 	for_each_gcwq_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -3780,7 +3978,7 @@ static int __init init_workqueues(void)
 		struct global_cwq *gcwq = get_gcwq(cpu);
 		struct worker *worker;
 
-		if (cpu != WORK_CPU_UNBOUND)
+		if (!is_unbound_gcwq_cpu(cpu))
 			gcwq->flags &= ~GCWQ_DISASSOCIATED;
 		worker = create_worker(gcwq, true);
 		BUG_ON(!worker);
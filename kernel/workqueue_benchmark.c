@@ -0,0 +1,191 @@
+/*
+ * unbound workqueue benchmark
+ *
+ * Every online cpu runs a producer which queues work items to an
+ * unbound workqueue.  Each work item touches a buffer allocated on
+ * the producer's node.  The benchmark reports the throughput and how
+ * many items, and how many bytes of buffer, were processed on a node
+ * other than the one the buffer lives on.
+ *
+ * All of it happens at load time, and the module refuses to stay
+ * loaded afterwards, so it can simply be loaded again for another run.
+ */
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+
+static unsigned int nr_items = 100000;
+module_param(nr_items, uint, 0444);
+MODULE_PARM_DESC(nr_items, "# of work items queued by each producer");
+
+static unsigned int buf_size = 1024;
+module_param(buf_size, uint, 0444);
+MODULE_PARM_DESC(buf_size, "# of bytes each work item touches");
+
+static unsigned int batch = 64;
+module_param(batch, uint, 0444);
+MODULE_PARM_DESC(batch, "# of work items each producer keeps in flight");
+
+struct bench_item {
+	struct work_struct	work;
+	int			node;		/* node of @buf */
+	char			*buf;
+};
+
+static struct workqueue_struct *bench_wq;
+static atomic_t nr_producers;
+static struct completion producers_done;
+
+static atomic_long_t nr_done;
+static atomic_long_t nr_remote;
+
+static void bench_work_fn(struct work_struct *work)
+{
+	struct bench_item *item = container_of(work, struct bench_item, work);
+	unsigned int i;
+
+	for (i = 0; i < buf_size; i += L1_CACHE_BYTES)
+		item->buf[i]++;
+
+	if (cpu_to_node(raw_smp_processor_id()) != item->node)
+		atomic_long_inc(&nr_remote);
+	atomic_long_inc(&nr_done);
+}
+
+static int bench_producer(void *data)
+{
+	struct bench_item *items = data;
+	unsigned int i;
+
+	for (i = 0; i < nr_items; i++) {
+		struct bench_item *item = &items[i % batch];
+
+		/* the item is still pending, wait for it to be picked up */
+		while (!queue_work(bench_wq, &item->work))
+			cond_resched();
+	}
+
+	if (atomic_dec_and_test(&nr_producers))
+		complete(&producers_done);
+	return 0;
+}
+
+static struct bench_item *alloc_items(int cpu)
+{
+	int node = cpu_to_node(cpu);
+	struct bench_item *items;
+	unsigned int i;
+
+	items = kzalloc_node(batch * sizeof(*items), GFP_KERNEL, node);
+	if (!items)
+		return NULL;
+
+	for (i = 0; i < batch; i++) {
+		items[i].node = node;
+		items[i].buf = kzalloc_node(buf_size, GFP_KERNEL, node);
+		if (!items[i].buf)
+			goto fail;
+		INIT_WORK(&items[i].work, bench_work_fn);
+	}
+	return items;
+fail:
+	while (i--)
+		kfree(items[i].buf);
+	kfree(items);
+	return NULL;
+}
+
+static void free_items(struct bench_item *items)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch; i++)
+		kfree(items[i].buf);
+	kfree(items);
+}
+
+static int __init workqueue_benchmark_init(void)
+{
+	struct task_struct **tasks;
+	struct bench_item **items;
+	unsigned long done, remote;
+	ktime_t start;
+	u64 us;
+	int cpu, ret = -ENOMEM;
+
+	if (!nr_items || !batch)
+		return -EINVAL;
+
+	bench_wq = alloc_workqueue("wq_bench", WQ_UNBOUND, 0);
+	tasks = kcalloc(nr_cpu_ids, sizeof(*tasks), GFP_KERNEL);
+	items = kcalloc(nr_cpu_ids, sizeof(*items), GFP_KERNEL);
+	if (!bench_wq || !tasks || !items)
+		goto out;
+
+	get_online_cpus();
+
+	for_each_online_cpu(cpu) {
+		items[cpu] = alloc_items(cpu);
+		if (!items[cpu])
+			goto out_put;
+		tasks[cpu] = kthread_create_on_node(bench_producer, items[cpu],
+						    cpu_to_node(cpu),
+						    "wq_bench/%d", cpu);
+		if (IS_ERR(tasks[cpu])) {
+			ret = PTR_ERR(tasks[cpu]);
+			tasks[cpu] = NULL;
+			goto out_put;
+		}
+		kthread_bind(tasks[cpu], cpu);
+	}
+
+	init_completion(&producers_done);
+	atomic_set(&nr_producers, num_online_cpus());
+	atomic_long_set(&nr_done, 0);
+	atomic_long_set(&nr_remote, 0);
+
+	start = ktime_get();
+	for_each_online_cpu(cpu) {
+		wake_up_process(tasks[cpu]);
+		tasks[cpu] = NULL;
+	}
+	wait_for_completion(&producers_done);
+	flush_workqueue(bench_wq);
+	us = ktime_to_us(ktime_sub(ktime_get(), start)) ?: 1;
+
+	done = atomic_long_read(&nr_done);
+	remote = atomic_long_read(&nr_remote);
+
+	printk(KERN_INFO "workqueue_benchmark: %lu items in %llu us, "
+	       "%llu items/sec\n", done, us,
+	       div64_u64((u64)done * USEC_PER_SEC, us));
+	printk(KERN_INFO "workqueue_benchmark: %lu cross-node items (%lu%%), "
+	       "%lu KB of cross-node buffer traffic\n", remote,
+	       done ? remote * 100 / done : 0,
+	       (unsigned long)((u64)remote * buf_size >> 10));
+	ret = -EAGAIN;
+
+out_put:
+	for_each_online_cpu(cpu) {
+		if (tasks[cpu])
+			kthread_stop(tasks[cpu]);
+		if (items[cpu])
+			free_items(items[cpu]);
+	}
+	put_online_cpus();
+out:
+	kfree(items);
+	kfree(tasks);
+	if (bench_wq)
+		destroy_workqueue(bench_wq);
+	return ret;
+}
+
+module_init(workqueue_benchmark_init);
+
+MODULE_DESCRIPTION("unbound workqueue benchmark");
+MODULE_LICENSE("GPL");
@@ -24,6 +24,9 @@ void __init_rwsem(struct rw_semaphore *sem, const char *name,
 	sem->count = RWSEM_UNLOCKED_VALUE;
 	spin_lock_init(&sem->wait_lock);
 	INIT_LIST_HEAD(&sem->wait_list);
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+	sem->owner = NULL;
+#endif
 }
 
 EXPORT_SYMBOL(__init_rwsem);
@@ -44,6 +47,13 @@ struct rwsem_waiter {
 #define RWSEM_WAKE_NO_ACTIVE  1 /* rwsem was observed with no active thread */
 #define RWSEM_WAKE_READ_OWNED 2 /* rwsem was observed to be read owned */
 
+/*
+ * Most readers that __rwsem_do_wake() lets overtake queued writers at a
+ * time.  The writers are only held back for the one read-locked phase
+ * the readers join, as readers arriving later queue behind them.
+ */
+#define RWSEM_WAKE_READ_BATCH 32
+
 /*
  * handle the lock release when processes blocked on it that can now run
  * - if we come here from up_xxxx(), then:
@@ -53,14 +63,16 @@ struct rwsem_waiter {
  * - the spinlock must be held by the caller
  * - woken process blocks are discarded from the list after having task zeroed
  * - writers are only woken if downgrading is false
+ * - if a reader is at the front of the queue, the readers queued behind
+ *   writers are woken with it, up to RWSEM_WAKE_READ_BATCH of them
  */
 static struct rw_semaphore *
 __rwsem_do_wake(struct rw_semaphore *sem, int wake_type)
 {
-	struct rwsem_waiter *waiter;
+	struct rwsem_waiter *waiter, *tmp;
 	struct task_struct *tsk;
-	struct list_head *next;
 	signed long oldcount, woken, loop, adjustment;
+	int writers = 0;
 
 	waiter = list_entry(sem->wait_list.next, struct rwsem_waiter, list);
 	if (!(waiter->flags & RWSEM_WAITING_FOR_WRITE))
@@ -119,32 +131,38 @@ __rwsem_do_wake(struct rw_semaphore *sem, int wake_type)
 		goto out;
 
 	/* Grant an infinite number of read locks to the readers at the front
-	 * of the queue.  Note we increment the 'active part' of the count by
-	 * the number of readers before waking any processes up.
+	 * of the queue, and let the readers queued behind writers share the
+	 * lock too, as long as the batch stays within RWSEM_WAKE_READ_BATCH.
+	 * Writers keep their place.  Note we increment the 'active part' of
+	 * the count by the number of readers before waking any processes up.
 	 */
 	woken = 0;
-	do {
-		woken++;
-
-		if (waiter->list.next == &sem->wait_list)
+	list_for_each_entry(waiter, &sem->wait_list, list) {
+		if (waiter->flags & RWSEM_WAITING_FOR_WRITE) {
+			writers = 1;
+			continue;
+		}
+		if (writers && woken >= RWSEM_WAKE_READ_BATCH)
 			break;
-
-		waiter = list_entry(waiter->list.next,
-					struct rwsem_waiter, list);
-
-	} while (waiter->flags & RWSEM_WAITING_FOR_READ);
+		woken++;
+	}
 
 	adjustment = woken * RWSEM_ACTIVE_READ_BIAS;
-	if (waiter->flags & RWSEM_WAITING_FOR_READ)
-		/* hit end of list above */
+	if (!writers)
+		/* the queue will be empty */
 		adjustment -= RWSEM_WAITING_BIAS;
 
 	rwsem_atomic_add(adjustment, sem);
 
-	next = sem->wait_list.next;
-	for (loop = woken; loop > 0; loop--) {
-		waiter = list_entry(next, struct rwsem_waiter, list);
-		next = waiter->list.next;
+	loop = woken;
+	list_for_each_entry_safe(waiter, tmp, &sem->wait_list, list) {
+		if (!loop)
+			break;
+		if (waiter->flags & RWSEM_WAITING_FOR_WRITE)
+			continue;
+		loop--;
+
+		list_del(&waiter->list);
 		tsk = waiter->task;
 		smp_mb();
 		waiter->task = NULL;
@@ -152,9 +170,6 @@ __rwsem_do_wake(struct rw_semaphore *sem, int wake_type)
 		put_task_struct(tsk);
 	}
 
-	sem->wait_list.next = next;
-	next->prev = &sem->wait_list;
-
  out:
 	return sem;
 
@@ -228,11 +243,67 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 					-RWSEM_ACTIVE_READ_BIAS);
 }
 
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+/*
+ * Number of times a writer polls the count of an rwsem held by readers,
+ * which have no owner to spin on, before going to sleep.
+ */
+#define RWSEM_SPIN_READER_LOOPS	1000
+
+/*
+ * Spin for the write lock instead of sleeping, like mutexes do.
+ *
+ * The caller still holds the active write bias that the fast path added,
+ * so no up_read() or up_write() wakes a waiter while we spin: once the
+ * active part of the count drops to our own bias, every other holder has
+ * gone and the lock is ours.  We spin as long as the lock is held by a
+ * writer that is running, or for a bounded time while it is held by
+ * readers, and give up when we need to reschedule.
+ */
+static int rwsem_optimistic_spin(struct rw_semaphore *sem)
+{
+	struct task_struct *owner;
+	int loops = 0;
+
+	for (;;) {
+		if ((ACCESS_ONCE(sem->count) & RWSEM_ACTIVE_MASK) ==
+		    RWSEM_ACTIVE_BIAS)
+			return 1;
+
+		owner = ACCESS_ONCE(sem->owner);
+		if (owner) {
+			if (!rwsem_spin_on_owner(sem, owner))
+				return 0;
+			continue;
+		}
+
+		if (need_resched() || ++loops > RWSEM_SPIN_READER_LOOPS)
+			return 0;
+
+		arch_mutex_cpu_relax();
+	}
+}
+#else
+static inline int rwsem_optimistic_spin(struct rw_semaphore *sem)
+{
+	return 0;
+}
+#endif
+
 /*
  * wait for the write lock to be granted
  */
 struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 {
+	int acquired;
+
+	/* like __mutex_lock_common(), don't get preempted or migrated */
+	preempt_disable();
+	acquired = rwsem_optimistic_spin(sem);
+	preempt_enable();
+	if (acquired)
+		return sem;
+
 	return rwsem_down_failed_common(sem, RWSEM_WAITING_FOR_WRITE,
 					-RWSEM_ACTIVE_WRITE_BIAS);
 }
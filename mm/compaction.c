@@ -14,6 +14,8 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -42,6 +44,9 @@ struct compact_control {
 	unsigned int order;		/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
 	struct zone *zone;
+
+	bool background;		/* kcompactd, any free block will do */
+	unsigned long end_jiffies;	/* kcompactd time budget */
 };
 
 static unsigned long release_freepages(struct list_head *freelist)
@@ -248,6 +253,17 @@ static bool too_many_isolated(struct zone *zone)
 	isolated = zone_page_state(zone, NR_ISOLATED_FILE) +
 					zone_page_state(zone, NR_ISOLATED_ANON);
 
+	if (isolated <= (inactive + active) / 2)
+		return false;
+
+	/* Recheck without the per cpu drift before throttling */
+	inactive = zone_page_state_snapshot(zone, NR_INACTIVE_FILE) +
+			zone_page_state_snapshot(zone, NR_INACTIVE_ANON);
+	active = zone_page_state_snapshot(zone, NR_ACTIVE_FILE) +
+			zone_page_state_snapshot(zone, NR_ACTIVE_ANON);
+	isolated = zone_page_state_snapshot(zone, NR_ISOLATED_FILE) +
+			zone_page_state_snapshot(zone, NR_ISOLATED_ANON);
+
 	return isolated > (inactive + active) / 2;
 }
 
@@ -471,6 +487,9 @@ static int compact_finished(struct zone *zone,
 	if (cc->order == -1)
 		return COMPACT_CONTINUE;
 
+	if (cc->background && time_after(jiffies, cc->end_jiffies))
+		return COMPACT_PARTIAL;
+
 	/* Compaction run is not finished if the watermark is not met */
 	watermark = low_wmark_pages(zone);
 	watermark += (1 << cc->order);
@@ -487,6 +506,10 @@ static int compact_finished(struct zone *zone,
 		/* Job done if allocation would set block type */
 		if (order >= pageblock_order && zone->free_area[order].nr_free)
 			return COMPACT_PARTIAL;
+
+		/* kcompactd: the allocator falls back to other types */
+		if (cc->background && zone->free_area[order].nr_free)
+			return COMPACT_PARTIAL;
 	}
 
 	return COMPACT_CONTINUE;
@@ -628,6 +651,21 @@ unsigned long compact_zone_order(struct zone *zone,
 
 int sysctl_extfrag_threshold = 500;
 
+/*
+ * Running average of the time a direct compactor stalls, used to
+ * estimate the stall time kcompactd saves.  Updated without locking,
+ * a lost update does not matter for an estimate.
+ */
+static unsigned long compact_stall_avg_usecs;
+
+static void account_compact_stall(u64 start)
+{
+	unsigned long usecs = div_u64(local_clock() - start, NSEC_PER_USEC);
+
+	count_vm_events(COMPACTSTALL_USECS, usecs);
+	compact_stall_avg_usecs = (compact_stall_avg_usecs * 7 + usecs) / 8;
+}
+
 /**
  * try_to_compact_pages - Direct compact to satisfy a high-order allocation
  * @zonelist: The zonelist used for the current allocation
@@ -648,6 +686,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 	struct zoneref *z;
 	struct zone *zone;
 	int rc = COMPACT_SKIPPED;
+	u64 start;
 
 	/*
 	 * Check whether it is worth even starting compaction. The order check is
@@ -658,6 +697,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 		return rc;
 
 	count_vm_event(COMPACTSTALL);
+	start = local_clock();
 
 	/* Compact each zone in the list */
 	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
@@ -672,6 +712,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 			break;
 	}
 
+	account_compact_stall(start);
 	return rc;
 }
 
@@ -746,6 +787,210 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * kcompactd compacts the zones of its node in the background, so that
+ * high-order allocations find free blocks instead of stalling in direct
+ * compaction.  It looks at the node every kcompactd_scan_millisecs, or
+ * right away when a high-order allocation entered the slow path, and
+ * compacts each zone for the highest order up to pageblock_order whose
+ * fragmentation index says that an allocation would fail because of
+ * fragmentation rather than a lack of free memory.  Migration is
+ * asynchronous and the time spent is kept within kcompactd_cpu_percent.
+ */
+int sysctl_kcompactd_cpu_percent = 5;
+int sysctl_kcompactd_scan_millisecs = 500;
+
+/* Highest order up to @max_order that @zone should be compacted for */
+static int kcompactd_zone_order(struct zone *zone, int max_order)
+{
+	int order;
+
+	for (order = max_order; order > 0; order--) {
+		if (compaction_suitable(zone, order) == COMPACT_CONTINUE)
+			return order;
+	}
+	return 0;
+}
+
+/*
+ * Compact the zones of @pgdat that need it.  Sets @timeout to when the
+ * node should be looked at next and returns how long kcompactd has to
+ * sleep before doing more work to stay within its cpu budget.
+ */
+static unsigned long kcompactd_do_work(pg_data_t *pgdat,
+				       unsigned long *timeout)
+{
+	unsigned long interval = msecs_to_jiffies(sysctl_kcompactd_scan_millisecs);
+	int percent = sysctl_kcompactd_cpu_percent;
+	int max_order = pgdat->kcompactd_max_order;
+	bool compacted = false, succeeded = false;
+	u64 runtime;
+	int zoneid;
+
+	/*
+	 * Compact for the order an allocation woke us for, or up to
+	 * pageblock_order on a periodic scan.  Beyond pageblock_order
+	 * background compaction takes too long to be worth it.
+	 */
+	if (!max_order || max_order > pageblock_order)
+		max_order = pageblock_order;
+	pgdat->kcompactd_max_order = 0;
+	*timeout = interval;
+	if (!percent)
+		return 0;
+
+	runtime = task_sched_runtime(current);
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.migratetype = MIGRATE_MOVABLE,
+			.zone = zone,
+			.sync = false,
+			.background = true,
+		};
+
+		if (!populated_zone(zone))
+			continue;
+
+		cc.order = kcompactd_zone_order(zone, max_order);
+		if (!cc.order)
+			continue;
+
+		cc.end_jiffies = jiffies + max(interval * percent / 100, 1UL);
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		compact_zone(zone, &cc);
+		compacted = true;
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+
+		/* Page migration frees to the PCP lists but we want merging */
+		preempt_disable();
+		drain_local_pages(NULL);
+		preempt_enable();
+
+		if (zone_watermark_ok(zone, cc.order, low_wmark_pages(zone), 0, 0)) {
+			/* an allocation of this order no longer has to stall */
+			count_vm_event(KCOMPACTD_SUCCESS);
+			count_vm_events(KCOMPACTD_STALL_AVOIDED_USECS,
+					compact_stall_avg_usecs);
+			succeeded = true;
+		}
+		cond_resched();
+	}
+	if (!compacted)
+		return 0;
+
+	/* Back off while compaction keeps failing, like direct compaction */
+	if (succeeded)
+		pgdat->kcompactd_defer_shift = 0;
+	else if (pgdat->kcompactd_defer_shift < COMPACT_MAX_DEFER_SHIFT)
+		pgdat->kcompactd_defer_shift++;
+	*timeout = interval << pgdat->kcompactd_defer_shift;
+
+	runtime = task_sched_runtime(current) - runtime;
+	count_vm_events(KCOMPACTD_USECS, div_u64(runtime, NSEC_PER_USEC));
+
+	/* idle long enough for the time just spent to be percent of the total */
+	return nsecs_to_jiffies(div_u64(runtime * (100 - percent), percent));
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+	unsigned long timeout = msecs_to_jiffies(sysctl_kcompactd_scan_millisecs);
+	unsigned long throttle;
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+	set_user_nice(current, 19);
+
+	pgdat->kcompactd_max_order = 0;
+	while (!kthread_should_stop()) {
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kthread_should_stop() || pgdat->kcompactd_max_order,
+				timeout);
+		if (kthread_should_stop())
+			break;
+
+		throttle = kcompactd_do_work(pgdat, &timeout);
+		if (throttle)
+			schedule_timeout_interruptible(throttle);
+	}
+
+	return 0;
+}
+
+/*
+ * A high-order allocation on @zone is about to enter the slow path, let
+ * kcompactd have a go at the node before the next one gets there.
+ */
+void wakeup_kcompactd(struct zone *zone, int order)
+{
+	pg_data_t *pgdat = zone->zone_pgdat;
+
+	if (!populated_zone(zone) || !sysctl_kcompactd_cpu_percent)
+		return;
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+	if (compaction_suitable(zone, order) != COMPACT_CONTINUE)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+	count_vm_event(KCOMPACTD_WAKE);
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * Called at boot and by memory hotplug when a node gets its first memory.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int ret = 0;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		ret = PTR_ERR(pgdat->kcompactd);
+		pgdat->kcompactd = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
@@ -1566,11 +1566,20 @@ static void do_sync_mmap_readahead(struct vm_area_struct *vma,
 	if (ra->mmap_miss < MMAP_LOTSAMISS * 10)
 		ra->mmap_miss++;
 
+	/*
+	 * Strided misses get readahead along the stride, read-around
+	 * would only read pages in between that are never touched.
+	 */
+	if (page_cache_stride_readahead(mapping, ra, file, offset))
+		return;
+
 	/*
 	 * Do we miss much more than hit in this file? If so,
-	 * stop bothering with read-ahead. It will only hurt.
+	 * stop bothering with read-ahead. It will only hurt,
+	 * except in the regions of the file that are hot.
 	 */
-	if (ra->mmap_miss > MMAP_LOTSAMISS)
+	if (ra->mmap_miss > MMAP_LOTSAMISS &&
+	    !page_cache_hot_cluster(mapping, ra, offset))
 		return;
 
 	/*
@@ -1600,7 +1609,9 @@ static void do_async_mmap_readahead(struct vm_area_struct *vma,
 		return;
 	if (ra->mmap_miss > 0)
 		ra->mmap_miss--;
-	if (PageReadahead(page))
+	if (PageReadahead(page) &&
+	    !page_cache_stride_async_readahead(mapping, ra, file,
+					       page, offset))
 		page_cache_async_readahead(mapping, ra, file,
 					   page, offset, ra->ra_pages);
 }
@@ -0,0 +1,376 @@
+/*
+ * Frontswap frontend
+ *
+ * This code provides the generic "frontend" layer to call a matching
+ * "backend" driver implementation of frontswap.  See
+ * Documentation/vm/frontswap.txt for more information.
+ *
+ * Copyright (C) 2009-2011 Oracle Corp.  All rights reserved.
+ * Author: Dan Magenheimer
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/bitmap.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/frontswap.h>
+#include <linux/swapfile.h>
+#include <linux/module.h>
+
+/*
+ * frontswap_ops is set by frontswap_register_ops to contain the pointers
+ * to the frontswap "backend" implementation functions.
+ */
+static struct frontswap_ops frontswap_ops;
+
+/*
+ * This global enablement flag reduces overhead on systems where frontswap_ops
+ * has not been registered, so is preferred to the slower alternative: a
+ * function call that checks a non-global.
+ */
+int frontswap_enabled;
+EXPORT_SYMBOL(frontswap_enabled);
+
+/* useful stats available in /sys/kernel/debug/frontswap */
+static u64 frontswap_gets;
+static u64 frontswap_succ_puts;
+static u64 frontswap_failed_puts;
+static u64 frontswap_flushes;
+static u64 frontswap_writebacks;
+
+/*
+ * Register operations for frontswap, returning previous thus allowing
+ * detection of multiple backends and possible nesting.  Swap areas that
+ * are already enabled are announced to the new backend right away.
+ */
+struct frontswap_ops frontswap_register_ops(struct frontswap_ops *ops)
+{
+	struct frontswap_ops old = frontswap_ops;
+	DECLARE_BITMAP(types, MAX_SWAPFILES);
+	unsigned int type;
+
+	bitmap_zero(types, MAX_SWAPFILES);
+	spin_lock(&swap_lock);
+	for (type = 0; type < nr_swapfiles; type++) {
+		struct swap_info_struct *sis = swap_info[type];
+
+		if ((sis->flags & SWP_WRITEOK) && sis->frontswap_map)
+			set_bit(type, types);
+	}
+	spin_unlock(&swap_lock);
+
+	frontswap_ops = *ops;
+	frontswap_enabled = 1;
+
+	for_each_set_bit(type, types, MAX_SWAPFILES)
+		(*frontswap_ops.init)(type);
+	return old;
+}
+EXPORT_SYMBOL(frontswap_register_ops);
+
+/* Called when a swap device is swapon'd */
+void __frontswap_init(unsigned type)
+{
+	struct swap_info_struct *sis = swap_info[type];
+
+	BUG_ON(sis == NULL);
+	if (sis->frontswap_map == NULL)
+		return;
+	if (frontswap_enabled)
+		(*frontswap_ops.init)(type);
+}
+EXPORT_SYMBOL(__frontswap_init);
+
+/*
+ * "Put" data from a page to frontswap and associate it with the page's
+ * swaptype and offset.  Page must be locked and in the swap cache.
+ * If frontswap already contains a page with matching swaptype and
+ * offset, the frontswap implmentation may either overwrite the data and
+ * return success or flush the page from frontswap and return failure.
+ */
+int __frontswap_put_page(struct page *page)
+{
+	int ret = -1, dup = 0;
+	swp_entry_t entry = { .val = page_private(page), };
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = swap_info[type];
+	pgoff_t offset = swp_offset(entry);
+
+	BUG_ON(!PageLocked(page));
+	BUG_ON(sis == NULL);
+	if (frontswap_test(sis, offset))
+		dup = 1;
+	ret = (*frontswap_ops.put_page)(type, offset, page);
+	if (ret == 0) {
+		frontswap_set(sis, offset);
+		frontswap_succ_puts++;
+		if (!dup)
+			atomic_inc(&sis->frontswap_pages);
+	} else if (dup) {
+		/*
+		 * failed dup always results in automatic flush of
+		 * the (older) page from frontswap
+		 */
+		frontswap_clear(sis, offset);
+		atomic_dec(&sis->frontswap_pages);
+		(*frontswap_ops.flush_page)(type, offset);
+		frontswap_failed_puts++;
+	} else
+		frontswap_failed_puts++;
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_put_page);
+
+/*
+ * "Get" data from frontswap associated with swaptype and offset that were
+ * specified when the data was put to frontswap and use it to fill the
+ * specified page with data. Page must be locked and in the swap cache.
+ */
+int __frontswap_get_page(struct page *page)
+{
+	int ret = -1;
+	swp_entry_t entry = { .val = page_private(page), };
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = swap_info[type];
+	pgoff_t offset = swp_offset(entry);
+
+	BUG_ON(!PageLocked(page));
+	BUG_ON(sis == NULL);
+	if (frontswap_test(sis, offset))
+		ret = (*frontswap_ops.get_page)(type, offset, page);
+	if (ret == 0)
+		frontswap_gets++;
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_get_page);
+
+/*
+ * Flush any data from frontswap associated with the specified swaptype
+ * and offset so that a subsequent "get" will fail.
+ */
+void __frontswap_flush_page(unsigned type, pgoff_t offset)
+{
+	struct swap_info_struct *sis = swap_info[type];
+
+	BUG_ON(sis == NULL);
+	if (frontswap_test(sis, offset)) {
+		(*frontswap_ops.flush_page)(type, offset);
+		atomic_dec(&sis->frontswap_pages);
+		frontswap_clear(sis, offset);
+		frontswap_flushes++;
+	}
+}
+EXPORT_SYMBOL(__frontswap_flush_page);
+
+/*
+ * Flush all data from frontswap associated with all offsets for the
+ * specified swaptype.
+ */
+void __frontswap_flush_area(unsigned type)
+{
+	struct swap_info_struct *sis = swap_info[type];
+
+	BUG_ON(sis == NULL);
+	if (sis->frontswap_map == NULL)
+		return;
+	(*frontswap_ops.flush_area)(type);
+	atomic_set(&sis->frontswap_pages, 0);
+	memset(sis->frontswap_map, 0, BITS_TO_LONGS(sis->max) * sizeof(long));
+}
+EXPORT_SYMBOL(__frontswap_flush_area);
+
+/*
+ * Count and return the number of pages frontswap pages across all
+ * swap devices.  This is exported so that a kernel module can
+ * determine current usage without reading debugfs.
+ */
+unsigned long frontswap_curr_pages(void)
+{
+	unsigned long totalpages = 0;
+	unsigned int type;
+
+	spin_lock(&swap_lock);
+	for (type = 0; type < nr_swapfiles; type++) {
+		struct swap_info_struct *sis = swap_info[type];
+
+		if (sis->flags & SWP_WRITEOK)
+			totalpages += atomic_read(&sis->frontswap_pages);
+	}
+	spin_unlock(&swap_lock);
+	return totalpages;
+}
+EXPORT_SYMBOL(frontswap_curr_pages);
+
+/*
+ * Writeback walks the frontswap bitmaps like a clock hand, so that
+ * successive calls move on instead of hitting the same slots again.
+ */
+static DEFINE_MUTEX(frontswap_writeback_mutex);
+static unsigned int frontswap_wb_type;
+static unsigned long frontswap_wb_offset;
+
+/* Find the next slot held in frontswap, called with the mutex held */
+static bool frontswap_writeback_next(swp_entry_t *entry)
+{
+	struct swap_info_struct *sis;
+	unsigned long offset;
+	unsigned int i;
+	bool found = false;
+
+	spin_lock(&swap_lock);
+	/* one extra pass covers the slots below the hand in its swap area */
+	for (i = 0; nr_swapfiles && i <= nr_swapfiles; i++) {
+		if (frontswap_wb_type >= nr_swapfiles) {
+			frontswap_wb_type = 0;
+			frontswap_wb_offset = 0;
+		}
+		sis = swap_info[frontswap_wb_type];
+		if ((sis->flags & SWP_WRITEOK) && sis->frontswap_map) {
+			offset = find_next_bit(sis->frontswap_map, sis->max,
+					       frontswap_wb_offset);
+			if (offset < sis->max) {
+				*entry = swp_entry(frontswap_wb_type, offset);
+				frontswap_wb_offset = offset + 1;
+				found = true;
+				break;
+			}
+		}
+		frontswap_wb_type++;
+		frontswap_wb_offset = 0;
+	}
+	spin_unlock(&swap_lock);
+	return found;
+}
+
+/*
+ * Move one page from frontswap to the swap device: bring it into the
+ * swap cache like a swapin would, drop the frontswap copy and start the
+ * write.  Once written the page is clean and reclaim frees it soon, as
+ * it is marked for reclaim.  Returns 0 if the write was started.
+ */
+static int frontswap_writeback_entry(swp_entry_t entry)
+{
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct page *page;
+	int err;
+
+	page = alloc_page(GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN);
+	if (!page)
+		return -ENOMEM;
+
+	/* the slot is free, or the page is in the swap cache already */
+	err = swapcache_prepare(entry);
+	if (err)
+		goto out_release;
+
+	__set_page_locked(page);
+	SetPageSwapBacked(page);
+	err = add_to_swap_cache(page, entry, GFP_KERNEL);
+	if (err) {
+		ClearPageSwapBacked(page);
+		__clear_page_locked(page);
+		swapcache_free(entry, NULL);
+		goto out_release;
+	}
+	lru_cache_add_anon(page);
+
+	if ((*frontswap_ops.get_page)(swp_type(entry), swp_offset(entry),
+				      page)) {
+		/* flushed meanwhile, so it is on the swap device */
+		swap_readpage(page);
+		err = -ENOENT;
+		goto out_release;
+	}
+	SetPageUptodate(page);
+
+	/*
+	 * If the write cannot be started, the page stays dirty in the swap
+	 * cache and frontswap keeps its copy, so the entry is still valid.
+	 */
+	SetPageReclaim(page);
+	err = __swap_writepage(page, &wbc);
+	if (err) {
+		ClearPageReclaim(page);
+		goto out_release;
+	}
+
+	/*
+	 * The page was unlocked for the write.  Only drop the frontswap
+	 * copy while the slot still belongs to it: a freed slot was already
+	 * flushed and may hold someone else's page by now.
+	 */
+	lock_page(page);
+	if (PageSwapCache(page) && page_private(page) == entry.val)
+		__frontswap_flush_page(swp_type(entry), swp_offset(entry));
+	unlock_page(page);
+	frontswap_writebacks++;
+
+out_release:
+	page_cache_release(page);
+	return err;
+}
+
+/*
+ * Write up to @nr_pages pages held in frontswap out to their swap
+ * devices, for backends that need to shrink their pool under memory
+ * pressure.  Returns the number of pages whose write was started.
+ * Must be called from process context that can do I/O.
+ */
+unsigned long frontswap_writeback(unsigned long nr_pages)
+{
+	unsigned long written = 0, tries = 0;
+	swp_entry_t entry;
+
+	if (!frontswap_enabled)
+		return 0;
+
+	mutex_lock(&frontswap_writeback_mutex);
+	while (written < nr_pages && tries++ < 2 * nr_pages &&
+	       frontswap_writeback_next(&entry)) {
+		if (!frontswap_writeback_entry(entry))
+			written++;
+		cond_resched();
+	}
+	mutex_unlock(&frontswap_writeback_mutex);
+	return written;
+}
+EXPORT_SYMBOL(frontswap_writeback);
+
+#ifdef CONFIG_DEBUG_FS
+static int frontswap_curr_pages_get(void *data, u64 *val)
+{
+	*val = frontswap_curr_pages();
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(frontswap_curr_pages_fops, frontswap_curr_pages_get,
+			NULL, "%llu\n");
+#endif
+
+static int __init init_frontswap(void)
+{
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *root = debugfs_create_dir("frontswap", NULL);
+
+	if (root == NULL)
+		return -ENXIO;
+	debugfs_create_u64("gets", S_IRUGO, root, &frontswap_gets);
+	debugfs_create_u64("succ_puts", S_IRUGO, root, &frontswap_succ_puts);
+	debugfs_create_u64("failed_puts", S_IRUGO, root,
+			   &frontswap_failed_puts);
+	debugfs_create_u64("flushes", S_IRUGO, root, &frontswap_flushes);
+	debugfs_create_u64("writebacks", S_IRUGO, root,
+			   &frontswap_writebacks);
+	debugfs_create_file("curr_pages", S_IRUGO, root, NULL,
+			    &frontswap_curr_pages_fops);
+#endif
+	return 0;
+}
+module_init(init_frontswap);
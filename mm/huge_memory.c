@@ -17,6 +17,10 @@
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/file.h>
+#include <linux/migrate.h>
+#include <linux/pagemap.h>
+#include <linux/shmem_fs.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -316,6 +320,9 @@ static struct attribute *hugepage_attr[] = {
 	&defrag_attr.attr,
 #ifdef CONFIG_DEBUG_VM
 	&debug_cow_attr.attr,
+#endif
+#ifdef CONFIG_SHMEM
+	&shmem_enabled_attr.attr,
 #endif
 	NULL,
 };
@@ -717,6 +724,50 @@ out:
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+/*
+ * Map the HPAGE_PMD_NR small pages of a file starting at @page with one
+ * huge pmd.  The pages have to be physically contiguous and naturally
+ * aligned, and they are not compound: each one takes a reference and a
+ * mapcount for the pmd exactly like it would for a pte, which is what
+ * lets truncation, reclaim and migration keep working on them one by
+ * one.  The caller passes in the page references and holds the pages
+ * locked.  Returns VM_FAULT_FALLBACK if the pmd got populated meanwhile.
+ */
+int set_huge_pmd_file(struct vm_area_struct *vma, unsigned long address,
+		      pmd_t *pmd, struct page *page, unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgtable_t pgtable;
+	pmd_t entry;
+	int i;
+
+	VM_BUG_ON(page_to_pfn(page) & (HPAGE_PMD_NR - 1));
+	VM_BUG_ON(PageCompound(page));
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return VM_FAULT_OOM;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		return VM_FAULT_FALLBACK;
+	}
+	entry = pmd_mkhuge(mk_pmd(page, vma->vm_page_prot));
+	if (flags & FAULT_FLAG_WRITE)
+		entry = pmd_mkdirty(entry);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_file_rmap(page + i);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	set_pmd_at(mm, haddr, pmd, entry);
+	prepare_pmd_huge_pte(pgtable, mm);
+	spin_unlock(&mm->page_table_lock);
+
+	return 0;
+}
+
 int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
 		  struct vm_area_struct *vma)
@@ -750,6 +801,12 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		goto out;
 	}
 	src_page = pmd_page(pmd);
+	if (!PageAnon(src_page)) {
+		/* the child faults the file pages in, like for ptes */
+		pte_free(dst_mm, pgtable);
+		ret = 0;
+		goto out_unlock;
+	}
 	VM_BUG_ON(!PageHead(src_page));
 	get_page(src_page);
 	page_dup_rmap(src_page);
@@ -959,11 +1016,40 @@ out:
 	return ret;
 }
 
-struct page *follow_trans_huge_pmd(struct mm_struct *mm,
+static struct page *follow_huge_file_pmd(struct vm_area_struct *vma,
+					 unsigned long addr,
+					 pmd_t *pmd,
+					 unsigned int flags)
+{
+	struct page *page;
+
+	page = pmd_page(*pmd) + ((addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+	if (flags & FOLL_GET)
+		get_page_foll(page);
+	if (flags & FOLL_TOUCH) {
+		if ((flags & FOLL_WRITE) &&
+		    !pmd_dirty(*pmd) && !PageDirty(page))
+			set_page_dirty(page);
+		mark_page_accessed(page);
+	}
+	/* same as for a pte mapping the page, see follow_page() */
+	if ((flags & FOLL_MLOCK) && (vma->vm_flags & VM_LOCKED)) {
+		if (page->mapping && trylock_page(page)) {
+			lru_add_drain();
+			if (page->mapping)
+				mlock_vma_page(page);
+			unlock_page(page);
+		}
+	}
+	return page;
+}
+
+struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
 				   unsigned long addr,
 				   pmd_t *pmd,
 				   unsigned int flags)
 {
+	struct mm_struct *mm = vma->vm_mm;
 	struct page *page = NULL;
 
 	assert_spin_locked(&mm->page_table_lock);
@@ -972,6 +1058,8 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		goto out;
 
 	page = pmd_page(*pmd);
+	if (!PageAnon(page))
+		return follow_huge_file_pmd(vma, addr, pmd, flags);
 	VM_BUG_ON(!PageHead(page));
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
@@ -995,8 +1083,41 @@ out:
 	return page;
 }
 
+/*
+ * Called with page_table_lock held, drops it.  The dirty and young bits
+ * of the pmd go to every small page it maps, like zap_pte_range() does
+ * for ptes.
+ */
+static void zap_huge_file_pmd(struct mmu_gather *tlb, pmd_t *pmd,
+			      unsigned long addr)
+{
+	struct mm_struct *mm = tlb->mm;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t orig_pmd;
+	int i;
+
+	pgtable = get_pmd_huge_pte(mm);
+	orig_pmd = pmdp_get_and_clear(mm, addr, pmd);
+	tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
+	page = pmd_page(orig_pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (pmd_dirty(orig_pmd))
+			set_page_dirty(page + i);
+		if (pmd_young(orig_pmd))
+			mark_page_accessed(page + i);
+		page_remove_rmap(page + i);
+		VM_BUG_ON(page_mapcount(page + i) < 0);
+	}
+	add_mm_counter(mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+	spin_unlock(&mm->page_table_lock);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		tlb_remove_page(tlb, page + i);
+	pte_free(mm, pgtable);
+}
+
 int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
-		 pmd_t *pmd)
+		 pmd_t *pmd, unsigned long addr)
 {
 	int ret = 0;
 
@@ -1006,12 +1127,16 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 			spin_unlock(&tlb->mm->page_table_lock);
 			wait_split_huge_page(vma->anon_vma,
 					     pmd);
+		} else if (!PageAnon(pmd_page(*pmd))) {
+			zap_huge_file_pmd(tlb, pmd, addr);
+			ret = 1;
 		} else {
 			struct page *page;
 			pgtable_t pgtable;
 			pgtable = get_pmd_huge_pte(tlb->mm);
 			page = pmd_page(*pmd);
 			pmd_clear(pmd);
+			tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
 			page_remove_rmap(page);
 			VM_BUG_ON(page_mapcount(page) < 0);
 			add_mm_counter(tlb->mm, MM_ANONPAGES, -HPAGE_PMD_NR);
@@ -1867,6 +1992,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 		goto out;
 
 	anon_vma_lock(vma->anon_vma);
+	/* the pte table is going away under the speculative fault path */
+	vm_write_begin(vma);
 
 	pte = pte_offset_map(pmd, address);
 	ptl = pte_lockptr(mm, pmd);
@@ -1891,6 +2018,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		BUG_ON(!pmd_none(*pmd));
 		set_pmd_at(mm, address, pmd, _pmd);
 		spin_unlock(&mm->page_table_lock);
+		vm_write_end(vma);
 		anon_vma_unlock(vma->anon_vma);
 		goto out;
 	}
@@ -1927,6 +2055,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	prepare_pmd_huge_pte(pgtable, mm);
 	mm->nr_ptes--;
 	spin_unlock(&mm->page_table_lock);
+	vm_write_end(vma);
 
 #ifndef CONFIG_NUMA
 	*hpage = NULL;
@@ -2016,6 +2145,302 @@ out:
 	return ret;
 }
 
+/*
+ * Collapsing a range of a file mapping does not copy anything into a
+ * compound page: the small page cache pages of the HPAGE_PMD_NR sized
+ * extent are first migrated into one naturally aligned block, unless
+ * they already are in one, and then the page table mapping them is
+ * replaced with a huge pmd, see set_huge_pmd_file().
+ */
+struct file_extent {
+	struct page	*block;
+	pgoff_t		index;
+	DECLARE_BITMAP(used, HPAGE_PMD_NR);
+};
+
+static struct page *file_extent_new_page(struct page *page,
+					 unsigned long private, int **result)
+{
+	struct file_extent *extent = (struct file_extent *)private;
+	unsigned long i = page->index - extent->index;
+
+	/* a failed migration freed the target, it is not handed out twice */
+	if (i >= HPAGE_PMD_NR || test_and_set_bit(i, extent->used))
+		return NULL;
+	return extent->block + i;
+}
+
+/*
+ * Returns true if the pages at @index of @mapping are now one naturally
+ * aligned, physically contiguous block. Called without mmap_sem.
+ */
+static bool khugepaged_file_extent(struct address_space *mapping,
+				   pgoff_t index)
+{
+	struct file_extent extent;
+	struct page *page, *first = NULL;
+	LIST_HEAD(pagelist);
+	bool contiguous = true;
+	gfp_t gfp;
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = find_get_page(mapping, index + i);
+		/* holes are only filled by faults */
+		if (!page)
+			return false;
+		if (!i)
+			first = page;
+		if (page != first + i ||
+		    page_to_pfn(first) & (HPAGE_PMD_NR - 1))
+			contiguous = false;
+		if (!PageUptodate(page)) {
+			page_cache_release(page);
+			return false;
+		}
+		page_cache_release(page);
+	}
+	if (contiguous)
+		return true;
+
+	gfp = alloc_hugepage_gfpmask(khugepaged_defrag(), 0) & ~__GFP_COMP;
+	extent.block = alloc_pages_node(page_to_nid(first), gfp,
+					HPAGE_PMD_ORDER);
+	if (unlikely(!extent.block)) {
+		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		return false;
+	}
+	count_vm_event(THP_COLLAPSE_ALLOC);
+	split_page(extent.block, HPAGE_PMD_ORDER);
+	extent.index = index;
+	bitmap_zero(extent.used, HPAGE_PMD_NR);
+
+	lru_add_drain();
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = find_get_page(mapping, index + i);
+		if (!page)
+			break;
+		if (isolate_lru_page(page)) {
+			page_cache_release(page);
+			break;
+		}
+		list_add_tail(&page->lru, &pagelist);
+		inc_zone_page_state(page, NR_ISOLATED_ANON +
+				    page_is_file_cache(page));
+		page_cache_release(page);
+	}
+	if (i == HPAGE_PMD_NR)
+		contiguous = !migrate_pages(&pagelist, file_extent_new_page,
+					    (unsigned long)&extent,
+					    false, true);
+	putback_lru_pages(&pagelist);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (!test_bit(i, extent.used))
+			__free_page(extent.block + i);
+	}
+	return contiguous;
+}
+
+/*
+ * Called with the mmap_sem held for writing and the pages of the
+ * extent locked. Any pte in the range either is none or maps the
+ * page cache page at the same index.
+ */
+static void __collapse_huge_file_pmd(struct vm_area_struct *vma,
+				     unsigned long address, pmd_t *pmd,
+				     struct page *page)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pmd_t _pmd;
+	pte_t *pte, *_pte;
+	pgtable_t pgtable;
+	spinlock_t *ptl;
+	bool young = false;
+	int i;
+
+	vm_write_begin(vma);
+	pte = pte_offset_map(pmd, address);
+	ptl = pte_lockptr(mm, pmd);
+
+	spin_lock(&mm->page_table_lock);
+	/* gup_fast cannot find the ptes anymore after this */
+	_pmd = pmdp_clear_flush_notify(vma, address, pmd);
+	spin_unlock(&mm->page_table_lock);
+
+	spin_lock(ptl);
+	for (i = 0, _pte = pte; i < HPAGE_PMD_NR; i++, _pte++) {
+		pte_t pteval = *_pte;
+
+		if (!pte_none(pteval) &&
+		    (!pte_present(pteval) || pte_page(pteval) != page + i))
+			break;
+	}
+	if (i < HPAGE_PMD_NR) {
+		spin_unlock(ptl);
+		pte_unmap(pte);
+		spin_lock(&mm->page_table_lock);
+		BUG_ON(!pmd_none(*pmd));
+		set_pmd_at(mm, address, pmd, _pmd);
+		spin_unlock(&mm->page_table_lock);
+		goto out;
+	}
+
+	for (i = 0, _pte = pte; i < HPAGE_PMD_NR; i++, _pte++) {
+		pte_t pteval = *_pte;
+
+		if (pte_none(pteval)) {
+			get_page(page + i);
+			page_add_file_rmap(page + i);
+			if (vma->vm_flags & VM_LOCKED)
+				mlock_vma_page(page + i);
+			add_mm_counter(mm, MM_FILEPAGES, 1);
+			continue;
+		}
+		if (pte_dirty(pteval))
+			set_page_dirty(page + i);
+		if (pte_young(pteval))
+			young = true;
+		pte_clear(mm, address + i * PAGE_SIZE, _pte);
+	}
+	spin_unlock(ptl);
+	pte_unmap(pte);
+
+	pgtable = pmd_pgtable(_pmd);
+	_pmd = pmd_mkhuge(mk_pmd(page, vma->vm_page_prot));
+	if (young)
+		_pmd = pmd_mkyoung(_pmd);
+
+	spin_lock(&mm->page_table_lock);
+	BUG_ON(!pmd_none(*pmd));
+	set_pmd_at(mm, address, pmd, _pmd);
+	prepare_pmd_huge_pte(pgtable, mm);
+	mm->nr_ptes--;
+	spin_unlock(&mm->page_table_lock);
+
+	khugepaged_pages_collapsed++;
+out:
+	vm_write_end(vma);
+}
+
+static void collapse_huge_file_pmd(struct mm_struct *mm,
+				   unsigned long address,
+				   struct address_space *mapping,
+				   pgoff_t index)
+{
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	int i;
+
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out;
+
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start ||
+	    address + HPAGE_PMD_SIZE > vma->vm_end)
+		goto out;
+	if (!shmem_huge_enabled(vma) || vma->vm_file->f_mapping != mapping ||
+	    linear_page_index(vma, address) != index)
+		goto out;
+	/* the pmd maps a huge page aligned range of the file */
+	if (index & (HPAGE_PMD_NR - 1))
+		goto out;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		goto out;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		goto out;
+	pmd = pmd_offset(pud, address);
+	/* pmd can't go away or become huge under us */
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		goto out;
+
+	/* page lock order is by index, like everywhere else */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		struct page *p = find_lock_page(mapping, index + i);
+
+		if (!i)
+			page = p;
+		if (!p || p != page + i || !PageUptodate(p)) {
+			if (p) {
+				unlock_page(p);
+				page_cache_release(p);
+			}
+			break;
+		}
+	}
+	/*
+	 * truncation waits for the page locks, so this is stable; and the
+	 * pmd maps a huge page aligned physical range, from the first pfn.
+	 */
+	if (i == HPAGE_PMD_NR &&
+	    !(page_to_pfn(page) & (HPAGE_PMD_NR - 1)) &&
+	    index + HPAGE_PMD_NR <= DIV_ROUND_UP(i_size_read(mapping->host),
+						 PAGE_CACHE_SIZE))
+		__collapse_huge_file_pmd(vma, address, pmd, page);
+
+	while (i--) {
+		unlock_page(page + i);
+		page_cache_release(page + i);
+	}
+out:
+	up_write(&mm->mmap_sem);
+}
+
+/*
+ * Returns 1 if the mmap_sem was released, like khugepaged_scan_pmd().
+ */
+static int khugepaged_scan_file_pmd(struct mm_struct *mm,
+				    struct vm_area_struct *vma,
+				    unsigned long address)
+{
+	struct file *file = vma->vm_file;
+	pgoff_t index = linear_page_index(vma, address);
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte, *_pte;
+	spinlock_t *ptl;
+	int present = 0;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return 0;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return 0;
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return 0;
+
+	/* only bother with ranges this mm actually uses */
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	for (_pte = pte; _pte < pte + HPAGE_PMD_NR; _pte++) {
+		if (pte_present(*_pte))
+			present++;
+		else if (!pte_none(*_pte))
+			break;
+	}
+	pte_unmap_unlock(pte, ptl);
+	if (_pte < pte + HPAGE_PMD_NR || !present)
+		return 0;
+
+	get_file(file);
+	up_read(&mm->mmap_sem);
+	if (khugepaged_file_extent(file->f_mapping, index))
+		collapse_huge_file_pmd(mm, address, file->f_mapping, index);
+	fput(file);
+	return 1;
+}
+
 static void collect_mm_slot(struct mm_slot *mm_slot)
 {
 	struct mm_struct *mm = mm_slot->mm;
@@ -2077,14 +2502,17 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			break;
 		}
 
-		if ((!(vma->vm_flags & VM_HUGEPAGE) &&
-		     !khugepaged_always()) ||
-		    (vma->vm_flags & VM_NOHUGEPAGE)) {
+		if (vma->vm_ops) {
+			/* shmem_huge_enabled() checks the pgoff alignment */
+			if (!shmem_huge_enabled(vma))
+				goto skip;
+		} else if ((!(vma->vm_flags & VM_HUGEPAGE) &&
+			    !khugepaged_always()) ||
+			   (vma->vm_flags & VM_NOHUGEPAGE)) {
 		skip:
 			progress++;
 			continue;
-		}
-		if (!vma->anon_vma || vma->vm_ops)
+		} else if (!vma->anon_vma)
 			goto skip;
 		if (is_vma_temporary_stack(vma))
 			goto skip;
@@ -2093,7 +2521,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		 * must be true too, verify it here.
 		 */
 		VM_BUG_ON(is_linear_pfn_mapping(vma) ||
-			  vma->vm_flags & VM_NO_THP);
+			  (!vma->vm_ops && vma->vm_flags & VM_NO_THP));
 
 		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
 		hend = vma->vm_end & HPAGE_PMD_MASK;
@@ -2114,9 +2542,13 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			VM_BUG_ON(khugepaged_scan.address < hstart ||
 				  khugepaged_scan.address + HPAGE_PMD_SIZE >
 				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
-						  hpage);
+			if (vma->vm_ops)
+				ret = khugepaged_scan_file_pmd(mm, vma,
+						khugepaged_scan.address);
+			else
+				ret = khugepaged_scan_pmd(mm, vma,
+						khugepaged_scan.address,
+						hpage);
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
@@ -2317,7 +2749,53 @@ static int khugepaged(void *none)
 	return 0;
 }
 
-void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
+/*
+ * The small pages mapped by a huge pmd of a file already hold their own
+ * references and mapcounts, so the pmd is split by handing it a page
+ * table that maps the same pages with the same protection.  Called with
+ * page_table_lock held.
+ */
+static void __split_huge_file_pmd(struct mm_struct *mm, unsigned long haddr,
+				  pmd_t *pmd)
+{
+	pmd_t orig_pmd = *pmd, _pmd;
+	struct page *page = pmd_page(orig_pmd);
+	pgprot_t prot = pmd_pgprot(orig_pmd);
+	pgtable_t pgtable;
+	unsigned long addr;
+	int i;
+
+	pgtable = get_pmd_huge_pte(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+
+	for (i = 0, addr = haddr; i < HPAGE_PMD_NR; i++, addr += PAGE_SIZE) {
+		pte_t *pte, entry;
+
+		entry = mk_pte(page + i, prot);
+		if (pmd_dirty(orig_pmd))
+			entry = pte_mkdirty(entry);
+		if (pmd_young(orig_pmd))
+			entry = pte_mkyoung(entry);
+		pte = pte_offset_map(&_pmd, addr);
+		BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, addr, pte, entry);
+		pte_unmap(pte);
+	}
+
+	mm->nr_ptes++;
+	smp_wmb(); /* make pte visible before pmd */
+	/*
+	 * Never let huge and small TLB entries for the same address
+	 * coexist, see __split_huge_page_map(). There is no vma here,
+	 * but flush_tlb_range() flushes the whole mm on x86 anyway.
+	 */
+	set_pmd_at(mm, haddr, pmd, pmd_mknotpresent(orig_pmd));
+	flush_tlb_mm(mm);
+	pmd_populate(mm, pmd, pgtable);
+}
+
+void __split_huge_page_pmd(struct mm_struct *mm, unsigned long address,
+			   pmd_t *pmd)
 {
 	struct page *page;
 
@@ -2327,6 +2805,11 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 		return;
 	}
 	page = pmd_page(*pmd);
+	if (!PageAnon(page)) {
+		__split_huge_file_pmd(mm, address & HPAGE_PMD_MASK, pmd);
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
 	VM_BUG_ON(!page_count(page));
 	get_page(page);
 	spin_unlock(&mm->page_table_lock);
@@ -2361,7 +2844,7 @@ static void split_huge_page_address(struct mm_struct *mm,
 	 * Caller holds the mmap_sem write mode, so a huge pmd cannot
 	 * materialize from under us.
 	 */
-	split_huge_page_pmd(mm, pmd);
+	split_huge_page_pmd(mm, address, pmd);
 }
 
 void __vma_adjust_trans_huge(struct vm_area_struct *vma,
@@ -23,7 +23,6 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -36,6 +35,7 @@
 #include <linux/hash.h>
 #include <linux/freezer.h>
 #include <linux/oom.h>
+#include <linux/vmalloc.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -78,6 +78,16 @@
  *    take 10 attempts to find a page in the unstable tree, once it is found,
  *    it is secured in the stable tree.  (When we scan a new page, we first
  *    compare it against the stable tree, and then against the unstable tree.)
+ *
+ * Both trees are really hash tables of rbtrees: a hash of a sample of the
+ * page contents picks the bucket, and only the pages within that bucket are
+ * compared and sorted by their full contents.  Most pages that have no
+ * duplicate land in an empty bucket and are not compared with anything.
+ *
+ * Any number of ksmd threads can scan: they take batches of pages from the
+ * one scan cursor, and work on them in parallel.  Each group of tree
+ * buckets has its own lock, which a thread holds for all of its work on a
+ * page: searching both trees, merging, and inserting into either tree.
  */
 
 /**
@@ -100,14 +110,17 @@ struct mm_slot {
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
  * @seqnr: count of completed full scans (needed when removing unstable node)
+ * @stale: rmap_items dropped from their rmap_list, to be freed
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * There is only the one ksm_scan instance of this cursor structure,
+ * shared by all the ksmd threads under ksm_scan_mutex.
  */
 struct ksm_scan {
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
 	unsigned long seqnr;
+	struct rmap_item *stale;
 };
 
 /**
@@ -115,11 +128,13 @@ struct ksm_scan {
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @checksum: checksum of the ksm page, which picks its stable tree bucket
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	u32 checksum;
 };
 
 /**
@@ -128,7 +143,8 @@ struct stable_node {
  * @anon_vma: pointer to anon_vma for this mm,address, when in stable tree
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
- * @oldchecksum: previous checksum of the page at that virtual address
+ * @oldchecksum: previous checksum of the page at that virtual address,
+ *	which also picks its tree bucket, and so its tree lock
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -152,9 +168,17 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/* The stable and unstable tree buckets, 1 << ksm_tree_shift of each */
+static struct rb_root *root_stable_tree;
+static struct rb_root *root_unstable_tree;
+static unsigned int ksm_tree_shift;
+
+#define KSM_TREE_SHIFT_MIN	10
+#define KSM_TREE_SHIFT_MAX	18
+
+/* The locks of the tree buckets, bucket i taking lock i % KSM_TREE_LOCKS */
+#define KSM_TREE_LOCKS		256
+static struct mutex ksm_tree_locks[KSM_TREE_LOCKS];
 
 #define MM_SLOTS_HASH_SHIFT 10
 #define MM_SLOTS_HASH_HEADS (1 << MM_SLOTS_HASH_SHIFT)
@@ -172,13 +196,13 @@ static struct kmem_cache *stable_node_cache;
 static struct kmem_cache *mm_slot_cache;
 
 /* The number of nodes in the stable tree */
-static unsigned long ksm_pages_shared;
+static atomic_long_t ksm_pages_shared;
 
 /* The number of page slots additionally sharing those nodes */
-static unsigned long ksm_pages_sharing;
+static atomic_long_t ksm_pages_sharing;
 
 /* The number of nodes in the unstable tree */
-static unsigned long ksm_pages_unshared;
+static atomic_long_t ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
 static unsigned long ksm_rmap_items;
@@ -189,13 +213,61 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* The number of pages scanned, and the cpu time ksmd spent on it in ns */
+static unsigned long ksm_pages_scanned;
+static atomic64_t ksm_scan_time;
+
+/* Pages taken from the scan cursor at a time by a ksmd thread */
+#define KSM_SCAN_BATCH		16
+
+#define KSM_MAX_THREADS		64
+
+/**
+ * struct ksm_thread - one of the ksmd threads
+ * @task: the kthread, NULL when this one is not running
+ * @pages_scanned: pages scanned by this thread since it was started
+ * @scan_time: cpu time this thread spent on scanning since then, in ns
+ */
+struct ksm_thread {
+	struct task_struct *task;
+	unsigned long pages_scanned;
+	u64 scan_time;
+};
+
+static struct ksm_thread ksm_threads[KSM_MAX_THREADS];
+static unsigned int ksm_nr_threads;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
 static unsigned int ksm_run = KSM_RUN_STOP;
 
+/*
+ * ksm_thread_sem is held for read by the ksmd threads while they scan,
+ * and for write by those who need all of ksm to themselves: unmerging
+ * everything and memory hotremove.  ksm_threads_mutex serializes starting
+ * and stopping the threads.
+ *
+ * ksm_scan_mutex guards the scan cursor and the rmap_lists.  A thread
+ * takes a batch of rmap_items from the cursor under it, and then works
+ * on them without it.  ksm_scan_batches counts the batches being worked
+ * on, so the cursor can wait for them before it frees an mm_slot, or
+ * ends a full scan.
+ *
+ * The tree locks guard their buckets, the stable_nodes in them and the
+ * tree state of the rmap_items in them: flags, node or head and hlist,
+ * and anon_vma.  The lock for an rmap_item is picked by its oldchecksum,
+ * which only changes while the rmap_item is in no tree, or to a checksum
+ * of the same bucket.  The tree locks nest outside mmap_sem and the page
+ * lock, so the cursor must not take them under mmap_sem: it moves the
+ * rmap_items it drops to ksm_scan.stale, for free_stale_rmap_items().
+ */
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
+static DECLARE_RWSEM(ksm_thread_sem);
+static DEFINE_MUTEX(ksm_threads_mutex);
+static DEFINE_MUTEX(ksm_scan_mutex);
+static atomic_t ksm_scan_batches;
+static DECLARE_WAIT_QUEUE_HEAD(ksm_scan_wait);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
@@ -226,6 +298,51 @@ out:
 	return -ENOMEM;
 }
 
+static int __init ksm_tree_init(void)
+{
+	unsigned long size;
+	int i;
+
+	/* about one bucket for every four pages of memory */
+	ksm_tree_shift = clamp_t(unsigned int, ilog2(totalram_pages) - 2,
+				 KSM_TREE_SHIFT_MIN, KSM_TREE_SHIFT_MAX);
+	size = sizeof(struct rb_root) << ksm_tree_shift;
+
+	root_stable_tree = vzalloc(size);
+	root_unstable_tree = vzalloc(size);
+	if (!root_stable_tree || !root_unstable_tree) {
+		vfree(root_stable_tree);
+		vfree(root_unstable_tree);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < KSM_TREE_LOCKS; i++)
+		mutex_init(&ksm_tree_locks[i]);
+	return 0;
+}
+
+static void __init ksm_tree_free(void)
+{
+	vfree(root_stable_tree);
+	vfree(root_unstable_tree);
+}
+
+static inline struct rb_root *stable_tree_root(u32 checksum)
+{
+	return &root_stable_tree[hash_32(checksum, ksm_tree_shift)];
+}
+
+static inline struct rb_root *unstable_tree_root(u32 checksum)
+{
+	return &root_unstable_tree[hash_32(checksum, ksm_tree_shift)];
+}
+
+static inline struct mutex *ksm_tree_lock(u32 checksum)
+{
+	return &ksm_tree_locks[hash_32(checksum, ksm_tree_shift) %
+			       KSM_TREE_LOCKS];
+}
+
 static void __init ksm_slab_free(void)
 {
 	kmem_cache_destroy(mm_slot_cache);
@@ -450,15 +567,15 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 
 	hlist_for_each_entry(rmap_item, hlist, &stable_node->hlist, hlist) {
 		if (rmap_item->hlist.next)
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
 		cond_resched();
 	}
 
-	rb_erase(&stable_node->node, &root_stable_tree);
+	rb_erase(&stable_node->node, stable_tree_root(stable_node->checksum));
 	free_stable_node(stable_node);
 }
 
@@ -480,7 +597,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
  * a page to put something that might look like our key in page->mapping.
  *
  * include/linux/pagemap.h page_cache_get_speculative() is a good reference,
- * but this is different - made simpler by ksm_thread_mutex being held, but
+ * but this is different - made simpler by the tree lock being held, but
  * interesting for assuming that no other use of the struct page could ever
  * put our expected_mapping into page->mapping (or a field of the union which
  * coincides with page->mapping).  The RCU calls are not for KSM at all, but
@@ -519,8 +636,9 @@ stale:
 /*
  * Removing rmap_item from stable or unstable tree.
  * This function will clean the information from the stable/unstable tree.
+ * The caller holds the tree lock of the rmap_item.
  */
-static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+static void __remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 {
 	if (rmap_item->address & STABLE_FLAG) {
 		struct stable_node *stable_node;
@@ -537,9 +655,9 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		put_page(page);
 
 		if (stable_node->hlist.first)
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
 
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
@@ -556,23 +674,67 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+			rb_erase(&rmap_item->node,
+				 unstable_tree_root(rmap_item->oldchecksum));
 
-		ksm_pages_unshared--;
+		atomic_long_dec(&ksm_pages_unshared);
 		rmap_item->address &= PAGE_MASK;
 	}
 out:
 	cond_resched();		/* we're called from many long loops */
 }
 
+/*
+ * The flags have to be tested under the tree lock: another thread may
+ * hold the rmap_item with its flags cleared, between taking it out of a
+ * tree and putting it into the stable tree or breaking COW on it in
+ * cmp_and_merge_page(), or while remove_node_from_stable_tree() walks
+ * the hlist it is on.  Both hold the lock of its bucket meanwhile.
+ */
+static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+{
+	struct mutex *lock;
+
+again:
+	lock = ksm_tree_lock(ACCESS_ONCE(rmap_item->oldchecksum));
+	mutex_lock(lock);
+	if (unlikely(lock != ksm_tree_lock(rmap_item->oldchecksum))) {
+		mutex_unlock(lock);
+		goto again;
+	}
+	if (rmap_item->address & (STABLE_FLAG | UNSTABLE_FLAG))
+		__remove_rmap_item_from_tree(rmap_item);
+	mutex_unlock(lock);
+}
+
+/*
+ * The rmap_item has been unlinked from its rmap_list, under mmap_sem:
+ * leave it to free_stale_rmap_items() to take it out of the trees.
+ */
+static inline void stale_rmap_item(struct rmap_item *rmap_item)
+{
+	rmap_item->rmap_list = ksm_scan.stale;
+	ksm_scan.stale = rmap_item;
+}
+
+static void free_stale_rmap_items(void)
+{
+	while (ksm_scan.stale) {
+		struct rmap_item *rmap_item = ksm_scan.stale;
+		ksm_scan.stale = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+		cond_resched();
+	}
+}
+
 static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
 				       struct rmap_item **rmap_list)
 {
 	while (*rmap_list) {
 		struct rmap_item *rmap_item = *rmap_list;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		stale_rmap_item(rmap_item);
 	}
 }
 
@@ -650,10 +812,12 @@ static int unmerge_and_remove_all_rmap_items(void)
 			free_mm_slot(mm_slot);
 			clear_bit(MMF_VM_MERGEABLE, &mm->flags);
 			up_read(&mm->mmap_sem);
+			free_stale_rmap_items();
 			mmdrop(mm);
 		} else {
 			spin_unlock(&ksm_mmlist_lock);
 			up_read(&mm->mmap_sem);
+			free_stale_rmap_items();
 		}
 	}
 
@@ -669,13 +833,36 @@ error:
 }
 #endif /* CONFIG_SYSFS */
 
+/*
+ * Hashing the whole page with jhash2 took most of ksmd's time.  Instead,
+ * only every KSM_CHECKSUM_STRIDE-th word of the page is hashed, still
+ * spread over the whole page, by four independent multiply-xor lanes
+ * that the compiler can interleave or vectorize.  That is good enough
+ * both to notice pages that change and to pick a tree bucket: a page
+ * that changed only in words skipped just gets compared in vain.
+ */
+#define KSM_CHECKSUM_STRIDE	4
+#define KSM_CHECKSUM_PRIME	0x9e3779b97f4a7c15ULL
+
 static u32 calc_checksum(struct page *page)
 {
-	u32 checksum;
-	void *addr = kmap_atomic(page, KM_USER0);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
-	kunmap_atomic(addr, KM_USER0);
-	return checksum;
+	u64 h0 = 17, h1 = 19, h2 = 23, h3 = 29;
+	const u64 *p = kmap_atomic(page, KM_USER0);
+	unsigned int i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(u64);
+	     i += 4 * KSM_CHECKSUM_STRIDE) {
+		h0 = (h0 ^ p[i]) * KSM_CHECKSUM_PRIME;
+		h1 = (h1 ^ p[i + KSM_CHECKSUM_STRIDE]) * KSM_CHECKSUM_PRIME;
+		h2 = (h2 ^ p[i + 2 * KSM_CHECKSUM_STRIDE]) * KSM_CHECKSUM_PRIME;
+		h3 = (h3 ^ p[i + 3 * KSM_CHECKSUM_STRIDE]) * KSM_CHECKSUM_PRIME;
+	}
+	kunmap_atomic((void *)p, KM_USER0);
+
+	/* the high bits of the lanes are the well mixed ones */
+	h0 ^= rol64(h1, 16) ^ rol64(h2, 32) ^ rol64(h3, 48);
+	h0 ^= h0 >> 29;
+	return (u32)(h0 >> 32) ^ (u32)h0;
 }
 
 static int memcmp_pages(struct page *page1, struct page *page2)
@@ -983,9 +1170,9 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  * This function returns the stable tree node of identical content if found,
  * NULL otherwise.
  */
-static struct page *stable_tree_search(struct page *page)
+static struct page *stable_tree_search(struct page *page, u32 checksum)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct rb_node *node = stable_tree_root(checksum)->rb_node;
 	struct stable_node *stable_node;
 
 	stable_node = page_stable_node(page);
@@ -1023,15 +1210,25 @@ static struct page *stable_tree_search(struct page *page)
  * stable_tree_insert - insert rmap_item pointing to new ksm page
  * into the stable tree.
  *
+ * The ksm page goes into the bucket of @checksum, the bucket whose lock
+ * the caller holds: so if the page changed since it was checksummed, and
+ * belongs in another bucket, it is not inserted at all.
+ *
  * This function returns the stable tree node just allocated on success,
  * NULL otherwise.
  */
-static struct stable_node *stable_tree_insert(struct page *kpage)
+static struct stable_node *stable_tree_insert(struct page *kpage,
+					      u32 checksum)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	struct rb_root *root = stable_tree_root(checksum);
+	struct rb_node **new = &root->rb_node;
 	struct rb_node *parent = NULL;
 	struct stable_node *stable_node;
 
+	/* kpage is write protected now, so this checksum is for good */
+	if (calc_checksum(kpage) != checksum)
+		return NULL;
+
 	while (*new) {
 		struct page *tree_page;
 		int ret;
@@ -1065,11 +1262,12 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		return NULL;
 
 	rb_link_node(&stable_node->node, parent, new);
-	rb_insert_color(&stable_node->node, &root_stable_tree);
+	rb_insert_color(&stable_node->node, root);
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
 	stable_node->kpfn = page_to_pfn(kpage);
+	stable_node->checksum = checksum;
 	set_page_stable_node(kpage, stable_node);
 
 	return stable_node;
@@ -1087,7 +1285,8 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
  * to the currently scanned page, NULL otherwise.
  *
  * This function does both searching and inserting, because they share
- * the same walking algorithm in an rbtree.
+ * the same walking algorithm in an rbtree.  The rmap_item's oldchecksum
+ * must be the current checksum of the page.
  */
 static
 struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
@@ -1095,7 +1294,8 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 					      struct page **tree_pagep)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	struct rb_root *root = unstable_tree_root(rmap_item->oldchecksum);
+	struct rb_node **new = &root->rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -1135,9 +1335,9 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	rmap_item->address |= UNSTABLE_FLAG;
 	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, root);
 
-	ksm_pages_unshared++;
+	atomic_long_inc(&ksm_pages_unshared);
 	return NULL;
 }
 
@@ -1151,12 +1351,14 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 {
 	rmap_item->head = stable_node;
 	rmap_item->address |= STABLE_FLAG;
+	/* the same bucket as before, so still the same tree lock */
+	rmap_item->oldchecksum = stable_node->checksum;
 	hlist_add_head(&rmap_item->hlist, &stable_node->hlist);
 
 	if (rmap_item->hlist.next)
-		ksm_pages_sharing++;
+		atomic_long_inc(&ksm_pages_sharing);
 	else
-		ksm_pages_shared++;
+		atomic_long_inc(&ksm_pages_shared);
 }
 
 /*
@@ -1175,12 +1377,23 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	struct stable_node *stable_node;
 	struct page *kpage;
 	unsigned int checksum;
+	struct mutex *lock;
 	int err;
 
 	remove_rmap_item_from_tree(rmap_item);
 
+	/* The one checksum serves both trees and the volatility check */
+	checksum = calc_checksum(page);
+
+	/*
+	 * Identical pages have the same checksum, so whatever this page
+	 * can be merged with is in the buckets of this lock.
+	 */
+	lock = ksm_tree_lock(checksum);
+	mutex_lock(lock);
+
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	kpage = stable_tree_search(page, checksum);
 	if (kpage) {
 		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
 		if (!err) {
@@ -1193,7 +1406,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			unlock_page(kpage);
 		}
 		put_page(kpage);
-		return;
+		goto out;
 	}
 
 	/*
@@ -1202,10 +1415,9 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
-		return;
+		goto out;
 	}
 
 	tree_rmap_item =
@@ -1220,10 +1432,10 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		 * tree, and insert it instead as new node in the stable tree.
 		 */
 		if (kpage) {
-			remove_rmap_item_from_tree(tree_rmap_item);
+			__remove_rmap_item_from_tree(tree_rmap_item);
 
 			lock_page(kpage);
-			stable_node = stable_tree_insert(kpage);
+			stable_node = stable_tree_insert(kpage, checksum);
 			if (stable_node) {
 				stable_tree_append(tree_rmap_item, stable_node);
 				stable_tree_append(rmap_item, stable_node);
@@ -1242,6 +1454,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			}
 		}
 	}
+out:
+	mutex_unlock(lock);
 }
 
 static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
@@ -1257,8 +1471,7 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 		if (rmap_item->address > addr)
 			break;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		stale_rmap_item(rmap_item);
 	}
 
 	rmap_item = alloc_rmap_item();
@@ -1272,7 +1485,25 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * Wait for the other ksmd threads to finish the batches they took, and
+ * so to let go of any rmap_item of this full scan: the caller holds
+ * ksm_scan_mutex, so that nobody can take another batch meanwhile.
+ */
+static void ksm_scan_drain(void)
+{
+	wait_event(ksm_scan_wait, !atomic_read(&ksm_scan_batches));
+}
+
+/*
+ * scan_get_next_rmap_item - advance the scan cursor to the next page.
+ *
+ * @batch_started tells that the caller already holds some rmap_items of
+ * this full scan: then we stop short at the end of an mm, where we might
+ * have to wait for all rmap_items to be let go of, and return NULL.
+ */
+static struct rmap_item *scan_get_next_rmap_item(struct page **page,
+						 bool batch_started)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
@@ -1296,7 +1527,8 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 */
 		lru_add_drain_all();
 
-		root_unstable_tree = RB_ROOT;
+		memset(root_unstable_tree, 0,
+		       sizeof(struct rb_root) << ksm_tree_shift);
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1350,6 +1582,7 @@ next_mm:
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
+				free_stale_rmap_items();
 				return rmap_item;
 			}
 			put_page(*page);
@@ -1358,6 +1591,13 @@ next_mm:
 		}
 	}
 
+	if (batch_started) {
+		/* the next call will find its way back here */
+		up_read(&mm->mmap_sem);
+		free_stale_rmap_items();
+		return NULL;
+	}
+
 	if (ksm_test_exit(mm)) {
 		ksm_scan.address = 0;
 		ksm_scan.rmap_list = &slot->rmap_list;
@@ -1388,10 +1628,14 @@ next_mm:
 		free_mm_slot(slot);
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
 		up_read(&mm->mmap_sem);
+		/* other threads may still be merging pages of this mm */
+		ksm_scan_drain();
+		free_stale_rmap_items();
 		mmdrop(mm);
 	} else {
 		spin_unlock(&ksm_mmlist_lock);
 		up_read(&mm->mmap_sem);
+		free_stale_rmap_items();
 	}
 
 	/* Repeat until we've completed scanning the whole list */
@@ -1399,27 +1643,54 @@ next_mm:
 	if (slot != &ksm_mm_head)
 		goto next_mm;
 
+	/*
+	 * Only now that nobody can insert into the unstable tree with this
+	 * seqnr, nor take it as a tree_rmap_item, may the seqnr move on.
+	 */
+	ksm_scan_drain();
 	ksm_scan.seqnr++;
 	return NULL;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @thread - the ksmd thread we are running in.
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_thread *thread, unsigned int scan_npages)
 {
-	struct rmap_item *rmap_item;
-	struct page *uninitialized_var(page);
+	struct rmap_item *rmap_items[KSM_SCAN_BATCH];
+	struct page *pages[KSM_SCAN_BATCH];
+	unsigned int i, nr, batch;
 
-	while (scan_npages-- && likely(!freezing(current))) {
+	while (scan_npages && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
-		if (!rmap_item)
+		batch = min_t(unsigned int, scan_npages, KSM_SCAN_BATCH);
+
+		mutex_lock(&ksm_scan_mutex);
+		for (nr = 0; nr < batch; nr++) {
+			rmap_items[nr] = scan_get_next_rmap_item(&pages[nr], nr);
+			if (!rmap_items[nr])
+				break;
+		}
+		if (nr) {
+			atomic_inc(&ksm_scan_batches);
+			ksm_pages_scanned += nr;
+		}
+		mutex_unlock(&ksm_scan_mutex);
+		if (!nr)
 			return;
-		if (!PageKsm(page) || !in_stable_tree(rmap_item))
-			cmp_and_merge_page(page, rmap_item);
-		put_page(page);
+
+		for (i = 0; i < nr; i++) {
+			if (!PageKsm(pages[i]) || !in_stable_tree(rmap_items[i]))
+				cmp_and_merge_page(pages[i], rmap_items[i]);
+			put_page(pages[i]);
+		}
+		if (atomic_dec_and_test(&ksm_scan_batches))
+			wake_up(&ksm_scan_wait);
+
+		thread->pages_scanned += nr;
+		scan_npages -= nr;
 	}
 }
 
@@ -1428,16 +1699,25 @@ static int ksmd_should_run(void)
 	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_thread *thread = data;
+
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		down_read(&ksm_thread_sem);
+		if (ksmd_should_run()) {
+			u64 start = task_sched_runtime(current);
+			u64 delta;
+
+			ksm_do_scan(thread, ksm_thread_pages_to_scan);
+			delta = task_sched_runtime(current) - start;
+			thread->scan_time += delta;
+			atomic64_add(delta, &ksm_scan_time);
+		}
+		up_read(&ksm_thread_sem);
 
 		try_to_freeze();
 
@@ -1452,6 +1732,43 @@ static int ksm_scan_thread(void *nothing)
 	return 0;
 }
 
+/*
+ * Start or stop ksmd threads until nr are running.  Thread 0 is always
+ * called ksmd, as it was when there was only the one.
+ */
+static int ksm_set_nr_threads(unsigned int nr)
+{
+	struct ksm_thread *thread;
+
+	mutex_lock(&ksm_threads_mutex);
+	while (ksm_nr_threads < nr) {
+		struct task_struct *task;
+
+		thread = &ksm_threads[ksm_nr_threads];
+		thread->pages_scanned = 0;
+		thread->scan_time = 0;
+		if (!ksm_nr_threads)
+			task = kthread_run(ksm_scan_thread, thread, "ksmd");
+		else
+			task = kthread_run(ksm_scan_thread, thread, "ksmd/%u",
+					   ksm_nr_threads);
+		if (IS_ERR(task)) {
+			mutex_unlock(&ksm_threads_mutex);
+			printk(KERN_ERR "ksm: creating kthread failed\n");
+			return PTR_ERR(task);
+		}
+		thread->task = task;
+		ksm_nr_threads++;
+	}
+	while (ksm_nr_threads > nr) {
+		thread = &ksm_threads[--ksm_nr_threads];
+		kthread_stop(thread->task);
+		thread->task = NULL;
+	}
+	mutex_unlock(&ksm_threads_mutex);
+	return 0;
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1760,40 +2077,45 @@ void ksm_migrate_page(struct page *newpage, struct page *oldpage)
 #endif /* CONFIG_MIGRATION */
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
-static struct stable_node *ksm_check_stable_tree(unsigned long start_pfn,
-						 unsigned long end_pfn)
+static void ksm_check_stable_tree(unsigned long start_pfn,
+				  unsigned long end_pfn)
 {
 	struct rb_node *node;
-
-	for (node = rb_first(&root_stable_tree); node; node = rb_next(node)) {
-		struct stable_node *stable_node;
-
-		stable_node = rb_entry(node, struct stable_node, node);
-		if (stable_node->kpfn >= start_pfn &&
-		    stable_node->kpfn < end_pfn)
-			return stable_node;
+	unsigned long i;
+
+	for (i = 0; i < (1UL << ksm_tree_shift); i++) {
+		node = rb_first(&root_stable_tree[i]);
+		while (node) {
+			struct stable_node *stable_node;
+
+			stable_node = rb_entry(node, struct stable_node, node);
+			/* the next node stays in the tree when this one goes */
+			node = rb_next(node);
+			if (stable_node->kpfn >= start_pfn &&
+			    stable_node->kpfn < end_pfn)
+				remove_node_from_stable_tree(stable_node);
+		}
+		cond_resched();
 	}
-	return NULL;
 }
 
 static int ksm_memory_callback(struct notifier_block *self,
 			       unsigned long action, void *arg)
 {
 	struct memory_notify *mn = arg;
-	struct stable_node *stable_node;
 
 	switch (action) {
 	case MEM_GOING_OFFLINE:
 		/*
 		 * Keep it very simple for now: just lock out ksmd and
 		 * MADV_UNMERGEABLE while any memory is going offline.
-		 * mutex_lock_nested() is necessary because lockdep was alarmed
-		 * that here we take ksm_thread_mutex inside notifier chain
+		 * down_write_nested() is necessary because lockdep was alarmed
+		 * that here we take ksm_thread_sem inside notifier chain
 		 * mutex, and later take notifier chain mutex inside
-		 * ksm_thread_mutex to unlock it.   But that's safe because both
+		 * ksm_thread_sem to unlock it.   But that's safe because both
 		 * are inside mem_hotplug_mutex.
 		 */
-		mutex_lock_nested(&ksm_thread_mutex, SINGLE_DEPTH_NESTING);
+		down_write_nested(&ksm_thread_sem, SINGLE_DEPTH_NESTING);
 		break;
 
 	case MEM_OFFLINE:
@@ -1802,13 +2124,12 @@ static int ksm_memory_callback(struct notifier_block *self,
 		 * be a few stable_nodes left over, still pointing to struct
 		 * pages which have been offlined: prune those from the tree.
 		 */
-		while ((stable_node = ksm_check_stable_tree(mn->start_pfn,
-					mn->start_pfn + mn->nr_pages)) != NULL)
-			remove_node_from_stable_tree(stable_node);
+		ksm_check_stable_tree(mn->start_pfn,
+				      mn->start_pfn + mn->nr_pages);
 		/* fallthrough */
 
 	case MEM_CANCEL_OFFLINE:
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		break;
 	}
 	return NOTIFY_OK;
@@ -1897,7 +2218,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	if (ksm_run != flags) {
 		ksm_run = flags;
 		if (flags & KSM_RUN_UNMERGE) {
@@ -1912,7 +2233,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -1921,24 +2242,49 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 }
 KSM_ATTR(run);
 
+static ssize_t scan_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_threads);
+}
+
+static ssize_t scan_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	unsigned long nr_threads;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr_threads);
+	if (err || !nr_threads || nr_threads > KSM_MAX_THREADS)
+		return -EINVAL;
+
+	err = ksm_set_nr_threads(nr_threads);
+	if (err)
+		return err;
+
+	return count;
+}
+KSM_ATTR(scan_threads);
+
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_shared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_shared));
 }
 KSM_ATTR_RO(pages_shared);
 
 static ssize_t pages_sharing_show(struct kobject *kobj,
 				  struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_sharing);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_sharing));
 }
 KSM_ATTR_RO(pages_sharing);
 
 static ssize_t pages_unshared_show(struct kobject *kobj,
 				   struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_unshared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_unshared));
 }
 KSM_ATTR_RO(pages_unshared);
 
@@ -1947,8 +2293,10 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
-				- ksm_pages_sharing - ksm_pages_unshared;
+	ksm_pages_volatile = ksm_rmap_items
+				- atomic_long_read(&ksm_pages_shared)
+				- atomic_long_read(&ksm_pages_sharing)
+				- atomic_long_read(&ksm_pages_unshared);
 	/*
 	 * It was not worth any locking to calculate that statistic,
 	 * but it might therefore sometimes be negative: conceal that.
@@ -1966,6 +2314,52 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t scan_cpu_msecs_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n", div_u64(atomic64_read(&ksm_scan_time),
+					      NSEC_PER_MSEC));
+}
+KSM_ATTR_RO(scan_cpu_msecs);
+
+static ssize_t scan_rate_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	u64 scan_time = atomic64_read(&ksm_scan_time);
+	u64 rate = 0;
+
+	if (scan_time)
+		rate = div64_u64((u64)ksm_pages_scanned * NSEC_PER_SEC,
+				 scan_time);
+	return sprintf(buf, "%llu\n", rate);
+}
+KSM_ATTR_RO(scan_rate);
+
+/* One line per ksmd thread: pages scanned, and cpu msecs spent on it */
+static ssize_t thread_stats_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	ssize_t ret = 0;
+	unsigned int i;
+
+	mutex_lock(&ksm_threads_mutex);
+	for (i = 0; i < ksm_nr_threads; i++)
+		ret += sprintf(buf + ret, "%lu %llu\n",
+			       ksm_threads[i].pages_scanned,
+			       div_u64(ksm_threads[i].scan_time,
+				       NSEC_PER_MSEC));
+	mutex_unlock(&ksm_threads_mutex);
+	return ret;
+}
+KSM_ATTR_RO(thread_stats);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -1975,6 +2369,11 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&pages_scanned_attr.attr,
+	&scan_cpu_msecs_attr.attr,
+	&scan_rate_attr.attr,
+	&scan_threads_attr.attr,
+	&thread_stats_attr.attr,
 	NULL,
 };
 
@@ -1986,26 +2385,26 @@ static struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
 	int err;
 
 	err = ksm_slab_init();
 	if (err)
 		goto out;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
-		printk(KERN_ERR "ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
+	err = ksm_tree_init();
+	if (err)
 		goto out_free;
-	}
+
+	err = ksm_set_nr_threads(1);
+	if (err)
+		goto out_free_tree;
 
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		printk(KERN_ERR "ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
-		goto out_free;
+		ksm_set_nr_threads(0);
+		goto out_free_tree;
 	}
 #else
 	ksm_run = KSM_RUN_MERGE;	/* no way for user to start it */
@@ -2014,13 +2413,15 @@ static int __init ksm_init(void)
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
 	/*
-	 * Choose a high priority since the callback takes ksm_thread_mutex:
+	 * Choose a high priority since the callback takes ksm_thread_sem:
 	 * later callbacks could only be taking locks which nest within that.
 	 */
 	hotplug_memory_notifier(ksm_memory_callback, 100);
 #endif
 	return 0;
 
+out_free_tree:
+	ksm_tree_free();
 out_free:
 	ksm_slab_free();
 out:
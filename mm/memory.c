@@ -57,6 +57,7 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/file.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -205,6 +206,9 @@ static int tlb_next_batch(struct mmu_gather *tlb)
 		return 1;
 	}
 
+	if (tlb->batch_count == MAX_GATHER_BATCH_COUNT)
+		return 0;
+
 	batch = (void *)__get_free_pages(GFP_NOWAIT | __GFP_NOWARN, 0);
 	if (!batch)
 		return 0;
@@ -213,6 +217,7 @@ static int tlb_next_batch(struct mmu_gather *tlb)
 	batch->nr   = 0;
 	batch->max  = MAX_GATHER_BATCH;
 
+	tlb->batch_count++;
 	tlb->active->next = batch;
 	tlb->active = batch;
 
@@ -235,6 +240,8 @@ void tlb_gather_mmu(struct mmu_gather *tlb, struct mm_struct *mm, bool fullmm)
 	tlb->local.nr   = 0;
 	tlb->local.max  = ARRAY_SIZE(tlb->__pages);
 	tlb->active     = &tlb->local;
+	tlb->batch_count = 0;
+	__tlb_reset_range(tlb);
 
 #ifdef CONFIG_HAVE_RCU_TABLE_FREE
 	tlb->batch = NULL;
@@ -249,6 +256,7 @@ void tlb_flush_mmu(struct mmu_gather *tlb)
 		return;
 	tlb->need_flush = 0;
 	tlb_flush(tlb);
+	__tlb_reset_range(tlb);
 #ifdef CONFIG_HAVE_RCU_TABLE_FREE
 	tlb_table_flush(tlb);
 #endif
@@ -1229,9 +1237,10 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		next = pmd_addr_end(addr, end);
 		if (pmd_trans_huge(*pmd)) {
 			if (next-addr != HPAGE_PMD_SIZE) {
-				VM_BUG_ON(!rwsem_is_locked(&tlb->mm->mmap_sem));
-				split_huge_page_pmd(vma->vm_mm, pmd);
-			} else if (zap_huge_pmd(tlb, vma, pmd))
+				VM_BUG_ON(!vma->vm_ops &&
+					  !rwsem_is_locked(&tlb->mm->mmap_sem));
+				split_huge_page_pmd(vma->vm_mm, addr, pmd);
+			} else if (zap_huge_pmd(tlb, vma, pmd, addr))
 				continue;
 			/* fall through */
 		}
@@ -1475,7 +1484,7 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	}
 	if (pmd_trans_huge(*pmd)) {
 		if (flags & FOLL_SPLIT) {
-			split_huge_page_pmd(mm, pmd);
+			split_huge_page_pmd(mm, address, pmd);
 			goto split_fallthrough;
 		}
 		spin_lock(&mm->page_table_lock);
@@ -1484,7 +1493,7 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 				spin_unlock(&mm->page_table_lock);
 				wait_split_huge_page(vma->anon_vma, pmd);
 			} else {
-				page = follow_trans_huge_pmd(mm, address,
+				page = follow_trans_huge_pmd(vma, address,
 							     pmd, flags);
 				spin_unlock(&mm->page_table_lock);
 				goto out;
@@ -3464,7 +3473,11 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+	if (pmd_none(*pmd) && vma->vm_ops && vma->vm_ops->pmd_fault) {
+		int ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
 		if (!vma->vm_ops)
 			return do_huge_pmd_anonymous_page(mm, vma, address,
 							  pmd, flags);
@@ -3474,10 +3487,14 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		if (pmd_trans_huge(orig_pmd)) {
 			if (flags & FAULT_FLAG_WRITE &&
 			    !pmd_write(orig_pmd) &&
-			    !pmd_trans_splitting(orig_pmd))
-				return do_huge_pmd_wp_page(mm, vma, address,
-							   pmd, orig_pmd);
-			return 0;
+			    !pmd_trans_splitting(orig_pmd)) {
+				if (!vma->vm_ops)
+					return do_huge_pmd_wp_page(mm, vma,
+							address, pmd, orig_pmd);
+				/* file pages are written through small ptes */
+				split_huge_page_pmd(mm, address, pmd);
+			} else
+				return 0;
 		}
 	}
 
@@ -3502,6 +3519,273 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Like find_vma(), but only returns a vma that contains @addr, and does
+ * neither use nor update mmap_cache.  Called under mm_rb_lock.
+ */
+static struct vm_area_struct *spf_find_vma(struct mm_struct *mm,
+					   unsigned long addr)
+{
+	struct rb_node *rb_node = mm->mm_rb.rb_node;
+
+	while (rb_node) {
+		struct vm_area_struct *vma;
+
+		vma = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (addr < vma->vm_start)
+			rb_node = rb_node->rb_left;
+		else if (addr >= vma->vm_end)
+			rb_node = rb_node->rb_right;
+		else
+			return vma;
+	}
+	return NULL;
+}
+
+/*
+ * read_seqcount_begin() would wait for an odd count to become even,
+ * but vmas being unmapped stay odd until they are freed.
+ */
+static inline unsigned spf_read_seqbegin(struct vm_area_struct *vma)
+{
+	unsigned seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+
+	smp_rmb();
+	return seq;
+}
+
+/* Can the fault be handled from the snapshot of the vma alone? */
+static bool spf_vma_ok(struct vm_area_struct *vma, unsigned int flags)
+{
+	if (vma->vm_flags & (VM_GROWSDOWN | VM_GROWSUP | VM_HUGETLB |
+			     VM_PFNMAP | VM_MIXEDMAP | VM_NONLINEAR |
+			     VM_LOCKED | VM_IO))
+		return false;
+	/* the allocation policy could go away under us */
+	if (vma_policy(vma))
+		return false;
+
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vma->vm_flags & VM_WRITE))
+			return false;
+	} else if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		return false;
+
+	/* anonymous: a write needs the anon_vma to be set up already */
+	if (!vma->vm_ops)
+		return !vma->vm_file &&
+			(!(flags & FAULT_FLAG_WRITE) || vma->anon_vma);
+
+	/* file: only read faults on plain page cache, no COW */
+	return !(flags & FAULT_FLAG_WRITE) && vma->vm_file &&
+		vma->vm_ops->fault == filemap_fault;
+}
+
+/*
+ * Is @vma still linked at @address with the same sequence count as when
+ * @snap was taken?  The fields are compared too, so a vma freed and
+ * reallocated at the same spot in the meantime cannot pass.
+ */
+static bool spf_vma_unchanged(struct mm_struct *mm, unsigned long address,
+			      struct vm_area_struct *vma,
+			      struct vm_area_struct *snap, unsigned seq)
+{
+	bool ret;
+
+	read_lock(&mm->mm_rb_lock);
+	ret = spf_find_vma(mm, address) == vma &&
+		spf_read_seqbegin(vma) == seq &&
+		vma->vm_start == snap->vm_start &&
+		vma->vm_end == snap->vm_end &&
+		vma->vm_flags == snap->vm_flags &&
+		pgprot_val(vma->vm_page_prot) ==
+			pgprot_val(snap->vm_page_prot) &&
+		vma->vm_pgoff == snap->vm_pgoff &&
+		vma->vm_file == snap->vm_file &&
+		vma->vm_ops == snap->vm_ops &&
+		vma->anon_vma == snap->anon_vma;
+	read_unlock(&mm->mm_rb_lock);
+	return ret;
+}
+
+/*
+ * Try to handle a fault on a pte_none() entry without mmap_sem, so that
+ * threads faulting memory in do not have to wait behind mmap, munmap or
+ * mprotect in another thread.
+ *
+ * The vma is looked up under mm_rb_lock and copied, and the copy is used
+ * as long as the vma's sequence count has not moved: every change to a
+ * linked vma that matters here bumps it, and unmapping leaves it odd.
+ * The page tables are walked with interrupts disabled, like gup_fast,
+ * which keeps them from being freed, and the vma is checked once more
+ * with the pte lock held before the pte is set.  Anything else, page
+ * table allocation, COW, swap, page cache misses and readahead marks,
+ * huge pmds, is left to the regular path.
+ *
+ * Returns VM_FAULT_RETRY if the fault has to be handled under mmap_sem.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma, snap;
+	struct address_space *mapping = NULL;
+	struct page *page = NULL;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t *pte, entry;
+	spinlock_t *ptl;
+	pgoff_t pgoff;
+	unsigned seq;
+
+	__set_current_state(TASK_RUNNING);
+
+	read_lock(&mm->mm_rb_lock);
+	vma = spf_find_vma(mm, address);
+	if (!vma)
+		goto out_unlock_rb;
+	seq = spf_read_seqbegin(vma);
+	if (seq & 1)
+		goto out_unlock_rb;
+	snap = *vma;
+	if (read_seqcount_retry(&vma->vm_sequence, seq))
+		goto out_unlock_rb;
+	if (!spf_vma_ok(&snap, flags))
+		goto out_unlock_rb;
+	if (snap.vm_file)
+		get_file(snap.vm_file);
+	read_unlock(&mm->mm_rb_lock);
+
+	check_sync_rss_stat(current);
+
+	if (!snap.vm_ops && (flags & FAULT_FLAG_WRITE)) {
+		page = alloc_zeroed_user_highpage_movable(&snap, address);
+		if (!page)
+			goto out;
+		__SetPageUptodate(page);
+		if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			page = NULL;
+			goto out;
+		}
+		entry = mk_pte(page, snap.vm_page_prot);
+		entry = pte_mkwrite(pte_mkdirty(entry));
+	} else if (!snap.vm_ops) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+						snap.vm_page_prot));
+	} else {
+		mapping = snap.vm_file->f_mapping;
+		pgoff = linear_page_index(&snap, address);
+		page = find_get_page(mapping, pgoff);
+		if (!page)
+			goto out;
+		/*
+		 * filemap_fault() starts the next async readahead batch on
+		 * a PG_readahead page, so leave those to it; other hits are
+		 * accounted as do_async_mmap_readahead() would.
+		 */
+		if (PageReadahead(page)) {
+			page_cache_release(page);
+			page = NULL;
+			goto out;
+		}
+		if (!VM_RandomReadHint(&snap) && snap.vm_file->f_ra.mmap_miss > 0)
+			snap.vm_file->f_ra.mmap_miss--;
+		if (!trylock_page(page)) {
+			page_cache_release(page);
+			page = NULL;
+			goto out;
+		}
+		/* truncation waits for the page lock, as in filemap_fault */
+		if (page->mapping != mapping || !PageUptodate(page) ||
+		    PageTransCompound(page) ||
+		    pgoff >= DIV_ROUND_UP(i_size_read(mapping->host),
+					  PAGE_CACHE_SIZE))
+			goto out_page;
+		entry = mk_pte(page, snap.vm_page_prot);
+	}
+
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out_walk;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out_walk;
+	pmd = pmd_offset(pud, address);
+	pmdval = *pmd;
+	barrier();
+	/* page table allocation and huge pmds need mmap_sem */
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) || pmd_bad(pmdval))
+		goto out_walk;
+
+	/*
+	 * Only try the lock: its holder may be waiting for us to take
+	 * a TLB flush IPI.
+	 */
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto out_walk;
+	}
+	if (!pmd_same(pmdval, *pmd) || !pte_none(*pte) ||
+	    !spf_vma_unchanged(mm, address, vma, &snap, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out_walk;
+	}
+	/*
+	 * Whoever changes the vma from here on has to take the pte lock
+	 * to get at this pte, and will see it.
+	 */
+	local_irq_enable();
+
+	if (!snap.vm_ops && (flags & FAULT_FLAG_WRITE)) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, &snap, address);
+	} else if (snap.vm_ops) {
+		inc_mm_counter_fast(mm, MM_FILEPAGES);
+		page_add_file_rmap(page);
+	}
+	set_pte_at(mm, address, pte, entry);
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(&snap, address, pte);
+	pte_unmap_unlock(pte, ptl);
+
+	if (mapping)
+		unlock_page(page);
+	if (snap.vm_file)
+		fput(snap.vm_file);
+
+	count_vm_event(PGFAULT);
+	mem_cgroup_count_vm_event(mm, PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	return 0;
+
+out_walk:
+	local_irq_enable();
+out_page:
+	if (page) {
+		if (mapping)
+			unlock_page(page);
+		else
+			mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+out:
+	if (snap.vm_file)
+		fput(snap.vm_file);
+	count_vm_event(SPECULATIVE_PGFAULT_FALLBACK);
+	return VM_FAULT_RETRY;
+
+out_unlock_rb:
+	read_unlock(&mm->mm_rb_lock);
+	count_vm_event(SPECULATIVE_PGFAULT_FALLBACK);
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -134,6 +134,7 @@ int pageblock_order __read_mostly;
 #endif
 
 static void __free_pages_ok(struct page *page, unsigned int order);
+static void free_pcp_page(struct page *page, unsigned int order, int cold);
 
 /*
  * results with 256, 32 in the lowmem_reserve sysctl:
@@ -579,10 +580,31 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+/*
+ * Take zone->lock, counting how often it was found held already.
+ * Interrupts must be disabled.
+ */
+static inline void lock_zone(struct zone *zone)
+{
+	if (!spin_trylock(&zone->lock)) {
+		__count_zone_vm_events(ZONE_LOCK_CONTENDED, zone, 1);
+		spin_lock(&zone->lock);
+	}
+	__count_zone_vm_events(ZONE_LOCK, zone, 1);
+}
+
+/* The pcp list of an order and migrate type, orders kept apart */
+static inline struct list_head *pcp_list(struct per_cpu_pages *pcp,
+					 unsigned int order, int migratetype)
+{
+	return &pcp->lists[order * MIGRATE_PCPTYPES + migratetype];
+}
+
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone.
+ * count is the number of pages to free, pages of a higher order count
+ * for all their base pages, so a few more may be freed than asked for.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -593,17 +615,19 @@ static inline int free_pages_check(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	int pindex = 0;
 	int batch_free = 0;
-	int to_free = count;
+	int to_free = min(count, pcp->count);
+	int freed = 0, freed_high = 0;
 
-	spin_lock(&zone->lock);
+	lock_zone(zone);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 
-	while (to_free) {
+	while (to_free > 0) {
 		struct page *page;
 		struct list_head *list;
+		unsigned int order;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -614,32 +638,39 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == NR_PCP_LISTS)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
 		/* This is the only non-empty list. Free them all. */
-		if (batch_free == MIGRATE_PCPTYPES)
+		if (batch_free == NR_PCP_LISTS)
 			batch_free = to_free;
 
+		order = pindex / MIGRATE_PCPTYPES;
 		do {
 			page = list_entry(list->prev, struct page, lru);
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
-		} while (--to_free && --batch_free && !list_empty(list));
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order, page_private(page));
+			to_free -= 1 << order;
+			freed += 1 << order;
+			if (order)
+				freed_high += 1 << order;
+		} while (to_free > 0 && --batch_free && !list_empty(list));
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
+	pcp->count -= freed;
+	__mod_zone_page_state(zone, NR_FREE_PAGES, freed);
+	__mod_zone_page_state(zone, NR_PCP_HIGH_ORDER, -freed_high);
 	spin_unlock(&zone->lock);
 }
 
 static void free_one_page(struct zone *zone, struct page *page, int order,
 				int migratetype)
 {
-	spin_lock(&zone->lock);
+	lock_zone(zone);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 
@@ -677,8 +708,14 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
-	int wasMlocked = __TestClearPageMlocked(page);
+	int wasMlocked;
 
+	if (order <= PAGE_ALLOC_COSTLY_ORDER) {
+		free_pcp_page(page, order, 0);
+		return;
+	}
+
+	wasMlocked = __TestClearPageMlocked(page);
 	if (!free_pages_prepare(page, order))
 		return;
 
@@ -1025,7 +1062,7 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 {
 	int i;
 	
-	spin_lock(&zone->lock);
+	lock_zone(zone);
 	for (i = 0; i < count; ++i) {
 		struct page *page = __rmqueue(zone, order, migratetype);
 		if (unlikely(page == NULL))
@@ -1072,7 +1109,6 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 	else
 		to_drain = pcp->count;
 	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
 	local_irq_restore(flags);
 }
 #endif
@@ -1097,10 +1133,8 @@ static void drain_pages(unsigned int cpu)
 		pset = per_cpu_ptr(zone->pageset, cpu);
 
 		pcp = &pset->pcp;
-		if (pcp->count) {
+		if (pcp->count)
 			free_pcppages_bulk(zone, pcp->count, pcp);
-			pcp->count = 0;
-		}
 		local_irq_restore(flags);
 	}
 }
@@ -1158,10 +1192,10 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Free a page of up to PAGE_ALLOC_COSTLY_ORDER to the pcp lists
  * cold == 1 ? free a cold page : free a hot page
  */
-void free_hot_cold_page(struct page *page, int cold)
+static void free_pcp_page(struct page *page, unsigned int order, int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
@@ -1169,7 +1203,15 @@ void free_hot_cold_page(struct page *page, int cold)
 	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
-	if (!free_pages_prepare(page, 0))
+	/*
+	 * Pages on the pcp lists are handed out again without going
+	 * through __free_one_page(), so a compound page is torn down here.
+	 */
+	if (unlikely(PageCompound(page)) &&
+	    unlikely(destroy_compound_page(page, order)))
+		return;
+
+	if (!free_pages_prepare(page, order))
 		return;
 
 	migratetype = get_pageblock_migratetype(page);
@@ -1177,7 +1219,7 @@ void free_hot_cold_page(struct page *page, int cold)
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1188,27 +1230,47 @@ void free_hot_cold_page(struct page *page, int cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
-			free_one_page(zone, page, 0, migratetype);
+			free_one_page(zone, page, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
+	/*
+	 * Below the low watermark a higher order page is worth more
+	 * merged back into the buddy lists, where high-order allocations
+	 * and compaction can see it, than kept for this cpu.
+	 */
+	if (order && zone_page_state(zone, NR_FREE_PAGES) <
+						low_wmark_pages(zone)) {
+		free_one_page(zone, page, order, migratetype);
+		goto out;
+	}
+
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
 	if (cold)
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
+		list_add_tail(&page->lru, pcp_list(pcp, order, migratetype));
 	else
-		list_add(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
+		list_add(&page->lru, pcp_list(pcp, order, migratetype));
+	pcp->count += 1 << order;
+	if (order)
+		__mod_zone_page_state(zone, NR_PCP_HIGH_ORDER, 1 << order);
+	if (pcp->count >= pcp->high)
 		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
-	}
 
 out:
 	local_irq_restore(flags);
 }
 
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	free_pcp_page(page, 0, cold);
+}
+
 /*
  * split_page takes a non-compound higher-order page, and splits it into
  * n (1<<order) sub-pages: page[0..n]
@@ -1296,18 +1358,39 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	struct page *page;
 	int cold = !!(gfp_flags & __GFP_COLD);
 
+	if (unlikely(gfp_flags & __GFP_NOFAIL)) {
+		/*
+		 * __GFP_NOFAIL is not to be used in new code.
+		 *
+		 * All __GFP_NOFAIL callers should be fixed so that they
+		 * properly detect and handle allocation failures.
+		 *
+		 * We most definitely don't want callers attempting to
+		 * allocate greater than order-1 page units with
+		 * __GFP_NOFAIL.
+		 */
+		WARN_ON_ONCE(order > 1);
+	}
+
 again:
-	if (likely(order == 0)) {
+	if (likely(order <= PAGE_ALLOC_COSTLY_ORDER)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
-		list = &pcp->lists[migratetype];
+		list = pcp_list(pcp, order, migratetype);
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			/* a batch worth of base pages, but at least two */
+			int batch = max(pcp->batch >> order, 2);
+			int added;
+
+			added = rmqueue_bulk(zone, order, batch, list,
+					     migratetype, cold) << order;
+			pcp->count += added;
+			if (order)
+				__mod_zone_page_state(zone, NR_PCP_HIGH_ORDER,
+						      added);
 			if (unlikely(list_empty(list)))
 				goto failed;
 		}
@@ -1318,22 +1401,13 @@ again:
 			page = list_entry(list->next, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
+		pcp->count -= 1 << order;
+		if (order)
+			__mod_zone_page_state(zone, NR_PCP_HIGH_ORDER,
+					      -(1 << order));
 	} else {
-		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
-			/*
-			 * __GFP_NOFAIL is not to be used in new code.
-			 *
-			 * All __GFP_NOFAIL callers should be fixed so that they
-			 * properly detect and handle allocation failures.
-			 *
-			 * We most definitely don't want callers attempting to
-			 * allocate greater than order-1 page units with
-			 * __GFP_NOFAIL.
-			 */
-			WARN_ON_ONCE(order > 1);
-		}
-		spin_lock_irqsave(&zone->lock, flags);
+		local_irq_save(flags);
+		lock_zone(zone);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
 		if (!page)
@@ -1472,8 +1546,14 @@ static bool __zone_watermark_ok(struct zone *z, int order, unsigned long mark,
 {
 	/* free_pages my go negative - that's OK */
 	long min = mark;
+	long pcp_high = zone_page_state(z, NR_PCP_HIGH_ORDER);
 	int o;
 
+	/*
+	 * Higher order pages on the pcp lists are free memory, but may be
+	 * on another cpu's list: count them towards the order-0 mark only.
+	 */
+	free_pages += pcp_high;
 	free_pages -= (1 << order) + 1;
 	if (alloc_flags & ALLOC_HIGH)
 		min -= min / 2;
@@ -1485,6 +1565,8 @@ static bool __zone_watermark_ok(struct zone *z, int order, unsigned long mark,
 	for (o = 0; o < order; o++) {
 		/* At the next order, this order's pages become unavailable */
 		free_pages -= z->free_area[o].nr_free << o;
+		if (!o)
+			free_pages -= pcp_high;
 
 		/* Require fewer higher order pages to be free */
 		min >>= 1;
@@ -1891,6 +1973,27 @@ out:
 	return page;
 }
 
+/*
+ * Higher order pages parked on the pcp lists are invisible to the buddy
+ * lists that high-order allocations and compaction look at.  Give them
+ * back before compacting or reclaiming for such an allocation.
+ */
+static bool drain_high_order_pcp(struct zonelist *zonelist,
+			enum zone_type high_zoneidx, nodemask_t *nodemask)
+{
+	struct zoneref *z;
+	struct zone *zone;
+
+	for_each_zone_zonelist_nodemask(zone, z, zonelist,
+					high_zoneidx, nodemask) {
+		if (zone_page_state(zone, NR_PCP_HIGH_ORDER)) {
+			drain_all_pages();
+			return true;
+		}
+	}
+	return false;
+}
+
 #ifdef CONFIG_COMPACTION
 /* Try memory compaction for high-order allocations before reclaim */
 static struct page *
@@ -2037,8 +2140,11 @@ void wake_all_kswapd(unsigned int order, struct zonelist *zonelist,
 	struct zoneref *z;
 	struct zone *zone;
 
-	for_each_zone_zonelist(zone, z, zonelist, high_zoneidx)
+	for_each_zone_zonelist(zone, z, zonelist, high_zoneidx) {
 		wakeup_kswapd(zone, order, classzone_idx);
+		if (order)
+			wakeup_kcompactd(zone, order);
+	}
 }
 
 static inline int
@@ -2167,6 +2273,15 @@ rebalance:
 	if (test_thread_flag(TIF_MEMDIE) && !(gfp_mask & __GFP_NOFAIL))
 		goto nopage;
 
+	if (order && drain_high_order_pcp(zonelist, high_zoneidx, nodemask)) {
+		page = get_page_from_freelist(gfp_mask, nodemask, order,
+				zonelist, high_zoneidx,
+				alloc_flags & ~ALLOC_NO_WATERMARKS,
+				preferred_zone, migratetype);
+		if (page)
+			goto got_pg;
+	}
+
 	/*
 	 * Try direct compaction. The first pass is asynchronous. Subsequent
 	 * attempts after direct reclaim are synchronous
@@ -2313,6 +2428,167 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+/**
+ * __alloc_pages_bulk - allocate a number of order-0 pages at once
+ * @gfp_mask: GFP flags for the allocation
+ * @nid: node to allocate from, or -1 for the current node
+ * @nr_pages: number of pages the list or array should end up with
+ * @page_list: list to add the pages to, or NULL
+ * @page_array: array to put the pages in, or NULL
+ *
+ * The pages come from the pcp list of the first zone that is above its
+ * low watermark by @nr_pages, and the pcp list is refilled with what is
+ * missing, up to its high mark, in one hold of zone->lock.  Interrupts
+ * stay disabled meanwhile, so ask for a few hundred pages at a time.
+ *
+ * Entries of @page_array that are not NULL are left alone and count as
+ * allocated, so the remainder can be asked for with the same array.
+ *
+ * Only the fast path is tried in bulk.  If no zone has pages to spare,
+ * or the task has a memory policy and @nid is -1, a single page is
+ * allocated the usual way, reclaiming if @gfp_mask allows.  Callers
+ * must cope with getting fewer pages than they asked for.
+ *
+ * Returns the number of pages on the list or in the array.
+ */
+unsigned long __alloc_pages_bulk(gfp_t gfp_mask, int nid,
+				 unsigned long nr_pages,
+				 struct list_head *page_list,
+				 struct page **page_array)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	int migratetype = allocflags_to_migratetype(gfp_mask);
+	int cold = !!(gfp_mask & __GFP_COLD);
+	struct zone *preferred_zone, *zone;
+	struct zonelist *zonelist;
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
+	struct page *page, *next;
+	struct zoneref *z;
+	unsigned long nr_populated = 0, nr_taken = 0, i;
+	unsigned long flags;
+	LIST_HEAD(pages);
+
+	if (page_array) {
+		for (i = 0; i < nr_pages; i++)
+			if (page_array[i])
+				nr_populated++;
+	}
+	if (nr_populated == nr_pages)
+		return nr_populated;
+
+	/* Not worth the trouble for a single page */
+	if (nr_pages - nr_populated == 1)
+		goto failed;
+#ifdef CONFIG_NUMA
+	/* The policy decides where every page goes */
+	if (nid < 0 && current->mempolicy)
+		goto failed;
+#endif
+
+	gfp_mask &= gfp_allowed_mask;
+	lockdep_trace_alloc(gfp_mask);
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+	if (should_fail_alloc_page(gfp_mask, 0))
+		goto failed;
+
+	zonelist = node_zonelist(nid < 0 ? numa_node_id() : nid, gfp_mask);
+	if (unlikely(!zonelist->_zonerefs->zone))
+		goto failed;
+
+	get_mems_allowed();
+	/* The preferred zone is used for statistics */
+	first_zones_zonelist(zonelist, high_zoneidx,
+			     &cpuset_current_mems_allowed, &preferred_zone);
+	if (!preferred_zone) {
+		put_mems_allowed();
+		goto failed;
+	}
+
+	for_each_zone_zonelist(zone, z, zonelist, high_zoneidx) {
+		if (!cpuset_zone_allowed_softwall(zone,
+						  gfp_mask | __GFP_HARDWALL))
+			continue;
+		if (zone_watermark_ok(zone, 0,
+				      low_wmark_pages(zone) + nr_pages,
+				      zone_idx(preferred_zone), 0))
+			break;
+	}
+	if (!zone) {
+		put_mems_allowed();
+		goto failed;
+	}
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = pcp_list(pcp, 0, migratetype);
+	while (nr_populated + nr_taken < nr_pages) {
+		if (list_empty(list)) {
+			unsigned long missing;
+			int batch;
+
+			missing = nr_pages - nr_populated - nr_taken;
+			batch = max_t(int, pcp->batch, min_t(unsigned long,
+						missing, pcp->high));
+			pcp->count += rmqueue_bulk(zone, 0, batch, list,
+						   migratetype, cold);
+			if (unlikely(list_empty(list)))
+				break;
+		}
+
+		if (cold)
+			page = list_entry(list->prev, struct page, lru);
+		else
+			page = list_entry(list->next, struct page, lru);
+		list_move_tail(&page->lru, &pages);
+		pcp->count--;
+		zone_statistics(preferred_zone, zone, gfp_mask);
+		nr_taken++;
+	}
+	if (nr_taken)
+		__count_zone_vm_events(PGALLOC, zone, nr_taken);
+	local_irq_restore(flags);
+	put_mems_allowed();
+
+	i = 0;
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		list_del(&page->lru);
+		/* A bad page is left alone, as buffered_rmqueue() does */
+		if (prep_new_page(page, 0, gfp_mask))
+			continue;
+		trace_mm_page_alloc(page, 0, gfp_mask, migratetype);
+
+		if (page_list) {
+			list_add_tail(&page->lru, page_list);
+		} else {
+			while (page_array[i])
+				i++;
+			page_array[i] = page;
+		}
+		nr_populated++;
+	}
+	if (nr_taken)
+		return nr_populated;
+
+failed:
+	if (nid < 0)
+		page = alloc_page(gfp_mask);
+	else
+		page = alloc_pages_node(nid, gfp_mask, 0);
+	if (!page)
+		return nr_populated;
+
+	if (page_list) {
+		list_add_tail(&page->lru, page_list);
+	} else {
+		for (i = 0; page_array[i]; i++)
+			;
+		page_array[i] = page;
+	}
+	return nr_populated + 1;
+}
+EXPORT_SYMBOL(__alloc_pages_bulk);
+
 /*
  * Common helper functions.
  */
@@ -3580,7 +3856,7 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
@@ -3588,8 +3864,8 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 /*
@@ -4301,6 +4577,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat_resize_init(pgdat);
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	pgdat->kswapd_max_order = 0;
 	pgdat_page_cgroup_init(pgdat);
 	
@@ -4358,7 +4637,7 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 
 		zone_pcp_init(zone);
 		for_each_lru(l)
-			INIT_LIST_HEAD(&zone->lru[l].list);
+			INIT_LIST_HEAD(&zone->lruvec.lists[l]);
 		zone->reclaim_stat.recent_rotated[0] = 0;
 		zone->reclaim_stat.recent_rotated[1] = 0;
 		zone->reclaim_stat.recent_scanned[0] = 0;
@@ -562,3 +562,213 @@ page_cache_async_readahead(struct address_space *mapping,
 	ondemand_readahead(mapping, ra, filp, true, offset, req_size);
 }
 EXPORT_SYMBOL_GPL(page_cache_async_readahead);
+
+/*
+ * mmap pattern readahead
+ *
+ * Page faults on mmap'ed index files and the like are often neither
+ * sequential nor fully random, and neither the readahead logic above nor
+ * the read-around done for mmap faults does much for them.  Two patterns
+ * are worth catching:
+ *
+ * - Strided: the misses walk through the file at a constant distance,
+ *   e.g. one field out of an array of large records.  Once the same
+ *   distance has been seen MMAP_STRIDE_HITS times in a row, the next few
+ *   pages of the stride are read in one go, and the one in the middle
+ *   gets PG_readahead so that the next batch is read asynchronously.
+ *
+ * - Hot clusters: random misses that concentrate in a few regions of the
+ *   file.  Read-around is turned off once mmap_miss says that the file is
+ *   accessed randomly, but it still pays off in a region where a good part
+ *   of the pages is cached already.  The page cache is sampled at
+ *   MMAP_CLUSTER_PROBES points around the miss to find out.
+ */
+#define MMAP_STRIDE_HITS	2
+#define MMAP_CLUSTER_PROBES	8
+#define MMAP_CLUSTER_HOT	2
+
+/* # of pages read per stride batch */
+static unsigned long stride_batch_pages(struct file_ra_state *ra)
+{
+	return max(max_sane_readahead(ra->ra_pages) / 4, 2UL);
+}
+
+/*
+ * Read @nr_to_read pages that are @stride pages apart, starting at @offset,
+ * and set PG_readahead on the one at index @mark of the batch.  A negative
+ * stride that runs past the start of the file wraps around to an offset
+ * beyond i_size and ends the batch.
+ */
+static int
+__do_page_cache_stride_readahead(struct address_space *mapping,
+			struct file *filp, pgoff_t offset, long stride,
+			unsigned long nr_to_read, unsigned long mark)
+{
+	struct inode *inode = mapping->host;
+	struct page *page;
+	unsigned long end_index;
+	LIST_HEAD(page_pool);
+	unsigned long i;
+	int ret = 0;
+	loff_t isize = i_size_read(inode);
+
+	if (isize == 0)
+		return 0;
+
+	end_index = ((isize - 1) >> PAGE_CACHE_SHIFT);
+
+	for (i = 0; i < nr_to_read; i++, offset += stride) {
+		if (offset > end_index)
+			break;
+
+		rcu_read_lock();
+		page = radix_tree_lookup(&mapping->page_tree, offset);
+		rcu_read_unlock();
+		if (page)
+			continue;
+
+		page = page_cache_alloc_readahead(mapping);
+		if (!page)
+			break;
+		page->index = offset;
+		list_add(&page->lru, &page_pool);
+		if (i == mark)
+			SetPageReadahead(page);
+		ret++;
+	}
+
+	if (ret)
+		read_pages(mapping, filp, &page_pool, ret);
+	BUG_ON(!list_empty(&page_pool));
+	return ret;
+}
+
+static void stride_readahead(struct address_space *mapping,
+			     struct file_ra_state *ra, struct file *filp,
+			     pgoff_t offset)
+{
+	unsigned long nr = stride_batch_pages(ra);
+
+	__do_page_cache_stride_readahead(mapping, filp, offset,
+					 ra->mmap_stride, nr, nr / 2);
+	ra->mmap_stride_next = offset + ra->mmap_stride * nr;
+}
+
+/**
+ * page_cache_stride_readahead - readahead for strided mmap misses
+ * @mapping: address_space which holds the pagecache and I/O vectors
+ * @ra: file_ra_state which holds the readahead state
+ * @filp: passed on to ->readpage() and ->readpages()
+ * @offset: offset of the missing page, in pagecache page-sized units
+ *
+ * Called on every page cache miss of an mmap fault to track the distance
+ * between the misses.  Returns true if @offset continues a stride, in which
+ * case the page and the next ones of the stride have been submitted.
+ */
+bool page_cache_stride_readahead(struct address_space *mapping,
+				 struct file_ra_state *ra, struct file *filp,
+				 pgoff_t offset)
+{
+	long delta = offset - ra->mmap_prev;
+	long stride = ra->mmap_stride;
+
+	ra->mmap_prev = offset;
+
+	/* sequential misses are left to read-around */
+	if (delta >= -1 && delta <= 1) {
+		ra->mmap_stride_hits = 0;
+		return false;
+	}
+
+	/*
+	 * Once the stride is established, a miss further down the same
+	 * stride, e.g. behind the last batch, keeps it going.
+	 */
+	if (delta != stride &&
+	    (ra->mmap_stride_hits < MMAP_STRIDE_HITS ||
+	     delta % stride || delta / stride < 0)) {
+		ra->mmap_stride = delta;
+		ra->mmap_stride_hits = 0;
+		return false;
+	}
+
+	if (ra->mmap_stride_hits < MMAP_STRIDE_HITS &&
+	    ++ra->mmap_stride_hits < MMAP_STRIDE_HITS)
+		return false;
+
+	stride_readahead(mapping, ra, filp, offset);
+	return true;
+}
+EXPORT_SYMBOL_GPL(page_cache_stride_readahead);
+
+/**
+ * page_cache_stride_async_readahead - continue strided mmap readahead
+ * @mapping: address_space which holds the pagecache and I/O vectors
+ * @ra: file_ra_state which holds the readahead state
+ * @filp: passed on to ->readpage() and ->readpages()
+ * @page: the page at @offset which has the PG_readahead flag set
+ * @offset: start offset into @mapping, in pagecache page-sized units
+ *
+ * Returns true if the PG_readahead marker on @page was set by the last
+ * stride batch, in which case the next batch has been submitted.
+ */
+bool page_cache_stride_async_readahead(struct address_space *mapping,
+				       struct file_ra_state *ra,
+				       struct file *filp, struct page *page,
+				       pgoff_t offset)
+{
+	long stride = ra->mmap_stride;
+	long ahead = ra->mmap_stride_next - offset;
+
+	if (ra->mmap_stride_hits < MMAP_STRIDE_HITS)
+		return false;
+	if (ahead % stride || ahead / stride <= 0 ||
+	    ahead / stride > stride_batch_pages(ra))
+		return false;
+
+	/*
+	 * Same bit is used for PG_readahead and PG_reclaim.
+	 */
+	if (PageWriteback(page))
+		return true;
+
+	ClearPageReadahead(page);
+	ra->mmap_prev = offset;
+
+	if (bdi_read_congested(mapping->backing_dev_info))
+		return true;
+
+	stride_readahead(mapping, ra, filp, ra->mmap_stride_next);
+	return true;
+}
+EXPORT_SYMBOL_GPL(page_cache_stride_async_readahead);
+
+/**
+ * page_cache_hot_cluster - check for cached pages around an mmap miss
+ * @mapping: address_space which holds the pagecache
+ * @ra: file_ra_state which holds the readahead state
+ * @offset: offset of the missing page, in pagecache page-sized units
+ *
+ * Samples the read-around window of @offset and returns true if enough of
+ * it is cached to make read-around worthwhile, even on a file that is
+ * otherwise accessed randomly.
+ */
+bool page_cache_hot_cluster(struct address_space *mapping,
+			    struct file_ra_state *ra, pgoff_t offset)
+{
+	unsigned long ra_pages = max_sane_readahead(ra->ra_pages);
+	unsigned long step = max(ra_pages / MMAP_CLUSTER_PROBES, 1UL);
+	pgoff_t start = max_t(long, 0, offset - ra_pages / 2);
+	unsigned long i;
+	int cached = 0;
+
+	rcu_read_lock();
+	for (i = 0; i < ra_pages; i += step) {
+		if (radix_tree_lookup(&mapping->page_tree, start + i))
+			cached++;
+	}
+	rcu_read_unlock();
+
+	return cached >= MMAP_CLUSTER_HOT;
+}
+EXPORT_SYMBOL_GPL(page_cache_hot_cluster);
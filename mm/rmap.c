@@ -597,8 +597,16 @@ pte_t *__page_check_address(struct page *page, struct mm_struct *mm,
 	pmd = pmd_offset(pud, address);
 	if (!pmd_present(*pmd))
 		return NULL;
-	if (pmd_trans_huge(*pmd))
-		return NULL;
+	if (pmd_trans_huge(*pmd)) {
+		if (PageAnon(page))
+			return NULL;
+		/*
+		 * Small file pages mapped by a huge pmd: the pmd is
+		 * turned into a page table with the same pages, which
+		 * khugepaged can put back together cheaply later.
+		 */
+		split_huge_page_pmd(mm, address, pmd);
+	}
 
 	pte = pte_offset_map(pmd, address);
 	/* Make a quick check before getting the lock */
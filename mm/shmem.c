@@ -60,6 +60,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
+#include <linux/khugepaged.h>
 
 #include <asm/uaccess.h>
 #include <asm/div64.h>
@@ -1200,6 +1201,23 @@ static struct page *shmem_alloc_page(gfp_t gfp,
 	 */
 	return alloc_page_vma(gfp, &pvma, 0);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, unsigned long idx)
+{
+	struct vm_area_struct pvma;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	pvma.vm_pgoff = idx;
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, idx);
+
+	return alloc_pages_vma(gfp, HPAGE_PMD_ORDER, &pvma, 0,
+			       numa_node_id());
+}
+#endif
 #else /* !CONFIG_NUMA */
 #ifdef CONFIG_TMPFS
 static inline void shmem_show_mpol(struct seq_file *seq, struct mempolicy *p)
@@ -1218,6 +1236,14 @@ static inline struct page *shmem_alloc_page(gfp_t gfp,
 {
 	return alloc_page(gfp);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static inline struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, unsigned long idx)
+{
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+}
+#endif
 #endif /* CONFIG_NUMA */
 
 #if !defined(CONFIG_NUMA) || !defined(CONFIG_TMPFS)
@@ -1228,28 +1254,41 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 #endif
 
 /*
- * shmem_getpage - either get the page from swap or allocate a new one
+ * __shmem_getpage - either get the page from swap or allocate a new one
  *
  * If we allocate a new one we do not mark it dirty. That's up to the
  * vm. If we swap it in we mark it dirty since we also free the swap
  * entry since a page cannot live in both the swap and page cache
+ *
+ * A new page is taken from @prealloc_page if that is given, which is
+ * how shmem_pmd_fault() puts a huge extent together; it is released if
+ * it ends up unused.
  */
-static int shmem_getpage(struct inode *inode, unsigned long idx,
-			struct page **pagep, enum sgp_type sgp, int *type)
+static int __shmem_getpage(struct inode *inode, unsigned long idx,
+			struct page **pagep, enum sgp_type sgp, int *type,
+			struct page *prealloc_page)
 {
 	struct address_space *mapping = inode->i_mapping;
 	struct shmem_inode_info *info = SHMEM_I(inode);
 	struct shmem_sb_info *sbinfo;
 	struct page *filepage = *pagep;
 	struct page *swappage;
-	struct page *prealloc_page = NULL;
 	swp_entry_t *entry;
 	swp_entry_t swap;
 	gfp_t gfp;
 	int error;
 
-	if (idx >= SHMEM_MAX_INDEX)
+	if (idx >= SHMEM_MAX_INDEX) {
+		if (prealloc_page)
+			page_cache_release(prealloc_page);
 		return -EFBIG;
+	}
+
+	if (prealloc_page && mem_cgroup_cache_charge(prealloc_page,
+						     current->mm, GFP_KERNEL)) {
+		page_cache_release(prealloc_page);
+		prealloc_page = NULL;
+	}
 
 	if (type)
 		*type = 0;
@@ -1536,6 +1575,12 @@ out:
 	return error;
 }
 
+static int shmem_getpage(struct inode *inode, unsigned long idx,
+			struct page **pagep, enum sgp_type sgp, int *type)
+{
+	return __shmem_getpage(inode, idx, pagep, sgp, type, NULL);
+}
+
 static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
 	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
@@ -1555,6 +1600,243 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret | VM_FAULT_LOCKED;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Huge pages in tmpfs are not compound pages.  An extent of HPAGE_PMD_NR
+ * pages at a HPAGE_PMD_NR aligned index is allocated as one naturally
+ * aligned block that is split into small pages right away, and each of
+ * them goes into the page cache like any other shmem page.  As long as
+ * the extent stays together like that it is mapped with a huge pmd, see
+ * set_huge_pmd_file(); truncation, swap and migration just see small
+ * pages, and a pmd mapping some of them is split into ptes on demand.
+ * khugepaged puts extents back together when they got scattered.
+ */
+bool shmem_huge_enabled(struct vm_area_struct *vma)
+{
+	struct inode *inode;
+
+	if (!vma->vm_file || vma->vm_file->f_mapping->a_ops != &shmem_aops)
+		return false;
+	/* private mappings and remap_file_pages() are left to ptes */
+	if (!(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & (VM_CAN_NONLINEAR | VM_NOHUGEPAGE)))
+		return false;
+	inode = vma->vm_file->f_path.dentry->d_inode;
+	if (!SHMEM_SB(inode->i_sb)->huge)
+		return false;
+	return !(((vma->vm_start >> PAGE_SHIFT) - vma->vm_pgoff) &
+		 (HPAGE_PMD_NR - 1));
+}
+
+static bool shmem_huge_extent_empty(struct address_space *mapping,
+				    pgoff_t index)
+{
+	struct page *page;
+	bool empty = true;
+
+	if (SHMEM_I(mapping->host)->swapped)
+		return false;
+	if (find_get_pages(mapping, index, 1, &page)) {
+		empty = page->index >= index + HPAGE_PMD_NR;
+		page_cache_release(page);
+	}
+	return empty;
+}
+
+/*
+ * Fill an empty extent from a new block. Returns the first page, with
+ * all of them locked and referenced, or NULL.
+ */
+static struct page *shmem_alloc_huge_extent(struct vm_area_struct *vma,
+					    struct inode *inode, pgoff_t index)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct page *block, *page;
+	gfp_t gfp;
+	int i, j;
+
+	gfp = mapping_gfp_mask(mapping) | __GFP_NOMEMALLOC | __GFP_NORETRY |
+		__GFP_NOWARN | __GFP_NO_KSWAPD;
+	if (!transparent_hugepage_defrag(vma))
+		gfp &= ~__GFP_WAIT;
+	block = shmem_alloc_hugepage(gfp, SHMEM_I(inode), index);
+	if (!block)
+		return NULL;
+	count_vm_event(THP_FILE_ALLOC);
+	split_page(block, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = NULL;
+		/* block + i is used or released by __shmem_getpage */
+		if (__shmem_getpage(inode, index + i, &page, SGP_CACHE, NULL,
+				    block + i))
+			break;
+		if (page != block + i) {
+			unlock_page(page);
+			page_cache_release(page);
+			break;
+		}
+	}
+	if (i == HPAGE_PMD_NR)
+		return block;
+
+	for (j = i + 1; j < HPAGE_PMD_NR; j++)
+		__free_page(block + j);
+	while (i--) {
+		unlock_page(block + i);
+		page_cache_release(block + i);
+	}
+	return NULL;
+}
+
+/*
+ * Lock an extent that is already populated. Returns the first page if
+ * it is one aligned block, with all of them locked and referenced.
+ */
+static struct page *shmem_lock_huge_extent(struct address_space *mapping,
+					   pgoff_t index)
+{
+	struct page *first = NULL, *page;
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = find_lock_page(mapping, index + i);
+		if (!page)
+			break;
+		if (!i && !(page_to_pfn(page) & (HPAGE_PMD_NR - 1)))
+			first = page;
+		if (page != first + i || !PageUptodate(page)) {
+			unlock_page(page);
+			page_cache_release(page);
+			break;
+		}
+	}
+	if (i == HPAGE_PMD_NR)
+		return first;
+
+	while (i--) {
+		unlock_page(first + i);
+		page_cache_release(first + i);
+	}
+	return NULL;
+}
+
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	struct address_space *mapping = inode->i_mapping;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgoff_t index;
+	int ret, i;
+
+	if (!shmem_huge_enabled(vma))
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	/* the whole extent has to be inside the file */
+	index = linear_page_index(vma, haddr);
+	if (index + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+		return VM_FAULT_FALLBACK;
+	if (unlikely(khugepaged_enter_file(vma)))
+		return VM_FAULT_OOM;
+
+	if (shmem_huge_extent_empty(mapping, index))
+		page = shmem_alloc_huge_extent(vma, inode, index);
+	else
+		page = shmem_lock_huge_extent(mapping, index);
+	if (!page)
+		return VM_FAULT_FALLBACK;
+
+	/* truncation waits for the page locks before it frees the pages */
+	if (index + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+		ret = VM_FAULT_FALLBACK;
+	else
+		ret = set_huge_pmd_file(vma, address, pmd, page, flags);
+
+	/* the references are the mapping's now, unless it failed */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unlock_page(page + i);
+		if (ret)
+			page_cache_release(page + i);
+	}
+	if (!ret)
+		count_vm_event(THP_FILE_MAPPED);
+	return ret;
+}
+
+static ssize_t shmem_enabled_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	if (!IS_ERR_OR_NULL(shm_mnt) && SHMEM_SB(shm_mnt->mnt_sb)->huge)
+		return sprintf(buf, "[always] never\n");
+	return sprintf(buf, "always [never]\n");
+}
+
+static ssize_t shmem_enabled_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	bool huge;
+
+	if (!memcmp("always", buf, min(sizeof("always")-1, count)))
+		huge = true;
+	else if (!memcmp("never", buf, min(sizeof("never")-1, count)))
+		huge = false;
+	else
+		return -EINVAL;
+	if (IS_ERR_OR_NULL(shm_mnt))
+		return -ENODEV;
+	SHMEM_SB(shm_mnt->mnt_sb)->huge = huge;
+	return count;
+}
+
+/*
+ * SysV shm and shared anonymous mappings live on the internal mount,
+ * this sets its huge= option.
+ */
+struct kobj_attribute shmem_enabled_attr =
+	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
+
+/*
+ * Place mappings of huge tmpfs files so that the file offset and the
+ * address agree modulo HPAGE_PMD_SIZE, which is what the pmds need.
+ */
+static unsigned long shmem_get_unmapped_area(struct file *file,
+		unsigned long addr, unsigned long len,
+		unsigned long pgoff, unsigned long flags)
+{
+	unsigned long (*get_area)(struct file *, unsigned long,
+				  unsigned long, unsigned long, unsigned long);
+	unsigned long inflated_len, inflated_addr, offset;
+	struct inode *inode = file->f_path.dentry->d_inode;
+
+	get_area = current->mm->get_unmapped_area;
+	addr = get_area(file, addr, len, pgoff, flags);
+	if (IS_ERR_VALUE(addr) || (flags & MAP_FIXED))
+		return addr;
+	if (!SHMEM_SB(inode->i_sb)->huge || len < HPAGE_PMD_SIZE)
+		return addr;
+	if (!((addr - (pgoff << PAGE_SHIFT)) & ~HPAGE_PMD_MASK))
+		return addr;
+
+	inflated_len = len + HPAGE_PMD_SIZE - PAGE_SIZE;
+	if (inflated_len < len || inflated_len > TASK_SIZE)
+		return addr;
+	inflated_addr = get_area(NULL, 0, inflated_len, 0, flags);
+	if (IS_ERR_VALUE(inflated_addr))
+		return addr;
+
+	offset = (inflated_addr - (pgoff << PAGE_SHIFT)) & ~HPAGE_PMD_MASK;
+	if (offset)
+		inflated_addr += HPAGE_PMD_SIZE - offset;
+	return inflated_addr;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *new)
 {
@@ -1601,9 +1883,13 @@ out_nomem:
 
 static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 {
+	struct inode *inode = file->f_path.dentry->d_inode;
+
 	file_accessed(file);
 	vma->vm_ops = &shmem_vm_ops;
-	vma->vm_flags |= VM_CAN_NONLINEAR;
+	/* a nonlinear vma could not be mapped with huge pmds */
+	if (!SHMEM_SB(inode->i_sb)->huge)
+		vma->vm_flags |= VM_CAN_NONLINEAR;
 	return 0;
 }
 
@@ -2477,6 +2763,17 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		} else if (!strcmp(this_char,"huge")) {
+			if (!strcmp(value, "always"))
+				sbinfo->huge = true;
+			else if (!strcmp(value, "never"))
+				sbinfo->huge = false;
+			else
+				goto bad_val;
+			if (sbinfo->huge && !has_transparent_hugepage())
+				goto bad_val;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2523,6 +2820,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge        = config.huge;
 
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
@@ -2546,6 +2844,8 @@ static int shmem_show_options(struct seq_file *seq, struct vfsmount *vfs)
 		seq_printf(seq, ",uid=%u", sbinfo->uid);
 	if (sbinfo->gid != 0)
 		seq_printf(seq, ",gid=%u", sbinfo->gid);
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=always");
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2694,6 +2994,9 @@ static const struct address_space_operations shmem_aops = {
 
 static const struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.get_unmapped_area = shmem_get_unmapped_area,
+#endif
 #ifdef CONFIG_TMPFS
 	.llseek		= generic_file_llseek,
 	.read		= do_sync_read,
@@ -2773,6 +3076,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
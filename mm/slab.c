@@ -3809,6 +3809,82 @@ void kmem_cache_free(struct kmem_cache *cachep, void *objp)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/**
+ * kmem_cache_alloc_bulk - Allocate an array of objects
+ * @cachep: The cache to allocate from.
+ * @flags: See kmalloc().
+ * @nr: The number of objects to allocate.
+ * @p: The array the objects are stored in.
+ *
+ * All objects are taken from the per cpu array cache with interrupts
+ * disabled only once.  Returns @nr, or 0 if not all objects could be
+ * allocated, in which case none are.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *cachep, gfp_t flags, size_t nr,
+			  void **p)
+{
+	unsigned long save_flags;
+	size_t i, allocated;
+
+	flags &= gfp_allowed_mask;
+
+	lockdep_trace_alloc(flags);
+
+	if (slab_should_failslab(cachep, flags))
+		return 0;
+
+	cache_alloc_debugcheck_before(cachep, flags);
+	local_irq_save(save_flags);
+	for (allocated = 0; allocated < nr; allocated++) {
+		p[allocated] = __do_cache_alloc(cachep, flags);
+		if (unlikely(!p[allocated]))
+			break;
+	}
+	local_irq_restore(save_flags);
+
+	for (i = 0; i < allocated; i++) {
+		p[i] = cache_alloc_debugcheck_after(cachep, flags, p[i],
+						    __builtin_return_address(0));
+		kmemleak_alloc_recursive(p[i], obj_size(cachep), 1,
+					 cachep->flags, flags);
+		kmemcheck_slab_alloc(cachep, flags, p[i], obj_size(cachep));
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[i], 0, obj_size(cachep));
+	}
+
+	if (unlikely(allocated < nr)) {
+		kmem_cache_free_bulk(cachep, allocated, p);
+		return 0;
+	}
+	return nr;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
+/**
+ * kmem_cache_free_bulk - Deallocate an array of objects
+ * @cachep: The cache the allocations were from.
+ * @nr: The number of objects to free.
+ * @p: The previously allocated objects.
+ *
+ * Like kmem_cache_free() for every object, but with interrupts disabled
+ * only once for the whole array.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *cachep, size_t nr, void **p)
+{
+	unsigned long flags;
+	size_t i;
+
+	local_irq_save(flags);
+	for (i = 0; i < nr; i++) {
+		debug_check_no_locks_freed(p[i], obj_size(cachep));
+		if (!(cachep->flags & SLAB_DEBUG_OBJECTS))
+			debug_check_no_obj_freed(p[i], obj_size(cachep));
+		__cache_free(cachep, p[i], __builtin_return_address(0));
+	}
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
 /**
  * kfree - free previously allocated memory
  * @objp: pointer returned by kmalloc.
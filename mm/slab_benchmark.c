@@ -0,0 +1,176 @@
+/*
+ * slab allocator benchmark
+ *
+ * Times kmem_cache_alloc() and kmem_cache_free() on a private cache
+ * for three patterns:
+ *
+ *  same:   every object is freed right after it was allocated on the
+ *          same cpu, which should never leave the per cpu fast path.
+ *  bulk:   a batch of objects is allocated and then freed again on the
+ *          same cpu, which walks through many slabs and exercises the
+ *          slow paths and the partial lists.
+ *  remote: a batch allocated on one cpu is freed on another one, which
+ *          is what the per cpu partial lists and the lockless frees
+ *          are meant to help with.
+ *
+ * The average number of cycles per allocation or free, or per pair for
+ * the same cpu pattern, is printed to the kernel log when the module is
+ * loaded.  The module does not stay loaded afterwards.
+ */
+#include <linux/workqueue.h>
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/cpumask.h>
+#include <linux/timex.h>
+
+static unsigned int size = 64;
+module_param(size, uint, 0444);
+MODULE_PARM_DESC(size, "Object size in bytes");
+
+static unsigned int nr_objs = 10000;
+module_param(nr_objs, uint, 0444);
+MODULE_PARM_DESC(nr_objs, "# of objects per batch");
+
+static unsigned int loops = 10;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "# of times each pattern is repeated");
+
+static struct kmem_cache *bench_cache;
+static void **bench_objs;
+
+struct bench_call {
+	void			(*fn)(struct bench_call *call);
+	unsigned long long	cycles;
+	unsigned int		failed;
+};
+
+static void bench_same(struct bench_call *call)
+{
+	cycles_t start = get_cycles();
+	unsigned int i;
+	void *p;
+
+	for (i = 0; i < nr_objs; i++) {
+		p = kmem_cache_alloc(bench_cache, GFP_KERNEL);
+		if (!p) {
+			call->failed++;
+			continue;
+		}
+		kmem_cache_free(bench_cache, p);
+	}
+	call->cycles += get_cycles() - start;
+}
+
+static void bench_alloc(struct bench_call *call)
+{
+	cycles_t start = get_cycles();
+	unsigned int i;
+
+	for (i = 0; i < nr_objs; i++) {
+		bench_objs[i] = kmem_cache_alloc(bench_cache, GFP_KERNEL);
+		if (!bench_objs[i])
+			call->failed++;
+	}
+	call->cycles += get_cycles() - start;
+}
+
+static void bench_free(struct bench_call *call)
+{
+	cycles_t start = get_cycles();
+	unsigned int i;
+
+	for (i = 0; i < nr_objs; i++) {
+		if (bench_objs[i])
+			kmem_cache_free(bench_cache, bench_objs[i]);
+	}
+	call->cycles += get_cycles() - start;
+}
+
+static long bench_call_fn(void *data)
+{
+	struct bench_call *call = data;
+
+	call->fn(call);
+	return 0;
+}
+
+/* run @call->fn on @cpu and wait for it */
+static void bench_run_on(struct bench_call *call, int cpu)
+{
+	work_on_cpu(cpu, bench_call_fn, call);
+}
+
+static void bench_report(const char *name, struct bench_call *call)
+{
+	unsigned long long ops = (unsigned long long)nr_objs * loops;
+
+	do_div(call->cycles, ops);
+	printk(KERN_INFO "slab_benchmark: %-12s %llu cycles/op%s\n",
+	       name, call->cycles, call->failed ? " (allocations failed)" : "");
+}
+
+static int __init slab_benchmark_init(void)
+{
+	struct bench_call same = { .fn = bench_same };
+	struct bench_call alloc = { .fn = bench_alloc };
+	struct bench_call free = { .fn = bench_free };
+	struct bench_call remote_alloc = { .fn = bench_alloc };
+	struct bench_call remote = { .fn = bench_free };
+	int local_cpu, remote_cpu;
+	unsigned int i;
+	int ret = -EAGAIN;
+
+	if (!size || !nr_objs || !loops)
+		return -EINVAL;
+
+	bench_objs = vmalloc(nr_objs * sizeof(void *));
+	if (!bench_objs)
+		return -ENOMEM;
+
+	bench_cache = kmem_cache_create("slab_benchmark", size, 0, 0, NULL);
+	if (!bench_cache) {
+		ret = -ENOMEM;
+		goto out_objs;
+	}
+
+	get_online_cpus();
+	local_cpu = cpumask_first(cpu_online_mask);
+	remote_cpu = cpumask_next(local_cpu, cpu_online_mask);
+
+	for (i = 0; i < loops; i++) {
+		bench_run_on(&same, local_cpu);
+		bench_run_on(&alloc, local_cpu);
+		bench_run_on(&free, local_cpu);
+
+		if (remote_cpu >= nr_cpu_ids)
+			continue;
+
+		/* same as the bulk alloc above, only the frees are reported */
+		bench_run_on(&remote_alloc, local_cpu);
+		bench_run_on(&remote, remote_cpu);
+	}
+	put_online_cpus();
+
+	printk(KERN_INFO "slab_benchmark: %u byte objects, batches of %u, %u loops\n",
+	       kmem_cache_size(bench_cache), nr_objs, loops);
+	bench_report("same cpu", &same);
+	bench_report("bulk alloc", &alloc);
+	bench_report("bulk free", &free);
+	if (remote_cpu < nr_cpu_ids)
+		bench_report("remote free", &remote);
+	else
+		printk(KERN_INFO "slab_benchmark: remote free needs two online cpus\n");
+
+	kmem_cache_destroy(bench_cache);
+out_objs:
+	vfree(bench_objs);
+	return ret;
+}
+
+module_init(slab_benchmark_init);
+
+MODULE_DESCRIPTION("slab allocator benchmark");
+MODULE_LICENSE("GPL");
@@ -246,7 +246,6 @@ EXPORT_SYMBOL(vmalloc_to_pfn);
 /*** Global kva allocator ***/
 
 #define VM_LAZY_FREE	0x01
-#define VM_LAZY_FREEING	0x02
 #define VM_VM_AREA	0x04
 
 struct vmap_area {
@@ -255,23 +254,39 @@ struct vmap_area {
 	unsigned long flags;
 	struct rb_node rb_node;		/* address sorted rbtree */
 	struct list_head list;		/* address sorted list */
-	struct list_head purge_list;	/* "lazy purge" list */
+	struct list_head purge_list;	/* "lazy purge" or cache list */
 	void *private;
 	struct rcu_head rcu_head;
+	unsigned long hole;		/* free space right below va_start */
+	unsigned long subtree_max_hole;	/* largest hole in rb subtree */
 };
 
 static DEFINE_SPINLOCK(vmap_area_lock);
 static LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
-
 static unsigned long vmap_area_pcpu_hole;
 
+/*
+ * Lazily freed vmap areas wait on a list of the cpu that freed them until
+ * the next purge.  Once purged, areas of up to VMAP_CACHE_PAGES pages are
+ * not given back to the rbtree right away, but kept for reuse by that cpu,
+ * up to VMAP_CACHE_DEPTH of each size: so that a vmalloc of a small size
+ * freed recently takes neither vmap_area_lock nor a search of the tree.
+ */
+#define VMAP_CACHE_PAGES	8
+#define VMAP_CACHE_DEPTH	16
+
+struct vmap_area_pcpu {
+	spinlock_t lock;
+	struct list_head lazy;		/* freed, waiting for the purge */
+	struct list_head purging;	/* taken by the running purge */
+	struct list_head cache[VMAP_CACHE_PAGES];	/* by size in pages */
+	unsigned int nr_cached[VMAP_CACHE_PAGES];
+};
+
+static DEFINE_PER_CPU(struct vmap_area_pcpu, vmap_area_pcpu);
+
 static struct vmap_area *__find_vmap_area(unsigned long addr)
 {
 	struct rb_node *n = vmap_area_root.rb_node;
@@ -291,6 +306,40 @@ static struct vmap_area *__find_vmap_area(unsigned long addr)
 	return NULL;
 }
 
+/*
+ * Every vmap_area records the size of the free hole between it and the
+ * area below it, and the largest hole of its rbtree subtree, so that the
+ * lowest hole large enough for an allocation is found in O(log n).
+ */
+static unsigned long subtree_max_hole(struct rb_node *node)
+{
+	struct vmap_area *va;
+
+	if (!node)
+		return 0;
+	va = rb_entry(node, struct vmap_area, rb_node);
+	return va->subtree_max_hole;
+}
+
+/* Update subtree_max_hole for a node, based on node and its children */
+static void vmap_area_augment_cb(struct rb_node *node, void *unused)
+{
+	struct vmap_area *va;
+
+	if (!node)
+		return;
+	va = rb_entry(node, struct vmap_area, rb_node);
+	va->subtree_max_hole = max3(va->hole, subtree_max_hole(node->rb_left),
+				    subtree_max_hole(node->rb_right));
+}
+
+/* The hole of @node changed: update it and all its ancestors */
+static void vmap_area_augment_up(struct rb_node *node)
+{
+	for (; node; node = rb_parent(node))
+		vmap_area_augment_cb(node, NULL);
+}
+
 static void __insert_vmap_area(struct vmap_area *va)
 {
 	struct rb_node **p = &vmap_area_root.rb_node;
@@ -319,8 +368,118 @@ static void __insert_vmap_area(struct vmap_area *va)
 		struct vmap_area *prev;
 		prev = rb_entry(tmp, struct vmap_area, rb_node);
 		list_add_rcu(&va->list, &prev->list);
-	} else
+		va->hole = va->va_start - prev->va_end;
+	} else {
 		list_add_rcu(&va->list, &vmap_area_list);
+		va->hole = va->va_start;
+	}
+	rb_augment_insert(&va->rb_node, vmap_area_augment_cb, NULL);
+
+	/* va now splits the hole of the area above it */
+	tmp = rb_next(&va->rb_node);
+	if (tmp) {
+		struct vmap_area *next;
+		next = rb_entry(tmp, struct vmap_area, rb_node);
+		next->hole = next->va_start - va->va_end;
+		vmap_area_augment_up(tmp);
+	}
+}
+
+/*
+ * Does the hole below @va take @size at @align, at or above @vstart?
+ * If so, return the address it would go at in *@addrp.
+ */
+static bool vmap_hole_fits(struct vmap_area *va, unsigned long size,
+			   unsigned long align, unsigned long vstart,
+			   unsigned long *addrp)
+{
+	unsigned long addr;
+
+	addr = ALIGN(max(va->va_start - va->hole, vstart), align);
+	if (addr < vstart || addr + size < addr || addr + size > va->va_start)
+		return false;
+	*addrp = addr;
+	return true;
+}
+
+/*
+ * Find the lowest hole below some vmap_area that takes @size at @align,
+ * at or above @vstart.  Holes too small to fit the allocation wherever
+ * they start are not even looked at, unless @exact: then they are, so
+ * that a lucky alignment is not missed when space runs short.
+ */
+static bool find_vmap_lowest_hole(unsigned long size, unsigned long align,
+				  unsigned long vstart, bool exact,
+				  unsigned long *addrp)
+{
+	struct rb_node *node = vmap_area_root.rb_node;
+	struct rb_node *child;
+	bool descend = true;
+	unsigned long length;
+
+	/* holes start and end page aligned */
+	length = size;
+	if (!exact && align > PAGE_SIZE)
+		length += align - PAGE_SIZE;
+
+	while (node) {
+		struct vmap_area *va;
+
+		va = rb_entry(node, struct vmap_area, rb_node);
+		if (descend && subtree_max_hole(node->rb_left) >= length &&
+		    vstart < va->va_start) {
+			node = node->rb_left;
+			continue;
+		}
+
+		if (vmap_hole_fits(va, size, align, vstart, addrp))
+			return true;
+
+		if (subtree_max_hole(node->rb_right) >= length) {
+			node = node->rb_right;
+			descend = true;
+			continue;
+		}
+
+		/* back up to the first ancestor whose left we came from */
+		do {
+			child = node;
+			node = rb_parent(node);
+		} while (node && child != node->rb_left);
+		descend = false;
+	}
+	return false;
+}
+
+/* Take a purged vmap area for reuse from this cpu's cache */
+static struct vmap_area *vmap_area_cache_get(unsigned long size,
+				unsigned long align,
+				unsigned long vstart, unsigned long vend)
+{
+	unsigned long idx = (size >> PAGE_SHIFT) - 1;
+	struct vmap_area_pcpu *vap;
+	struct vmap_area *va, *found = NULL;
+
+	if (idx >= VMAP_CACHE_PAGES)
+		return NULL;
+
+	vap = &get_cpu_var(vmap_area_pcpu);
+	spin_lock(&vap->lock);
+	list_for_each_entry(va, &vap->cache[idx], purge_list) {
+		if (va->va_start >= vstart && va->va_end <= vend &&
+		    IS_ALIGNED(va->va_start, align)) {
+			list_del(&va->purge_list);
+			vap->nr_cached[idx]--;
+			found = va;
+			break;
+		}
+	}
+	spin_unlock(&vap->lock);
+	put_cpu_var(vmap_area_pcpu);
+
+	if (found)
+		found->flags = 0;
+	return found;
 }
 
 static void purge_vmap_area_lazy(void);
@@ -338,12 +497,15 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 	struct rb_node *n;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
 	BUG_ON(!is_power_of_2(align));
 
+	va = vmap_area_cache_get(size, align, vstart, vend);
+	if (va)
+		return va;
+
 	va = kmalloc_node(sizeof(struct vmap_area),
 			gfp_mask & GFP_RECLAIM_MASK, node);
 	if (unlikely(!va))
@@ -352,83 +514,35 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 retry:
 	spin_lock(&vmap_area_lock);
 	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
+	 * First fit: the lowest hole between two areas that takes the
+	 * allocation, else the space above the last area, else a hole
+	 * that only takes it thanks to where it starts.
 	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
-	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
-
-		if (!first)
-			goto found;
-	}
+	if (find_vmap_lowest_hole(size, align, vstart, false, &addr) &&
+	    addr + size <= vend)
+		goto found;
 
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = rb_next(&first->rb_node);
-		if (n)
-			first = rb_entry(n, struct vmap_area, rb_node);
-		else
-			goto found;
+	n = rb_last(&vmap_area_root);
+	addr = vstart;
+	if (n) {
+		struct vmap_area *last;
+		last = rb_entry(n, struct vmap_area, rb_node);
+		addr = max(addr, last->va_end);
 	}
+	addr = ALIGN(addr, align);
+	if (addr >= vstart && addr + size - 1 >= addr && addr + size <= vend)
+		goto found;
 
-found:
-	if (addr + size > vend)
+	if (align <= PAGE_SIZE ||
+	    !find_vmap_lowest_hole(size, align, vstart, true, &addr) ||
+	    addr + size > vend)
 		goto overflow;
+found:
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
 
 	BUG_ON(va->va_start & (align-1));
@@ -461,24 +575,23 @@ static void rcu_free_va(struct rcu_head *head)
 
 static void __free_vmap_area(struct vmap_area *va)
 {
+	struct rb_node *next, *deepest;
+
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
+	/* the area above takes over the hole below va, and va itself */
+	next = rb_next(&va->rb_node);
+	if (next) {
+		struct vmap_area *next_va;
+		next_va = rb_entry(next, struct vmap_area, rb_node);
+		next_va->hole += va->hole + (va->va_end - va->va_start);
 	}
+
+	deepest = rb_augment_erase_begin(&va->rb_node);
 	rb_erase(&va->rb_node, &vmap_area_root);
+	rb_augment_erase_end(deepest, vmap_area_augment_cb, NULL);
+	if (next)
+		vmap_area_augment_up(next);
 	RB_CLEAR_NODE(&va->rb_node);
 	list_del_rcu(&va->list);
 
@@ -587,9 +700,11 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 {
 	static DEFINE_SPINLOCK(purge_lock);
 	LIST_HEAD(valist);
+	struct vmap_area_pcpu *vap;
 	struct vmap_area *va;
 	struct vmap_area *n_va;
 	int nr = 0;
+	int cpu;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -605,20 +720,20 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
+	for_each_possible_cpu(cpu) {
+		vap = &per_cpu(vmap_area_pcpu, cpu);
+		spin_lock(&vap->lock);
+		list_splice_tail_init(&vap->lazy, &vap->purging);
+		spin_unlock(&vap->lock);
+
+		list_for_each_entry(va, &vap->purging, purge_list) {
 			if (va->va_start < *start)
 				*start = va->va_start;
 			if (va->va_end > *end)
 				*end = va->va_end;
 			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
 		}
 	}
-	rcu_read_unlock();
 
 	if (nr)
 		atomic_sub(nr, &vmap_lazy_nr);
@@ -626,15 +741,70 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (nr || force_flush)
 		flush_tlb_kernel_range(*start, *end);
 
-	if (nr) {
+	if (!nr)
+		goto out;
+
+	/* hand small areas back to the cpu that freed them, if it has room */
+	for_each_possible_cpu(cpu) {
+		vap = &per_cpu(vmap_area_pcpu, cpu);
+		spin_lock(&vap->lock);
+		list_for_each_entry_safe(va, n_va, &vap->purging, purge_list) {
+			unsigned long idx;
+
+			/* no longer a vm area: find_vm_area() must skip it */
+			va->flags = 0;
+			idx = ((va->va_end - va->va_start) >> PAGE_SHIFT) - 1;
+			if (idx < VMAP_CACHE_PAGES &&
+			    vap->nr_cached[idx] < VMAP_CACHE_DEPTH &&
+			    va->va_start >= VMALLOC_START &&
+			    va->va_end <= VMALLOC_END) {
+				list_move(&va->purge_list, &vap->cache[idx]);
+				vap->nr_cached[idx]++;
+			}
+		}
+		spin_unlock(&vap->lock);
+		list_splice_tail_init(&vap->purging, &valist);
+	}
+
+	if (!list_empty(&valist)) {
 		spin_lock(&vmap_area_lock);
 		list_for_each_entry_safe(va, n_va, &valist, purge_list)
 			__free_vmap_area(va);
 		spin_unlock(&vmap_area_lock);
 	}
+out:
 	spin_unlock(&purge_lock);
 }
 
+/*
+ * Give the areas kept for reuse back to the rbtree, when an allocation
+ * is short of space.
+ */
+static void drain_vmap_area_cache(void)
+{
+	LIST_HEAD(valist);
+	struct vmap_area *va, *n_va;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct vmap_area_pcpu *vap = &per_cpu(vmap_area_pcpu, cpu);
+
+		spin_lock(&vap->lock);
+		for (i = 0; i < VMAP_CACHE_PAGES; i++) {
+			list_splice_init(&vap->cache[i], &valist);
+			vap->nr_cached[i] = 0;
+		}
+		spin_unlock(&vap->lock);
+	}
+
+	if (list_empty(&valist))
+		return;
+	spin_lock(&vmap_area_lock);
+	list_for_each_entry_safe(va, n_va, &valist, purge_list)
+		__free_vmap_area(va);
+	spin_unlock(&vmap_area_lock);
+}
+
 /*
  * Kick off a purge of the outstanding lazy areas. Don't bother if somebody
  * is already purging.
@@ -647,13 +817,15 @@ static void try_purge_vmap_area_lazy(void)
 }
 
 /*
- * Kick off a purge of the outstanding lazy areas.
+ * Kick off a purge of the outstanding lazy areas, and give back the
+ * areas kept for reuse too: the caller ran out of space.
  */
 static void purge_vmap_area_lazy(void)
 {
 	unsigned long start = ULONG_MAX, end = 0;
 
 	__purge_vmap_area_lazy(&start, &end, 1, 0);
+	drain_vmap_area_cache();
 }
 
 /*
@@ -663,7 +835,15 @@ static void purge_vmap_area_lazy(void)
  */
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
+	struct vmap_area_pcpu *vap;
+
 	va->flags |= VM_LAZY_FREE;
+	vap = &get_cpu_var(vmap_area_pcpu);
+	spin_lock(&vap->lock);
+	list_add_tail(&va->purge_list, &vap->lazy);
+	spin_unlock(&vap->lock);
+	put_cpu_var(vmap_area_pcpu);
+
 	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
 	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
@@ -1165,10 +1345,19 @@ void __init vmalloc_init(void)
 
 	for_each_possible_cpu(i) {
 		struct vmap_block_queue *vbq;
+		struct vmap_area_pcpu *vap;
+		int j;
 
 		vbq = &per_cpu(vmap_block_queue, i);
 		spin_lock_init(&vbq->lock);
 		INIT_LIST_HEAD(&vbq->free);
+
+		vap = &per_cpu(vmap_area_pcpu, i);
+		spin_lock_init(&vap->lock);
+		INIT_LIST_HEAD(&vap->lazy);
+		INIT_LIST_HEAD(&vap->purging);
+		for (j = 0; j < VMAP_CACHE_PAGES; j++)
+			INIT_LIST_HEAD(&vap->cache[j]);
 	}
 
 	/* Import existing vmlist entries. */
@@ -1554,6 +1743,9 @@ void *vmap(struct page **pages, unsigned int count,
 }
 EXPORT_SYMBOL(vmap);
 
+/* Pages asked of the bulk page allocator at a time */
+#define VMALLOC_BULK_PAGES	128U
+
 static void *__vmalloc_node(unsigned long size, unsigned long align,
 			    gfp_t gfp_mask, pgprot_t prot,
 			    int node, void *caller);
@@ -1562,7 +1754,7 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 {
 	const int order = 0;
 	struct page **pages;
-	unsigned int nr_pages, array_size, i;
+	unsigned int nr_pages, array_size, i, nr;
 	gfp_t nested_gfp = (gfp_mask & GFP_RECLAIM_MASK) | __GFP_ZERO;
 
 	nr_pages = (area->size - PAGE_SIZE) >> PAGE_SHIFT;
@@ -1585,21 +1777,21 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 		return NULL;
 	}
 
-	for (i = 0; i < area->nr_pages; i++) {
-		struct page *page;
+	/*
+	 * The pages array starts out zeroed, and is filled in chunks, so
+	 * that interrupts are not kept off for long by the bulk allocator.
+	 */
+	for (i = 0; i < area->nr_pages; i += nr) {
+		unsigned int chunk = min(area->nr_pages - i, VMALLOC_BULK_PAGES);
 		gfp_t tmp_mask = gfp_mask | __GFP_NOWARN;
 
-		if (node < 0)
-			page = alloc_page(tmp_mask);
-		else
-			page = alloc_pages_node(node, tmp_mask, order);
-
-		if (unlikely(!page)) {
+		nr = alloc_pages_bulk_array_node(tmp_mask, node, chunk,
+						 area->pages + i);
+		if (unlikely(!nr)) {
 			/* Successfully allocated i pages, free them in __vunmap() */
 			area->nr_pages = i;
 			goto fail;
 		}
-		area->pages[i] = page;
 	}
 
 	if (map_vm_area(area, prot, &pages))
@@ -0,0 +1,282 @@
+/*
+ * vmalloc benchmark and stress test
+ *
+ * Times vmalloc() and vfree() from a kthread on every online cpu at
+ * once, all of them hammering the vmap area allocator together, for three
+ * patterns:
+ *
+ *  small:  an area of one to eight pages is allocated and freed again
+ *          right away, which the per cpu caches of purged areas are
+ *          meant to serve without taking the global lock.
+ *  mixed:  nr_objs areas of one to max_pages pages are kept allocated,
+ *          and a random one of them is freed and allocated again with
+ *          a new size, which fragments the vmalloc space and exercises
+ *          the search for a free hole.
+ *  large:  an area of large_pages pages is allocated and freed again,
+ *          which mostly measures how fast its pages are allocated.
+ *
+ * Every area is tagged with its own address in its first and last word,
+ * which is checked before it is freed, so that two areas handed out
+ * overlapping show up as corrupted.  The average number of cycles per
+ * allocation and free, and the number of failed allocations and
+ * corrupted areas are printed to the kernel log when the module is
+ * loaded, which then fails with -EAGAIN rather than keep it around.
+ */
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/cpumask.h>
+#include <linux/timex.h>
+
+static unsigned int nr_objs = 64;
+module_param(nr_objs, uint, 0444);
+MODULE_PARM_DESC(nr_objs, "# of areas each thread keeps in the mixed pattern");
+
+static unsigned int max_pages = 64;
+module_param(max_pages, uint, 0444);
+MODULE_PARM_DESC(max_pages, "Largest area in the mixed pattern, in pages");
+
+static unsigned int loops = 10000;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "# of allocations per thread and pattern");
+
+static unsigned int large_pages = 1024;
+module_param(large_pages, uint, 0444);
+MODULE_PARM_DESC(large_pages, "Size of the area in the large pattern, in pages");
+
+static unsigned int large_loops = 100;
+module_param(large_loops, uint, 0444);
+MODULE_PARM_DESC(large_loops, "# of allocations per thread in the large pattern");
+
+#define BENCH_SMALL_PAGES	8
+
+struct bench_obj {
+	unsigned long *area;
+	unsigned long size;
+};
+
+struct bench_call {
+	void			(*fn)(struct bench_call *call);
+	struct completion	done;
+	struct rnd_state	rnd;
+	struct bench_obj	*objs;
+	unsigned long long	alloc_cycles;
+	unsigned long long	free_cycles;
+	unsigned long		nr_allocs;
+	unsigned int		failed;
+	unsigned int		corrupted;
+};
+
+static unsigned long bench_size(struct bench_call *call, unsigned int pages)
+{
+	return (prandom32(&call->rnd) % pages + 1) << PAGE_SHIFT;
+}
+
+static void bench_alloc(struct bench_call *call, struct bench_obj *obj)
+{
+	cycles_t start = get_cycles();
+	unsigned long *p;
+
+	p = vmalloc(obj->size);
+	call->alloc_cycles += get_cycles() - start;
+	call->nr_allocs++;
+	obj->area = p;
+	if (!p) {
+		call->failed++;
+		return;
+	}
+	p[0] = (unsigned long)p;
+	p[obj->size / sizeof(*p) - 1] = (unsigned long)p;
+}
+
+static void bench_free(struct bench_call *call, struct bench_obj *obj)
+{
+	unsigned long *p = obj->area;
+	cycles_t start;
+
+	if (!p)
+		return;
+	if (p[0] != (unsigned long)p ||
+	    p[obj->size / sizeof(*p) - 1] != (unsigned long)p)
+		call->corrupted++;
+
+	start = get_cycles();
+	vfree(p);
+	call->free_cycles += get_cycles() - start;
+	obj->area = NULL;
+}
+
+static void bench_small(struct bench_call *call)
+{
+	struct bench_obj obj;
+	unsigned int i;
+
+	for (i = 0; i < loops; i++) {
+		obj.size = bench_size(call, BENCH_SMALL_PAGES);
+		bench_alloc(call, &obj);
+		bench_free(call, &obj);
+		cond_resched();
+	}
+}
+
+static void bench_large(struct bench_call *call)
+{
+	struct bench_obj obj;
+	unsigned int i;
+
+	for (i = 0; i < large_loops; i++) {
+		obj.size = (unsigned long)large_pages << PAGE_SHIFT;
+		bench_alloc(call, &obj);
+		bench_free(call, &obj);
+		cond_resched();
+	}
+}
+
+static void bench_mixed(struct bench_call *call)
+{
+	struct bench_obj *obj;
+	unsigned int i;
+
+	for (i = 0; i < nr_objs; i++) {
+		obj = &call->objs[i];
+		obj->size = bench_size(call, max_pages);
+		bench_alloc(call, obj);
+	}
+
+	for (i = 0; i < loops; i++) {
+		obj = &call->objs[prandom32(&call->rnd) % nr_objs];
+		bench_free(call, obj);
+		obj->size = bench_size(call, max_pages);
+		bench_alloc(call, obj);
+		cond_resched();
+	}
+
+	for (i = 0; i < nr_objs; i++)
+		bench_free(call, &call->objs[i]);
+}
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_call *call = data;
+
+	call->fn(call);
+	complete(&call->done);
+	return 0;
+}
+
+/* run @fn in a kthread bound to each online cpu, all at once */
+static int bench_run(struct bench_call *calls, void (*fn)(struct bench_call *))
+{
+	struct task_struct *task;
+	int cpu, ret = 0;
+
+	for_each_online_cpu(cpu) {
+		struct bench_call *call = &calls[cpu];
+
+		call->fn = fn;
+		prandom32_seed(&call->rnd, cpu + 1);
+		init_completion(&call->done);
+		task = kthread_create(bench_thread_fn, call,
+				      "vmalloc_bench/%d", cpu);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			complete(&call->done);
+			continue;
+		}
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+	}
+
+	for_each_online_cpu(cpu)
+		wait_for_completion(&calls[cpu].done);
+	return ret;
+}
+
+static void bench_report(const char *name, struct bench_call *calls)
+{
+	unsigned long long alloc_cycles = 0, free_cycles = 0;
+	unsigned long nr_allocs = 0;
+	unsigned int failed = 0, corrupted = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		alloc_cycles += calls[cpu].alloc_cycles;
+		free_cycles += calls[cpu].free_cycles;
+		nr_allocs += calls[cpu].nr_allocs;
+		failed += calls[cpu].failed;
+		corrupted += calls[cpu].corrupted;
+	}
+	if (!nr_allocs)
+		nr_allocs = 1;
+
+	printk(KERN_INFO "vmalloc_benchmark: %-6s alloc %llu cycles/op, "
+	       "free %llu cycles/op, %u failed, %u corrupted\n", name,
+	       div64_u64(alloc_cycles, nr_allocs),
+	       div64_u64(free_cycles, nr_allocs), failed, corrupted);
+}
+
+static int __init vmalloc_benchmark_init(void)
+{
+	struct bench_call *calls;
+	int cpu, ret;
+
+	if (!nr_objs || !max_pages || !loops || !large_pages || !large_loops)
+		return -EINVAL;
+
+	calls = kcalloc(nr_cpu_ids, sizeof(*calls), GFP_KERNEL);
+	if (!calls)
+		return -ENOMEM;
+
+	/* the per cpu results are summed over the cpus that ran */
+	get_online_cpus();
+
+	printk(KERN_INFO "vmalloc_benchmark: %u cpus, %u loops, %u areas "
+	       "of up to %u pages in the mixed pattern, %u loops of %u "
+	       "pages in the large pattern\n", num_online_cpus(), loops,
+	       nr_objs, max_pages, large_loops, large_pages);
+
+	ret = bench_run(calls, bench_small);
+	if (ret)
+		goto out;
+	bench_report("small", calls);
+
+	memset(calls, 0, nr_cpu_ids * sizeof(*calls));
+	ret = bench_run(calls, bench_large);
+	if (ret)
+		goto out;
+	bench_report("large", calls);
+
+	for_each_online_cpu(cpu) {
+		memset(&calls[cpu], 0, sizeof(calls[cpu]));
+		calls[cpu].objs = kcalloc(nr_objs, sizeof(struct bench_obj),
+					  GFP_KERNEL);
+		if (!calls[cpu].objs) {
+			ret = -ENOMEM;
+			goto out_objs;
+		}
+	}
+
+	ret = bench_run(calls, bench_mixed);
+	if (ret)
+		goto out_objs;
+	bench_report("mixed", calls);
+	ret = -EAGAIN;
+
+out_objs:
+	for_each_online_cpu(cpu)
+		kfree(calls[cpu].objs);
+out:
+	put_online_cpus();
+	kfree(calls);
+	return ret;
+}
+
+module_init(vmalloc_benchmark_init);
+
+MODULE_DESCRIPTION("vmalloc benchmark and stress test");
+MODULE_LICENSE("GPL");
@@ -14,6 +14,7 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/cpu.h>
+#include <linux/sysctl.h>
 #include <linux/vmstat.h>
 #include <linux/sched.h>
 #include <linux/math64.h>
@@ -154,6 +155,56 @@ int calculate_normal_threshold(struct zone *zone)
 	return threshold;
 }
 
+/*
+ * Counters that only feed statistics, and that no watermark, reclaim or
+ * writeback decision is based on.  Most of them change on every fault
+ * or allocation, so they are allowed to drift further than the others
+ * before they are folded into the zone: their threshold is the normal
+ * one shifted left by sysctl_stat_threshold_shift.
+ */
+static const bool vmstat_relaxed[NR_VM_ZONE_STAT_ITEMS] = {
+	[NR_MLOCK]			= true,
+	[NR_ANON_PAGES]			= true,
+	[NR_SLAB_UNRECLAIMABLE]		= true,
+	[NR_PAGETABLE]			= true,
+	[NR_KERNEL_STACK]		= true,
+	[NR_BOUNCE]			= true,
+	[NR_VMSCAN_WRITE]		= true,
+	[NR_SHMEM]			= true,
+	[NR_DIRTIED]			= true,
+	[NR_WRITTEN]			= true,
+#ifdef CONFIG_NUMA
+	[NUMA_HIT]			= true,
+	[NUMA_MISS]			= true,
+	[NUMA_FOREIGN]			= true,
+	[NUMA_INTERLEAVE_HIT]		= true,
+	[NUMA_LOCAL]			= true,
+	[NUMA_OTHER]			= true,
+#endif
+	[NR_ANON_TRANSPARENT_HUGEPAGES]	= true,
+};
+
+int sysctl_stat_threshold_shift __read_mostly = 2;
+
+/*
+ * Set the threshold of the counters of @zone on @cpu that decisions are
+ * based on to @threshold, and that of the relaxed ones to @relaxed,
+ * unless it is negative.
+ */
+static void set_zone_stat_threshold(struct zone *zone, int cpu,
+				    int threshold, int relaxed)
+{
+	struct per_cpu_pageset *p = per_cpu_ptr(zone->pageset, cpu);
+	int i;
+
+	for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++) {
+		if (!vmstat_relaxed[i])
+			p->stat_threshold[i] = threshold;
+		else if (relaxed >= 0)
+			p->stat_threshold[i] = relaxed;
+	}
+}
+
 /*
  * Refresh the thresholds for each zone.
  */
@@ -161,16 +212,16 @@ void refresh_zone_stat_thresholds(void)
 {
 	struct zone *zone;
 	int cpu;
-	int threshold;
+	int threshold, relaxed;
 
 	for_each_populated_zone(zone) {
 		unsigned long max_drift, tolerate_drift;
 
 		threshold = calculate_normal_threshold(zone);
+		relaxed = min(125, threshold << sysctl_stat_threshold_shift);
 
 		for_each_online_cpu(cpu)
-			per_cpu_ptr(zone->pageset, cpu)->stat_threshold
-							= threshold;
+			set_zone_stat_threshold(zone, cpu, threshold, relaxed);
 
 		/*
 		 * Only set percpu_drift_mark if there is a danger that
@@ -198,13 +249,28 @@ void set_pgdat_percpu_threshold(pg_data_t *pgdat,
 		if (!zone->percpu_drift_mark)
 			continue;
 
+		/* the relaxed counters do not matter for the watermarks */
 		threshold = (*calculate_pressure)(zone);
 		for_each_possible_cpu(cpu)
-			per_cpu_ptr(zone->pageset, cpu)->stat_threshold
-							= threshold;
+			set_zone_stat_threshold(zone, cpu, threshold, -1);
 	}
 }
 
+int vmstat_threshold_shift_sysctl_handler(ctl_table *table, int write,
+	void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	get_online_cpus();
+	refresh_zone_stat_thresholds();
+	put_online_cpus();
+	return 0;
+}
+
 /*
  * For use when we know that interrupts are disabled.
  */
@@ -218,7 +284,7 @@ void __mod_zone_page_state(struct zone *zone, enum zone_stat_item item,
 
 	x = delta + __this_cpu_read(*p);
 
-	t = __this_cpu_read(pcp->stat_threshold);
+	t = __this_cpu_read(pcp->stat_threshold[item]);
 
 	if (unlikely(x > t || x < -t)) {
 		zone_page_state_add(x, zone, item);
@@ -258,7 +324,7 @@ void __inc_zone_state(struct zone *zone, enum zone_stat_item item)
 	s8 v, t;
 
 	v = __this_cpu_inc_return(*p);
-	t = __this_cpu_read(pcp->stat_threshold);
+	t = __this_cpu_read(pcp->stat_threshold[item]);
 	if (unlikely(v > t)) {
 		s8 overstep = t >> 1;
 
@@ -280,7 +346,7 @@ void __dec_zone_state(struct zone *zone, enum zone_stat_item item)
 	s8 v, t;
 
 	v = __this_cpu_dec_return(*p);
-	t = __this_cpu_read(pcp->stat_threshold);
+	t = __this_cpu_read(pcp->stat_threshold[item]);
 	if (unlikely(v < - t)) {
 		s8 overstep = t >> 1;
 
@@ -328,7 +394,7 @@ static inline void mod_state(struct zone *zone,
 		 * Most of the time the thresholds are the same anyways
 		 * for all cpus in a zone.
 		 */
-		t = this_cpu_read(pcp->stat_threshold);
+		t = this_cpu_read(pcp->stat_threshold[item]);
 
 		o = this_cpu_read(*p);
 		n = delta + o;
@@ -433,12 +499,17 @@ EXPORT_SYMBOL(dec_zone_page_state);
  * statistics in the remote zone struct as well as the global cachelines
  * with the global counters. These could cause remote node cache line
  * bouncing and will have to be only done when necessary.
+ *
+ * Returns the number of counters that were updated, plus one for each
+ * remote pageset that is still waiting to be drained, so that zero
+ * means that there is nothing left to do for this cpu.
  */
-void refresh_cpu_vm_stats(int cpu)
+int refresh_cpu_vm_stats(int cpu)
 {
 	struct zone *zone;
 	int i;
 	int global_diff[NR_VM_ZONE_STAT_ITEMS] = { 0, };
+	int changes = 0;
 
 	for_each_populated_zone(zone) {
 		struct per_cpu_pageset *p;
@@ -456,6 +527,7 @@ void refresh_cpu_vm_stats(int cpu)
 				local_irq_restore(flags);
 				atomic_long_add(v, &zone->vm_stat[i]);
 				global_diff[i] += v;
+				changes++;
 #ifdef CONFIG_NUMA
 				/* 3 seconds idle till flush */
 				p->expire = 3;
@@ -482,8 +554,10 @@ void refresh_cpu_vm_stats(int cpu)
 		}
 
 		p->expire--;
-		if (p->expire)
+		if (p->expire) {
+			changes++;
 			continue;
+		}
 
 		if (p->pcp.count)
 			drain_zone_pages(zone, &p->pcp);
@@ -493,6 +567,8 @@ void refresh_cpu_vm_stats(int cpu)
 	for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++)
 		if (global_diff[i])
 			atomic_long_add(global_diff[i], &vm_stat[i]);
+
+	return changes;
 }
 
 #endif
@@ -718,6 +794,7 @@ const char * const vmstat_text[] = {
 	"numa_other",
 #endif
 	"nr_anon_transparent_hugepages",
+	"nr_pcp_high_order",
 	"nr_dirty_threshold",
 	"nr_dirty_background_threshold",
 
@@ -728,6 +805,8 @@ const char * const vmstat_text[] = {
 	"pswpout",
 
 	TEXTS_FOR_ZONES("pgalloc")
+	TEXTS_FOR_ZONES("zone_lock")
+	TEXTS_FOR_ZONES("zone_lock_contended")
 
 	"pgfree",
 	"pgactivate",
@@ -735,6 +814,10 @@ const char * const vmstat_text[] = {
 
 	"pgfault",
 	"pgmajfault",
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+	"speculative_pgfault_fallback",
+#endif
 
 	TEXTS_FOR_ZONES("pgrefill")
 	TEXTS_FOR_ZONES("pgsteal")
@@ -763,6 +846,11 @@ const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_stall_usecs",
+	"compact_daemon_wake",
+	"compact_daemon_usecs",
+	"compact_daemon_success",
+	"compact_daemon_stall_avoided_usecs",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
@@ -784,6 +872,8 @@ const char * const vmstat_text[] = {
 	"thp_collapse_alloc",
 	"thp_collapse_alloc_failed",
 	"thp_split",
+	"thp_file_alloc",
+	"thp_file_mapped",
 #endif
 
 #endif /* CONFIG_VM_EVENTS_COUNTERS */
@@ -1011,7 +1101,9 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   pageset->pcp.batch);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
-				pageset->stat_threshold);
+				pageset->stat_threshold[NR_FREE_PAGES]);
+		seq_printf(m, "\n  vm stats threshold relaxed: %d",
+				pageset->stat_threshold[NR_ANON_PAGES]);
 #endif
 	}
 	seq_printf(m,
@@ -1141,10 +1233,66 @@ static const struct file_operations proc_vmstat_file_operations = {
 static DEFINE_PER_CPU(struct delayed_work, vmstat_work);
 int sysctl_stat_interval __read_mostly = HZ;
 
+/*
+ * Online cpus whose vmstat_work found nothing to fold and stopped
+ * rearming itself.  vmstat_shepherd restarts it once the cpu has
+ * differentials again, so an idle cpu is not woken up every
+ * sysctl_stat_interval just to find out that nothing changed.
+ */
+static cpumask_var_t cpu_stat_off;
+
 static void vmstat_update(struct work_struct *w)
 {
-	refresh_cpu_vm_stats(smp_processor_id());
-	schedule_delayed_work(&__get_cpu_var(vmstat_work),
+	int cpu = smp_processor_id();
+
+	if (refresh_cpu_vm_stats(cpu))
+		schedule_delayed_work(&__get_cpu_var(vmstat_work),
+			round_jiffies_relative(sysctl_stat_interval));
+	else
+		cpumask_set_cpu(cpu, cpu_stat_off);
+}
+
+/*
+ * Check whether @cpu has any differentials, or remote pagesets still
+ * to drain.  Only reads the pagesets, so that the cachelines stay
+ * exclusive to the cpu they belong to.
+ */
+static bool need_update(int cpu)
+{
+	struct zone *zone;
+	int i;
+
+	for_each_populated_zone(zone) {
+		struct per_cpu_pageset *p = per_cpu_ptr(zone->pageset, cpu);
+
+		for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++)
+			if (p->vm_stat_diff[i])
+				return true;
+#ifdef CONFIG_NUMA
+		if (p->expire && p->pcp.count)
+			return true;
+#endif
+	}
+	return false;
+}
+
+static void vmstat_shepherd(struct work_struct *w);
+
+static DECLARE_DELAYED_WORK(shepherd, vmstat_shepherd);
+
+static void vmstat_shepherd(struct work_struct *w)
+{
+	int cpu;
+
+	get_online_cpus();
+	for_each_cpu(cpu, cpu_stat_off)
+		if (need_update(cpu) &&
+		    cpumask_test_and_clear_cpu(cpu, cpu_stat_off))
+			schedule_delayed_work_on(cpu, &per_cpu(vmstat_work, cpu),
+				__round_jiffies_relative(sysctl_stat_interval, cpu));
+	put_online_cpus();
+
+	schedule_delayed_work(&shepherd,
 		round_jiffies_relative(sysctl_stat_interval));
 }
 
@@ -1152,6 +1300,7 @@ static void __cpuinit start_cpu_timer(int cpu)
 {
 	struct delayed_work *work = &per_cpu(vmstat_work, cpu);
 
+	cpumask_clear_cpu(cpu, cpu_stat_off);
 	INIT_DELAYED_WORK_DEFERRABLE(work, vmstat_update);
 	schedule_delayed_work_on(cpu, work, __round_jiffies_relative(HZ, cpu));
 }
@@ -1177,6 +1326,7 @@ static int __cpuinit vmstat_cpuup_callback(struct notifier_block *nfb,
 	case CPU_DOWN_PREPARE_FROZEN:
 		cancel_delayed_work_sync(&per_cpu(vmstat_work, cpu));
 		per_cpu(vmstat_work, cpu).work.func = NULL;
+		cpumask_clear_cpu(cpu, cpu_stat_off);
 		break;
 	case CPU_DOWN_FAILED:
 	case CPU_DOWN_FAILED_FROZEN:
@@ -1201,10 +1351,15 @@ static int __init setup_vmstat(void)
 #ifdef CONFIG_SMP
 	int cpu;
 
+	if (!zalloc_cpumask_var(&cpu_stat_off, GFP_KERNEL))
+		BUG();
+
 	register_cpu_notifier(&vmstat_notifier);
 
 	for_each_online_cpu(cpu)
 		start_cpu_timer(cpu);
+	schedule_delayed_work(&shepherd,
+		round_jiffies_relative(sysctl_stat_interval));
 #endif
 #ifdef CONFIG_PROC_FS
 	proc_create("buddyinfo", S_IRUGO, NULL, &fragmentation_file_operations);
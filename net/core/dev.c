@@ -3774,6 +3774,7 @@ static void net_rx_action(struct softirq_action *h)
 	int budget = netdev_budget;
 	void *have;
 
+	__kfree_skb_defer();
 	local_irq_disable();
 
 	while (!list_empty(&sd->poll_list)) {
@@ -3836,6 +3837,7 @@ static void net_rx_action(struct softirq_action *h)
 	}
 out:
 	net_rps_action_and_irq_enable(sd);
+	__kfree_skb_flush();
 
 #ifdef CONFIG_NET_DMA
 	/*
@@ -462,6 +462,101 @@ void consume_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(consume_skb);
 
+/*
+ * sk_buff heads freed from NAPI poll routines are collected per cpu and
+ * handed back to the slab allocator in bulk, either when the cache is full
+ * or at the end of the NET_RX softirq.  They are only collected while
+ * net_rx_action() runs the poll routines, so that nothing stays behind
+ * once it is done; anywhere else they are freed right away.
+ */
+#define NAPI_SKB_CACHE_SIZE	64
+
+struct napi_skb_cache {
+	unsigned int	count;
+	bool		active;
+	void		*skbs[NAPI_SKB_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct napi_skb_cache, napi_skb_cache);
+
+/* net.core.skb_bulk_free, turns the batching off to compare with it */
+int sysctl_skb_bulk_free __read_mostly = 1;
+
+/**
+ *	__kfree_skb_defer - let napi_consume_skb defer freeing sk_buff heads
+ *
+ *	Called from the NET_RX softirq before it runs the NAPI poll routines.
+ */
+void __kfree_skb_defer(void)
+{
+	__get_cpu_var(napi_skb_cache).active = sysctl_skb_bulk_free;
+}
+
+/**
+ *	__kfree_skb_flush - free the sk_buff heads deferred by napi_consume_skb
+ *
+ *	Called from the NET_RX softirq once all NAPI poll routines ran.
+ */
+void __kfree_skb_flush(void)
+{
+	struct napi_skb_cache *nc = &__get_cpu_var(napi_skb_cache);
+
+	nc->active = false;
+	if (nc->count) {
+		kmem_cache_free_bulk(skbuff_head_cache, nc->count, nc->skbs);
+		nc->count = 0;
+	}
+}
+
+/**
+ *	napi_consume_skb - free an skbuff from a NAPI poll routine
+ *	@skb: buffer to free
+ *
+ *	Functions like consume_skb, and is meant for NAPI poll routines, e.g.
+ *	when a driver cleans its tx ring.  When called from net_rx_action(),
+ *	the sk_buff head is not freed right away but batched with others for
+ *	kmem_cache_free_bulk.
+ */
+void napi_consume_skb(struct sk_buff *skb)
+{
+	struct napi_skb_cache *nc;
+
+	if (unlikely(!skb))
+		return;
+
+	/*
+	 * netpoll runs the poll routines with interrupts disabled, and
+	 * nobody would flush heads deferred outside of net_rx_action().
+	 */
+	if (unlikely(in_irq() || irqs_disabled() ||
+		     !__get_cpu_var(napi_skb_cache).active)) {
+		dev_kfree_skb_any(skb);
+		return;
+	}
+
+	if (likely(atomic_read(&skb->users) == 1))
+		smp_rmb();
+	else if (likely(!atomic_dec_and_test(&skb->users)))
+		return;
+	trace_consume_skb(skb);
+
+	/* fast clones are freed together with their other half */
+	if (skb->fclone != SKB_FCLONE_UNAVAILABLE) {
+		__kfree_skb(skb);
+		return;
+	}
+
+	skb_release_all(skb);
+
+	nc = &__get_cpu_var(napi_skb_cache);
+	nc->skbs[nc->count++] = skb;
+	if (nc->count == NAPI_SKB_CACHE_SIZE) {
+		kmem_cache_free_bulk(skbuff_head_cache, nc->count, nc->skbs);
+		nc->count = 0;
+	}
+}
+EXPORT_SYMBOL(napi_consume_skb);
+
 /**
  *	skb_recycle_check - check if skb can be reused for receive
  *	@skb: buffer
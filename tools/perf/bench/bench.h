@@ -4,6 +4,17 @@
 extern int bench_sched_messaging(int argc, const char **argv, const char *prefix);
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
+extern int bench_mem_pagecache(int argc, const char **argv, const char *prefix);
+extern int bench_mem_mmap_replay(int argc, const char **argv, const char *prefix);
+extern int bench_mem_shm_random(int argc, const char **argv, const char *prefix);
+extern int bench_mem_munmap(int argc, const char **argv, const char *prefix);
+extern int bench_mem_fault(int argc, const char **argv, const char *prefix);
+extern int bench_mem_zram(int argc, const char **argv, const char *prefix);
+extern int bench_mem_ksm(int argc, const char **argv, const char *prefix);
+extern int bench_mem_pcp(int argc, const char **argv, const char *prefix);
+extern int bench_mem_memcg(int argc, const char **argv, const char *prefix);
+extern int bench_mem_vmstat(int argc, const char **argv, const char *prefix);
+extern int bench_futex_hash(int argc, const char **argv, const char *prefix);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -0,0 +1,183 @@
+/*
+ *
+ * futex-hash.c
+ *
+ * hash: Benchmark for futex hash bucket contention
+ *
+ * A number of threads each own a set of futexes and keep calling
+ * FUTEX_WAIT on them with a value that never matches, so every call
+ * takes the hash bucket lock and returns right away.  This measures
+ * how well the futex hash scales with the number of threads.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifndef FUTEX_PRIVATE_FLAG
+#define FUTEX_PRIVATE_FLAG	128
+#endif
+
+#ifndef PR_SET_FUTEX_HASH
+#define PR_SET_FUTEX_HASH	35
+#define PR_GET_FUTEX_HASH	36
+#endif
+
+static unsigned int nthreads;
+static unsigned int nfutexes = 1024;
+static unsigned int nsecs = 10;
+static bool fshared = false;
+static int private_hash = -1;
+
+static volatile int done;
+
+struct worker {
+	pthread_t thread;
+	u32 *futex;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: number of cpus)"),
+	OPT_UINTEGER('f', "futexes", &nfutexes,
+		     "Specify number of futexes per thread"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_BOOLEAN('s', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_INTEGER('p', "private-hash", &private_hash,
+		    "Use a per-process futex hash with this many buckets (0: default size)"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	int op = FUTEX_WAIT | (fshared ? 0 : FUTEX_PRIVATE_FLAG);
+	unsigned int i;
+
+	while (!done) {
+		for (i = 0; i < nfutexes; i++) {
+			/* *futex is 0, this fails with EWOULDBLOCK */
+			syscall(SYS_futex, &w->futex[i], op, 1, NULL, NULL, 0);
+		}
+		w->ops += nfutexes;
+	}
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long total = 0, usecs;
+	unsigned int i;
+	int buckets = 0;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_hash_usage, 0);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads || !nfutexes || !nsecs)
+		usage_with_options(bench_futex_hash_usage, options);
+
+	/* has to happen while we are still single threaded */
+	if (private_hash >= 0) {
+		if (prctl(PR_SET_FUTEX_HASH, private_hash, 0, 0, 0))
+			barf("PR_SET_FUTEX_HASH");
+		buckets = prctl(PR_GET_FUTEX_HASH, 0, 0, 0, 0);
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	signal(SIGALRM, alarm_handler);
+	done = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		workers[i].futex = calloc(nfutexes, sizeof(u32));
+		if (!workers[i].futex)
+			barf("calloc");
+		if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]))
+			barf("pthread_create");
+	}
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			barf("pthread_join");
+		total += workers[i].ops;
+		free(workers[i].futex);
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	free(workers);
+
+	usecs = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!usecs)
+		usecs = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads operating on %u %s futexes each",
+		       nthreads, nfutexes, fshared ? "shared" : "private");
+		if (buckets > 0)
+			printf(", %d bucket private hash", buckets);
+		printf("\n\n");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+		printf(" %14llu ops/sec\n", total * 1000000ULL / usecs);
+		printf(" %14llu ops/sec per thread\n",
+		       total * 1000000ULL / usecs / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", total * 1000000ULL / usecs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ *
+ * mem-fault.c
+ *
+ * fault: Benchmark for page faults racing with mmap and munmap
+ *
+ * A number of threads each keep faulting in a private anonymous region
+ * of their own, throwing the pages away with MADV_DONTNEED after every
+ * pass, while other threads of the same process keep mapping and
+ * unmapping small regions.  Faults taken under mmap_sem have to wait
+ * behind every mmap and munmap, so this shows how fault throughput
+ * holds up against address space changes in the same process.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+#ifndef MADV_NOHUGEPAGE
+#define MADV_NOHUGEPAGE	15
+#endif
+
+static unsigned int nthreads;
+static unsigned int nmappers = 1;
+static unsigned int size_mb = 64;
+static unsigned int nsecs = 10;
+
+static volatile int done;
+static long page_size;
+
+struct worker {
+	pthread_t thread;
+	unsigned long long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of faulting threads (default: number of cpus)"),
+	OPT_UINTEGER('m', "mappers", &nmappers,
+		     "Specify number of threads doing mmap/munmap"),
+	OPT_UINTEGER('s', "size", &size_mb,
+		     "Specify size of each faulting thread's region (in MB)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_END()
+};
+
+static const char * const bench_mem_fault_usage[] = {
+	"perf bench mem fault <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void *fault_worker(void *arg)
+{
+	struct worker *w = arg;
+	size_t size = (size_t)size_mb << 20;
+	size_t off;
+	char *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		barf("mmap");
+	/* huge pmds would hide the small page faults */
+	madvise(p, size, MADV_NOHUGEPAGE);
+
+	while (!done) {
+		for (off = 0; off < size && !done; off += page_size) {
+			p[off] = 1;
+			w->ops++;
+		}
+		if (madvise(p, size, MADV_DONTNEED))
+			barf("madvise");
+	}
+
+	munmap(p, size);
+	return NULL;
+}
+
+static void *map_worker(void *arg)
+{
+	struct worker *w = arg;
+	char *p;
+
+	while (!done) {
+		p = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			barf("mmap");
+		if (munmap(p, page_size))
+			barf("munmap");
+		w->ops++;
+	}
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+int bench_mem_fault(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long faults = 0, maps = 0, usecs;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_fault_usage, 0);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads || !size_mb || !nsecs)
+		usage_with_options(bench_mem_fault_usage, options);
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	workers = calloc(nthreads + nmappers, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	signal(SIGALRM, alarm_handler);
+	done = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads + nmappers; i++) {
+		if (pthread_create(&workers[i].thread, NULL,
+				   i < nthreads ? fault_worker : map_worker,
+				   &workers[i]))
+			barf("pthread_create");
+	}
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads + nmappers; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			barf("pthread_join");
+		if (i < nthreads)
+			faults += workers[i].ops;
+		else
+			maps += workers[i].ops;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	free(workers);
+
+	usecs = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!usecs)
+		usecs = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads faulting in %u MB each, %u threads doing mmap/munmap\n\n",
+		       nthreads, size_mb, nmappers);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+		printf(" %14llu faults/sec\n", faults * 1000000ULL / usecs);
+		printf(" %14llu faults/sec per thread\n",
+		       faults * 1000000ULL / usecs / nthreads);
+		if (nmappers)
+			printf(" %14llu mmap/munmap/sec\n",
+			       maps * 1000000ULL / usecs);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", faults * 1000000ULL / usecs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ *
+ * mem-ksm.c
+ *
+ * ksm: Benchmark for how fast ksmd finds and merges duplicate pages
+ *
+ * A number of processes each fill an anonymous area with a given share
+ * of pages that are copies of a few distinct pages, the same in all of
+ * them, and random pages for the rest, and then hand it to KSM with
+ * MADV_MERGEABLE.  The counters ksmd exports are polled until all
+ * duplicates are merged or the runtime is over, and the time that took,
+ * the pages ksmd scanned and the cpu time it spent on them are reported.
+ * Run with different /sys/kernel/mm/ksm/scan_threads to see how ksmd
+ * scales.
+ *
+ * ksmd has to be running, "echo 1 > /sys/kernel/mm/ksm/run", and no
+ * other mergeable areas should be around to get a clean measurement.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#undef _GNU_SOURCE
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#define KSM_SYSFS	"/sys/kernel/mm/ksm/"
+
+static unsigned int nprocs = 1;
+static unsigned int size_mb = 256;
+static unsigned int dup_pct = 90;
+static unsigned int nr_contents = 16;
+static unsigned int nsecs = 60;
+
+static const struct option options[] = {
+	OPT_UINTEGER('p', "processes", &nprocs,
+		     "Specify number of processes"),
+	OPT_UINTEGER('s', "size", &size_mb,
+		     "Specify size of the mergeable area of all processes (in MB)"),
+	OPT_UINTEGER('d', "duplicate", &dup_pct,
+		     "Specify percentage of duplicate pages"),
+	OPT_UINTEGER('g', "groups", &nr_contents,
+		     "Specify number of distinct duplicate contents"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify max runtime (in seconds)"),
+	OPT_END()
+};
+
+static const char * const bench_mem_ksm_usage[] = {
+	"perf bench mem ksm <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static unsigned long read_ksm(const char *name)
+{
+	char path[64];
+	unsigned long val;
+	FILE *f;
+
+	snprintf(path, sizeof(path), KSM_SYSFS "%s", name);
+	f = fopen(path, "r");
+	if (!f)
+		barf(path);
+	if (fscanf(f, "%lu", &val) != 1)
+		barf(path);
+	fclose(f);
+	return val;
+}
+
+/*
+ * Page i is a duplicate if its slot in every hundred pages is below
+ * dup_pct, so duplicates are spread over the whole area, and the
+ * duplicates take turns among the distinct contents.  Every word of a
+ * random page is random, so that a sample of it tells it apart.
+ */
+static void fill_area(char *area, unsigned long nr_pages, long page_size,
+		      unsigned int *seed)
+{
+	unsigned long i, j, dups = 0;
+
+	for (i = 0; i < nr_pages; i++) {
+		unsigned int *p = (unsigned int *)(area + i * page_size);
+
+		if (i % 100 < dup_pct) {
+			unsigned int content = dups++ % nr_contents + 1;
+
+			for (j = 0; j < page_size / sizeof(*p); j++)
+				p[j] = content * 2654435761U + j;
+		} else {
+			for (j = 0; j < page_size / sizeof(*p); j++)
+				p[j] = rand_r(seed);
+		}
+	}
+}
+
+/*
+ * A child fills its area and tells so through the ready pipe, makes it
+ * mergeable once the go pipe is closed, and exits when killed.
+ */
+static void child(unsigned long nr_pages, long page_size, unsigned int seed,
+		  int ready_fd, int go_fd)
+{
+	char *area, c = 0;
+
+	area = mmap(NULL, nr_pages * page_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		barf("mmap");
+	fill_area(area, nr_pages, page_size, &seed);
+
+	if (write(ready_fd, &c, 1) != 1)
+		barf("write");
+	if (read(go_fd, &c, 1) < 0)
+		barf("read");
+	if (madvise(area, nr_pages * page_size, MADV_MERGEABLE))
+		barf("madvise");
+
+	for (;;)
+		pause();
+}
+
+int bench_mem_ksm(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	unsigned long nr_pages, nr_dups, expected, i;
+	unsigned long sharing, sharing0, scanned0, cpu0;
+	unsigned long sharing_done = 0, scanned = 0, cpu = 0;
+	struct timeval start, now, diff, merged = { 0, 0 };
+	int ready_fds[2], go_fds[2];
+	unsigned int p, threads;
+	long page_size;
+	pid_t *pids;
+	char c;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_ksm_usage, 0);
+
+	if (!nprocs || !size_mb || dup_pct > 100 || !nr_contents || !nsecs)
+		usage_with_options(bench_mem_ksm_usage, options);
+
+	if (access(KSM_SYSFS "run", R_OK) || read_ksm("run") != 1) {
+		fprintf(stderr, "ksmd is not running, skipping: "
+			"echo 1 > " KSM_SYSFS "run first\n");
+		return 0;
+	}
+
+	threads = read_ksm("scan_threads");
+
+	/* pages per process */
+	page_size = sysconf(_SC_PAGESIZE);
+	nr_pages = ((unsigned long)size_mb << 20) / page_size / nprocs;
+	if (!nr_pages)
+		usage_with_options(bench_mem_ksm_usage, options);
+
+	/* every distinct content ends up as one shared page */
+	for (nr_dups = 0, i = 0; i < nr_pages; i++)
+		if (i % 100 < dup_pct)
+			nr_dups++;
+	expected = nr_dups * nprocs;
+	expected -= nr_dups < nr_contents ? nr_dups : nr_contents;
+
+	pids = calloc(nprocs, sizeof(*pids));
+	if (!pids)
+		barf("calloc");
+	if (pipe(ready_fds) || pipe(go_fds))
+		barf("pipe");
+
+	for (p = 0; p < nprocs; p++) {
+		pids[p] = fork();
+		if (pids[p] < 0)
+			barf("fork");
+		if (!pids[p]) {
+			close(ready_fds[0]);
+			close(go_fds[1]);
+			/* random pages differ from one process to another */
+			child(nr_pages, page_size, p + 1, ready_fds[1], go_fds[0]);
+		}
+	}
+	close(ready_fds[1]);
+	close(go_fds[0]);
+
+	for (p = 0; p < nprocs; p++)
+		if (read(ready_fds[0], &c, 1) != 1)
+			barf("read");
+
+	sharing0 = read_ksm("pages_sharing");
+	scanned0 = read_ksm("pages_scanned");
+	cpu0 = read_ksm("scan_cpu_msecs");
+
+	gettimeofday(&start, NULL);
+	close(go_fds[1]);
+
+	for (;;) {
+		usleep(10000);
+		gettimeofday(&now, NULL);
+		timersub(&now, &start, &diff);
+
+		sharing = read_ksm("pages_sharing") - sharing0;
+		if (sharing > sharing_done) {
+			sharing_done = sharing;
+			merged = diff;
+			scanned = read_ksm("pages_scanned") - scanned0;
+			cpu = read_ksm("scan_cpu_msecs") - cpu0;
+		}
+		if (sharing_done >= expected || diff.tv_sec >= (long)nsecs)
+			break;
+	}
+	if (sharing_done < expected)
+		fprintf(stderr, "only %lu of %lu pages merged in %u seconds\n",
+			sharing_done, expected, nsecs);
+
+	for (p = 0; p < nprocs; p++) {
+		kill(pids[p], SIGKILL);
+		waitpid(pids[p], NULL, 0);
+	}
+	close(ready_fds[0]);
+	free(pids);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u processes of %lu pages, %u%% duplicates of %u contents, %u ksmd threads\n\n",
+		       nprocs, nr_pages, dup_pct, nr_contents, threads);
+
+		/* time to the last merge seen, not to the end of the run */
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Time to merge",
+		       merged.tv_sec, (unsigned long) (merged.tv_usec / 1000));
+		printf(" %14lu pages merged\n", sharing_done);
+		printf(" %14lu pages scanned\n", scanned);
+		printf(" %14lu msecs of ksmd cpu time\n", cpu);
+		printf(" %14lu pages scanned per cpu second\n",
+		       cpu ? scanned * 1000 / cpu : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu\n", cpu);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,258 @@
+/*
+ *
+ * mem-memcg.c
+ *
+ * memcg: Benchmark for page faults charged to nested memory cgroups
+ *
+ * For every depth from 0 up to the given one, a chain of that many
+ * nested memory cgroups with use_hierarchy set is created below the
+ * mount point, and the benchmark moves itself to the innermost one.
+ * A number of threads then keep mapping an anonymous region, faulting
+ * in every page of it and unmapping it again, so that every fault is
+ * charged to each level of the hierarchy.  The faults per second are
+ * reported for every depth; depth 0 runs in the cgroup the memory
+ * controller is mounted at.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char *mnt = "/sys/fs/cgroup/memory";
+static unsigned int max_depth = 5;
+static unsigned int nthreads;
+static unsigned int size_kb = 1024;
+static unsigned int nsecs = 5;
+
+static volatile int done;
+static long page_size;
+
+struct worker {
+	pthread_t thread;
+	unsigned long long faults;
+};
+
+static const struct option options[] = {
+	OPT_STRING('m', "mount", &mnt, "dir",
+		   "Specify mount point of the memory cgroup hierarchy"),
+	OPT_UINTEGER('d', "depth", &max_depth,
+		     "Specify deepest nesting of memory cgroups"),
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: number of cpus)"),
+	OPT_UINTEGER('s', "size", &size_kb,
+		     "Specify size of each mapping (in KB)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime of every depth (in seconds)"),
+	OPT_END()
+};
+
+static const char * const bench_mem_memcg_usage[] = {
+	"perf bench mem memcg <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void write_file(const char *dir, const char *name, const char *val)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+	if (!f)
+		barf(path);
+	if (fprintf(f, "%s\n", val) < 0 || fclose(f))
+		barf(path);
+}
+
+/* Move this process, threads created later follow it */
+static void enter_cgroup(const char *dir)
+{
+	char pid[16];
+
+	snprintf(pid, sizeof(pid), "%d", getpid());
+	write_file(dir, "tasks", pid);
+}
+
+/* The directory of the cgroup at @depth, "perf-bench-memcg/1/2/..." */
+static void cgroup_path(char *path, size_t len, unsigned int depth)
+{
+	unsigned int d;
+	int n;
+
+	n = snprintf(path, len, "%s", mnt);
+	if (depth)
+		n += snprintf(path + n, len - n, "/perf-bench-memcg");
+	for (d = 1; d < depth; d++)
+		n += snprintf(path + n, len - n, "/%u", d);
+}
+
+/* Remove the cgroups from @depth up to the top one */
+static void remove_cgroups(unsigned int depth)
+{
+	char path[PATH_MAX];
+
+	for (; depth >= 1; depth--) {
+		cgroup_path(path, sizeof(path), depth);
+		if (rmdir(path))
+			barf(path);
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	size_t size = (size_t)size_kb << 10;
+	size_t off;
+	char *p;
+
+	while (!done) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			barf("mmap");
+		for (off = 0; off < size; off += page_size) {
+			p[off] = 1;
+			w->faults++;
+		}
+		if (munmap(p, size))
+			barf("munmap");
+	}
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+/* Faults per second of all threads at the current depth */
+static unsigned long long run_depth(struct worker *workers)
+{
+	struct timeval start, stop, diff;
+	unsigned long long total = 0, usecs;
+	unsigned int i;
+
+	memset(workers, 0, nthreads * sizeof(*workers));
+	done = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]))
+			barf("pthread_create");
+	}
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			barf("pthread_join");
+		total += workers[i].faults;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	usecs = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!usecs)
+		usecs = 1;
+	return total * 1000000ULL / usecs;
+}
+
+int bench_mem_memcg(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	unsigned long long *rates;
+	struct worker *workers;
+	char path[PATH_MAX];
+	unsigned int depth;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_memcg_usage, 0);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads || !size_kb || !nsecs)
+		usage_with_options(bench_mem_memcg_usage, options);
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	rates = calloc(max_depth + 1, sizeof(*rates));
+	if (!workers || !rates)
+		barf("calloc");
+
+	signal(SIGALRM, alarm_handler);
+
+	/*
+	 * The top cgroup has to be set to hierarchy before it has children.
+	 * Without the memory controller mounted, or permission to create
+	 * cgroups, there is nothing to measure.
+	 */
+	for (depth = 1; depth <= max_depth; depth++) {
+		cgroup_path(path, sizeof(path), depth);
+		if (mkdir(path, 0755) && errno != EEXIST) {
+			fprintf(stderr, "cannot create %s (error: %s), skipping\n",
+				path, strerror(errno));
+			remove_cgroups(depth - 1);
+			free(workers);
+			free(rates);
+			return 0;
+		}
+		if (depth == 1)
+			write_file(path, "memory.use_hierarchy", "1");
+	}
+
+	for (depth = 0; depth <= max_depth; depth++) {
+		cgroup_path(path, sizeof(path), depth);
+		enter_cgroup(path);
+		rates[depth] = run_depth(workers);
+	}
+
+	enter_cgroup(mnt);
+	remove_cgroups(max_depth);
+	free(workers);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads faulting in %u KB, nested memcgs up to depth %u\n\n",
+		       nthreads, size_kb, max_depth);
+
+		for (depth = 0; depth <= max_depth; depth++)
+			printf(" depth %u: %14llu faults/sec (%llu%% of depth 0)\n",
+			       depth, rates[depth],
+			       rates[0] ? rates[depth] * 100 / rates[0] : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		for (depth = 0; depth <= max_depth; depth++)
+			printf("%llu\n", rates[depth]);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(rates);
+	return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ *
+ * mem-mmap-replay.c
+ *
+ * mmap-replay: Benchmark for readahead on mmap page faults
+ *
+ * A file is mapped and its page cache dropped, then a sequence of page
+ * offsets is touched through the mapping one after the other.  The
+ * offsets come from a trace file, one page offset per line, or from one
+ * of a few synthetic patterns: strided, random accesses clustered in a
+ * few hot regions, or plain random.  This measures the page fault latency
+ * and the I/O that readahead causes for such access patterns.  Put the
+ * file on a ramdisk or a loop device backed filesystem to keep the
+ * device latency out of the results.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define NR_CLUSTERS		4
+#define CLUSTER_PAGES		256
+
+static const char *file;
+static const char *trace;
+static const char *pattern = "stride";
+static unsigned int stride = 16;
+static unsigned int nr_accesses = 10000;
+
+static const struct option options[] = {
+	OPT_STRING('f', "file", &file, "file",
+		   "Specify the file to map"),
+	OPT_STRING('T', "trace", &trace, "file",
+		   "Replay the page offsets from this file, one per line"),
+	OPT_STRING('p', "pattern", &pattern, "pattern",
+		   "Specify synthetic pattern: stride, cluster or random"),
+	OPT_UINTEGER('s', "stride", &stride,
+		     "Specify stride of the stride pattern (in pages)"),
+	OPT_UINTEGER('n', "nr", &nr_accesses,
+		     "Specify number of accesses of the synthetic patterns"),
+	OPT_END()
+};
+
+static const char * const bench_mem_mmap_replay_usage[] = {
+	"perf bench mem mmap-replay <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static unsigned long *read_trace(unsigned long npages, unsigned int *nr)
+{
+	unsigned long *offsets = NULL, off;
+	unsigned int alloc = 0;
+	FILE *f;
+
+	f = fopen(trace, "r");
+	if (!f)
+		barf("fopen");
+
+	*nr = 0;
+	while (fscanf(f, "%lu", &off) == 1) {
+		if (*nr == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			offsets = realloc(offsets, alloc * sizeof(*offsets));
+			if (!offsets)
+				barf("realloc");
+		}
+		offsets[(*nr)++] = off % npages;
+	}
+	fclose(f);
+
+	if (!*nr) {
+		fprintf(stderr, "no page offsets in %s\n", trace);
+		exit(1);
+	}
+	return offsets;
+}
+
+static unsigned long *make_pattern(unsigned long npages, unsigned int nr)
+{
+	unsigned long *offsets, region, size;
+	unsigned int seed = 1;
+	unsigned int i;
+
+	offsets = malloc(nr * sizeof(*offsets));
+	if (!offsets)
+		barf("malloc");
+
+	region = npages / NR_CLUSTERS;
+	size = region < CLUSTER_PAGES ? region : CLUSTER_PAGES;
+	if (!size)
+		size = 1;
+
+	for (i = 0; i < nr; i++) {
+		if (!strcmp(pattern, "stride")) {
+			offsets[i] = (unsigned long)i * stride % npages;
+		} else if (!strcmp(pattern, "cluster")) {
+			offsets[i] = rand_r(&seed) % NR_CLUSTERS * region +
+				     rand_r(&seed) % size;
+		} else if (!strcmp(pattern, "random")) {
+			offsets[i] = rand_r(&seed) % npages;
+		} else {
+			fprintf(stderr, "Unknown pattern:%s\n", pattern);
+			exit(1);
+		}
+	}
+	return offsets;
+}
+
+/* read_bytes from /proc/self/io, i.e. what actually went to the device */
+static unsigned long long io_read_bytes(void)
+{
+	unsigned long long val = 0;
+	char line[128];
+	FILE *f;
+
+	f = fopen("/proc/self/io", "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "read_bytes: %llu", &val) == 1)
+			break;
+	}
+	fclose(f);
+	return val;
+}
+
+static unsigned long long nsecs_between(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000000000ULL + b->tv_nsec - a->tv_nsec;
+}
+
+int bench_mem_mmap_replay(int argc, const char **argv,
+			  const char *prefix __used)
+{
+	unsigned long long total = 0, max = 0, ns, io;
+	unsigned long *offsets, npages;
+	unsigned int i, nr = nr_accesses;
+	struct rusage ru_start, ru_stop;
+	struct timespec start, stop;
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned long sum = 0;
+	struct stat st;
+	char *map;
+	int fd;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_mmap_replay_usage, 0);
+
+	if (!file || !stride || !nr_accesses)
+		usage_with_options(bench_mem_mmap_replay_usage, options);
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		barf("open");
+	if (fstat(fd, &st))
+		barf("fstat");
+	npages = st.st_size / page_size;
+	if (!npages) {
+		fprintf(stderr, "%s is smaller than a page\n", file);
+		exit(1);
+	}
+
+	if (trace)
+		offsets = read_trace(npages, &nr);
+	else
+		offsets = make_pattern(npages, nr);
+
+	map = mmap(NULL, npages * page_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		barf("mmap");
+
+	/* start out with nothing of the file cached */
+	if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+		barf("posix_fadvise");
+
+	io = io_read_bytes();
+	getrusage(RUSAGE_SELF, &ru_start);
+
+	for (i = 0; i < nr; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		sum += *(volatile char *)(map + offsets[i] * page_size);
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		ns = nsecs_between(&start, &stop);
+		total += ns;
+		if (ns > max)
+			max = ns;
+	}
+
+	getrusage(RUSAGE_SELF, &ru_stop);
+	io = io_read_bytes() - io;
+
+	munmap(map, npages * page_size);
+	close(fd);
+	free(offsets);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u accesses to %lu pages, %s%s\n\n", nr, npages,
+		       trace ? "trace " : "", trace ? trace : pattern);
+
+		printf(" %14llu nsecs per access\n", total / nr);
+		printf(" %14llu nsecs max\n", max);
+		printf(" %14ld major faults\n",
+		       ru_stop.ru_majflt - ru_start.ru_majflt);
+		printf(" %14llu KB read\n", io >> 10);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", total / nr);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ *
+ * mem-munmap.c
+ *
+ * munmap: Benchmark for mmap/touch/munmap cycles
+ *
+ * A number of threads of one process each keep mapping an anonymous
+ * region, writing to every page of it and unmapping it again, which is
+ * what malloc trimming and garbage collectors returning memory do.
+ * Since all threads share the mm, every munmap has to shoot down the
+ * TLB entries on the other cpus running the process, so this measures
+ * the cost of page table teardown and of the TLB flushes it needs.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+static unsigned int nthreads;
+static unsigned int size_kb = 64;
+static unsigned int nsecs = 10;
+
+static volatile int done;
+static long page_size;
+
+struct worker {
+	pthread_t thread;
+	unsigned long long cycles;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: number of cpus)"),
+	OPT_UINTEGER('s', "size", &size_kb,
+		     "Specify size of each mapping (in KB)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_END()
+};
+
+static const char * const bench_mem_munmap_usage[] = {
+	"perf bench mem munmap <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	size_t size = (size_t)size_kb << 10;
+	size_t off;
+	char *p;
+
+	while (!done) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			barf("mmap");
+		for (off = 0; off < size; off += page_size)
+			p[off] = 1;
+		if (munmap(p, size))
+			barf("munmap");
+		w->cycles++;
+	}
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+int bench_mem_munmap(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long total = 0, usecs;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_munmap_usage, 0);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads || !size_kb || !nsecs)
+		usage_with_options(bench_mem_munmap_usage, options);
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	signal(SIGALRM, alarm_handler);
+	done = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]))
+			barf("pthread_create");
+	}
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			barf("pthread_join");
+		total += workers[i].cycles;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	free(workers);
+
+	usecs = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!usecs)
+		usecs = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads mapping, touching and unmapping %u KB\n\n",
+		       nthreads, size_kb);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+		printf(" %14llu cycles/sec\n", total * 1000000ULL / usecs);
+		printf(" %14llu cycles/sec per thread\n",
+		       total * 1000000ULL / usecs / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", total * 1000000ULL / usecs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ *
+ * mem-pagecache.c
+ *
+ * pagecache: Benchmark for streaming through the page cache
+ *
+ * A number of threads each stream through a file of their own, either
+ * reading it or rewriting it over and over.  With files that do not
+ * fit into memory, or when run inside a memory cgroup with a limit
+ * below the total file size, every thread keeps adding pages to the
+ * LRU lists while reclaim keeps taking them off, so this measures how
+ * page cache throughput scales with the number of threads under
+ * reclaim.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#define CHUNK_SIZE	(64 * 1024)
+
+static unsigned int nthreads;
+static unsigned int file_mb = 256;
+static unsigned int nsecs = 10;
+static const char *dir = ".";
+static bool do_write = false;
+
+static volatile int done;
+
+struct worker {
+	pthread_t thread;
+	char path[PATH_MAX];
+	int fd;
+	unsigned long long bytes;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: number of cpus)"),
+	OPT_UINTEGER('s', "size", &file_mb,
+		     "Specify size of each thread's file (in MB)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_STRING('d', "directory", &dir, "dir",
+		   "Create the files in this directory"),
+	OPT_BOOLEAN('w', "write", &do_write,
+		    "Rewrite the files instead of reading them"),
+	OPT_END()
+};
+
+static const char * const bench_mem_pagecache_usage[] = {
+	"perf bench mem pagecache <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void fill_file(struct worker *w, char *buf)
+{
+	unsigned long long size = (unsigned long long)file_mb << 20;
+	unsigned long long pos;
+
+	for (pos = 0; pos < size; pos += CHUNK_SIZE) {
+		if (write(w->fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+			barf("write");
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long long size = (unsigned long long)file_mb << 20;
+	unsigned long long pos;
+	char *buf;
+	ssize_t ret;
+
+	buf = malloc(CHUNK_SIZE);
+	if (!buf)
+		barf("malloc");
+	memset(buf, 0x5a, CHUNK_SIZE);
+
+	while (!done) {
+		for (pos = 0; pos < size && !done; pos += CHUNK_SIZE) {
+			if (do_write)
+				ret = pwrite(w->fd, buf, CHUNK_SIZE, pos);
+			else
+				ret = pread(w->fd, buf, CHUNK_SIZE, pos);
+			if (ret < 0)
+				barf(do_write ? "pwrite" : "pread");
+			w->bytes += ret;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+int bench_mem_pagecache(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long total = 0, usecs;
+	unsigned int i;
+	char *buf;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_pagecache_usage, 0);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads || !file_mb || !nsecs)
+		usage_with_options(bench_mem_pagecache_usage, options);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	buf = malloc(CHUNK_SIZE);
+	if (!buf)
+		barf("malloc");
+	memset(buf, 0x5a, CHUNK_SIZE);
+
+	/* the files are unlinked right away, they go away on exit */
+	for (i = 0; i < nthreads; i++) {
+		snprintf(workers[i].path, sizeof(workers[i].path),
+			 "%s/perf-bench-pagecache.%d.%u", dir, getpid(), i);
+		workers[i].fd = open(workers[i].path,
+				     O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (workers[i].fd < 0)
+			barf("open");
+		unlink(workers[i].path);
+		fill_file(&workers[i], buf);
+	}
+	free(buf);
+
+	signal(SIGALRM, alarm_handler);
+	done = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]))
+			barf("pthread_create");
+	}
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			barf("pthread_join");
+		total += workers[i].bytes;
+		close(workers[i].fd);
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	free(workers);
+
+	usecs = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!usecs)
+		usecs = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads %s %u MB files each\n\n",
+		       nthreads, do_write ? "rewriting" : "reading", file_mb);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+		printf(" %14llu MB/sec\n", (total >> 20) * 1000000ULL / usecs);
+		printf(" %14llu MB/sec per thread\n",
+		       (total >> 20) * 1000000ULL / usecs / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", (total >> 20) * 1000000ULL / usecs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,302 @@
+/*
+ *
+ * mem-pcp.c
+ *
+ * pcp: Benchmark for the per cpu page lists of the page allocator
+ *
+ * A number of workers on all cpus run a workload that allocates and
+ * frees small higher order pages at a high rate:
+ *
+ *  fork: every worker is a process that keeps forking children that
+ *        exit right away, each of them needing a kernel stack, page
+ *        tables and a few slabs.
+ *  net:  every worker is a thread that keeps sending UDP datagrams to
+ *        itself over loopback and receiving them, each of them too
+ *        large for the slab caches and allocated from the page
+ *        allocator.
+ *
+ * The rate of operations is reported together with how often zone->lock
+ * was taken, and found held already, meanwhile, as counted in
+ * /proc/vmstat.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static const char *workload = "fork";
+static unsigned int nworkers;
+static unsigned int msg_size = 16000;
+static unsigned int nsecs = 10;
+
+static volatile int done;
+
+struct worker {
+	pthread_t thread;
+	pid_t pid;
+	int fd;
+	unsigned long long ops;
+};
+
+static const struct option options[] = {
+	OPT_STRING('w', "workload", &workload, "fork|net",
+		   "Specify workload: fork or net"),
+	OPT_UINTEGER('t', "tasks", &nworkers,
+		     "Specify number of workers (default: number of cpus)"),
+	OPT_UINTEGER('s', "size", &msg_size,
+		     "Specify size of the datagrams of the net workload (in bytes)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_END()
+};
+
+static const char * const bench_mem_pcp_usage[] = {
+	"perf bench mem pcp <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+/* zone->lock acquisitions and contentions summed over all zones */
+static void read_zone_lock(unsigned long long *locked,
+			   unsigned long long *contended)
+{
+	char name[64];
+	unsigned long long val;
+	FILE *f;
+
+	*locked = *contended = 0;
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		barf("/proc/vmstat");
+	while (fscanf(f, "%63s %llu", name, &val) == 2) {
+		if (!strncmp(name, "zone_lock_contended_", 20))
+			*contended += val;
+		else if (!strncmp(name, "zone_lock_", 10))
+			*locked += val;
+	}
+	fclose(f);
+}
+
+/* A fork worker runs in its own process and reports through a pipe */
+static void fork_worker(int fd)
+{
+	unsigned long long ops = 0;
+	pid_t pid;
+
+	signal(SIGALRM, alarm_handler);
+	alarm(nsecs);
+
+	while (!done) {
+		pid = fork();
+		if (pid < 0)
+			barf("fork");
+		if (!pid)
+			_exit(0);
+		if (waitpid(pid, NULL, 0) < 0 && errno != EINTR)
+			barf("waitpid");
+		ops++;
+	}
+
+	if (write(fd, &ops, sizeof(ops)) != sizeof(ops))
+		barf("write");
+	exit(0);
+}
+
+static void run_fork(struct worker *workers)
+{
+	unsigned int i;
+	int fds[2];
+
+	for (i = 0; i < nworkers; i++) {
+		if (pipe(fds))
+			barf("pipe");
+		workers[i].pid = fork();
+		if (workers[i].pid < 0)
+			barf("fork");
+		if (!workers[i].pid) {
+			close(fds[0]);
+			fork_worker(fds[1]);
+		}
+		close(fds[1]);
+		workers[i].fd = fds[0];
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		if (read(workers[i].fd, &workers[i].ops,
+			 sizeof(workers[i].ops)) != sizeof(workers[i].ops))
+			barf("read");
+		close(workers[i].fd);
+		waitpid(workers[i].pid, NULL, 0);
+	}
+}
+
+static void *net_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd, bufsize = 4 * msg_size;
+	char *buf;
+
+	buf = malloc(msg_size);
+	if (!buf)
+		barf("malloc");
+	memset(buf, 1, msg_size);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		barf("socket");
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		barf("bind");
+	if (getsockname(fd, (struct sockaddr *)&addr, &len))
+		barf("getsockname");
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		barf("connect");
+
+	/* loopback delivers on the sending cpu, before send returns */
+	while (!done) {
+		if (send(fd, buf, msg_size, 0) != (ssize_t)msg_size)
+			barf("send");
+		if (recv(fd, buf, msg_size, 0) < 0 && errno != EINTR)
+			barf("recv");
+		w->ops++;
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void run_net(struct worker *workers)
+{
+	unsigned int i;
+
+	signal(SIGALRM, alarm_handler);
+	alarm(nsecs);
+
+	for (i = 0; i < nworkers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, net_worker,
+				   &workers[i]))
+			barf("pthread_create");
+	}
+	for (i = 0; i < nworkers; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			barf("pthread_join");
+	}
+}
+
+int bench_mem_pcp(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long total = 0, usecs;
+	unsigned long long locked0, contended0, locked, contended;
+	unsigned int i;
+	int net;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_pcp_usage, 0);
+
+	if (!nworkers)
+		nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!strcmp(workload, "fork"))
+		net = 0;
+	else if (!strcmp(workload, "net"))
+		net = 1;
+	else
+		usage_with_options(bench_mem_pcp_usage, options);
+	if (!nworkers || !nsecs || (net && !msg_size))
+		usage_with_options(bench_mem_pcp_usage, options);
+
+	workers = calloc(nworkers, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	done = 0;
+	read_zone_lock(&locked0, &contended0);
+	gettimeofday(&start, NULL);
+
+	if (net)
+		run_net(workers);
+	else
+		run_fork(workers);
+
+	gettimeofday(&stop, NULL);
+	read_zone_lock(&locked, &contended);
+	locked -= locked0;
+	contended -= contended0;
+	timersub(&stop, &start, &diff);
+
+	for (i = 0; i < nworkers; i++)
+		total += workers[i].ops;
+	free(workers);
+
+	usecs = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!usecs)
+		usecs = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		if (net)
+			printf("# %u threads sending %u byte datagrams over loopback\n\n",
+			       nworkers, msg_size);
+		else
+			printf("# %u processes forking\n\n", nworkers);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+		printf(" %14llu %s/sec\n", total * 1000000ULL / usecs,
+		       net ? "datagrams" : "forks");
+		printf(" %14llu zone lock acquisitions\n", locked);
+		printf(" %14llu zone lock contentions (%llu%%)\n", contended,
+		       locked ? contended * 100 / locked : 0);
+		printf(" %14llu zone lock acquisitions per 1000 %s\n",
+		       total ? locked * 1000 / total : 0,
+		       net ? "datagrams" : "forks");
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", total * 1000000ULL / usecs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
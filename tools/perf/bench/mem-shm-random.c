@@ -0,0 +1,226 @@
+/*
+ *
+ * mem-shm-random.c
+ *
+ * shm-random: Benchmark for random access to a large shared memory segment
+ *
+ * A number of threads do dependent random 8 byte reads all over a SysV
+ * shared memory segment, or a shared mapping of a file in the given
+ * directory, that is much larger than what the TLB covers.  Almost every
+ * access misses the TLB, so the throughput mostly depends on the cost of
+ * the page walks, which huge pmds on shmem (shmem_enabled, or a tmpfs
+ * mounted with huge=always) cut down.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+
+static unsigned int nthreads;
+static unsigned int shm_mb = 4096;
+static unsigned int nsecs = 10;
+static const char *dir;
+
+static volatile int done;
+
+static u64 *area;
+static unsigned long nr_words;
+
+struct worker {
+	pthread_t thread;
+	unsigned long seed;
+	unsigned long long accesses;
+	u64 sum;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: number of cpus)"),
+	OPT_UINTEGER('s', "size", &shm_mb,
+		     "Specify size of the segment (in MB)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_STRING('d', "directory", &dir, "dir",
+		   "Map a file in this directory instead of a SysV segment"),
+	OPT_END()
+};
+
+static const char * const bench_mem_shm_random_usage[] = {
+	"perf bench mem shm-random <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+/* xorshift, good enough to defeat the prefetchers */
+static inline unsigned long next_rand(unsigned long *seed)
+{
+	unsigned long x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*seed = x;
+	return x;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long seed = w->seed;
+	u64 sum = 0;
+	unsigned int i;
+
+	while (!done) {
+		for (i = 0; i < 1024; i++) {
+			/* make each address depend on the previous load */
+			sum += area[(next_rand(&seed) ^ (sum & 1)) % nr_words];
+		}
+		w->accesses += 1024;
+	}
+	w->sum = sum;
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+static u64 *map_area(size_t size, int *shmid)
+{
+	char path[PATH_MAX];
+	void *p;
+	int fd;
+
+	if (!dir) {
+		*shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+		if (*shmid < 0)
+			barf("shmget");
+		p = shmat(*shmid, NULL, 0);
+		/* the segment goes away once it is detached */
+		shmctl(*shmid, IPC_RMID, NULL);
+		if (p == (void *)-1)
+			barf("shmat");
+		return p;
+	}
+
+	*shmid = -1;
+	snprintf(path, sizeof(path), "%s/perf-bench-shm.%d", dir, getpid());
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		barf("open");
+	unlink(path);
+	if (ftruncate(fd, size))
+		barf("ftruncate");
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		barf("mmap");
+	return p;
+}
+
+int bench_mem_shm_random(int argc, const char **argv,
+			 const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long total = 0, usecs;
+	size_t size;
+	unsigned long i;
+	int shmid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_shm_random_usage, 0);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads || !shm_mb || !nsecs)
+		usage_with_options(bench_mem_shm_random_usage, options);
+
+	size = (size_t)shm_mb << 20;
+	nr_words = size / sizeof(u64);
+	area = map_area(size, &shmid);
+
+	/* populate the whole segment before the clock starts */
+	for (i = 0; i < nr_words; i += 512)
+		area[i] = i;
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	signal(SIGALRM, alarm_handler);
+	done = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		workers[i].seed = 2654435761UL * (i + 1);
+		if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]))
+			barf("pthread_create");
+	}
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			barf("pthread_join");
+		total += workers[i].accesses;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	free(workers);
+
+	if (shmid >= 0)
+		shmdt(area);
+	else
+		munmap(area, size);
+
+	usecs = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!usecs)
+		usecs = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads reading randomly from a %u MB %s\n\n",
+		       nthreads, shm_mb, dir ? "shared file mapping" : "SysV segment");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+		printf(" %14llu accesses/sec\n", total * 1000000ULL / usecs);
+		printf(" %14llu accesses/sec per thread\n",
+		       total * 1000000ULL / usecs / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", total * 1000000ULL / usecs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
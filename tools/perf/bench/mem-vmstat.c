@@ -0,0 +1,260 @@
+/*
+ *
+ * mem-vmstat.c
+ *
+ * vmstat: Benchmark for how page faults scale with the vm statistics
+ *
+ * Every anonymous page fault updates several zone based vm statistics,
+ * the free pages, the LRU lists, the anon pages and the NUMA counters,
+ * through per cpu differentials that are folded into the shared zone
+ * counters once they exceed their threshold.  A number of threads keep
+ * mapping an anonymous region, faulting in every page of it and
+ * unmapping it again, for 1, 2, 4, ... threads up to the given number.
+ * Each step runs once with /proc/sys/vm/stat_threshold_shift set to 0,
+ * the same threshold for all counters, and once with the given shift,
+ * and the faults per second of both are reported.  The shift that was
+ * set before is restored at the end, and also when the benchmark fails
+ * or is interrupted.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+#define SHIFT_SYSCTL	"/proc/sys/vm/stat_threshold_shift"
+
+static unsigned int max_threads;
+static unsigned int shift = 2;
+static unsigned int size_kb = 1024;
+static unsigned int nsecs = 5;
+
+static volatile int done;
+static long page_size;
+
+/* the shift found at start, as written back to SHIFT_SYSCTL */
+static char old_shift[16];
+static int old_shift_len;
+
+struct worker {
+	pthread_t thread;
+	unsigned long long faults;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &max_threads,
+		     "Specify max number of threads (default: number of cpus)"),
+	OPT_UINTEGER('S', "shift", &shift,
+		     "Specify stat_threshold_shift to compare against 0"),
+	OPT_UINTEGER('s', "size", &size_kb,
+		     "Specify size of each mapping (in KB)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime of every step (in seconds)"),
+	OPT_END()
+};
+
+static const char * const bench_mem_vmstat_usage[] = {
+	"perf bench mem vmstat <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static unsigned int read_shift(void)
+{
+	unsigned int val;
+	FILE *f;
+
+	f = fopen(SHIFT_SYSCTL, "r");
+	if (!f)
+		barf(SHIFT_SYSCTL);
+	if (fscanf(f, "%u", &val) != 1)
+		barf(SHIFT_SYSCTL);
+	fclose(f);
+	return val;
+}
+
+static void write_shift(unsigned int val)
+{
+	FILE *f;
+
+	f = fopen(SHIFT_SYSCTL, "w");
+	if (!f)
+		barf(SHIFT_SYSCTL);
+	if (fprintf(f, "%u\n", val) < 0 || fclose(f))
+		barf(SHIFT_SYSCTL);
+}
+
+/*
+ * Put the old shift back.  This runs from exit() on every barf() and
+ * from signal handlers too, so it only uses async-signal-safe calls and
+ * cannot report failures.
+ */
+static void restore_shift(void)
+{
+	int fd;
+
+	if (!old_shift_len)
+		return;
+
+	fd = open(SHIFT_SYSCTL, O_WRONLY);
+	if (fd >= 0) {
+		if (write(fd, old_shift, old_shift_len) == old_shift_len)
+			old_shift_len = 0;
+		close(fd);
+	}
+}
+
+static void restore_shift_handler(int sig)
+{
+	restore_shift();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	size_t size = (size_t)size_kb << 10;
+	size_t off;
+	char *p;
+
+	while (!done) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			barf("mmap");
+		for (off = 0; off < size; off += page_size) {
+			p[off] = 1;
+			w->faults++;
+		}
+		if (munmap(p, size))
+			barf("munmap");
+	}
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+/* Faults per second of @nthreads threads */
+static unsigned long long run_step(struct worker *workers,
+				   unsigned int nthreads)
+{
+	struct timeval start, stop, diff;
+	unsigned long long total = 0, usecs;
+	unsigned int i;
+
+	memset(workers, 0, nthreads * sizeof(*workers));
+	done = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]))
+			barf("pthread_create");
+	}
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			barf("pthread_join");
+		total += workers[i].faults;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	usecs = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!usecs)
+		usecs = 1;
+	return total * 1000000ULL / usecs;
+}
+
+int bench_mem_vmstat(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	unsigned long long fixed, shifted;
+	struct worker *workers;
+	unsigned int nthreads;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_vmstat_usage, 0);
+
+	if (!max_threads)
+		max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!max_threads || !size_kb || !nsecs)
+		usage_with_options(bench_mem_vmstat_usage, options);
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	workers = calloc(max_threads, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	signal(SIGALRM, alarm_handler);
+
+	old_shift_len = snprintf(old_shift, sizeof(old_shift), "%u\n",
+				 read_shift());
+	atexit(restore_shift);
+	signal(SIGINT, restore_shift_handler);
+	signal(SIGTERM, restore_shift_handler);
+	signal(SIGHUP, restore_shift_handler);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# threads faulting in %u KB, stat_threshold_shift 0 vs. %u\n\n",
+		       size_kb, shift);
+
+	/* the last step always runs with max_threads */
+	for (nthreads = 1; ; nthreads *= 2) {
+		if (nthreads > max_threads)
+			nthreads = max_threads;
+
+		write_shift(0);
+		fixed = run_step(workers, nthreads);
+		write_shift(shift);
+		shifted = run_step(workers, nthreads);
+
+		switch (bench_format) {
+		case BENCH_FORMAT_DEFAULT:
+			printf(" %4u threads: %14llu faults/sec, %14llu faults/sec (%llu%%)\n",
+			       nthreads, fixed, shifted,
+			       fixed ? shifted * 100 / fixed : 0);
+			break;
+
+		case BENCH_FORMAT_SIMPLE:
+			printf("%u %llu %llu\n", nthreads, fixed, shifted);
+			break;
+
+		default:
+			/* reaching here is something disaster */
+			fprintf(stderr, "Unknown format:%d\n", bench_format);
+			exit(1);
+			break;
+		}
+
+		if (nthreads == max_threads)
+			break;
+	}
+
+	restore_shift();
+	free(workers);
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ *
+ * mem-zram.c
+ *
+ * zram: Benchmark for random 4K I/O to a compressed RAM block device
+ *
+ * A number of threads issue random page sized O_DIRECT reads and writes
+ * to a zram device (or any other block device), like a swap workload
+ * on a memory overcommitted host would.  The device is filled once
+ * before the run so that reads have to decompress.  The data written
+ * compresses to roughly a quarter, and is never all zeros, as zram
+ * keeps no data at all for those.
+ *
+ * This overwrites the device, so there is no default device, and one
+ * that is mounted, used for swap or otherwise held open exclusively is
+ * refused.  Still, do not point it at a disk that holds anything of
+ * value.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#undef _GNU_SOURCE
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#define IO_SIZE		4096
+
+static unsigned int nthreads;
+static unsigned int size_mb = 256;
+static unsigned int write_pct = 50;
+static unsigned int nsecs = 10;
+static const char *device;
+
+static volatile int done;
+static unsigned long long nr_blocks;
+static int fd;
+
+struct worker {
+	pthread_t thread;
+	unsigned int seed;
+	unsigned long long reads;
+	unsigned long long writes;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: number of cpus)"),
+	OPT_UINTEGER('s', "size", &size_mb,
+		     "Specify size of the device area to use (in MB)"),
+	OPT_UINTEGER('w', "write", &write_pct,
+		     "Specify percentage of writes"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_STRING('d', "device", &device, "device",
+		   "Specify the block device to overwrite (required)"),
+	OPT_END()
+};
+
+static const char * const bench_mem_zram_usage[] = {
+	"perf bench mem zram <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+/* a quarter random bytes, the rest a repeating pattern */
+static void fill_block(char *buf, unsigned int *seed)
+{
+	unsigned int i;
+
+	for (i = 0; i < IO_SIZE / 4; i++)
+		buf[i] = rand_r(seed);
+	for (; i < IO_SIZE; i++)
+		buf[i] = "perf bench mem zram "[i % 20];
+}
+
+static void *alloc_block(void)
+{
+	void *buf;
+
+	/* O_DIRECT wants aligned buffers */
+	if (posix_memalign(&buf, IO_SIZE, IO_SIZE))
+		barf("posix_memalign");
+	return buf;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long long block;
+	char *buf;
+
+	buf = alloc_block();
+	fill_block(buf, &w->seed);
+
+	while (!done) {
+		block = ((unsigned long long)rand_r(&w->seed) << 31 |
+			 rand_r(&w->seed)) % nr_blocks;
+		if ((unsigned int)rand_r(&w->seed) % 100 < write_pct) {
+			/* vary the data a bit from one write to the next */
+			*(unsigned long long *)buf = block;
+			if (pwrite(fd, buf, IO_SIZE, block * IO_SIZE) != IO_SIZE)
+				barf("pwrite");
+			w->writes++;
+		} else {
+			if (pread(fd, buf, IO_SIZE, block * IO_SIZE) != IO_SIZE)
+				barf("pread");
+			w->reads++;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+int bench_mem_zram(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long reads = 0, writes = 0, usecs, block;
+	unsigned int i, seed = 1;
+	off_t dev_size;
+	char *buf;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_zram_usage, 0);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!device || !nthreads || !size_mb || write_pct > 100 || !nsecs)
+		usage_with_options(bench_mem_zram_usage, options);
+
+	/* O_EXCL on a block device fails while it is mounted or swapped on */
+	fd = open(device, O_RDWR | O_DIRECT | O_EXCL);
+	if (fd < 0) {
+		if (errno == EBUSY) {
+			fprintf(stderr, "%s is in use\n", device);
+			exit(1);
+		}
+		barf(device);
+	}
+
+	dev_size = lseek(fd, 0, SEEK_END);
+	if (dev_size < 0)
+		barf("lseek");
+	nr_blocks = ((unsigned long long)size_mb << 20) / IO_SIZE;
+	if (nr_blocks > (unsigned long long)dev_size / IO_SIZE)
+		nr_blocks = dev_size / IO_SIZE;
+	if (!nr_blocks) {
+		fprintf(stderr, "%s is too small\n", device);
+		exit(1);
+	}
+
+	buf = alloc_block();
+	for (block = 0; block < nr_blocks; block++) {
+		fill_block(buf, &seed);
+		if (pwrite(fd, buf, IO_SIZE, block * IO_SIZE) != IO_SIZE)
+			barf("pwrite");
+	}
+	free(buf);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	signal(SIGALRM, alarm_handler);
+	done = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		workers[i].seed = i + 1;
+		if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]))
+			barf("pthread_create");
+	}
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			barf("pthread_join");
+		reads += workers[i].reads;
+		writes += workers[i].writes;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	free(workers);
+	close(fd);
+
+	usecs = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!usecs)
+		usecs = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads doing random 4K I/O to %llu MB of %s, %u%% writes\n\n",
+		       nthreads, nr_blocks * IO_SIZE >> 20, device, write_pct);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+		printf(" %14llu IOPS\n", (reads + writes) * 1000000ULL / usecs);
+		printf(" %14llu read IOPS\n", reads * 1000000ULL / usecs);
+		printf(" %14llu write IOPS\n", writes * 1000000ULL / usecs);
+		printf(" %14llu IOPS per thread\n",
+		       (reads + writes) * 1000000ULL / usecs / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", (reads + writes) * 1000000ULL / usecs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
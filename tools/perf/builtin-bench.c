@@ -13,6 +13,7 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  futex ... futex hash scalability
  *
  */
 
@@ -52,6 +53,50 @@ static struct bench_suite mem_suites[] = {
 	{ "memcpy",
 	  "Simple memory copy in various ways",
 	  bench_mem_memcpy },
+	{ "pagecache",
+	  "Threads streaming through the page cache",
+	  bench_mem_pagecache },
+	{ "mmap-replay",
+	  "Replay page faults on a mapped file",
+	  bench_mem_mmap_replay },
+	{ "munmap",
+	  "Threads mapping, touching and unmapping memory",
+	  bench_mem_munmap },
+	{ "fault",
+	  "Threads faulting in memory against mmap/munmap",
+	  bench_mem_fault },
+	{ "pcp",
+	  "Fork and loopback workloads on the per cpu page lists",
+	  bench_mem_pcp },
+	suite_all,
+	/*
+	 * Not run by "all", which stops at its sentinel: these need
+	 * setup or privileges, or change the state of the system.
+	 */
+	{ "shm-random",
+	  "Random reads from a large shared memory segment",
+	  bench_mem_shm_random },
+	{ "zram",
+	  "Threads doing random 4K I/O to a zram device",
+	  bench_mem_zram },
+	{ "ksm",
+	  "Time and cpu time for ksmd to merge duplicate pages",
+	  bench_mem_ksm },
+	{ "memcg",
+	  "Page faults charged to nested memory cgroups",
+	  bench_mem_memcg },
+	{ "vmstat",
+	  "Page fault scalability with relaxed vm statistics thresholds",
+	  bench_mem_vmstat },
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite futex_suites[] = {
+	{ "hash",
+	  "Contention on the futex hash bucket locks",
+	  bench_futex_hash },
 	suite_all,
 	{ NULL,
 	  NULL,
@@ -71,6 +116,9 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "futex",
+	  "futex hash scalability",
+	  futex_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },
@@ -2917,6 +2917,112 @@ pretty_print_func_graph(void *data, int size, struct event *event,
 	printf("\n");
 }
 
+/*
+ * Compact ftrace records (see kernel/trace/trace_entries.h) keep
+ * their fields, the pid included, as varints in the "buf" field.
+ */
+static unsigned char *compact_get(unsigned char *p, unsigned char *end,
+				  unsigned long long *val)
+{
+	unsigned long long v = 0;
+	int shift;
+
+	for (shift = 0; p < end && shift < 64; shift += 7) {
+		v |= (unsigned long long)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*val = v;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static long long compact_signed(unsigned long long v)
+{
+	return (v >> 1) ^ -(v & 1);
+}
+
+static int compact_decode(void *data, struct event *event,
+			  unsigned long long *vals, int nr)
+{
+	struct format_field *len_field, *buf_field;
+	unsigned char *p, *end;
+	int i;
+
+	len_field = find_field(event, "len");
+	buf_field = find_field(event, "buf");
+	if (!len_field || !buf_field)
+		return -1;
+
+	p = data + buf_field->offset;
+	end = p + read_size(data + len_field->offset, len_field->size);
+
+	for (i = 0; i < nr && p; i++)
+		p = compact_get(p, end, &vals[i]);
+
+	return p ? 0 : -1;
+}
+
+static int compact_parse_pid(void *data, struct event *event)
+{
+	unsigned long long pid;
+
+	if (compact_decode(data, event, &pid, 1) < 0)
+		return -1;
+	return pid;
+}
+
+static unsigned long long compact_text_base(void)
+{
+	static unsigned long long base;
+	unsigned int i;
+
+	for (i = 0; !base && i < func_count; i++)
+		if (strcmp(func_list[i].func, "_stext") == 0)
+			base = func_list[i].addr;
+
+	return base;
+}
+
+static void compact_print_func(unsigned long long addr)
+{
+	struct func_map *func = find_func(addr);
+
+	if (func)
+		printf("%s+0x%llx", func->func, addr - func->addr);
+	else
+		printf("%llx", addr);
+}
+
+static void pretty_print_compact(void *data, struct event *event)
+{
+	unsigned long long vals[8];
+	unsigned long long ip, prev_pid, next_pid;
+
+	if (strcmp(event->name, "function_compact") == 0) {
+		if (compact_decode(data, event, vals, 3) < 0)
+			goto bad;
+		ip = compact_text_base() + compact_signed(vals[1]);
+		printf(" ");
+		compact_print_func(ip);
+		printf(" <-- ");
+		compact_print_func(ip + compact_signed(vals[2]));
+		return;
+	}
+
+	if (compact_decode(data, event, vals, 8) < 0)
+		goto bad;
+	prev_pid = vals[0] + compact_signed(vals[1]);
+	next_pid = prev_pid + compact_signed(vals[2]);
+	printf("%llu:%llu:%llu  %s %llu:%llu:%llu [%03llu]",
+	       prev_pid, vals[4], vals[5],
+	       strcmp(event->name, "wakeup_compact") == 0 ? "==+" : "==>",
+	       next_pid, vals[6], vals[7], vals[3]);
+	return;
+bad:
+	printf("EVENT '%s' MALFORMED", event->name);
+}
+
 void print_trace_event(int cpu, void *data, int size)
 {
 	struct event *event;
@@ -2931,7 +3037,10 @@ void print_trace_event(int cpu, void *data, int size)
 		return;
 	}
 
-	pid = trace_parse_common_pid(data);
+	if (event->flags & EVENT_FL_ISCOMPACT)
+		pid = compact_parse_pid(data, event);
+	else
+		pid = trace_parse_common_pid(data);
 
 	if (event->flags & (EVENT_FL_ISFUNCENT | EVENT_FL_ISFUNCRET))
 		return pretty_print_func_graph(data, size, event, cpu, pid);
@@ -2945,6 +3054,9 @@ void print_trace_event(int cpu, void *data, int size)
 		return;
 	}
 
+	if (event->flags & EVENT_FL_ISCOMPACT)
+		return pretty_print_compact(data, event);
+
 	pretty_print(data, size, event);
 }
 
@@ -3044,6 +3156,11 @@ int parse_ftrace_file(char *buf, unsigned long size)
 	else if (strcmp(event->name, "bprint") == 0)
 		event->flags |= EVENT_FL_ISBPRINT;
 
+	else if (strcmp(event->name, "function_compact") == 0 ||
+		 strcmp(event->name, "context_switch_compact") == 0 ||
+		 strcmp(event->name, "wakeup_compact") == 0)
+		event->flags |= EVENT_FL_ISCOMPACT;
+
 	event->id = event_read_id();
 	if (event->id < 0)
 		die("failed to read ftrace event id");
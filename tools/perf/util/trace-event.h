@@ -149,6 +149,7 @@ enum {
 	EVENT_FL_ISFUNC		= 0x08,
 	EVENT_FL_ISFUNCENT	= 0x10,
 	EVENT_FL_ISFUNCRET	= 0x20,
+	EVENT_FL_ISCOMPACT	= 0x40,
 
 	EVENT_FL_FAILED		= 0x80000000
 };